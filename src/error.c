@@ -21,6 +21,7 @@ const char* const ERR_MESSAGES[] = {
     "Not implemented (yet?)",
     "Existing image ID",
     "Image manipulation library error",
+    "Unsatisfiable range",
     "Debug",
     "no error (shall not be displayed)" // ERR_LAST
 };
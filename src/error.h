@@ -41,6 +41,7 @@ enum error_codes {
     NOT_IMPLEMENTED,
     ERR_DUPLICATE_ID,
     ERR_IMGLIB,
+    ERR_RANGE,
     ERR_DEBUG,
     ERR_LAST // not an actual error but to have e.g. the total number of errors
 };
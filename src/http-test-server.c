@@ -5,7 +5,7 @@
 
 int main(void)
 {
-    int err = http_init(DEFAULT_LISTENING_PORT, NULL);
+    int err = http_init(DEFAULT_LISTENING_PORT, NULL, NULL);
     if (err < 0) {
         fprintf(stderr, "http_init() failed\n");
         fprintf(stderr, "%s\n", ERR_MSG(err));
@@ -11,17 +11,39 @@
 #include <string.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <errno.h>
+#include <limits.h> // INT_MAX
 #include <signal.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <strings.h> // strncasecmp()
+#include <sys/time.h> // struct timeval
+#include <time.h> // clock_gettime()
 
 #include "http_prot.h"
 #include "http_net.h"
 #include "socket_layer.h"
+#include "trace.h"
 #include "error.h"
 #include "util.h"
 
-static int passive_socket = -1;
+// the listening sockets, all on the same port: the first one is served by http_receive(),
+// each of the others by its own accept thread
+static int passive_sockets[HTTP_MAX_LISTENERS] = {-1};
+static size_t nb_listeners;
 static EventCallback cb;
+static struct http_options options;
+
+// the number of connections being served
+static atomic_uint nb_connections;
+
+// the number of requests served on the connection of the thread, and whether
+// the reply being sent is the last one of this connection (which it then announces)
+static _Thread_local unsigned int nb_requests;
+static _Thread_local int closing;
+
+// the number of bytes sent by the thread (see http_sent_bytes())
+static _Thread_local size_t sent_bytes;
 
 #define MK_OUR_ERR(X) \
 static int our_ ## X = X
@@ -31,6 +53,33 @@ static int our_ ## X = X
 #define HTTP_HDR_END_DELIM_LENGTH 4
 #define CONTENT_LENGTH_LENGTH 16
 #define CONTENT_LENGTH "Content-Length: "
+#define TRANSFER_ENCODING_CHUNKED "Transfer-Encoding: chunked"
+#define CHUNK_SIZE_MAX_LENGTH 16
+#define CONNECTION_CLOSE "Connection: close" HTTP_LINE_DELIM
+#define REJECTION_HEADERS CONNECTION_CLOSE "Retry-After: 1" HTTP_LINE_DELIM
+// below, the body of a reply is copied after its headers: cheaper than corking the connection
+#define CORK_MIN_BODY_LENGTH 4096
+// the connections accepted at once, the connections waiting for a worker,
+// and how long (s) a worker waits for a connection before ending
+#define ACCEPT_BATCH_SIZE 64
+#define CONNECTION_QUEUE_SIZE (HTTP_MAX_LISTENERS * ACCEPT_BATCH_SIZE)
+#define WORKER_IDLE_S 60
+// the first allocation of a chunked body, and the room kept to read its next bytes
+// (the body of at most MAX_REQUEST_SIZE bytes, then its last chunk and trailer)
+#define CHUNKED_BODY_INITIAL_SIZE 65536
+#define CHUNKED_BODY_MIN_READ 4096
+
+// the connections accepted, waiting for a worker; the workers idle or starting take the first ones,
+// the others get new workers (see hand_over())
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    int queue[CONNECTION_QUEUE_SIZE];
+    size_t first;
+    size_t nb_queued;
+    size_t nb_idle;
+    size_t nb_starting;
+} workers = {.lock = PTHREAD_MUTEX_INITIALIZER, .ready = PTHREAD_COND_INITIALIZER};
 
 MK_OUR_ERR(ERR_NONE);
 MK_OUR_ERR(ERR_INVALID_ARGUMENT);
@@ -75,11 +124,22 @@ void* return_and_garbage_collect_handle_connection(char* output, int error_code,
     if(start_body != NULL) free(start_body);
     if(socket != NULL) {
         if(*socket != -1) close(*socket);
-        free(socket);
+        atomic_fetch_sub(&nb_connections, 1);
     }
     return convert_error(error_code);
 }
 
+/**
+* @brief Whether the client asks for its connection to be closed after the reply
+* @param message (const struct http_message*) : the request
+* @return (int) : 1 if the request has a "Connection: close" header, 0 otherwise
+*/
+static int client_closes(const struct http_message* message)
+{
+    const struct http_string* value = http_get_header(message, "Connection");
+    return value != NULL && value->len == strlen("close") && !strncasecmp(value->val, "close", value->len);
+}
+
 /**
 * @brief this function resets all the variable passed (except the connection socket) and calls the callback (if requested)
 * to maybe satisfy the request of the client if there are no error in the latter. Indeed it prepares for the next round of tcp
@@ -105,7 +165,11 @@ int prepare_for_next_round(int use_callback, char** output, size_t* to_receive,
 {
 
     if(use_callback) {
+        // the handler replies: it must know whether its reply is the last one of the connection
+        closing = (options.max_requests != 0 && ++nb_requests >= options.max_requests) || client_closes(message);
+        const uint64_t start = trace_now();
         int ret = cb(message, *socket);
+        trace_phase("request", start);
         if (ret != ERR_NONE) return ret;
     }
 
@@ -127,19 +191,56 @@ int prepare_for_next_round(int use_callback, char** output, size_t* to_receive,
 }
 
 
+/**
+* @brief Decodes the bytes of a chunked body just received, at the end of the data already decoded,
+* then makes room to read the next ones, growing the body up to MAX_REQUEST_SIZE bytes of data.
+* @param decoder (struct http_chunked*) : the decoder of the body
+* @param received (const char*) : the bytes received (either in the header buffer, or in the body after its data)
+* @param len (size_t) : the number of bytes received
+* @param body (char**) : the body, its data first
+* @param body_len (ssize_t*) : the length of the data in the body
+* @param capacity (ssize_t*) : the allocated size of the body
+* @return (int) : 1 if the body is complete, 0 if more is expected, or some (negative) error code
+*/
+static int receive_chunks(struct http_chunked* decoder, const char* received, size_t len,
+                          char** body, ssize_t* body_len, ssize_t* capacity)
+{
+    size_t decoded = 0;
+    const int ret = http_chunked_decode(decoder, received, len, *body + *body_len, &decoded);
+    if(ret < 0) return ret;
+    *body_len += (ssize_t) decoded;
+    if(*body_len > MAX_REQUEST_SIZE) return ERR_RUNTIME;
+    if(ret > 0 || *capacity - *body_len >= CHUNKED_BODY_MIN_READ) return ret;
+
+    const ssize_t new_capacity = MIN(2 * *capacity, MAX_REQUEST_SIZE + CHUNKED_BODY_MIN_READ);
+    if(new_capacity - *body_len < CHUNKED_BODY_MIN_READ) return ERR_RUNTIME;
+    char* new_body = realloc(*body, (size_t) new_capacity);
+    if(new_body == NULL) return ERR_OUT_OF_MEMORY;
+    *body = new_body;
+    *capacity = new_capacity;
+    return 0;
+}
+
 /*******************************************************************
- * Handle connection
+ * Handle connection (the socket is passed cast to a pointer)
  */
 static void *handle_connection(void *arg)
 {
-    sigset_t mask;
-    sigemptyset(&mask);
-    sigaddset(&mask, SIGINT );
-    sigaddset(&mask, SIGTERM);
-    pthread_sigmask(SIG_BLOCK, &mask, NULL);
-
-    if (arg == NULL) return convert_error(ERR_INVALID_ARGUMENT);
-    int* socket_ptr = (int*) arg;
+    int active_socket = (int) (intptr_t) arg;
+    int* socket_ptr = &active_socket;
+
+    nb_requests = 0;
+    closing = 0;
+
+    // an idle client (between requests or in the middle of one) gets its connection
+    // closed: tcp_read() then fails
+    if(options.idle_timeout_ms != 0) {
+        const struct timeval timeout = {.tv_sec = options.idle_timeout_ms / 1000,
+                                        .tv_usec = (options.idle_timeout_ms % 1000) * 1000
+                                       };
+        if(setsockopt(*socket_ptr, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1)
+            return return_and_garbage_collect_handle_connection(NULL, ERR_IO, socket_ptr, NULL);
+    }
 
     int ret_error = 0;
 
@@ -153,23 +254,65 @@ static void *handle_connection(void *arg)
     char* start_body = NULL;
     struct http_message message;
     int content_length = 0;
+    struct http_chunked chunked;
 
     if((ret_error = prepare_for_next_round(0, &output, &to_receive, &bytes_received, &content_length, &started_read, &iter, &message, socket_ptr)) != ERR_NONE)
         return return_and_garbage_collect_handle_connection(output, ret_error, socket_ptr, NULL);
 
-    while((length_read = tcp_read(*socket_ptr, iter, to_receive - bytes_received)) != 0) {
+    while(!closing && (length_read = tcp_read(*socket_ptr, iter, to_receive - bytes_received)) != 0) {
         if(length_read == -1) return return_and_garbage_collect_handle_connection(output, ERR_IO, socket_ptr, start_body);
 
         bytes_received += length_read;
         iter += length_read;
 
+        // a chunked body: what is received is decoded at once (bytes_received is then the length
+        // of the data decoded, to_receive the size of the body)
+        if(started_read == 1 && content_length == HTTP_CHUNKED_BODY) {
+            bytes_received -= length_read;
+            ret_error = receive_chunks(&chunked, iter - length_read, length_read, &start_body, &bytes_received, &to_receive);
+            if(ret_error < 0) return return_and_garbage_collect_handle_connection(output, ret_error, socket_ptr, start_body);
+            iter = start_body + bytes_received;
+            if(ret_error == 0) continue;
+
+            message.body.val = start_body;
+            message.body.len = bytes_received;
+            ret_error = prepare_for_next_round(1, &output, &to_receive, &bytes_received, &content_length, &started_read, &iter, &message, socket_ptr);
+            if(ret_error != ERR_NONE)
+                return return_and_garbage_collect_handle_connection(output, ret_error, socket_ptr, start_body);
+            continue;
+        }
+
         if(started_read == 0) {
+            const uint64_t parse_start = trace_now();
             ret_error = http_parse_message(output, bytes_received, &message, &content_length);
+            trace_phase("parse", parse_start);
 
             if(ret_error < 0) {
                 if(ret_error == ERR_RUNTIME) return return_and_garbage_collect_handle_connection(output, ERR_RUNTIME, socket_ptr, start_body);
                 else if(ret_error == ERR_OUT_OF_MEMORY) return return_and_garbage_collect_handle_connection(output, ERR_OUT_OF_MEMORY, socket_ptr, start_body);
                 else return return_and_garbage_collect_handle_connection(output, ERR_DEBUG, socket_ptr, start_body);
+            } else if(ret_error == 0 && content_length == HTTP_CHUNKED_BODY) {
+                // the headers are kept in output, the body is decoded into start_body
+                to_receive = MAX(CHUNKED_BODY_INITIAL_SIZE, (ssize_t) message.body.len + CHUNKED_BODY_MIN_READ);
+                start_body = realloc(start_body, (size_t) to_receive);
+                if(start_body == NULL)
+                    return return_and_garbage_collect_handle_connection(output, ERR_OUT_OF_MEMORY, socket_ptr, start_body);
+
+                http_chunked_init(&chunked);
+                bytes_received = 0;
+                started_read = 1;
+                ret_error = receive_chunks(&chunked, message.body.val, message.body.len, &start_body, &bytes_received, &to_receive);
+                if(ret_error < 0) return return_and_garbage_collect_handle_connection(output, ret_error, socket_ptr, start_body);
+                iter = start_body + bytes_received;
+
+                if(ret_error > 0) {
+                    message.body.val = start_body;
+                    message.body.len = bytes_received;
+                    ret_error = prepare_for_next_round(1, &output, &to_receive,
+                                                       &bytes_received, &content_length, &started_read, &iter, &message, socket_ptr);
+                    if(ret_error != ERR_NONE)
+                        return return_and_garbage_collect_handle_connection(output, ret_error, socket_ptr, start_body);
+                }
             } else if(ret_error == 0 && (0 < content_length && message.body.len < content_length)) {
                 start_body = realloc(start_body, content_length * sizeof(char));
                 if(start_body == NULL)
@@ -204,11 +347,77 @@ static void *handle_connection(void *arg)
 /*******************************************************************
  * Init connection
  */
-int http_init(uint16_t port, EventCallback callback)
+void http_options_init(struct http_options* http_options)
+{
+    if(http_options == NULL) return;
+    http_options->idle_timeout_ms = HTTP_IDLE_TIMEOUT_MS;
+    http_options->max_requests = HTTP_MAX_REQUESTS;
+    http_options->max_connections = HTTP_MAX_CONNECTIONS;
+    http_options->address = HTTP_ADDRESS;
+    http_options->backlog = HTTP_BACKLOG;
+    http_options->nb_listeners = 1;
+    tcp_options_init(&http_options->tcp);
+}
+
+static int receive_on(int passive_socket);
+
+/**
+* @brief Blocks SIGINT and SIGTERM in the calling thread: they are handled by the main thread
+*/
+static void block_signals(void)
 {
-    passive_socket = tcp_server_init(port);
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT );
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+}
+
+/**
+* @brief The loop of an accept thread, until its listening socket is closed
+* @param arg (void*) : the listening socket, cast to a pointer
+*/
+static void* accept_loop(void* arg)
+{
+    block_signals();
+
+    const int passive_socket = (int) (intptr_t) arg;
+    while(receive_on(passive_socket) == ERR_NONE) {}
+    return NULL;
+}
+
+int http_init(uint16_t port, EventCallback callback, const struct http_options* http_options)
+{
+    if(http_options != NULL) options = *http_options;
+    else http_options_init(&options);
+    if(options.nb_listeners == 0 || options.nb_listeners > HTTP_MAX_LISTENERS
+       || options.backlog == 0 || options.backlog > INT_MAX) return ERR_INVALID_ARGUMENT;
+
     cb = callback;
-    return passive_socket;
+    for(size_t l = 0; l < options.nb_listeners; ++l) {
+        // a single listener keeps the port to itself: a second server started on it fails to bind
+        const int passive_socket = tcp_server_init_at(options.address, port, (int) options.backlog,
+                                                      options.nb_listeners > 1, &options.tcp);
+        if(passive_socket < 0) {
+            http_close();
+            return passive_socket;
+        }
+        if(tcp_set_nonblocking(passive_socket) != ERR_NONE) {
+            close(passive_socket);
+            http_close();
+            return ERR_IO;
+        }
+        passive_sockets[nb_listeners++] = passive_socket;
+
+        pthread_t thread;
+        if(l == 0) continue;
+        if(pthread_create(&thread, NULL, accept_loop, (void*) (intptr_t) passive_socket) != 0) {
+            http_close();
+            return ERR_THREADING;
+        }
+        pthread_detach(thread);
+    }
+    return passive_sockets[0];
 }
 
 
@@ -217,57 +426,134 @@ int http_init(uint16_t port, EventCallback callback)
  */
 void http_close(void)
 {
-    if (passive_socket > 0) {
-        if (close(passive_socket) == -1)
+    for(size_t l = 0; l < nb_listeners; ++l) {
+        if (passive_sockets[l] < 0) continue;
+        // wakes up the accept thread blocked on the socket
+        shutdown(passive_sockets[l], SHUT_RDWR);
+        if (close(passive_sockets[l]) == -1)
             perror("close() in http_close()");
         else
-            passive_socket = -1;
+            passive_sockets[l] = -1;
     }
+    nb_listeners = 0;
 }
 
 
-/**
-* @brief this function is the garbage collector for http_receive. If the pointer is not null
-* it does garbage collecting. If the socket pointer contains a valid socket file desscriptor it closes it.
-* After that it frees the pointer. Then it always returns error none as no errors are raised.
-* @param active_socket (int*) : a pointer to an int containing the value of a socket file descriptor
-* @return (int) : the error code, which is always ERR_NONE.
-*/
-int garbage_collector_http_receive(int* active_socket)
-{
-    if(active_socket != NULL) {
-        if(*active_socket != -1) close(*active_socket);
-        free(active_socket);
-    }
-    return ERR_NONE;
-}
 /*******************************************************************
  * Receive content
  */
 int http_receive(void)
 {
-    int* active_socket = calloc(1, sizeof(int));
-    if(active_socket == NULL)
-        return garbage_collector_http_receive(active_socket);
+    return receive_on(passive_sockets[0]);
+}
 
-    *active_socket = tcp_accept(passive_socket);
-    if(*active_socket == -1)
-        return garbage_collector_http_receive(active_socket);
+/**
+* @brief The loop of a worker: serves the connections handed over by the accept threads, one after the other,
+* and ends after waiting WORKER_IDLE_S for a connection in vain.
+*/
+static void* worker_loop(void* arg _unused)
+{
+    block_signals();
+
+    pthread_mutex_lock(&workers.lock);
+    --workers.nb_starting;
+    for(;;) {
+        while(workers.nb_queued == 0) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += WORKER_IDLE_S;
+
+            ++workers.nb_idle;
+            const int ret = pthread_cond_timedwait(&workers.ready, &workers.lock, &deadline);
+            --workers.nb_idle;
+            if(ret == ETIMEDOUT && workers.nb_queued == 0) {
+                pthread_mutex_unlock(&workers.lock);
+                return NULL;
+            }
+        }
 
-    pthread_attr_t attr;
-    zero_init_var(attr);
-    pthread_t thread;
-    zero_init_var(thread);
+        const int active_socket = workers.queue[workers.first];
+        workers.first = (workers.first + 1) % CONNECTION_QUEUE_SIZE;
+        --workers.nb_queued;
+        pthread_mutex_unlock(&workers.lock);
 
-    int ret = 0;
-    if( ((ret = pthread_attr_init(&attr)) != 0)
-        || ((ret = pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED)) != 0)
-        || ((ret = pthread_create(&thread, &attr, handle_connection, (void*) active_socket)) != 0))
-        return garbage_collector_http_receive(active_socket);
+        handle_connection((void*) (intptr_t) active_socket);
 
+        pthread_mutex_lock(&workers.lock);
+    }
+}
+
+/**
+* @brief Hands connections over to the workers, all at once: they are queued under a single lock, the idle
+* workers are woken up and new workers are started for the connections no idle worker can take.
+* @param sockets (const int*) : the connections
+* @param nb (size_t) : the number of connections
+*/
+static void hand_over(const int* sockets, size_t nb)
+{
+    pthread_mutex_lock(&workers.lock);
+    size_t queued = 0;
+    for(; queued < nb && workers.nb_queued < CONNECTION_QUEUE_SIZE; ++queued) {
+        workers.queue[(workers.first + workers.nb_queued++) % CONNECTION_QUEUE_SIZE] = sockets[queued];
+    }
+    const size_t available = workers.nb_idle + workers.nb_starting;
+    size_t nb_new = workers.nb_queued > available ? workers.nb_queued - available : 0;
+    workers.nb_starting += nb_new;
+
+    if(queued > 1) pthread_cond_broadcast(&workers.ready);
+    else if(queued == 1) pthread_cond_signal(&workers.ready);
+    pthread_mutex_unlock(&workers.lock);
+
+    // (should the queue be full, which the limit of connections makes unlikely)
+    for(size_t i = queued; i < nb; ++i) {
+        close(sockets[i]);
+        atomic_fetch_sub(&nb_connections, 1);
+    }
+
+    pthread_attr_t attr;
+    if(nb_new == 0 || pthread_attr_init(&attr) != 0) return;
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for(; nb_new > 0; --nb_new) {
+        pthread_t thread;
+        if(pthread_create(&thread, &attr, worker_loop, NULL) != 0) {
+            // the connections wait for the workers running
+            perror("pthread_create() in hand_over()");
+            pthread_mutex_lock(&workers.lock);
+            workers.nb_starting -= nb_new;
+            pthread_mutex_unlock(&workers.lock);
+            break;
+        }
+    }
     pthread_attr_destroy(&attr);
+}
+
+/**
+* @brief Accepts the pending connections of a listening socket, by batches, and hands them over to the workers
+* @param passive_socket (int) : the listening socket
+* @return (int) : ERR_NONE, or ERR_IO once the listening socket is closed
+*/
+static int receive_on(int passive_socket)
+{
+    int sockets[ACCEPT_BATCH_SIZE];
+    const int nb_accepted = tcp_accept_batch(passive_socket, sockets, ACCEPT_BATCH_SIZE);
+    if(nb_accepted < 0) return ERR_IO;
+
+    size_t nb = 0;
+    for(int i = 0; i < nb_accepted; ++i) {
+        // beyond the limit, a connection is rejected at once, without reading its request
+        if(atomic_fetch_add(&nb_connections, 1) >= options.max_connections && options.max_connections != 0) {
+            atomic_fetch_sub(&nb_connections, 1);
+            http_reply(sockets[i], HTTP_SERVICE_UNAVAILABLE, REJECTION_HEADERS, "", 0);
+            close(sockets[i]);
+        } else {
+            sockets[nb++] = sockets[i];
+        }
+    }
+
+    if(nb > 0) hand_over(sockets, nb);
     return ERR_NONE;
 }
+
 /*******************************************************************
  * Serve a file content over HTTP
  */
@@ -327,6 +613,27 @@ int garbage_collector_of_http_reply(int error_code, char* body_len_string_ptr, c
     return error_code;
 }
 
+/**
+* @brief Sends the whole buffer, looping over partial sends.
+* @return (int) : ERR_NONE, or ERR_IO if the connection failed.
+*/
+static int send_all(int connection, const char* buffer, size_t len)
+{
+    while(len > 0) {
+        const ssize_t ret = tcp_send(connection, buffer, len);
+        if(ret <= 0) return ERR_IO;
+        buffer += ret;
+        len -= (size_t) ret;
+        sent_bytes += (size_t) ret;
+    }
+    return ERR_NONE;
+}
+
+size_t http_sent_bytes(void)
+{
+    return sent_bytes;
+}
+
 /*******************************************************************
  * Create and send HTTP reply
  */
@@ -349,32 +656,103 @@ int http_reply(int connection, const char* status, const char* headers, const ch
 
     size_t size_of_body_len = strlen(body_len_string);
     // we have that the maximum length is 20 for an unsigned long, so to null terminate
+    const char* connection_header = closing ? CONNECTION_CLOSE : "";
     ssize_t total_header_size = HTTP_PROTOCOL_ID_LENGTH + strlen(status) + HTTP_LINE_DELIM_LENGTH + strlen(headers)
-                                + CONTENT_LENGTH_LENGTH + size_of_body_len + HTTP_HDR_END_DELIM_LENGTH;
-    size_t total_message_size = total_header_size + body_len;
+                                + strlen(connection_header) + CONTENT_LENGTH_LENGTH + size_of_body_len + HTTP_HDR_END_DELIM_LENGTH;
+    // corked, the body is sent from where it is instead of being copied after the headers:
+    // the cork gathers both into full segments
+    const int corked = options.tcp.cork && body_len > CORK_MIN_BODY_LENGTH;
+    size_t total_message_size = total_header_size + (corked ? 0 : body_len);
 
     char* http_message_buffer = calloc(total_message_size + 1, sizeof(char));
     if(http_message_buffer == NULL) {
         return garbage_collector_of_http_reply(ERR_OUT_OF_MEMORY, body_len_string, NULL);
     }
 
-    if(snprintf(http_message_buffer, total_header_size + 1, "%s%s%s%s%s%zu%s",
-                HTTP_PROTOCOL_ID, status, HTTP_LINE_DELIM, headers, CONTENT_LENGTH, body_len, HTTP_HDR_END_DELIM) == -1) {
+    if(snprintf(http_message_buffer, total_header_size + 1, "%s%s%s%s%s%s%zu%s",
+                HTTP_PROTOCOL_ID, status, HTTP_LINE_DELIM, headers, connection_header, CONTENT_LENGTH, body_len,
+                HTTP_HDR_END_DELIM) == -1) {
         return garbage_collector_of_http_reply(ERR_RUNTIME, body_len_string, http_message_buffer);
     }
 
-    if(body_len != 0) {
+    if(body_len != 0 && !corked) {
         memcpy(http_message_buffer + total_header_size, body, body_len);
     }
 
-    size_t bytes_sent = 0;
-    char* iter = http_message_buffer;
-    while(bytes_sent < total_message_size) {
-        size_t ret = tcp_send(connection, iter, total_message_size - bytes_sent);
-        if(ret < 0) return garbage_collector_of_http_reply(ERR_IO, body_len_string, http_message_buffer);
-        bytes_sent += ret;
-        iter += ret;
+    const uint64_t start = trace_now();
+    if(corked) tcp_cork(connection, 1);
+    int ret = send_all(connection, http_message_buffer, total_message_size);
+    if(ret == ERR_NONE && corked) ret = send_all(connection, body, body_len);
+    if(corked) tcp_cork(connection, 0);
+    trace_phase("send", start);
+
+    return garbage_collector_of_http_reply(ret, body_len_string, http_message_buffer);
+}
+
+/**
+ * @brief Sends the status line and the headers of a reply, the given last header included.
+ * @param last_header (const char*) : the last header line (with its line delimiter), empty for none
+*/
+static int send_head(int connection, const char* status, const char* headers, const char* last_header)
+{
+    M_REQUIRE_NON_NULL(status);
+    M_REQUIRE_NON_NULL(headers);
+
+    const char* connection_header = closing ? CONNECTION_CLOSE : "";
+    const size_t len = HTTP_PROTOCOL_ID_LENGTH + strlen(status) + HTTP_LINE_DELIM_LENGTH + strlen(headers)
+                       + strlen(connection_header) + strlen(last_header) + HTTP_LINE_DELIM_LENGTH;
+    char* header = calloc(len + 1, sizeof(char));
+    if(header == NULL) return ERR_OUT_OF_MEMORY;
+
+    snprintf(header, len + 1, "%s%s%s%s%s%s%s", HTTP_PROTOCOL_ID, status, HTTP_LINE_DELIM, headers,
+             connection_header, last_header, HTTP_LINE_DELIM);
+
+    const int ret = send_all(connection, header, len);
+    free(header);
+    return ret;
+}
+
+/*******************************************************************
+ * Start a chunked HTTP reply
+ */
+int http_reply_chunked(int connection, const char* status, const char* headers)
+{
+    // the headers and the chunks leave in full segments, until the last chunk uncorks the connection
+    if(options.tcp.cork) tcp_cork(connection, 1);
+    return send_head(connection, status, headers, TRANSFER_ENCODING_CHUNKED HTTP_LINE_DELIM);
+}
+
+/*******************************************************************
+ * Send an HTTP reply without body
+ */
+int http_reply_no_body(int connection, const char* status, const char* headers)
+{
+    return send_head(connection, status, headers, "");
+}
+
+/*******************************************************************
+ * Send one chunk of a chunked HTTP reply
+ */
+int http_send_chunk(int connection, const char* data, size_t len)
+{
+    if(len != 0) M_REQUIRE_NON_NULL(data);
+
+    // the chunk is framed in a single buffer: a separate send for the size line
+    // would be delayed by Nagle's algorithm until the previous one is acknowledged
+    char* chunk = calloc(CHUNK_SIZE_MAX_LENGTH + len + HTTP_HDR_END_DELIM_LENGTH + 1, sizeof(char));
+    if(chunk == NULL) return ERR_OUT_OF_MEMORY;
+
+    const int size_len = snprintf(chunk, CHUNK_SIZE_MAX_LENGTH + 1, "%zx" HTTP_LINE_DELIM, len);
+    size_t chunk_len = (size_t) size_len;
+    if(len != 0) {
+        memcpy(chunk + chunk_len, data, len);
+        chunk_len += len;
     }
+    memcpy(chunk + chunk_len, HTTP_LINE_DELIM, HTTP_LINE_DELIM_LENGTH);
+    chunk_len += HTTP_LINE_DELIM_LENGTH;
 
-    return garbage_collector_of_http_reply(ERR_NONE, body_len_string, http_message_buffer);
-}
\ No newline at end of file
+    const int ret = send_all(connection, chunk, chunk_len);
+    free(chunk);
+    if(len == 0 && options.tcp.cork) tcp_cork(connection, 0);
+    return ret;
+}
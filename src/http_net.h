@@ -9,6 +9,7 @@
 
 #include <stdint.h>
 #include "http_prot.h" // for structs
+#include "socket_layer.h" // for struct tcp_options
 
 #define MAX_REQUEST_SIZE 8388608 // 2^23 -> to handle images up to 8MB
 #define MAX_HEADER_SIZE    16384 // 2^14 -> to handle http headers
@@ -24,7 +25,46 @@
 
 typedef int (*EventCallback)(struct http_message*, int);
 
-int http_init(uint16_t port, EventCallback cb);
+#define HTTP_IDLE_TIMEOUT_MS  30000
+#define HTTP_MAX_REQUESTS     1000
+#define HTTP_MAX_CONNECTIONS  1024
+#define HTTP_ADDRESS          "127.0.0.1"
+#define HTTP_BACKLOG          1024
+#define HTTP_MAX_LISTENERS    64
+
+/**
+ * @brief How the connections are managed, 0 meaning no limit for each field
+ */
+struct http_options {
+    /*!Time (in ms) a connection may wait for the next bytes of a request before being closed*/
+    unsigned int idle_timeout_ms;
+    /*!Number of requests served on a connection, the last reply closing it*/
+    unsigned int max_requests;
+    /*!Number of connections served at the same time, the next ones being rejected with 503*/
+    unsigned int max_connections;
+    /*!The IPv4 or IPv6 address or the host name to listen on, NULL for all the interfaces*/
+    const char* address;
+    /*!The maximal number of connections waiting to be accepted by each listening socket*/
+    unsigned int backlog;
+    /*!The number of sockets listening on the port (SO_REUSEPORT if more than one), each with its accept thread*/
+    unsigned int nb_listeners;
+    /*!The options of the sockets*/
+    struct tcp_options tcp;
+};
+
+/**
+ * @brief Sets the options to their defaults.
+ */
+void http_options_init(struct http_options* options);
+
+/**
+ * @brief Starts listening on the given port, and starts the accept threads of
+ *        all the listening sockets but the first one, served by http_receive().
+ *
+ * @param options How the connections are managed, NULL for the defaults
+ * @return The first listening socket, or some (negative) error code.
+ */
+int http_init(uint16_t port, EventCallback cb, const struct http_options* options);
 
 int http_receive(void);
 
@@ -32,4 +72,28 @@ int http_serve_file(int connection, const char* filename);
 
 int http_reply(int connection, const char* status, const char* headers, const char* body, size_t body_len);
 
+/**
+ * @brief Starts a reply whose body is sent afterwards by http_send_chunk()
+ *        (Transfer-Encoding: chunked), when its length is not known beforehand
+ */
+int http_reply_chunked(int connection, const char* status, const char* headers);
+
+/**
+ * @brief Sends one chunk of the body of a reply started by http_reply_chunked();
+ *        a chunk of length 0 ends the body
+ */
+int http_send_chunk(int connection, const char* data, size_t len);
+
+/**
+ * @brief Sends a reply that has no body at all, not even a Content-Length
+ *        (e.g. 304 Not Modified, whose headers describe the body not sent)
+ */
+int http_reply_no_body(int connection, const char* status, const char* headers);
+
+/**
+ * @brief The number of bytes sent so far by the calling thread, in all its replies
+ *        (the difference before and after a reply tells its size)
+ */
+size_t http_sent_bytes(void);
+
 void http_close(void);
@@ -2,7 +2,9 @@
 #include "util.h"
 
 #include <string.h>
+#include <strings.h> // strncasecmp()
 #include <stdlib.h>
+#include <stdint.h> // SIZE_MAX
 
 /**
 * @brief This function tells us if the string haystack is prefixed by the strign needle.
@@ -39,6 +41,18 @@ int http_match_verb(const struct http_string* method, const char* verb)
     return !strncmp(method->val, verb, method->len) && verb[method->len] == '\0';
 }
 
+const struct http_string* http_get_header(const struct http_message* message, const char* key)
+{
+    if(message == NULL || key == NULL) return NULL;
+
+    const size_t key_len = strlen(key);
+    for(size_t i = 0; i < message->num_headers; ++i) {
+        const struct http_header* header = &message->headers[i];
+        if(header->key.len == key_len && !strncasecmp(header->key.val, key, key_len)) return &header->value;
+    }
+    return NULL;
+}
+
 /**
 * @brief This function is a garbage collector for our other functions.
 * Nothing fancy, just frees the associated memory to the pointer, before returning
@@ -264,6 +278,18 @@ int http_parse_message(const char *stream, size_t bytes_received, struct http_me
     if((iter = http_parse_headers(iter, out)) == NULL) return ERR_RUNTIME;
     else number_of_bytes_header = (ptrdiff_t)((iter) - (stream));
 
+    // a chunked body is decoded by the caller as it arrives
+    const struct http_string* transfer_encoding = http_get_header(out, "Transfer-Encoding");
+    if(transfer_encoding != NULL) {
+        if(http_get_header(out, "Content-Length") != NULL || transfer_encoding->len != strlen("chunked")
+           || strncasecmp(transfer_encoding->val, "chunked", transfer_encoding->len)) return ERR_RUNTIME;
+
+        out->body.val = iter;
+        out->body.len = bytes_received - number_of_bytes_header;
+        *content_len = HTTP_CHUNKED_BODY;
+        return 0;
+    }
+
     for(int i = 0; i < out->num_headers; ++i) {
         if(http_match_verb(&out->headers[i].key, "Content-Length")) {
             const char* val_temp_buffer = NULL;
@@ -291,3 +317,105 @@ int http_parse_message(const char *stream, size_t bytes_received, struct http_me
     *content_len = 0;
     return 1;
 }
+
+void http_chunked_init(struct http_chunked* decoder)
+{
+    if(decoder == NULL) return;
+    zero_init_ptr(decoder);
+    decoder->state = CHUNK_SIZE;
+}
+
+/**
+ * @brief The value of an hexadecimal digit
+ * @param c (char) : the digit
+ * @return (int) : its value, -1 if c is not an hexadecimal digit
+*/
+static int hex_digit(char c)
+{
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * @brief Ends the size line of a chunk: its data follows, or the trailer if it is the last chunk
+ * @param decoder (struct http_chunked*) : the decoder
+ * @return (int) : ERR_NONE, or ERR_RUNTIME if the line has no size
+*/
+static int end_size_line(struct http_chunked* decoder)
+{
+    if(decoder->nb_digits == 0) return ERR_RUNTIME;
+    decoder->state = decoder->chunk_left == 0 ? CHUNK_TRAILER : CHUNK_DATA;
+    decoder->line_len = 0;
+    return ERR_NONE;
+}
+
+int http_chunked_decode(struct http_chunked* decoder, const char* in, size_t len, char* out, size_t* out_len)
+{
+    M_REQUIRE_NON_NULL(decoder);
+    M_REQUIRE_NON_NULL(in);
+    M_REQUIRE_NON_NULL(out);
+    M_REQUIRE_NON_NULL(out_len);
+
+    *out_len = 0;
+    const char* const end = in + len;
+    while(in < end && decoder->state != CHUNK_DONE) {
+        // the data is moved at once (out never goes past in: in place decoding is safe)
+        if(decoder->state == CHUNK_DATA) {
+            const size_t data_len = MIN(decoder->chunk_left, (size_t) (end - in));
+            memmove(out + *out_len, in, data_len);
+            *out_len += data_len;
+            in += data_len;
+            decoder->chunk_left -= data_len;
+            if(decoder->chunk_left == 0) decoder->state = CHUNK_DATA_END;
+            continue;
+        }
+
+        const char c = *in++;
+        switch(decoder->state) {
+        case CHUNK_SIZE: {
+            const int digit = hex_digit(c);
+            if(digit >= 0) {
+                if(decoder->chunk_left > (SIZE_MAX >> 4)) return ERR_RUNTIME;
+                decoder->chunk_left = (decoder->chunk_left << 4) | (size_t) digit;
+                ++decoder->nb_digits;
+            } else if(c == ';' || c == ' ' || c == '\t') {
+                decoder->state = CHUNK_EXTENSION;
+            } else if(c == '\r') {
+                decoder->state = CHUNK_SIZE_END;
+            } else if(c == '\n') {
+                if(end_size_line(decoder) != ERR_NONE) return ERR_RUNTIME;
+            } else return ERR_RUNTIME;
+            break;
+        }
+        case CHUNK_EXTENSION:
+            if(c == '\r') decoder->state = CHUNK_SIZE_END;
+            else if(c == '\n' && end_size_line(decoder) != ERR_NONE) return ERR_RUNTIME;
+            break;
+        case CHUNK_SIZE_END:
+            if(c != '\n' || end_size_line(decoder) != ERR_NONE) return ERR_RUNTIME;
+            break;
+        case CHUNK_DATA_END:
+        case CHUNK_DATA_CR:
+            if(c == '\n') {
+                decoder->state = CHUNK_SIZE;
+                decoder->nb_digits = 0;
+            } else if(c == '\r' && decoder->state == CHUNK_DATA_END) {
+                decoder->state = CHUNK_DATA_CR;
+            } else return ERR_RUNTIME;
+            break;
+        case CHUNK_TRAILER:
+            // the trailer fields are ignored, up to the empty line that ends the body
+            if(c == '\n') {
+                if(decoder->line_len == 0) decoder->state = CHUNK_DONE;
+                decoder->line_len = 0;
+            } else if(c != '\r') ++decoder->line_len;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return decoder->state == CHUNK_DONE;
+}
@@ -14,7 +14,14 @@
 #define HTTP_HDR_END_DELIM HTTP_LINE_DELIM HTTP_LINE_DELIM
 #define HTTP_PROTOCOL_ID   "HTTP/1.1 "
 #define HTTP_OK            "200 OK"
+#define HTTP_PARTIAL_CONTENT "206 Partial Content"
+#define HTTP_NOT_MODIFIED  "304 Not Modified"
 #define HTTP_BAD_REQUEST   "400 Bad Request"
+#define HTTP_RANGE_NOT_SATISFIABLE "416 Range Not Satisfiable"
+#define HTTP_SERVICE_UNAVAILABLE "503 Service Unavailable"
+
+// the content length reported by http_parse_message() for a chunked body
+#define HTTP_CHUNKED_BODY (-1)
 
 #include <stddef.h>
 
@@ -44,6 +51,36 @@ struct http_message {
  */
 int http_match_uri(const struct http_message *message, const char *target_uri);
 
+/**
+ * @brief Where a chunked body decoder is in the chunk framing (see http_chunked_decode())
+ */
+enum http_chunked_state {
+    CHUNK_SIZE,
+    CHUNK_EXTENSION,
+    // the CR ending a size line was read: only its LF may follow
+    CHUNK_SIZE_END,
+    CHUNK_DATA,
+    CHUNK_DATA_END,
+    // the CR after the data of a chunk was read: only its LF may follow
+    CHUNK_DATA_CR,
+    CHUNK_TRAILER,
+    CHUNK_DONE
+};
+
+/**
+ * @brief An incremental decoder of a "Transfer-Encoding: chunked" body
+ */
+struct http_chunked {
+    /*!Where the decoder is in the framing*/
+    enum http_chunked_state state;
+    /*!The size of the chunk being read (while in its size line) or its bytes still to come (in its data)*/
+    size_t chunk_left;
+    /*!The number of hexadecimal digits read in the size line*/
+    size_t nb_digits;
+    /*!The length of the trailer line being read*/
+    size_t line_len;
+};
+
 /**
  * @brief Accepts a potentially partial TCP stream and parses an HTTP message.
  *
@@ -53,6 +90,12 @@ int http_match_uri(const struct http_message *message, const char *target_uri);
  * Also writes the content of header "Content Length" to content_len upon parsing the header in the stream.
  * content_len can be used by the caller to allocate memory to receive the whole HTTP message.
  *
+ * If the body is sent with "Transfer-Encoding: chunked", content_len is set to
+ * HTTP_CHUNKED_BODY, 0 is returned, and out->body holds the chunked bytes received
+ * so far: the caller decodes them, then the rest of the body, with http_chunked_decode().
+ * A message with both a Content-Length and a Transfer-Encoding, or with another
+ * transfer coding than chunked, is an error.
+ *
  * Returns:
  *  a negative int if there was an error
  *  0 if the message has not been received completely (partial treatment)
@@ -60,6 +103,26 @@ int http_match_uri(const struct http_message *message, const char *target_uri);
  */
 int http_parse_message(const char *stream, size_t bytes_received, struct http_message *out, int *content_len);
 
+/**
+ * @brief Starts the decoding of a chunked body.
+ */
+void http_chunked_init(struct http_chunked* decoder);
+
+/**
+ * @brief Decodes the next len bytes of a chunked body, as they are received.
+ *
+ * The data of the chunks is written to out (which may be in, the data being
+ * never longer than the bytes that carry it: a body can be decoded in place)
+ * and its length to out_len. The framing can be split anywhere between two calls.
+ * The bytes after the end of the body (the last chunk and the trailer) are ignored.
+ *
+ * Returns:
+ *  a negative int if the framing is invalid
+ *  0 if the body has not been received completely
+ *  1 if the end of the body has been reached
+ */
+int http_chunked_decode(struct http_chunked* decoder, const char* in, size_t len, char* out, size_t* out_len);
+
 /**
  * @brief Writes the value of parameter `name` from URL in message to buffer out.
  *
@@ -72,3 +135,9 @@ int http_get_var(const struct http_string* url, const char* name, char* out, siz
  * @brief Compare method with verb and return 1 if they are equal, 0 otherwise
  */
 int http_match_verb(const struct http_string* method, const char* verb);
+
+/**
+ * @brief Returns the value of the (first) header named key in message, the
+ *        name being compared case-insensitively; NULL if there is none.
+ */
+const struct http_string* http_get_header(const struct http_message* message, const char* key);
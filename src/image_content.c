@@ -1,10 +1,16 @@
 #include "image_content.h"
 #include "imgfs.h"
+#include "imgfs_blobs.h"
+#include "metrics.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <vips/vips.h>
 
+// the grey thumbnail of get_dhash(): one bit per pair of horizontally adjacent pixels
+#define DHASH_WIDTH  9
+#define DHASH_HEIGHT 8
+
 /**
 * @brief handles the different possible garbage collecting cases, called only in the event of a specific error occuring.
 * @param error_code (int) : the error code to be returned
@@ -36,6 +42,25 @@ int error_handler_content(int error_code, void* to_write, void* orig_img, VipsIm
     return error_code;
 }
 
+/**
+ * @brief Gives the resolutions of the content of a slot to all the other slots sharing this content
+ * @param imgfs_file (struct imgfs_file*) : the imgFS
+ * @param index (uint32_t) : the slot
+ * @return (int) : ERR_IO if the metadata of a duplicate cannot be written, ERR_NONE otherwise
+ */
+static int share_with_duplicates(struct imgfs_file* imgfs_file, uint32_t index)
+{
+    const struct blob_table* blobs = imgfs_file->blobs;
+    for(uint32_t slot = blobs_first_slot(blobs, imgfs_file->metadata[index].SHA); slot != NO_SLOT; slot = blobs_next_slot(blobs, slot)) {
+        struct img_metadata duplicate = imgfs_file->metadata[slot];
+        if(slot == index || !blobs_adopt(blobs, &duplicate)) continue;
+
+        if(write_metadata(imgfs_file, slot, &duplicate) != ERR_NONE) return ERR_IO;
+        imgfs_file->metadata[slot] = duplicate;
+    }
+    return ERR_NONE;
+}
+
 int lazily_resize(int resolution, struct imgfs_file* imgfs_file, size_t index)
 {
     M_REQUIRE_NON_NULL(imgfs_file);
@@ -49,6 +74,15 @@ int lazily_resize(int resolution, struct imgfs_file* imgfs_file, size_t index)
     struct img_metadata img = imgfs_file->metadata[index];
 
     if(!img.offset[resolution] || !img.size[resolution]) {
+        // a duplicate may have materialized the resolution already: its copy is shared rather than made again
+        if(blobs_adopt(imgfs_file->blobs, &img) && img.offset[resolution] && img.size[resolution]) {
+            if(write_metadata(imgfs_file, (uint32_t) index, &img) != ERR_NONE) return ERR_IO;
+            imgfs_file->metadata[index] = img;
+            if(share_with_duplicates(imgfs_file, (uint32_t) index) != ERR_NONE) return ERR_IO;
+            return do_commit(imgfs_file);
+        }
+
+        const uint64_t start = metrics_now_ns();
         uint16_t img_width = imgfs_file->header.resized_res[2 * resolution];
         uint16_t img_height = imgfs_file->header.resized_res[2 * resolution + 1];
 
@@ -93,8 +127,7 @@ int lazily_resize(int resolution, struct imgfs_file* imgfs_file, size_t index)
         img.offset[resolution] = (uint64_t) offset;
         img.size[resolution] = (uint32_t) to_write_len;
 
-        if(fseek(imgfs_file->file, sizeof(struct imgfs_header) + index * sizeof(struct img_metadata), SEEK_SET) == -1
-           || fwrite(&img, sizeof(struct img_metadata), 1UL, imgfs_file->file) != 1UL)
+        if(write_metadata(imgfs_file, (uint32_t) index, &img) != ERR_NONE)
             return error_handler_content(ERR_IO, to_write, orig_img, in, out);
 
         imgfs_file->metadata[index] = img;
@@ -102,6 +135,13 @@ int lazily_resize(int resolution, struct imgfs_file* imgfs_file, size_t index)
         // free the pointers
         g_object_unref(VIPS_OBJECT(in));
         g_object_unref(VIPS_OBJECT(out));
+
+        // resized once for all the duplicates
+        if(share_with_duplicates(imgfs_file, (uint32_t) index) != ERR_NONE) return ERR_IO;
+
+        const int ret = do_commit(imgfs_file);
+        if(ret == ERR_NONE) metrics_resize(resolution, metrics_now_ns() - start);
+        return ret;
     }
 
     return ERR_NONE;
@@ -127,4 +167,41 @@ int get_resolution(uint32_t *height, uint32_t *width,
 
     g_object_unref(VIPS_OBJECT(original));
     return ERR_NONE;
-}
\ No newline at end of file
+}
+
+int get_dhash(uint64_t* hash, const char* image_buffer, size_t image_size)
+{
+    M_REQUIRE_NON_NULL(hash);
+    M_REQUIRE_NON_NULL(image_buffer);
+
+    VipsImage* thumb = NULL;
+    VipsImage* grey = NULL;
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wcast-qual"
+    if(vips_thumbnail_buffer((void*) image_buffer, image_size, &thumb, DHASH_WIDTH,
+                             "height", DHASH_HEIGHT, "size", VIPS_SIZE_FORCE, NULL) == -1)
+        return ERR_IMGLIB;
+#pragma GCC diagnostic pop
+    if(vips_colourspace(thumb, &grey, VIPS_INTERPRETATION_B_W, NULL) == -1)
+        return error_handler_content(ERR_IMGLIB, NULL, NULL, thumb, grey);
+
+    const size_t bands = (size_t) vips_image_get_bands(grey);
+    const size_t width = (size_t) vips_image_get_width(grey);
+    size_t len = 0;
+    unsigned char* pixels = vips_image_write_to_memory(grey, &len);
+    if(pixels == NULL || width < DHASH_WIDTH || len < width * bands * DHASH_HEIGHT) {
+        g_free(pixels);
+        return error_handler_content(ERR_IMGLIB, NULL, NULL, thumb, grey);
+    }
+
+    // a bit set where the brightness decreases from left to right
+    uint64_t bits = 0;
+    for(size_t y = 0; y < DHASH_HEIGHT; ++y) {
+        const unsigned char* row = pixels + y * width * bands;
+        for(size_t x = 0; x + 1 < DHASH_WIDTH; ++x) bits = bits << 1 | (row[x * bands] > row[(x + 1) * bands]);
+    }
+    *hash = bits;
+
+    g_free(pixels);
+    return error_handler_content(ERR_NONE, NULL, NULL, thumb, grey);
+}
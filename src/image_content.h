@@ -26,9 +26,26 @@ extern "C" {
  */
 int get_resolution(uint32_t *height, uint32_t *width, const char *image_buffer, size_t image_size);
 
+/**
+ * @brief Computes the perceptual hash (dHash) of an image: libvips makes a
+ *        grey thumbnail of 9 x 8 pixels of it, each of the 64 bits tells
+ *        whether a pixel is brighter than its right neighbour. The hashes of
+ *        re-encoded or resized copies of an image differ in a few bits only.
+ *
+ * @param hash Where to put the hash.
+ * @param image_buffer The content of the image.
+ * @param image_size Its size.
+ * @return Some error code. 0 if no error.
+ */
+int get_dhash(uint64_t* hash, const char* image_buffer, size_t image_size);
+
 /**
  * @brief Calls the create_resized_img function and updates the metadata on the disk
  *
+ * The images sharing the content of the image (see imgfs_blobs.h) share
+ * its resized copy: it is taken from them if one already has it, and given
+ * to all of them once made.
+ *
  * @param resolution
  * @param imgfs_file The main in-memory structure
  * @param index The index of the image in the metadata array
@@ -1,35 +1,60 @@
-#include "imgfs.h"
-#include "image_dedup.h"
-
-#include <string.h>
-
-int do_name_and_content_dedup(struct imgfs_file* imgfs_file, uint32_t index)
-{
-    M_REQUIRE_NON_NULL(imgfs_file);
-    M_REQUIRE_NON_NULL(imgfs_file->metadata);
-
-    if(index >= imgfs_file->header.max_files || !imgfs_file->metadata[index].is_valid) return ERR_IMAGE_NOT_FOUND;
-
-    struct img_metadata image_to_find = imgfs_file->metadata[index];
-    int has_duplicate_content = 0;
-
-    for(size_t i = 0; i < imgfs_file->header.max_files; ++i) {
-        struct img_metadata current_image = imgfs_file->metadata[i];
-        if(i != index && current_image.is_valid) {
-            if(!strncmp(current_image.img_id, image_to_find.img_id, MAX_IMG_ID + 1)) {
-                return ERR_DUPLICATE_ID;
-            } else if(!strncmp(current_image.SHA, image_to_find.SHA, SHA256_DIGEST_LENGTH)) {
-                memcpy(image_to_find.offset, current_image.offset, 3 * sizeof(uint64_t));
-                memcpy(image_to_find.size, current_image.size, 3 * sizeof(uint32_t));
-
-                ++has_duplicate_content;
-            }
-        }
-    }
-
-    if (!has_duplicate_content) image_to_find.offset[ORIG_RES] = 0;
-
-    imgfs_file->metadata[index] = image_to_find;
-
-    return ERR_NONE;
+#include "imgfs.h"
+#include "image_dedup.h"
+#include "imgfs_index.h"
+#include "imgfs_blobs.h"
+
+#include <string.h>
+
+int do_name_and_content_dedup(struct imgfs_file* imgfs_file, uint32_t index)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->metadata);
+
+    if(index >= imgfs_file->header.max_files || !imgfs_file->metadata[index].is_valid) return ERR_IMAGE_NOT_FOUND;
+
+    struct img_metadata image_to_find = imgfs_file->metadata[index];
+    int has_duplicate_content = 0;
+
+    const struct imgfs_index* hot = &imgfs_file->index;
+    const uint32_t hash = imgfs_index_id_hash(image_to_find.img_id);
+    const uint64_t prefix = imgfs_index_sha_prefix(image_to_find.SHA);
+    const uint16_t fingerprint = image_to_find.fingerprint;
+    const uint32_t size = image_to_find.size[ORIG_RES];
+
+    // most images are new: when the filters tell so, the slots are not scanned
+    if(!imgfs_index_may_have_duplicate(hot, index, hash, fingerprint, size)) {
+        imgfs_file->metadata[index].offset[ORIG_RES] = 0;
+        return ERR_NONE;
+    }
+
+    // only the slots whose ID hash, or fingerprint (SHA prefix without fingerprint) and size match are compared on their metadata
+    for(uint32_t i = imgfs_index_next_valid(hot, 0); i < imgfs_file->header.max_files; i = imgfs_index_next_valid(hot, i + 1)) {
+        if(i == index) continue;
+
+        const int same_hash = hot->id_hash[i] == hash;
+        const int same_content = hot->orig_size[i] == size
+                                 && (fingerprint != 0 && hot->fingerprint[i] != 0 ? hot->fingerprint[i] == fingerprint
+                                     : hot->sha_prefix[i] == prefix);
+        if(!same_hash && !same_content) continue;
+
+        const struct img_metadata* current_image = &imgfs_file->metadata[i];
+        if(!current_image->is_valid) continue;
+
+        if(same_hash && !strncmp(current_image->img_id, image_to_find.img_id, MAX_IMG_ID + 1)) {
+            return ERR_DUPLICATE_ID;
+        } else if(same_content && !memcmp(current_image->SHA, image_to_find.SHA, SHA256_DIGEST_LENGTH)) {
+            memcpy(image_to_find.offset, current_image->offset, 3 * sizeof(uint64_t));
+            memcpy(image_to_find.size, current_image->size, 3 * sizeof(uint32_t));
+
+            ++has_duplicate_content;
+        }
+    }
+
+    // the duplicates may hold different copies of a resolution, resized before they shared their content
+    if (!has_duplicate_content) image_to_find.offset[ORIG_RES] = 0;
+    else blobs_adopt(imgfs_file->blobs, &image_to_find);
+
+    imgfs_file->metadata[index] = image_to_find;
+
+    return ERR_NONE;
 }
\ No newline at end of file
@@ -0,0 +1,327 @@
+/**
+ * @file image_similar.c
+ * @brief Perceptual near-duplicate search: BK-tree of the perceptual hashes
+ */
+
+#include "image_similar.h"
+#include "image_content.h"
+#include "imgfs_index.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// the initial number of nodes allocated for a tree
+#define SIMILAR_MIN_CAPACITY 64
+// the tree is rebuilt when it has more than twice as many nodes as valid images, plus this
+#define SIMILAR_MIN_REBUILD  64
+// the number of bits of a perceptual hash
+#define HASH_BITS            64
+
+/**
+ * @brief The slots found by a search, the closest first
+ */
+struct collector {
+    /*!The imgFS searched*/
+    const struct imgfs_file* imgfs_file;
+    /*!A slot not to collect (the image being inserted), max_files if none*/
+    uint32_t exclude;
+    /*!The maximal number of slots collected*/
+    size_t max_slots;
+    /*!The number of slots collected*/
+    size_t nb_slots;
+    /*!The slots collected*/
+    uint32_t slots[SIMILAR_MAX_MATCHES];
+    /*!Their distance to the searched hash*/
+    uint32_t distances[SIMILAR_MAX_MATCHES];
+};
+
+static uint32_t hamming(uint64_t a, uint64_t b)
+{
+    return (uint32_t) __builtin_popcountll(a ^ b);
+}
+
+uint64_t similar_get_hash(const struct img_metadata* metadata)
+{
+    return metadata == NULL ? 0 : (uint64_t) metadata->phash_high << 32 | metadata->phash_low;
+}
+
+void similar_set_hash(struct img_metadata* metadata, uint64_t hash)
+{
+    if(metadata == NULL) return;
+    metadata->phash_high = (uint32_t) (hash >> 32);
+    metadata->phash_low = (uint32_t) hash;
+}
+
+int similar_index_add(struct similar_index* index, uint32_t slot, uint64_t hash)
+{
+    M_REQUIRE_NON_NULL(index);
+
+    if(index->nb_nodes == index->capacity) {
+        const uint32_t capacity = index->capacity == 0 ? SIMILAR_MIN_CAPACITY : 2 * index->capacity;
+        struct similar_node* nodes = realloc(index->nodes, capacity * sizeof(struct similar_node));
+        if(nodes == NULL) return ERR_OUT_OF_MEMORY;
+        index->nodes = nodes;
+        index->capacity = capacity;
+    }
+
+    const uint32_t added = index->nb_nodes;
+    struct similar_node* nodes = index->nodes;
+    nodes[added].hash = hash;
+    nodes[added].slot = slot;
+    nodes[added].first_child = 0;
+    nodes[added].next_sibling = 0;
+    nodes[added].distance = 0;
+
+    // down the children at the same distance as the new hash, up to a node without one
+    uint32_t current = 0;
+    while(added > 0) {
+        const uint32_t distance = hamming(nodes[current].hash, hash);
+        uint32_t child = nodes[current].first_child;
+        while(child != 0 && nodes[child].distance != distance) child = nodes[child].next_sibling;
+
+        if(child == 0) {
+            nodes[added].distance = distance;
+            nodes[added].next_sibling = nodes[current].first_child;
+            nodes[current].first_child = added;
+            break;
+        }
+        current = child;
+    }
+
+    ++index->nb_nodes;
+    return ERR_NONE;
+}
+
+int similar_index_find(const struct similar_index* index, uint64_t hash, uint32_t max_distance,
+                       int (*visit)(void* context, uint32_t slot, uint64_t hash, uint32_t distance), void* context)
+{
+    M_REQUIRE_NON_NULL(index);
+    M_REQUIRE_NON_NULL(visit);
+
+    if(index->nb_nodes == 0) return ERR_NONE;
+
+    // every node is pushed at most once
+    uint32_t* stack = calloc(index->nb_nodes, sizeof(uint32_t));
+    if(stack == NULL) return ERR_OUT_OF_MEMORY;
+    size_t top = 0;
+    stack[top++] = 0;
+
+    int ret = ERR_NONE;
+    while(top > 0 && ret == ERR_NONE) {
+        const struct similar_node* node = &index->nodes[stack[--top]];
+        const uint32_t distance = hamming(node->hash, hash);
+        if(distance <= max_distance) ret = visit(context, node->slot, node->hash, distance);
+
+        // by the triangle inequality, a match below a child is within max_distance of distance from the node
+        const uint32_t low = distance > max_distance ? distance - max_distance : 0;
+        const uint32_t high = distance + max_distance;
+        for(uint32_t child = node->first_child; child != 0; child = index->nodes[child].next_sibling) {
+            if(low <= index->nodes[child].distance && index->nodes[child].distance <= high) stack[top++] = child;
+        }
+    }
+
+    free(stack);
+    return ret;
+}
+
+void similar_index_free(struct similar_index* index)
+{
+    if(index == NULL) return;
+    free(index->nodes);
+    free(index);
+}
+
+void similar_close(struct imgfs_file* imgfs_file)
+{
+    if(imgfs_file == NULL) return;
+    similar_index_free(imgfs_file->similar);
+    imgfs_file->similar = NULL;
+}
+
+int do_set_dedup(struct imgfs_file* imgfs_file, enum imgfs_dedup dedup, uint32_t max_distance)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    if(dedup < DEDUP_EXACT || dedup >= NB_DEDUP_MODES || max_distance > HASH_BITS) return ERR_INVALID_ARGUMENT;
+
+    imgfs_file->dedup = dedup;
+    imgfs_file->similar_distance = max_distance == 0 ? DEFAULT_SIMILAR_DISTANCE : max_distance;
+
+    return ERR_NONE;
+}
+
+/**
+ * @brief The perceptual hash of a valid slot: the stored one or, if none, the one computed from its content
+ * (then kept in the metadata in memory: it is written with the slot, if it ever is)
+ * @param slot (uint32_t) : the slot
+ * @param hash (uint64_t*) : where to put the hash
+ * @return (int) : some error code, ERR_NONE if no error
+*/
+static int slot_hash(struct imgfs_file* imgfs_file, uint32_t slot, uint64_t* hash)
+{
+    struct img_metadata* metadata = &imgfs_file->metadata[slot];
+    if((*hash = similar_get_hash(metadata)) != 0) return ERR_NONE;
+    if(metadata->size[ORIG_RES] == 0) return ERR_IMGLIB;
+
+    char* image = calloc(1UL, metadata->size[ORIG_RES]);
+    if(image == NULL) return ERR_OUT_OF_MEMORY;
+
+    int ret = ERR_NONE;
+    if(fseek(imgfs_file->file, (long) metadata->offset[ORIG_RES], SEEK_SET) == -1
+       || fread(image, metadata->size[ORIG_RES], 1UL, imgfs_file->file) != 1UL) ret = ERR_IO;
+    else if((ret = get_dhash(hash, image, metadata->size[ORIG_RES])) == ERR_NONE) similar_set_hash(metadata, *hash);
+
+    free(image);
+    return ret;
+}
+
+/**
+ * @brief Builds the index of the perceptual hashes of the valid slots if it is not built yet,
+ * or rebuilds it if the nodes of deleted images outnumber the others.
+ * The images libvips cannot decode are left out.
+ * @return (int) : some error code, ERR_NONE if no error
+*/
+static int build_index(struct imgfs_file* imgfs_file)
+{
+    const struct similar_index* built = imgfs_file->similar;
+    if(built != NULL && built->nb_nodes <= 2 * imgfs_file->header.nb_files + SIMILAR_MIN_REBUILD) return ERR_NONE;
+
+    similar_close(imgfs_file);
+    struct similar_index* index = calloc(1UL, sizeof(struct similar_index));
+    if(index == NULL) return ERR_OUT_OF_MEMORY;
+
+    const struct imgfs_index* hot = &imgfs_file->index;
+    for(uint32_t i = imgfs_index_next_valid(hot, 0); i < imgfs_file->header.max_files; i = imgfs_index_next_valid(hot, i + 1)) {
+        uint64_t hash = 0;
+        int ret = slot_hash(imgfs_file, i, &hash);
+        if(ret == ERR_IMGLIB) continue;
+        if(ret == ERR_NONE) ret = similar_index_add(index, i, hash);
+        if(ret != ERR_NONE) {
+            similar_index_free(index);
+            return ret;
+        }
+    }
+
+    imgfs_file->similar = index;
+    return ERR_NONE;
+}
+
+/**
+ * @brief Visitor of similar_index_find(): collects the slot of a node if it is still the one of a valid image
+ * with the same hash, keeping the closest ones
+*/
+static int collect(void* context, uint32_t slot, uint64_t hash, uint32_t distance)
+{
+    struct collector* found = context;
+    const struct imgfs_file* imgfs_file = found->imgfs_file;
+
+    if(slot == found->exclude || slot >= imgfs_file->header.max_files || !imgfs_file->metadata[slot].is_valid
+       || similar_get_hash(&imgfs_file->metadata[slot]) != hash) return ERR_NONE;
+    // a slot deleted then given the same hash again has two nodes
+    for(size_t i = 0; i < found->nb_slots; ++i) {
+        if(found->slots[i] == slot) return ERR_NONE;
+    }
+
+    size_t at = found->nb_slots;
+    if(at == found->max_slots) {
+        if(at == 0 || distance >= found->distances[at - 1]) return ERR_NONE;
+        --at;
+    } else ++found->nb_slots;
+
+    for(; at > 0 && found->distances[at - 1] > distance; --at) {
+        found->slots[at] = found->slots[at - 1];
+        found->distances[at] = found->distances[at - 1];
+    }
+    found->slots[at] = slot;
+    found->distances[at] = distance;
+    return ERR_NONE;
+}
+
+int do_perceptual_hash(struct imgfs_file* imgfs_file, const char* img_id, uint64_t* hash)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->file);
+    M_REQUIRE_NON_NULL(imgfs_file->metadata);
+    M_REQUIRE_NON_NULL(img_id);
+    M_REQUIRE_NON_NULL(hash);
+
+    uint32_t slot = 0;
+    const int ret = find_image(img_id, imgfs_file, &slot);
+    if(ret != ERR_NONE) return ret;
+
+    return slot_hash(imgfs_file, slot, hash);
+}
+
+int do_find_similar(struct imgfs_file* imgfs_file, uint64_t hash, uint32_t max_distance,
+                    struct similar_match* matches, size_t max_matches, size_t* nb_matches)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->file);
+    M_REQUIRE_NON_NULL(imgfs_file->metadata);
+    M_REQUIRE_NON_NULL(matches);
+    M_REQUIRE_NON_NULL(nb_matches);
+
+    *nb_matches = 0;
+    int ret = build_index(imgfs_file);
+    if(ret != ERR_NONE) return ret;
+
+    struct collector found;
+    zero_init_var(found);
+    found.imgfs_file = imgfs_file;
+    found.exclude = imgfs_file->header.max_files;
+    found.max_slots = MIN(max_matches, SIMILAR_MAX_MATCHES);
+
+    if((ret = similar_index_find(imgfs_file->similar, hash, max_distance, collect, &found)) != ERR_NONE) return ret;
+
+    for(size_t i = 0; i < found.nb_slots; ++i) {
+        memcpy(matches[i].img_id, imgfs_file->metadata[found.slots[i]].img_id, MAX_IMG_ID + 1);
+        matches[i].distance = found.distances[i];
+    }
+    *nb_matches = found.nb_slots;
+    return ERR_NONE;
+}
+
+int do_similar_dedup(struct imgfs_file* imgfs_file, uint32_t index, const char* image_buffer, size_t image_size)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->metadata);
+    M_REQUIRE_NON_NULL(image_buffer);
+
+    if(index >= imgfs_file->header.max_files) return ERR_INVALID_ARGUMENT;
+    if(imgfs_file->dedup != DEDUP_PERCEPTUAL && imgfs_file->similar == NULL) return ERR_NONE;
+
+    struct img_metadata* image = &imgfs_file->metadata[index];
+    uint64_t hash = 0;
+    int ret = ERR_NONE;
+    if((ret = get_dhash(&hash, image_buffer, image_size)) != ERR_NONE
+       || (ret = build_index(imgfs_file)) != ERR_NONE) return ret;
+    similar_set_hash(image, hash);
+
+    // an image with an exact duplicate already shares its content
+    if(imgfs_file->dedup == DEDUP_PERCEPTUAL && !image->offset[ORIG_RES]) {
+        struct collector found;
+        zero_init_var(found);
+        found.imgfs_file = imgfs_file;
+        found.exclude = index;
+        found.max_slots = 1;
+
+        ret = similar_index_find(imgfs_file->similar, hash, imgfs_file->similar_distance, collect, &found);
+        if(ret != ERR_NONE) return ret;
+
+        if(found.nb_slots > 0) {
+            const struct img_metadata* closest = &imgfs_file->metadata[found.slots[0]];
+            memcpy(image->SHA, closest->SHA, SHA256_DIGEST_LENGTH);
+            memcpy(image->orig_res, closest->orig_res, sizeof(image->orig_res));
+            memcpy(image->size, closest->size, sizeof(image->size));
+            memcpy(image->offset, closest->offset, sizeof(image->offset));
+            image->fingerprint = closest->fingerprint;
+            image->phash_high = closest->phash_high;
+            image->phash_low = closest->phash_low;
+        }
+    }
+
+    // should the insert fail, the node is skipped as the slot is not valid (or has another hash);
+    // without memory for it, the index is dropped, to be built again
+    if(similar_index_add(imgfs_file->similar, index, similar_get_hash(image)) != ERR_NONE) similar_close(imgfs_file);
+    return ERR_NONE;
+}
@@ -0,0 +1,159 @@
+/**
+ * @file image_similar.h
+ * @brief Perceptual near-duplicate search.
+ *
+ * Every image can get a perceptual hash (see get_dhash()), stored in the
+ * phash_high and phash_low fields of its metadata. The hashes of the valid
+ * images of an imgFS are kept in a BK-tree (struct similar_index), which
+ * finds the hashes within a Hamming distance of a given one without
+ * comparing them all: the children of a node are labelled by their distance
+ * to it and, by the triangle inequality, only those whose label is within
+ * the searched distance of the distance to the node can lead to a match.
+ *
+ * The index is built on first use (the images without a stored hash are
+ * then hashed from their content) and kept up to date by do_insert(); the
+ * nodes of deleted images are left in the tree, and skipped by checking
+ * the metadata, until the tree is rebuilt.
+ */
+
+#pragma once
+
+#include "imgfs.h" // for struct imgfs_file, struct img_metadata, MAX_IMG_ID
+
+#include <stddef.h> // for size_t
+#include <stdint.h> // for uint32_t, uint64_t
+
+// the maximal number of near-duplicates reported by do_find_similar()
+#define SIMILAR_MAX_MATCHES 64
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief A node of the BK-tree: the children of a node are chained from its
+ *        first child through their next sibling.
+ */
+struct similar_node {
+    /*!The perceptual hash*/
+    uint64_t hash;
+    /*!The slot of the image in the metadata array*/
+    uint32_t slot;
+    /*!The first child, 0 if none (the root is never a child)*/
+    uint32_t first_child;
+    /*!The next child of the parent, 0 if none*/
+    uint32_t next_sibling;
+    /*!The Hamming distance to the parent*/
+    uint32_t distance;
+};
+
+/**
+ * @brief The BK-tree of the perceptual hashes of an imgFS, rooted at its first node
+ */
+struct similar_index {
+    /*!The nodes, in the order of their insertion*/
+    struct similar_node* nodes;
+    /*!The number of nodes*/
+    uint32_t nb_nodes;
+    /*!The number of nodes allocated*/
+    uint32_t capacity;
+};
+
+/**
+ * @brief A near-duplicate found by do_find_similar()
+ */
+struct similar_match {
+    /*!The ID of the image*/
+    char img_id[MAX_IMG_ID + 1];
+    /*!The Hamming distance between its perceptual hash and the searched one*/
+    uint32_t distance;
+};
+
+/**
+ * @brief Returns the perceptual hash stored in a metadata, 0 if none.
+ */
+uint64_t similar_get_hash(const struct img_metadata* metadata);
+
+/**
+ * @brief Stores a perceptual hash in a metadata.
+ */
+void similar_set_hash(struct img_metadata* metadata, uint64_t hash);
+
+/**
+ * @brief Adds the hash of a slot to a BK-tree.
+ *
+ * @param index The tree
+ * @param slot The slot of the image
+ * @param hash Its perceptual hash
+ * @return Some error code. 0 if no error.
+ */
+int similar_index_add(struct similar_index* index, uint32_t slot, uint64_t hash);
+
+/**
+ * @brief Calls visit on every node of a BK-tree whose hash is within
+ *        max_distance of the given one, until it returns an error.
+ *
+ * @param index The tree
+ * @param hash The searched hash
+ * @param max_distance The maximal Hamming distance
+ * @param visit Called with context, then the slot, the hash and the distance of each node found
+ * @param context Passed to visit
+ * @return Some error code (the first one returned by visit). 0 if no error.
+ */
+int similar_index_find(const struct similar_index* index, uint64_t hash, uint32_t max_distance,
+                       int (*visit)(void* context, uint32_t slot, uint64_t hash, uint32_t distance), void* context);
+
+/**
+ * @brief Frees a BK-tree.
+ */
+void similar_index_free(struct similar_index* index);
+
+/**
+ * @brief Frees the index of the perceptual hashes of an imgFS, if any.
+ */
+void similar_close(struct imgfs_file* imgfs_file);
+
+/**
+ * @brief Gives the perceptual hash of an image, computed from its content
+ *        (and kept in memory) if it has none stored.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param img_id The ID of the image
+ * @param hash Where to put the hash
+ * @return Some error code. 0 if no error.
+ */
+int do_perceptual_hash(struct imgfs_file* imgfs_file, const char* img_id, uint64_t* hash);
+
+/**
+ * @brief Finds the valid images whose perceptual hash is within max_distance
+ *        of the given one, building the index first if need be.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param hash The searched hash
+ * @param max_distance The maximal Hamming distance
+ * @param matches Where to put the closest images found, by increasing distance
+ * @param max_matches The number of elements of matches
+ * @param nb_matches Set to the number of images put in matches
+ * @return Some error code. 0 if no error.
+ */
+int do_find_similar(struct imgfs_file* imgfs_file, uint64_t hash, uint32_t max_distance,
+                    struct similar_match* matches, size_t max_matches, size_t* nb_matches);
+
+/**
+ * @brief Perceptual deduplication of an image being inserted, after its
+ *        exact deduplication: hashes it and adds it to the index (if the
+ *        index is built or the mode is DEDUP_PERCEPTUAL) then, in mode
+ *        DEDUP_PERCEPTUAL and if it has no exact duplicate, gives it the
+ *        content of the closest image within the distance of the imgFS, if any.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param index The slot of the image in the metadata array
+ * @param image_buffer Its content
+ * @param image_size Its size
+ * @return Some error code. 0 if no error.
+ */
+int do_similar_dedup(struct imgfs_file* imgfs_file, uint32_t index, const char* image_buffer, size_t image_size);
+
+#ifdef __cplusplus
+}
+#endif
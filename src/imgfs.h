@@ -40,6 +40,16 @@
 #define ORIG_RES  2
 #define NB_RES    3
 
+// Max. number of extensions of the metadata table (see do_grow())
+#define MAX_EXTENSIONS 32
+
+// Defaults for the durability policies (see enum imgfs_durability)
+#define DEFAULT_SYNC_INTERVAL_MS 1000
+#define DEFAULT_SYNC_GROUP_SIZE    32
+
+// Default maximal Hamming distance between the perceptual hashes of near-duplicates (see enum imgfs_dedup)
+#define DEFAULT_SIMILAR_DISTANCE 6
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -66,12 +76,40 @@ struct imgfs_header {
     /*!The array containing all the resolutions of the thumbnail and the small image resolution stored in the following order :
     thumbnail width, thumbnail height, small width, small height */
     uint16_t resized_res[2 * (NB_RES - 1)];
-    /*! Unused variable stored on 32 bits (intended for future evolution)*/
+    /*! Once the imgFS has grown: the number of slots of the metadata table following the header, 0 otherwise*/
     uint32_t unused_32;
-    /*! Unused variable, stored on 64 bit (intended for future evolutions) */
+    /*! Once the imgFS has grown: the offset of the first extension of the metadata table, 0 otherwise*/
     uint64_t unused_64;
 };
 
+/**
+* @struct imgfs_extension : The header of an extension of the metadata table
+* @brief do_grow() appends the new slots at the end of the file: this header immediately followed by nb_slots
+* img_metadata. The extensions are chained from the unused_64 field of the imgfs_header; the slots of the
+* metadata table following the header and of all the extensions add up to max_files.
+*/
+struct imgfs_extension {
+    /*!The offset of the next extension in the file, 0 for the last one*/
+    uint64_t next;
+    /*!The number of metadata slots of this extension*/
+    uint32_t nb_slots;
+    /*!Unused space stored on 32 bits*/
+    uint32_t unused_32;
+};
+
+/**
+* @struct extension_region : Where an extension of the metadata table lies in the file
+* @brief In memory only: the metadata array stays contiguous, this maps its slots back to the file.
+*/
+struct extension_region {
+    /*!The index of the first slot of the extension in the metadata array*/
+    uint32_t first_slot;
+    /*!The number of slots of the extension*/
+    uint32_t nb_slots;
+    /*!The offset of the first slot of the extension in the file*/
+    uint64_t offset;
+};
+
 /**
 * @struct img_metadata : The metadata of the current image
 * @brief The metadata of the image like its ID, its SHA, its vailidity (can it be overwritten because unvalid ot not), its original size, ...
@@ -85,12 +123,78 @@ struct img_metadata {
     uint32_t orig_res[ORIG_RES];
     /*!The size of the image at different resolutions (thumbnail, small, original)*/
     uint32_t size[NB_RES];
+    /*!The high half of the perceptual hash of the image (see image_similar.h), in what was padding*/
+    uint32_t phash_high;
     /*!The position of the image in the database*/
     uint64_t offset[NB_RES];
     /*!An indicator of the vailidity pf the image*/
     uint16_t is_valid;
-    /*!For now, unused space stored on 16 bits*/
-    uint16_t unused_16;
+    /*!A cheap hash of the size and of the first and last bytes of the image (see imgfs_index_fingerprint()),
+    0 if the image was inserted without one*/
+    uint16_t fingerprint;
+    /*!The low half of the perceptual hash of the image, in what was padding*/
+    uint32_t phash_low;
+};
+
+/**
+ * @brief Durability policies applied after each write operation
+ * (do_insert, do_delete and lazily_resize).
+ */
+enum imgfs_durability {
+    /*!Never sync explicitly: stdio and the page cache decide when to flush*/
+    DURABILITY_NONE,
+    /*!Sync once sync_param milliseconds elapsed since the last sync: on a write operation,
+    or between them on the call of do_sync_due() by the owner of the file (e.g. a timer)*/
+    DURABILITY_PERIODIC,
+    /*!Sync after every single write operation*/
+    DURABILITY_PER_OP,
+    /*!Sync once every sync_param write operations*/
+    DURABILITY_GROUP_COMMIT,
+    NB_DURABILITY_MODES
+};
+
+/**
+ * @brief Deduplication modes of do_insert()
+ */
+enum imgfs_dedup {
+    /*!Only the images of identical content share their data*/
+    DEDUP_EXACT,
+    /*!An image whose perceptual hash is close enough to the one of an image already stored
+    takes the content of the latter instead of being stored again*/
+    DEDUP_PERCEPTUAL,
+    NB_DEDUP_MODES
+};
+
+struct similar_index; // see image_similar.h
+struct blob_table;    // see imgfs_blobs.h
+
+/**
+* @struct imgfs_index : Structure-of-arrays copy of the fields of the metadata read by the scans
+* @brief Built from the metadata array by do_open() and kept up to date by write_metadata(), so that listing,
+* lookups by ID, deduplication and the search of an empty slot touch a few bytes per slot instead of a whole
+* img_metadata. The arrays live in the same allocation as the metadata array (see imgfs_index.h).
+*/
+struct imgfs_index {
+    /*!The number of slots of the index, max_files of the imgFS*/
+    uint32_t nb_slots;
+    /*!One bit per slot, set when the slot holds a valid image*/
+    uint64_t* valid;
+    /*!The first 8 bytes of the SHA of each slot*/
+    uint64_t* sha_prefix;
+    /*!The hash of the ID of each slot (see imgfs_index_id_hash())*/
+    uint32_t* id_hash;
+    /*!The size of the original image of each slot*/
+    uint32_t* orig_size;
+    /*!The fingerprint of each slot*/
+    uint16_t* fingerprint;
+    /*!The number of buckets of the counting filters minus one (their number is a power of two)*/
+    uint32_t filter_mask;
+    /*!The number of valid slots per bucket of their ID hash*/
+    uint32_t* id_count;
+    /*!The number of valid slots per bucket of their fingerprint and size (the slots with a fingerprint)*/
+    uint32_t* content_count;
+    /*!The number of valid slots without fingerprint*/
+    uint32_t nb_unfingerprinted;
 };
 
 /**
@@ -105,6 +209,28 @@ struct imgfs_file {
     struct imgfs_header header;
     /*!The array containing all the metadata of the different stored images*/
     struct img_metadata* metadata;
+    /*!The durability policy honored by the write operations*/
+    enum imgfs_durability durability;
+    /*!The parameter of the policy: interval in ms (PERIODIC) or group size (GROUP_COMMIT)*/
+    uint32_t sync_param;
+    /*!The number of write operations done since the last sync*/
+    uint32_t pending_ops;
+    /*!The time of the last sync, in ms of the monotonic clock*/
+    uint64_t last_sync_ms;
+    /*!The number of extensions of the metadata table*/
+    uint32_t nb_extensions;
+    /*!The extensions of the metadata table, in the order of the metadata array*/
+    struct extension_region extensions[MAX_EXTENSIONS];
+    /*!The hot fields of the metadata array*/
+    struct imgfs_index index;
+    /*!The deduplication mode of do_insert()*/
+    enum imgfs_dedup dedup;
+    /*!The maximal Hamming distance between the perceptual hashes of near-duplicates (DEDUP_PERCEPTUAL)*/
+    uint32_t similar_distance;
+    /*!The index of the perceptual hashes, built on first use, NULL before*/
+    struct similar_index* similar;
+    /*!The distinct contents and the slots sharing them, kept up to date by write_metadata()*/
+    struct blob_table* blobs;
 };
 
 
@@ -136,10 +262,95 @@ int do_open(const char* imgfs_filename,
 /**
  * @brief Do some clean-up for imgFS file handling.
  *
+ * Pending write operations are synced first unless the durability
+ * policy is DURABILITY_NONE.
+ *
  * @param imgfs_file Structure for header, metadata and file pointer to be freed/closed.
  */
 void do_close(struct imgfs_file* imgfs_file);
 
+/**
+ * @brief Returns the offset in the imgFS file of the metadata of the given slot.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param index The order number of the slot in the metadata array
+ * @return The offset of the slot.
+ */
+uint64_t metadata_offset(const struct imgfs_file* imgfs_file, uint32_t index);
+
+/**
+ * @brief Writes the metadata of the given slot to the imgFS file and updates
+ *        the index accordingly.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param index The order number of the slot in the metadata array
+ * @param metadata The metadata to write (not necessarily imgfs_file->metadata[index])
+ * @return Some error code. 0 if no error.
+ */
+int write_metadata(struct imgfs_file* imgfs_file, uint32_t index,
+                   const struct img_metadata* metadata);
+
+/**
+ * @brief Sets the durability policy of an opened imgFS.
+ *
+ * do_open() and do_create() reset the policy to DURABILITY_NONE.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param durability The policy to apply after each write operation
+ * @param sync_param Interval in ms for DURABILITY_PERIODIC, number of
+ *        operations per sync for DURABILITY_GROUP_COMMIT, ignored otherwise.
+ *        0 selects the default value.
+ * @return Some error code. 0 if no error.
+ */
+int do_set_durability(struct imgfs_file* imgfs_file,
+                      enum imgfs_durability durability, uint32_t sync_param);
+
+/**
+ * @brief Sets the deduplication mode of do_insert() on an opened imgFS.
+ *
+ * do_open() and do_create() reset the mode to DEDUP_EXACT.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param dedup The mode
+ * @param max_distance The maximal Hamming distance (at most 64) between the
+ *        perceptual hashes of near-duplicates for DEDUP_PERCEPTUAL, ignored
+ *        otherwise. 0 selects the default value.
+ * @return Some error code. 0 if no error.
+ */
+int do_set_dedup(struct imgfs_file* imgfs_file, enum imgfs_dedup dedup, uint32_t max_distance);
+
+/**
+ * @brief Flushes the stdio buffers and forces the content of the imgFS
+ *        file to the disk (fdatasync), whatever the durability policy.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @return Some error code. 0 if no error.
+ */
+int do_sync(struct imgfs_file* imgfs_file);
+
+/**
+ * @brief Syncs the imgFS file if its policy is DURABILITY_PERIODIC, write
+ *        operations are pending and the interval elapsed since the last
+ *        sync; does nothing otherwise.
+ *
+ * do_commit() only checks the interval on a write operation: the owner of
+ * the file calls this function regularly so that the last writes before a
+ * pause are not left unsynced.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @return Some error code. 0 if no error.
+ */
+int do_sync_due(struct imgfs_file* imgfs_file);
+
+/**
+ * @brief Marks the end of a write operation and syncs the imgFS file
+ *        if the durability policy requires it.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @return Some error code. 0 if no error.
+ */
+int do_commit(struct imgfs_file* imgfs_file);
+
 /**
  * @brief List of possible output modes for do_list()
  *
@@ -163,6 +374,95 @@ enum do_list_mode {
 int do_list(const struct imgfs_file* imgfs_file,
             enum do_list_mode output_mode, char** json);
 
+/**
+ * @brief Same as do_list() for an array of imgFS: STDOUT mode displays them
+ *        one after the other, JSON mode gathers all their images in one list.
+ *
+ * @param imgfs_files Array of in memory structures with header and metadata.
+ * @param nb_files Number of elements of imgfs_files.
+ * @param output_mode What style to use for displaying infos.
+ * @param json See do_list().
+ * @return some error code.
+ */
+int do_list_multiple(const struct imgfs_file* imgfs_files, size_t nb_files,
+                     enum do_list_mode output_mode, char** json);
+
+struct json_writer; // see json_writer.h
+
+/*
+ * The fields of an image listed besides its ID (see struct list_options)
+ */
+#define LIST_FIELD_ORIG_RES    0x1 // the resolution of the original image
+#define LIST_FIELD_SIZE        0x2 // the size of the image at every resolution, 0 if not materialized
+#define LIST_FIELD_RESOLUTIONS 0x4 // the names of the materialized resolutions
+#define LIST_FIELDS_ALL        (LIST_FIELD_ORIG_RES | LIST_FIELD_SIZE | LIST_FIELD_RESOLUTIONS)
+
+/**
+ * @brief What a JSON listing contains
+ */
+struct list_options {
+    /*!The fields listed besides the IDs (LIST_FIELD_*); 0 lists the IDs alone, as strings*/
+    unsigned int fields;
+    /*!Only the images whose ID starts with this prefix are listed*/
+    char prefix[MAX_IMG_ID + 1];
+    /*!Only the images whose original size is at least min_size...*/
+    uint32_t min_size;
+    /*!...and at most max_size are listed*/
+    uint32_t max_size;
+};
+
+/**
+ * @brief Sets the options of a listing of all the images, by ID only.
+ */
+void list_options_init(struct list_options* options);
+
+/**
+ * @brief Whether an image passes the filters of the options.
+ */
+int list_options_match(const struct list_options* options, const struct img_metadata* metadata);
+
+/**
+ * @brief Writes an image as an element of a JSON listing: its ID, or an
+ *        object with its ID and the requested fields.
+ *
+ * @param writer The JSON writer.
+ * @param metadata The metadata of the image.
+ * @param fields The fields listed besides the ID (LIST_FIELD_*).
+ * @return some error code.
+ */
+int do_list_entry_json(struct json_writer* writer, const struct img_metadata* metadata,
+                       unsigned int fields);
+
+/**
+ * @brief Writes the JSON list of do_list_multiple() with a given writer,
+ *        e.g. to reuse its buffer from a listing to the next one.
+ *
+ * @param imgfs_files Array of in memory structures with header and metadata.
+ * @param nb_files Number of elements of imgfs_files.
+ * @param options What the listing contains, NULL for the IDs of all the images.
+ * @param writer The JSON writer.
+ * @return some error code.
+ */
+int do_list_json(const struct imgfs_file* imgfs_files, size_t nb_files,
+                 const struct list_options* options, struct json_writer* writer);
+
+/**
+ * @brief Copies the metadata of (at most) max_images valid images passing
+ *        the filters of the options, starting at a given slot, so that a long
+ *        listing can be done by pages.
+ *
+ * @param imgfs_file In memory structure with header and metadata.
+ * @param options The filters, NULL for none.
+ * @param cursor The first slot to look at; set to the slot following the
+ *      last copied image, or to header.max_files once all the slots are seen.
+ * @param max_images Number of elements of images.
+ * @param images Where to copy the metadata.
+ * @param nb_images Set to the number of images copied.
+ * @return some error code.
+ */
+int do_list_page(const struct imgfs_file* imgfs_file, const struct list_options* options,
+                 uint32_t* cursor, size_t max_images, struct img_metadata* images, size_t* nb_images);
+
 /**
  * @brief Creates the imgFS called imgfs_filename. Writes the header and the
  *        preallocated empty metadata array to imgFS file.
@@ -178,7 +478,8 @@ int do_create(const char* imgfs_filename, struct imgfs_file* imgfs_file);
  * Effectively, it only invalidates the is_valid field and updates the
  * metadata.  The raw data content is not erased, it stays where it
  * was (and  new content is always appended to the end; no garbage
- * collection).
+ * collection). Once no other image shares it, it counts as reclaimable
+ * (see do_space()).
  *
  * @param img_id The ID of the image to be deleted.
  * @param imgfs_file The main in-memory data structure
@@ -186,6 +487,16 @@ int do_create(const char* imgfs_filename, struct imgfs_file* imgfs_file);
  */
 int do_delete(const char* img_id, struct imgfs_file* imgfs_file);
 
+/**
+ * @brief Looks for a valid image by its ID.
+ *
+ * @param img_id The ID of the image to look for.
+ * @param imgfs_file The main in-memory data structure
+ * @param index Where to store the order number of the image in the metadata array
+ * @return ERR_NONE if found, ERR_IMAGE_NOT_FOUND otherwise.
+ */
+int find_image(const char* img_id, const struct imgfs_file* imgfs_file, uint32_t* index);
+
 /**
  * @brief Transforms resolution string to its int value.
  *
@@ -208,6 +519,35 @@ int resolution_atoi(const char* resolution);
 int do_read(const char* img_id, int resolution, char** image_buffer,
             uint32_t* image_size, struct imgfs_file* imgfs_file);
 
+/**
+ * @brief Reads a span of bytes of an image from a imgFS, only this span
+ *        being read from the file.
+ *
+ * @param img_id The ID of the image to be read.
+ * @param resolution The desired resolution for the image read.
+ * @param first The offset of the first byte to read, negative to count from
+ *      the end of the image (-n for the n last bytes); set to the actual offset.
+ * @param len The number of bytes to read, cut at the end of the image;
+ *      set to the number of bytes read.
+ * @param image_buffer Location of the location of the bytes read
+ * @param image_size Location of the (whole) image size variable, set even
+ *      if the range is not satisfiable
+ * @param imgfs_file The main in-memory data structure
+ * @return Some error code, ERR_RANGE if the span is out of the image. 0 if no error.
+ */
+int do_read_range(const char* img_id, int resolution, int64_t* first, uint32_t* len,
+                  char** image_buffer, uint32_t* image_size, struct imgfs_file* imgfs_file);
+
+/**
+ * @brief Copies the metadata of an image, without reading nor resizing it.
+ *
+ * @param img_id The ID of the image
+ * @param metadata Where to copy the metadata
+ * @param imgfs_file The main in-memory data structure
+ * @return Some error code. 0 if no error.
+ */
+int do_stat(const char* img_id, struct img_metadata* metadata, const struct imgfs_file* imgfs_file);
+
 /**
  * @brief Insert image in the imgFS file
  *
@@ -219,6 +559,42 @@ int do_read(const char* img_id, int resolution, char** image_buffer,
 int do_insert(const char* image_buffer, size_t image_size,
               const char* img_id, struct imgfs_file* imgfs_file);
 
+/**
+ * @brief Same as do_insert() for an image whose SHA-256 is already computed
+ *        (e.g. before locking the imgFS, or with others by sha256_many()).
+ *
+ * @param sha The SHA-256 of the image content
+ */
+int do_insert_hashed(const char* image_buffer, size_t image_size, const unsigned char* sha,
+                     const char* img_id, struct imgfs_file* imgfs_file);
+
+/**
+ * @brief Grows the metadata table of an opened imgFS to new_max_files slots.
+ *
+ * The new slots are appended at the end of the file as an extension
+ * (see struct imgfs_extension), then linked to the existing table and
+ * the header is updated: the image data is not moved, so growing costs
+ * O(new_max_files - max_files).
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param new_max_files The new maximal number of files, greater than the current one
+ * @return Some error code. 0 if no error.
+ */
+int do_grow(struct imgfs_file* imgfs_file, uint32_t new_max_files);
+
+/**
+ * @brief Writes a copy of an imgFS in the compact on-disk format 2 (see
+ *        imgfs_format.h): the metadata table, followed by the IDs of the
+ *        valid images and their contents. Deleted images are dropped, the
+ *        duplicates share a single copy of each resolution and the
+ *        extensions of the metadata table are merged.
+ *
+ * @param imgfs_path The path to the imgFS file to convert (format 1 or 2)
+ * @param new_imgfs_path The path to the imgFS file to create
+ * @return Some error code. 0 if no error.
+ */
+int do_convert(const char* imgfs_path, const char* new_imgfs_path);
+
 /**
  * @brief Removes the deleted images by moving the existing ones
  *
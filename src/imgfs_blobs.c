@@ -0,0 +1,253 @@
+/**
+ * @file imgfs_blobs.c
+ * @brief Reference-counted table of the contents of an imgFS
+ */
+
+#include "imgfs_blobs.h"
+#include "imgfs_format.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief The bucket of a SHA: its first bytes, the SHA being uniformly distributed
+ */
+static uint32_t bucket_of(const struct blob_table* table, const unsigned char* SHA)
+{
+    uint32_t prefix = 0;
+    memcpy(&prefix, SHA, sizeof(prefix));
+    return prefix & table->mask;
+}
+
+static uint64_t blob_bytes(const struct blob* blob)
+{
+    uint64_t bytes = 0;
+    for(int res = 0; res < NB_RES; ++res) {
+        if(blob->offset[res] != 0) bytes += blob->size[res];
+    }
+    return bytes;
+}
+
+static uint32_t lookup(const struct blob_table* table, const unsigned char* SHA)
+{
+    for(uint32_t b = table->buckets[bucket_of(table, SHA)]; b != NO_BLOB; b = table->blobs[b].next) {
+        if(!memcmp(table->blobs[b].SHA, SHA, SHA256_DIGEST_LENGTH)) return b;
+    }
+    return NO_BLOB;
+}
+
+/**
+ * @brief Drops a reference to a blob, and the blob with its last reference
+ * @param table (struct blob_table*) : the table
+ * @param b (uint32_t) : the blob
+ */
+static void release(struct blob_table* table, uint32_t b)
+{
+    struct blob* blob = &table->blobs[b];
+    if(--blob->refcount > 0) return;
+
+    uint32_t* link = &table->buckets[bucket_of(table, blob->SHA)];
+    while(*link != b) link = &table->blobs[*link].next;
+    *link = blob->next;
+
+    table->live_bytes -= blob_bytes(blob);
+    --table->nb_blobs;
+    zero_init_ptr(blob);
+    blob->next = table->free_head;
+    table->free_head = b;
+}
+
+/**
+ * @brief Removes a slot from the chain of the slots of a blob
+ */
+static void unlink_slot(struct blob_table* table, uint32_t b, uint32_t slot)
+{
+    uint32_t* link = &table->blobs[b].first_slot;
+    while(*link != slot) link = &table->next_slot[*link];
+    *link = table->next_slot[slot];
+    table->next_slot[slot] = NO_SLOT;
+}
+
+static void link_slot(struct blob_table* table, uint32_t b, uint32_t slot)
+{
+    table->next_slot[slot] = table->blobs[b].first_slot;
+    table->blobs[b].first_slot = slot;
+}
+
+/**
+ * @brief Adds a reference to the blob of a metadata, created if need be
+ * @param table (struct blob_table*) : the table
+ * @param metadata (const struct img_metadata*) : the metadata of a valid slot
+ * @return (uint32_t) : the blob, NO_BLOB if the table is full (cannot happen, see blobs_build())
+ */
+static uint32_t acquire(struct blob_table* table, const struct img_metadata* metadata)
+{
+    uint32_t b = lookup(table, metadata->SHA);
+    if(b == NO_BLOB) {
+        if((b = table->free_head) == NO_BLOB) return NO_BLOB;
+
+        struct blob* blob = &table->blobs[b];
+        table->free_head = blob->next;
+        memcpy(blob->SHA, metadata->SHA, SHA256_DIGEST_LENGTH);
+        blob->first_slot = NO_SLOT;
+        uint32_t* bucket = &table->buckets[bucket_of(table, metadata->SHA)];
+        blob->next = *bucket;
+        *bucket = b;
+        ++table->nb_blobs;
+    }
+
+    // the first copy of a resolution becomes the one of the blob
+    struct blob* blob = &table->blobs[b];
+    for(int res = 0; res < NB_RES; ++res) {
+        if(blob->offset[res] == 0 && metadata->offset[res] != 0 && metadata->size[res] != 0) {
+            blob->offset[res] = metadata->offset[res];
+            blob->size[res] = metadata->size[res];
+            table->live_bytes += blob->size[res];
+        }
+    }
+    ++blob->refcount;
+    return b;
+}
+
+struct blob_table* blobs_build(uint32_t nb_slots, const struct img_metadata* metadata)
+{
+    if(metadata == NULL && nb_slots > 0) return NULL;
+
+    struct blob_table* table = calloc(1UL, sizeof(struct blob_table));
+    if(table == NULL) return NULL;
+
+    size_t nb_buckets = 1;
+    while(nb_buckets < nb_slots) nb_buckets *= 2;
+
+    table->nb_slots = nb_slots;
+    table->mask = (uint32_t) (nb_buckets - 1);
+    // one blob per slot, plus the one of a slot rewritten with another content (see blobs_set())
+    table->blobs = calloc(nb_slots + 1UL, sizeof(struct blob));
+    table->buckets = malloc(nb_buckets * sizeof(uint32_t));
+    table->slot_blob = malloc(MAX(nb_slots, 1U) * sizeof(uint32_t));
+    table->next_slot = malloc(MAX(nb_slots, 1U) * sizeof(uint32_t));
+    if(table->blobs == NULL || table->buckets == NULL || table->slot_blob == NULL || table->next_slot == NULL) {
+        blobs_free(table);
+        return NULL;
+    }
+
+    for(size_t i = 0; i < nb_buckets; ++i) table->buckets[i] = NO_BLOB;
+    for(uint32_t i = 0; i < nb_slots; ++i) {
+        table->blobs[i].next = i + 1;
+        table->slot_blob[i] = NO_BLOB;
+        table->next_slot[i] = NO_SLOT;
+    }
+    table->blobs[nb_slots].next = NO_BLOB;
+    table->free_head = 0;
+
+    for(uint32_t i = 0; i < nb_slots; ++i) {
+        if(!metadata[i].is_valid) continue;
+        const uint32_t b = acquire(table, &metadata[i]);
+        table->slot_blob[i] = b;
+        if(b != NO_BLOB) link_slot(table, b, i);
+    }
+
+    return table;
+}
+
+void blobs_free(struct blob_table* table)
+{
+    if(table == NULL) return;
+    free(table->blobs);
+    free(table->buckets);
+    free(table->slot_blob);
+    free(table->next_slot);
+    free(table);
+}
+
+void blobs_set(struct blob_table* table, uint32_t slot, const struct img_metadata* metadata)
+{
+    if(table == NULL || metadata == NULL || slot >= table->nb_slots) return;
+
+    // acquired first: a slot rewritten with the same content keeps its blob alive
+    const uint32_t previous = table->slot_blob[slot];
+    const uint32_t b = metadata->is_valid ? acquire(table, metadata) : NO_BLOB;
+    table->slot_blob[slot] = b;
+    if(b != previous) {
+        if(previous != NO_BLOB) unlink_slot(table, previous, slot);
+        if(b != NO_BLOB) link_slot(table, b, slot);
+    }
+    if(previous != NO_BLOB) release(table, previous);
+}
+
+const struct blob* blobs_find(const struct blob_table* table, const unsigned char* SHA)
+{
+    if(table == NULL || SHA == NULL) return NULL;
+
+    const uint32_t b = lookup(table, SHA);
+    return b == NO_BLOB ? NULL : &table->blobs[b];
+}
+
+uint32_t blobs_first_slot(const struct blob_table* table, const unsigned char* SHA)
+{
+    const struct blob* blob = blobs_find(table, SHA);
+    return blob == NULL ? NO_SLOT : blob->first_slot;
+}
+
+uint32_t blobs_next_slot(const struct blob_table* table, uint32_t slot)
+{
+    if(table == NULL || slot >= table->nb_slots) return NO_SLOT;
+    return table->next_slot[slot];
+}
+
+int blobs_adopt(const struct blob_table* table, struct img_metadata* metadata)
+{
+    if(metadata == NULL) return 0;
+
+    const struct blob* blob = blobs_find(table, metadata->SHA);
+    if(blob == NULL) return 0;
+
+    int changed = 0;
+    for(int res = 0; res < NB_RES; ++res) {
+        if(blob->offset[res] != 0 && metadata->offset[res] != blob->offset[res]) {
+            metadata->offset[res] = blob->offset[res];
+            metadata->size[res] = blob->size[res];
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+int do_space(struct imgfs_file* imgfs_file, struct imgfs_space* space)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->file);
+    M_REQUIRE_NON_NULL(imgfs_file->metadata);
+    M_REQUIRE_NON_NULL(space);
+
+    zero_init_ptr(space);
+
+    // a table built for the occasion if the imgFS has none (e.g. not opened by do_open())
+    struct blob_table* table = imgfs_file->blobs;
+    if(table == NULL && (table = blobs_build(imgfs_file->header.max_files, imgfs_file->metadata)) == NULL)
+        return ERR_OUT_OF_MEMORY;
+    space->nb_contents = table->nb_blobs;
+    space->live_bytes = table->live_bytes;
+    if(table != imgfs_file->blobs) blobs_free(table);
+
+    if(fseek(imgfs_file->file, 0, SEEK_END) == -1) return ERR_IO;
+    const long end = ftell(imgfs_file->file);
+    if(end == -1) return ERR_IO;
+    space->file_bytes = (uint64_t) end;
+
+    space->table_bytes = sizeof(struct imgfs_header)
+                         + 1UL * imgfs_file->header.max_files * metadata_record_size(&imgfs_file->header)
+                         + 1UL * imgfs_file->nb_extensions * sizeof(struct imgfs_extension);
+    const int with_ids = imgfs_format(&imgfs_file->header) == IMGFS_FORMAT_V2;
+    for(uint32_t i = 0; i < imgfs_file->header.max_files; ++i) {
+        if(!imgfs_file->metadata[i].is_valid) continue;
+        ++space->nb_images;
+        if(with_ids) space->table_bytes += strnlen(imgfs_file->metadata[i].img_id, MAX_IMG_ID + 1);
+    }
+
+    const uint64_t used = space->table_bytes + space->live_bytes;
+    space->reclaimable_bytes = space->file_bytes > used ? space->file_bytes - used : 0;
+
+    return ERR_NONE;
+}
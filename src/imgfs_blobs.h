@@ -0,0 +1,161 @@
+/**
+ * @file imgfs_blobs.h
+ * @brief Reference-counted table of the contents of an imgFS.
+ *
+ * Deduplication makes several slots share the bytes of the same content.
+ * The blob table records this sharing: one blob per distinct SHA among the
+ * valid slots, with the number of slots referencing it and the offsets and
+ * sizes of its original and of its derivatives (the resized images). The
+ * first materialized copy of a resolution becomes the one of the blob, so
+ * that a resize is done once per content whatever the slot it is read from
+ * (see lazily_resize()); copies made before, by slots that did not know of
+ * each other, are redundant and counted as reclaimable.
+ *
+ * The slots referencing a blob are chained from it, so that a resolution
+ * materialized for one of them is given to all the others at once.
+ *
+ * Like the index (see imgfs_index.h), the table is built by do_open() and
+ * kept up to date by write_metadata(); it is in memory only.
+ */
+
+#pragma once
+
+#include "imgfs.h"
+
+#include <openssl/sha.h> // for SHA256_DIGEST_LENGTH
+#include <stdint.h>      // for uint32_t, uint64_t
+
+// the blob of a slot that references none
+#define NO_BLOB UINT32_MAX
+// the end of a chain of slots
+#define NO_SLOT UINT32_MAX
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief A distinct content of the imgFS
+ */
+struct blob {
+    /*!The SHA of the content*/
+    unsigned char SHA[SHA256_DIGEST_LENGTH];
+    /*!The number of valid slots referencing the blob, 0 for a free entry*/
+    uint32_t refcount;
+    /*!The next blob of the same bucket, or of the free list, NO_BLOB if none*/
+    uint32_t next;
+    /*!The first slot referencing the blob, the others following through next_slot of the table*/
+    uint32_t first_slot;
+    /*!The size of the content at each resolution, 0 if not materialized*/
+    uint32_t size[NB_RES];
+    /*!The offset of the content at each resolution, 0 if not materialized*/
+    uint64_t offset[NB_RES];
+};
+
+/**
+ * @brief The blobs of an imgFS, hashed by SHA
+ */
+struct blob_table {
+    /*!The number of slots of the imgFS; there cannot be more blobs*/
+    uint32_t nb_slots;
+    /*!The entries: one per slot at most, the free ones chained from free_head*/
+    struct blob* blobs;
+    /*!The first blob of each bucket, NO_BLOB if none*/
+    uint32_t* buckets;
+    /*!The number of buckets minus one (their number is a power of two)*/
+    uint32_t mask;
+    /*!The first free entry, NO_BLOB if none*/
+    uint32_t free_head;
+    /*!The blob referenced by each slot, NO_BLOB if none*/
+    uint32_t* slot_blob;
+    /*!The next slot referencing the same blob as each slot, NO_SLOT if none*/
+    uint32_t* next_slot;
+    /*!The number of blobs*/
+    uint32_t nb_blobs;
+    /*!The bytes of the blobs at all their resolutions*/
+    uint64_t live_bytes;
+};
+
+/**
+ * @brief How the data of an imgFS file is used (see do_space())
+ */
+struct imgfs_space {
+    /*!The number of valid images*/
+    uint32_t nb_images;
+    /*!The number of distinct contents among them*/
+    uint32_t nb_contents;
+    /*!The size of the file*/
+    uint64_t file_bytes;
+    /*!The bytes of the metadata table, of its extensions and of the IDs of the valid images (format 2)*/
+    uint64_t table_bytes;
+    /*!The bytes of the distinct contents, at all their materialized resolutions*/
+    uint64_t live_bytes;
+    /*!The rest: deleted contents, redundant copies of resized images and stale IDs,
+    which a conversion (see do_convert()) drops*/
+    uint64_t reclaimable_bytes;
+};
+
+/**
+ * @brief Allocates a blob table for nb_slots slots and fills it from the
+ *        valid slots of the metadata array.
+ *
+ * @param nb_slots The number of slots
+ * @param metadata The metadata array
+ * @return The table, to be freed with blobs_free(), NULL if out of memory.
+ */
+struct blob_table* blobs_build(uint32_t nb_slots, const struct img_metadata* metadata);
+
+/**
+ * @brief Frees a blob table.
+ */
+void blobs_free(struct blob_table* table);
+
+/**
+ * @brief Releases the blob of a slot, then makes the slot reference the blob
+ *        of its metadata if valid: the blob is created if need be, and takes
+ *        the resolutions it lacks from the metadata. Does nothing on a NULL table.
+ *
+ * @param table The table
+ * @param slot The slot
+ * @param metadata Its new metadata
+ */
+void blobs_set(struct blob_table* table, uint32_t slot, const struct img_metadata* metadata);
+
+/**
+ * @brief Returns the blob of a SHA, NULL if none (or if the table is NULL).
+ */
+const struct blob* blobs_find(const struct blob_table* table, const unsigned char* SHA);
+
+/**
+ * @brief Returns the first slot referencing the blob of a SHA, NO_SLOT if
+ *        none: the others follow through blobs_next_slot().
+ */
+uint32_t blobs_first_slot(const struct blob_table* table, const unsigned char* SHA);
+
+/**
+ * @brief Returns the next slot referencing the same blob as slot, NO_SLOT if none.
+ */
+uint32_t blobs_next_slot(const struct blob_table* table, uint32_t slot);
+
+/**
+ * @brief Gives a metadata the resolutions materialized by its blob that it
+ *        lacks or holds a redundant copy of.
+ *
+ * @param table The table, NULL for none
+ * @param metadata The metadata
+ * @return 1 if the metadata was changed, 0 otherwise.
+ */
+int blobs_adopt(const struct blob_table* table, struct img_metadata* metadata);
+
+/**
+ * @brief Tells how the data of an opened imgFS file is used.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param space Where to put the figures
+ * @return Some error code. 0 if no error.
+ */
+int do_space(struct imgfs_file* imgfs_file, struct imgfs_space* space);
+
+#ifdef __cplusplus
+}
+#endif
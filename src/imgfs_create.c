@@ -1,4 +1,7 @@
 #include "imgfs.h"
+#include "imgfs_index.h"
+#include "image_similar.h"
+#include "imgfs_blobs.h"
 #include "util.h"
 
 #include <stdlib.h>
@@ -20,13 +23,19 @@ int do_create(const char* imgfs_filename, struct imgfs_file* imgfs_file)
 
     size_t max_files = 1UL * new_header.max_files;
 
-    struct img_metadata* new_metadata = calloc(max_files, sizeof(struct img_metadata));
+    struct img_metadata* new_metadata = imgfs_index_alloc(new_header.max_files, &imgfs_file->index);
     if(new_metadata == NULL) return ERR_OUT_OF_MEMORY;
+    struct blob_table* blobs = blobs_build(new_header.max_files, new_metadata);
+    if(blobs == NULL) {
+        free(new_metadata);
+        return ERR_OUT_OF_MEMORY;
+    }
 
     if((database = fopen(imgfs_filename, "wb")) == NULL
        || fwrite(&new_header, sizeof(struct imgfs_header), 1UL, database) != 1UL
        || fwrite(new_metadata, sizeof(struct img_metadata), max_files, database) != max_files) {
         free(new_metadata);
+        blobs_free(blobs);
         if(database) fclose(database);
         return ERR_IO;
     }
@@ -34,6 +43,12 @@ int do_create(const char* imgfs_filename, struct imgfs_file* imgfs_file)
     imgfs_file->file = database;
     imgfs_file->header = new_header;
     imgfs_file->metadata = new_metadata;
+    imgfs_file->pending_ops = 0;
+    imgfs_file->nb_extensions = 0;
+    imgfs_file->similar = NULL;
+    imgfs_file->blobs = blobs;
+    do_set_durability(imgfs_file, DURABILITY_NONE, 0);
+    do_set_dedup(imgfs_file, DEDUP_EXACT, 0);
 
     printf("%u items were written.\n", 1 + new_header.max_files);
     return ERR_NONE;
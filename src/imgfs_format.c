@@ -0,0 +1,372 @@
+/**
+ * @file imgfs_format.c
+ * @brief On-disk formats of the metadata table and conversion to format 2
+ */
+
+#include "imgfs_format.h"
+#include "imgfs_blobs.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// number of records read at once
+#define RECORDS_CHUNK 1024
+// size of the window through which the ID pool is read
+#define ID_WINDOW (64 * 1024)
+
+/**
+ * @brief Where the ID of a slot lies in the ID pool
+ */
+struct id_ref {
+    uint64_t offset;
+    uint32_t slot;
+    uint32_t len;
+};
+
+/**
+ * @brief An image content to copy by do_convert()
+ */
+struct blob_ref {
+    uint64_t offset;
+    uint32_t size;
+    uint32_t slot;
+    int resolution;
+};
+
+static void pack48(uint64_t value, uint16_t* words)
+{
+    for(int w = 0; w < OFFSET_WORDS; ++w) words[w] = (uint16_t) (value >> (16 * w));
+}
+
+static uint64_t unpack48(const uint16_t* words)
+{
+    uint64_t value = 0;
+    for(int w = 0; w < OFFSET_WORDS; ++w) value |= (uint64_t) words[w] << (16 * w);
+    return value;
+}
+
+int imgfs_format(const struct imgfs_header* header)
+{
+    if(header != NULL && !strncmp(header->name, CAT_TXT_V2, MAX_IMGFS_NAME + 1)) return IMGFS_FORMAT_V2;
+    return IMGFS_FORMAT_V1;
+}
+
+// the perceptual hash took the place of the padding of the records of format 1
+_Static_assert(sizeof(struct img_metadata) == 216, "the records of format 1 are 216 bytes");
+
+size_t metadata_record_size(const struct imgfs_header* header)
+{
+    return imgfs_format(header) == IMGFS_FORMAT_V2 ? sizeof(struct img_record) : sizeof(struct img_metadata);
+}
+
+/**
+ * @brief Fills a record with everything but the ID reference
+ */
+static void encode_record(const struct img_metadata* metadata, struct img_record* record)
+{
+    memcpy(record->SHA, metadata->SHA, SHA256_DIGEST_LENGTH);
+    memcpy(record->orig_res, metadata->orig_res, sizeof(record->orig_res));
+    memcpy(record->size, metadata->size, sizeof(record->size));
+    for(int res = 0; res < NB_RES; ++res) pack48(metadata->offset[res], record->offset[res]);
+    record->is_valid = (uint8_t) metadata->is_valid;
+    record->fingerprint = metadata->fingerprint;
+}
+
+/**
+ * @brief Fills a metadata with everything but the ID
+ */
+static void decode_record(const struct img_record* record, struct img_metadata* metadata)
+{
+    memcpy(metadata->SHA, record->SHA, SHA256_DIGEST_LENGTH);
+    memcpy(metadata->orig_res, record->orig_res, sizeof(record->orig_res));
+    memcpy(metadata->size, record->size, sizeof(record->size));
+    for(int res = 0; res < NB_RES; ++res) metadata->offset[res] = unpack48(record->offset[res]);
+    metadata->is_valid = record->is_valid;
+    metadata->fingerprint = record->fingerprint;
+}
+
+static int compare_id_refs(const void* a, const void* b)
+{
+    const struct id_ref* r1 = a;
+    const struct id_ref* r2 = b;
+    return (r1->offset > r2->offset) - (r1->offset < r2->offset);
+}
+
+static int compare_blob_refs(const void* a, const void* b)
+{
+    const struct blob_ref* r1 = a;
+    const struct blob_ref* r2 = b;
+    return (r1->offset > r2->offset) - (r1->offset < r2->offset);
+}
+
+/**
+ * @brief Reads nb_slots format 2 records from offset and decodes them into metadata[first_slot...],
+ * collecting where their IDs lie.
+ */
+static int read_records(FILE* file, uint64_t offset, uint32_t first_slot, uint32_t nb_slots,
+                        struct img_metadata* metadata, struct img_record* records,
+                        struct id_ref* ids, size_t* nb_ids)
+{
+    if(fseek(file, (long) offset, SEEK_SET) == -1) return ERR_IO;
+
+    for(uint32_t done = 0; done < nb_slots;) {
+        const size_t nb = nb_slots - done < RECORDS_CHUNK ? nb_slots - done : RECORDS_CHUNK;
+        if(fread(records, sizeof(struct img_record), nb, file) != nb) return ERR_IO;
+
+        for(size_t r = 0; r < nb; ++r) {
+            const uint32_t slot = first_slot + done + (uint32_t) r;
+            decode_record(&records[r], &metadata[slot]);
+            if(records[r].id_len > MAX_IMG_ID) return ERR_IO;
+            if(records[r].id_len > 0) {
+                struct id_ref id = {unpack48(records[r].id_offset), slot, records[r].id_len};
+                ids[(*nb_ids)++] = id;
+            }
+        }
+        done += (uint32_t) nb;
+    }
+
+    return ERR_NONE;
+}
+
+/**
+ * @brief Copies the IDs from the pool into the metadata, reading the pool in increasing order
+ * through a window so that IDs stored next to each other cost a single read.
+ */
+static int read_ids(FILE* file, struct id_ref* ids, size_t nb_ids, struct img_metadata* metadata)
+{
+    qsort(ids, nb_ids, sizeof(struct id_ref), compare_id_refs);
+
+    char* window = malloc(ID_WINDOW);
+    if(window == NULL) return ERR_OUT_OF_MEMORY;
+
+    uint64_t window_start = 0;
+    size_t window_len = 0;
+
+    for(size_t i = 0; i < nb_ids; ++i) {
+        if(ids[i].offset < window_start || ids[i].offset + ids[i].len > window_start + window_len) {
+            window_start = ids[i].offset;
+            if(fseek(file, (long) window_start, SEEK_SET) == -1) window_len = 0;
+            else window_len = fread(window, sizeof(char), ID_WINDOW, file);
+
+            if(window_len < ids[i].len) {
+                free(window);
+                return ERR_IO;
+            }
+        }
+
+        char* img_id = metadata[ids[i].slot].img_id;
+        memcpy(img_id, window + (ids[i].offset - window_start), ids[i].len);
+        img_id[ids[i].len] = '\0';
+    }
+
+    free(window);
+    return ERR_NONE;
+}
+
+int read_metadata_table(FILE* file, const struct imgfs_header* header,
+                        const struct extension_region* extensions, uint32_t nb_extensions,
+                        struct img_metadata* metadata)
+{
+    M_REQUIRE_NON_NULL(file);
+    M_REQUIRE_NON_NULL(header);
+    M_REQUIRE_NON_NULL(metadata);
+
+    const uint32_t nb_primary = nb_extensions == 0 ? header->max_files : header->unused_32;
+
+    if(imgfs_format(header) == IMGFS_FORMAT_V1) {
+        if(fseek(file, sizeof(struct imgfs_header), SEEK_SET) == -1
+           || fread(metadata, sizeof(struct img_metadata), nb_primary, file) != nb_primary)
+            return ERR_IO;
+
+        for(uint32_t e = 0; e < nb_extensions; ++e) {
+            if(fseek(file, (long) extensions[e].offset, SEEK_SET) == -1
+               || fread(metadata + extensions[e].first_slot, sizeof(struct img_metadata), extensions[e].nb_slots, file) != extensions[e].nb_slots)
+                return ERR_IO;
+        }
+        return ERR_NONE;
+    }
+
+    struct img_record* records = calloc(RECORDS_CHUNK, sizeof(struct img_record));
+    struct id_ref* ids = calloc(header->max_files, sizeof(struct id_ref));
+    size_t nb_ids = 0;
+
+    int ret = records == NULL || ids == NULL ? ERR_OUT_OF_MEMORY
+              : read_records(file, sizeof(struct imgfs_header), 0, nb_primary, metadata, records, ids, &nb_ids);
+    for(uint32_t e = 0; ret == ERR_NONE && e < nb_extensions; ++e) {
+        ret = read_records(file, extensions[e].offset, extensions[e].first_slot, extensions[e].nb_slots,
+                           metadata, records, ids, &nb_ids);
+    }
+    if(ret == ERR_NONE) ret = read_ids(file, ids, nb_ids, metadata);
+
+    free(records);
+    free(ids);
+    return ret;
+}
+
+int write_record(FILE* file, uint64_t offset, const struct img_metadata* metadata)
+{
+    M_REQUIRE_NON_NULL(file);
+    M_REQUIRE_NON_NULL(metadata);
+
+    struct img_record record;
+    zero_init_var(record);
+    struct img_record current;
+    zero_init_var(current);
+
+    const size_t id_len = strnlen(metadata->img_id, MAX_IMG_ID + 1);
+    if(id_len > MAX_IMG_ID) return ERR_INVALID_IMGID;
+
+    if(fseek(file, (long) offset, SEEK_SET) == -1
+       || fread(&current, sizeof(struct img_record), 1UL, file) != 1UL)
+        return ERR_IO;
+
+    // deletions and resizes keep the ID: reuse it rather than growing the pool
+    uint64_t id_offset = 0;
+    if(id_len > 0 && current.id_len == id_len) {
+        char current_id[MAX_IMG_ID + 1];
+        const uint64_t current_offset = unpack48(current.id_offset);
+
+        if(fseek(file, (long) current_offset, SEEK_SET) == -1
+           || fread(current_id, sizeof(char), id_len, file) != id_len)
+            return ERR_IO;
+        if(!memcmp(current_id, metadata->img_id, id_len)) id_offset = current_offset;
+    }
+
+    if(id_len > 0 && id_offset == 0) {
+        if(fseek(file, 0, SEEK_END) == -1) return ERR_IO;
+        const long end = ftell(file);
+        if(end == -1 || fwrite(metadata->img_id, sizeof(char), id_len, file) != id_len) return ERR_IO;
+        id_offset = (uint64_t) end;
+    }
+
+    encode_record(metadata, &record);
+    pack48(id_offset, record.id_offset);
+    record.id_len = (uint8_t) id_len;
+
+    if(fseek(file, (long) offset, SEEK_SET) == -1
+       || fwrite(&record, sizeof(struct img_record), 1UL, file) != 1UL)
+        return ERR_IO;
+
+    return ERR_NONE;
+}
+
+/**
+ * @brief Releases everything do_convert() allocated and returns the error code
+ */
+static int convert_error(struct imgfs_file* source, FILE* dest, void* buffer, void* blobs, void* id_offsets, int error_code)
+{
+    do_close(source);
+    if(dest != NULL) fclose(dest);
+    free(buffer);
+    free(blobs);
+    free(id_offsets);
+    return error_code;
+}
+
+int do_convert(const char* imgfs_path, const char* new_imgfs_path)
+{
+    M_REQUIRE_NON_NULL(imgfs_path);
+    M_REQUIRE_NON_NULL(new_imgfs_path);
+
+    if(!strcmp(imgfs_path, new_imgfs_path)) return ERR_INVALID_FILENAME;
+
+    struct imgfs_file source;
+    zero_init_var(source);
+    int ret = do_open(imgfs_path, "rb", &source);
+    if(ret != ERR_NONE) return ret;
+
+    const uint32_t max_files = source.header.max_files;
+    struct img_metadata* metadata = source.metadata;
+
+    FILE* dest = fopen(new_imgfs_path, "wb");
+    uint64_t* id_offsets = calloc(max_files, sizeof(uint64_t));
+    struct blob_ref* blobs = calloc(1UL * max_files * NB_RES, sizeof(struct blob_ref));
+    void* buffer = calloc(RECORDS_CHUNK, sizeof(struct img_record));
+    if(dest == NULL) return convert_error(&source, dest, buffer, blobs, id_offsets, ERR_IO);
+    if(id_offsets == NULL || blobs == NULL || buffer == NULL)
+        return convert_error(&source, dest, buffer, blobs, id_offsets, ERR_OUT_OF_MEMORY);
+
+    // the extensions, if any, are merged into a single table
+    struct imgfs_header header = source.header;
+    memset(header.name, 0, sizeof(header.name));
+    strcpy(header.name, CAT_TXT_V2);
+    header.unused_32 = 0;
+    header.unused_64 = 0;
+
+    if(fwrite(&header, sizeof(struct imgfs_header), 1UL, dest) != 1UL)
+        return convert_error(&source, dest, buffer, blobs, id_offsets, ERR_IO);
+    for(uint32_t done = 0; done < max_files;) {
+        const size_t nb = max_files - done < RECORDS_CHUNK ? max_files - done : RECORDS_CHUNK;
+        if(fwrite(buffer, sizeof(struct img_record), nb, dest) != nb)
+            return convert_error(&source, dest, buffer, blobs, id_offsets, ERR_IO);
+        done += (uint32_t) nb;
+    }
+
+    // the ID pool, contiguous so that do_open() reads it in a few chunks
+    size_t nb_blobs = 0;
+    for(uint32_t i = 0; i < max_files; ++i) {
+        if(!metadata[i].is_valid) continue;
+        // the duplicates of a content all reference the same copy of each resolution, copied once
+        blobs_adopt(source.blobs, &metadata[i]);
+
+        const size_t id_len = strnlen(metadata[i].img_id, MAX_IMG_ID + 1);
+        const long position = ftell(dest);
+        if(id_len > MAX_IMG_ID || position == -1
+           || fwrite(metadata[i].img_id, sizeof(char), id_len, dest) != id_len)
+            return convert_error(&source, dest, buffer, blobs, id_offsets, ERR_IO);
+        id_offsets[i] = id_len > 0 ? (uint64_t) position : 0;
+
+        for(int res = 0; res < NB_RES; ++res) {
+            if(metadata[i].offset[res] != 0 && metadata[i].size[res] != 0) {
+                struct blob_ref blob = {metadata[i].offset[res], metadata[i].size[res], i, res};
+                blobs[nb_blobs++] = blob;
+            }
+        }
+    }
+
+    // the live contents, in the order of the source file; deduplicated ones are copied once
+    qsort(blobs, nb_blobs, sizeof(struct blob_ref), compare_blob_refs);
+    uint64_t new_offset = 0;
+    size_t buffer_size = 0;
+    for(size_t b = 0; b < nb_blobs; ++b) {
+        if(b == 0 || blobs[b].offset != blobs[b - 1].offset) {
+            if(blobs[b].size > buffer_size) {
+                void* bigger = realloc(buffer, blobs[b].size);
+                if(bigger == NULL) return convert_error(&source, dest, buffer, blobs, id_offsets, ERR_OUT_OF_MEMORY);
+                buffer = bigger;
+                buffer_size = blobs[b].size;
+            }
+
+            const long position = ftell(dest);
+            if(position == -1
+               || fseek(source.file, (long) blobs[b].offset, SEEK_SET) == -1
+               || fread(buffer, sizeof(char), blobs[b].size, source.file) != blobs[b].size
+               || fwrite(buffer, sizeof(char), blobs[b].size, dest) != blobs[b].size)
+                return convert_error(&source, dest, buffer, blobs, id_offsets, ERR_IO);
+            new_offset = (uint64_t) position;
+        }
+        metadata[blobs[b].slot].offset[blobs[b].resolution] = new_offset;
+    }
+
+    // and finally the table
+    if(fseek(dest, sizeof(struct imgfs_header), SEEK_SET) == -1)
+        return convert_error(&source, dest, buffer, blobs, id_offsets, ERR_IO);
+    for(uint32_t i = 0; i < max_files; ++i) {
+        struct img_record record;
+        zero_init_var(record);
+        if(metadata[i].is_valid) {
+            encode_record(&metadata[i], &record);
+            pack48(id_offsets[i], record.id_offset);
+            record.id_len = (uint8_t) strnlen(metadata[i].img_id, MAX_IMG_ID);
+        }
+        if(fwrite(&record, sizeof(struct img_record), 1UL, dest) != 1UL)
+            return convert_error(&source, dest, buffer, blobs, id_offsets, ERR_IO);
+    }
+
+    FILE* written = dest;
+    dest = NULL;
+    if(fclose(written) == EOF) return convert_error(&source, dest, buffer, blobs, id_offsets, ERR_IO);
+
+    return convert_error(&source, dest, buffer, blobs, id_offsets, ERR_NONE);
+}
@@ -0,0 +1,97 @@
+/**
+ * @file imgfs_format.h
+ * @brief On-disk formats of the metadata table.
+ *
+ * Format 1 stores every slot as a struct img_metadata (216 bytes). Format 2
+ * stores the compact struct img_record (80 bytes): the image ID is kept in
+ * an ID pool in the data area of the file and the offsets are packed on
+ * 48 bits. Both are loaded into the same in-memory img_metadata array; the
+ * format of a file is told by the name in its header.
+ */
+
+#pragma once
+
+#include "imgfs.h"
+
+#include <openssl/sha.h> // for SHA256_DIGEST_LENGTH
+#include <stddef.h>      // for size_t
+#include <stdint.h>      // for uint8_t, uint16_t, uint32_t, uint64_t
+#include <stdio.h>       // for FILE
+
+#define IMGFS_FORMAT_V1 1
+#define IMGFS_FORMAT_V2 2
+
+#define CAT_TXT_V2 CAT_TXT " v2"
+
+// number of 16-bit words of a packed offset
+#define OFFSET_WORDS 3
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+* @struct img_record : The metadata of an image in format 2
+* @brief Same content as img_metadata, but the ID is only referenced (it lives in the ID pool) and the offsets
+* are stored on 48 bits, least significant word first.
+*/
+struct img_record {
+    /*!The SHA hash code of the image*/
+    unsigned char SHA[SHA256_DIGEST_LENGTH];
+    /*!The original size of the image*/
+    uint32_t orig_res[ORIG_RES];
+    /*!The size of the image at different resolutions (thumbnail, small, original)*/
+    uint32_t size[NB_RES];
+    /*!The position of the image in the file at different resolutions*/
+    uint16_t offset[NB_RES][OFFSET_WORDS];
+    /*!The position of the ID in the file, 0 if there is no ID*/
+    uint16_t id_offset[OFFSET_WORDS];
+    /*!The length of the ID, without the final '\0'*/
+    uint8_t id_len;
+    /*!An indicator of the validity of the image*/
+    uint8_t is_valid;
+    /*!The fingerprint of the image, 0 if none*/
+    uint16_t fingerprint;
+};
+
+/**
+ * @brief Returns the format of an imgFS: IMGFS_FORMAT_V2 if its name is
+ *        CAT_TXT_V2, IMGFS_FORMAT_V1 otherwise.
+ */
+int imgfs_format(const struct imgfs_header* header);
+
+/**
+ * @brief Returns the size of a slot of the metadata table on disk.
+ */
+size_t metadata_record_size(const struct imgfs_header* header);
+
+/**
+ * @brief Reads the whole metadata table (the slots following the header
+ *        and the extensions) into the metadata array.
+ *
+ * @param file The imgFS file
+ * @param header Its header
+ * @param extensions The extensions of the metadata table
+ * @param nb_extensions The number of extensions
+ * @param metadata The zeroed array of header->max_files metadata to fill
+ * @return Some error code. 0 if no error.
+ */
+int read_metadata_table(FILE* file, const struct imgfs_header* header,
+                        const struct extension_region* extensions, uint32_t nb_extensions,
+                        struct img_metadata* metadata);
+
+/**
+ * @brief Writes the metadata of an image as a format 2 record at the given
+ *        offset. The ID is appended to the ID pool, unless the record
+ *        currently at this offset already references the same ID.
+ *
+ * @param file The imgFS file, opened for reading and writing
+ * @param offset The offset of the record in the file
+ * @param metadata The metadata to write
+ * @return Some error code. 0 if no error.
+ */
+int write_record(FILE* file, uint64_t offset, const struct img_metadata* metadata);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,88 @@
+/**
+ * @file imgfs_grow.c
+ * @brief Online growth of the metadata table of an imgFS
+ */
+
+#include "imgfs.h"
+#include "imgfs_format.h"
+#include "imgfs_index.h"
+#include "imgfs_blobs.h"
+#include "util.h"
+
+#include <stddef.h> // for offsetof
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int do_grow(struct imgfs_file* imgfs_file, uint32_t new_max_files)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->file);
+    M_REQUIRE_NON_NULL(imgfs_file->metadata);
+
+    const uint32_t max_files = imgfs_file->header.max_files;
+    if(new_max_files <= max_files || imgfs_file->nb_extensions >= MAX_EXTENSIONS) return ERR_MAX_FILES;
+
+    const uint32_t nb_slots = new_max_files - max_files;
+
+    // the new slots are zeroed in memory first: their records are then written from there
+    // (a record on disk is never larger than an img_metadata)
+    struct imgfs_index index;
+    zero_init_var(index);
+    struct img_metadata* metadata = imgfs_index_alloc(new_max_files, &index);
+    if(metadata == NULL) return ERR_OUT_OF_MEMORY;
+    memcpy(metadata, imgfs_file->metadata, 1UL * max_files * sizeof(struct img_metadata));
+    struct blob_table* blobs = blobs_build(new_max_files, metadata);
+    if(blobs == NULL) {
+        free(metadata);
+        return ERR_OUT_OF_MEMORY;
+    }
+    imgfs_index_build(&index, metadata);
+    free(imgfs_file->metadata);
+    blobs_free(imgfs_file->blobs);
+    imgfs_file->metadata = metadata;
+    imgfs_file->index = index;
+    imgfs_file->blobs = blobs;
+
+    struct imgfs_extension extension;
+    zero_init_var(extension);
+    extension.nb_slots = nb_slots;
+
+    if(fseek(imgfs_file->file, 0, SEEK_END) == -1) return ERR_IO;
+    const long offset = ftell(imgfs_file->file);
+    if(offset == -1
+       || fwrite(&extension, sizeof(struct imgfs_extension), 1UL, imgfs_file->file) != 1UL
+       || fwrite(metadata + max_files, metadata_record_size(&imgfs_file->header), nb_slots, imgfs_file->file) != nb_slots)
+        return ERR_IO;
+
+    // the extension must be on disk before anything points to it
+    int ret = ERR_NONE;
+    if(imgfs_file->durability != DURABILITY_NONE && (ret = do_sync(imgfs_file)) != ERR_NONE) return ret;
+
+    struct imgfs_header header = imgfs_file->header;
+
+    if(imgfs_file->nb_extensions == 0) {
+        header.unused_32 = max_files;
+        header.unused_64 = (uint64_t) offset;
+    } else {
+        // the next field of the last extension, which is not accounted for until the header is updated
+        const struct extension_region* last = &imgfs_file->extensions[imgfs_file->nb_extensions - 1];
+        const uint64_t next = (uint64_t) offset;
+        if(fseek(imgfs_file->file, (long) (last->offset - sizeof(struct imgfs_extension) + offsetof(struct imgfs_extension, next)), SEEK_SET) == -1
+           || fwrite(&next, sizeof(uint64_t), 1UL, imgfs_file->file) != 1UL)
+            return ERR_IO;
+    }
+
+    header.max_files = new_max_files;
+    header.version++;
+
+    if(fseek(imgfs_file->file, 0, SEEK_SET) == -1
+       || fwrite(&header, sizeof(struct imgfs_header), 1UL, imgfs_file->file) != 1UL)
+        return ERR_IO;
+
+    struct extension_region region = {max_files, nb_slots, (uint64_t) offset + sizeof(struct imgfs_extension)};
+    imgfs_file->extensions[imgfs_file->nb_extensions++] = region;
+    imgfs_file->header = header;
+
+    return do_commit(imgfs_file);
+}
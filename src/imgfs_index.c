@@ -0,0 +1,236 @@
+/**
+ * @file imgfs_index.c
+ * @brief Structure-of-arrays index of the hot metadata fields
+ */
+
+#include "imgfs_index.h"
+#include "util.h" // for MIN
+
+#include <stdlib.h>
+#include <string.h>
+
+#define FNV32_OFFSET_BASIS 0x811c9dc5U
+#define FNV32_PRIME        0x01000193U
+
+#define BITS_PER_WORD 64
+
+// the primes of xxHash64
+#define PRIME64_1 0x9e3779b185ebca87UL
+#define PRIME64_2 0xc2b2ae3d27d4eb4fUL
+#define PRIME64_3 0x165667b19e3779f9UL
+#define PRIME64_4 0x85ebca77c2b2ae63UL
+
+// the bytes hashed at each end of an image by imgfs_index_fingerprint()
+#define FINGERPRINT_BLOCK 4096
+
+static size_t nb_words(uint32_t nb_slots)
+{
+    return (nb_slots + BITS_PER_WORD - 1UL) / BITS_PER_WORD;
+}
+
+/**
+ * @brief The number of buckets of the counting filters: the power of two at least twice nb_slots
+ */
+static size_t nb_buckets(uint32_t nb_slots)
+{
+    size_t buckets = 2;
+    while(buckets < 2UL * nb_slots) buckets *= 2;
+    return buckets;
+}
+
+struct img_metadata* imgfs_index_alloc(uint32_t nb_slots, struct imgfs_index* index)
+{
+    if(index == NULL) return NULL;
+
+    // 8-byte arrays first: all the arrays stay aligned (sizeof(struct img_metadata) is a multiple of 8)
+    const size_t metadata_bytes = 1UL * nb_slots * sizeof(struct img_metadata);
+    const size_t valid_bytes = nb_words(nb_slots) * sizeof(uint64_t);
+    const size_t buckets = nb_buckets(nb_slots);
+    const size_t total = metadata_bytes + valid_bytes
+                         + 1UL * nb_slots * (sizeof(uint64_t) + 2 * sizeof(uint32_t) + sizeof(uint16_t))
+                         + 2 * buckets * sizeof(uint32_t);
+
+    char* memory = calloc(1UL, total);
+    if(memory == NULL) return NULL;
+
+    index->nb_slots = nb_slots;
+    index->valid = (uint64_t*) (void*) (memory + metadata_bytes);
+    index->sha_prefix = (uint64_t*) (void*) (memory + metadata_bytes + valid_bytes);
+    index->id_hash = (uint32_t*) (void*) (index->sha_prefix + nb_slots);
+    index->orig_size = index->id_hash + nb_slots;
+    index->id_count = index->orig_size + nb_slots;
+    index->content_count = index->id_count + buckets;
+    index->fingerprint = (uint16_t*) (void*) (index->content_count + buckets);
+    index->filter_mask = (uint32_t) (buckets - 1);
+    index->nb_unfingerprinted = 0;
+
+    return (struct img_metadata*) (void*) memory;
+}
+
+uint32_t imgfs_index_id_hash(const char* img_id)
+{
+    uint32_t hash = FNV32_OFFSET_BASIS;
+    for(size_t i = 0; i < MAX_IMG_ID + 1 && img_id[i] != '\0'; ++i) {
+        hash ^= (unsigned char) img_id[i];
+        hash *= FNV32_PRIME;
+    }
+    return hash;
+}
+
+uint64_t imgfs_index_sha_prefix(const unsigned char* SHA)
+{
+    uint64_t prefix = 0;
+    memcpy(&prefix, SHA, sizeof(prefix));
+    return prefix;
+}
+
+static uint64_t rotl64(uint64_t x, unsigned int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+/**
+ * @brief Mixes the 8-byte words of a block into an accumulator (a round of xxHash64)
+ */
+static uint64_t hash_block(uint64_t acc, const unsigned char* block, size_t len)
+{
+    size_t i = 0;
+    for(; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+        uint64_t lane = 0;
+        memcpy(&lane, block + i, sizeof(lane));
+        acc ^= rotl64(lane * PRIME64_2, 31) * PRIME64_1;
+        acc = rotl64(acc, 27) * PRIME64_1 + PRIME64_4;
+    }
+    for(; i < len; ++i) {
+        acc ^= block[i] * PRIME64_1;
+        acc = rotl64(acc, 11) * PRIME64_2;
+    }
+    return acc;
+}
+
+uint16_t imgfs_index_fingerprint(const void* image, size_t size)
+{
+    if(image == NULL) return 0;
+
+    const unsigned char* bytes = image;
+    const size_t head = MIN(size, FINGERPRINT_BLOCK);
+    uint64_t acc = hash_block(PRIME64_3 + size, bytes, head);
+    if(size > head) {
+        const size_t tail = MIN(size - head, FINGERPRINT_BLOCK);
+        acc = hash_block(acc, bytes + size - tail, tail);
+    }
+
+    // avalanche, then fold on 16 bits: 0 is kept for "no fingerprint"
+    acc ^= acc >> 33;
+    acc *= PRIME64_2;
+    acc ^= acc >> 29;
+    acc *= PRIME64_3;
+    acc ^= acc >> 32;
+    const uint16_t fingerprint = (uint16_t) (acc ^ (acc >> 16) ^ (acc >> 32) ^ (acc >> 48));
+    return fingerprint != 0 ? fingerprint : 1;
+}
+
+/**
+ * @brief The bucket of the content filter of a fingerprint and a size
+ */
+static uint32_t content_bucket(const struct imgfs_index* index, uint16_t fingerprint, uint32_t size)
+{
+    const uint64_t key = ((uint64_t) size << 16 | fingerprint) * PRIME64_1;
+    return (uint32_t) (key >> 32) & index->filter_mask;
+}
+
+/**
+ * @brief Adds (delta 1) or removes (delta -1) a valid slot from the counting filters
+ */
+static void count_slot(struct imgfs_index* index, uint32_t slot, uint32_t delta)
+{
+    index->id_count[index->id_hash[slot] & index->filter_mask] += delta;
+    if(index->fingerprint[slot] != 0) {
+        index->content_count[content_bucket(index, index->fingerprint[slot], index->orig_size[slot])] += delta;
+    } else index->nb_unfingerprinted += delta;
+}
+
+static int slot_is_valid(const struct imgfs_index* index, uint32_t slot)
+{
+    return (int) ((index->valid[slot / BITS_PER_WORD] >> (slot % BITS_PER_WORD)) & 1UL);
+}
+
+void imgfs_index_set(struct imgfs_index* index, uint32_t slot, const struct img_metadata* metadata)
+{
+    if(index == NULL || index->valid == NULL || metadata == NULL || slot >= index->nb_slots) return;
+
+    // the filters count the valid slots: the former entries leave them, the new ones enter them
+    if(slot_is_valid(index, slot)) count_slot(index, slot, (uint32_t) -1);
+
+    const uint64_t bit = 1UL << (slot % BITS_PER_WORD);
+    if(metadata->is_valid) index->valid[slot / BITS_PER_WORD] |= bit;
+    else index->valid[slot / BITS_PER_WORD] &= ~bit;
+
+    index->sha_prefix[slot] = imgfs_index_sha_prefix(metadata->SHA);
+    index->id_hash[slot] = imgfs_index_id_hash(metadata->img_id);
+    index->orig_size[slot] = metadata->size[ORIG_RES];
+    index->fingerprint[slot] = metadata->fingerprint;
+
+    if(metadata->is_valid) count_slot(index, slot, 1);
+}
+
+int imgfs_index_may_have_duplicate(const struct imgfs_index* index, uint32_t slot, uint32_t id_hash,
+                                   uint16_t fingerprint, uint32_t size)
+{
+    if(index == NULL || index->valid == NULL) return 1;
+
+    uint32_t same_id = index->id_count[id_hash & index->filter_mask];
+    uint32_t same_content = fingerprint != 0 ? index->content_count[content_bucket(index, fingerprint, size)] : 1;
+    uint32_t unfingerprinted = index->nb_unfingerprinted;
+
+    // the slot itself does not count
+    if(slot < index->nb_slots && slot_is_valid(index, slot)) {
+        same_id -= (index->id_hash[slot] & index->filter_mask) == (id_hash & index->filter_mask);
+        if(index->fingerprint[slot] == 0) --unfingerprinted;
+        else if(fingerprint != 0) {
+            same_content -= content_bucket(index, index->fingerprint[slot], index->orig_size[slot])
+                            == content_bucket(index, fingerprint, size);
+        }
+    }
+
+    // a slot without fingerprint may hold any content
+    return same_id != 0 || same_content != 0 || unfingerprinted != 0;
+}
+
+void imgfs_index_build(struct imgfs_index* index, const struct img_metadata* metadata)
+{
+    if(index == NULL || metadata == NULL) return;
+
+    for(uint32_t slot = 0; slot < index->nb_slots; ++slot) imgfs_index_set(index, slot, &metadata[slot]);
+}
+
+/**
+ * @brief First slot at or after slot whose validity bit equals wanted, index->nb_slots if none
+ */
+static uint32_t next_slot(const struct imgfs_index* index, uint32_t slot, int wanted)
+{
+    if(index == NULL || index->valid == NULL || slot >= index->nb_slots) return index == NULL ? 0 : index->nb_slots;
+
+    const uint64_t flip = wanted ? 0 : ~0UL;
+    size_t word = slot / BITS_PER_WORD;
+    uint64_t bits = (index->valid[word] ^ flip) & (~0UL << (slot % BITS_PER_WORD));
+
+    while(bits == 0) {
+        if(++word == nb_words(index->nb_slots)) return index->nb_slots;
+        bits = index->valid[word] ^ flip;
+    }
+
+    // the bits after the last slot are clear, thus "empty": clamp
+    const uint64_t found = word * BITS_PER_WORD + (uint64_t) __builtin_ctzll(bits);
+    return found < index->nb_slots ? (uint32_t) found : index->nb_slots;
+}
+
+uint32_t imgfs_index_next_valid(const struct imgfs_index* index, uint32_t slot)
+{
+    return next_slot(index, slot, 1);
+}
+
+uint32_t imgfs_index_next_empty(const struct imgfs_index* index, uint32_t slot)
+{
+    return next_slot(index, slot, 0);
+}
@@ -0,0 +1,95 @@
+/**
+ * @file imgfs_index.h
+ * @brief Structure-of-arrays index of the hot metadata fields.
+ *
+ * The index (struct imgfs_index) is stored right after the metadata array,
+ * in the same allocation, so that freeing the metadata frees the index.
+ * It is a filter: a match on the index is always confirmed on the metadata,
+ * which stays the reference.
+ *
+ * Two counting filters, of about twice as many buckets as slots, count the
+ * valid slots per bucket of their ID hash and of their fingerprint and size:
+ * when both buckets of an image are empty, neither its ID nor its content
+ * can be in the imgFS, and deduplication skips the scan of the slots.
+ */
+
+#pragma once
+
+#include "imgfs.h"
+
+#include <stddef.h> // for size_t
+#include <stdint.h> // for uint32_t, uint64_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Allocates a zeroed metadata array of nb_slots slots followed by
+ *        its (empty) index.
+ *
+ * @param nb_slots The number of slots
+ * @param index The index to attach to the allocation
+ * @return The metadata array, to be freed with free(), NULL if out of memory.
+ */
+struct img_metadata* imgfs_index_alloc(uint32_t nb_slots, struct imgfs_index* index);
+
+/**
+ * @brief Sets the entries of every slot of the index from the metadata array.
+ */
+void imgfs_index_build(struct imgfs_index* index, const struct img_metadata* metadata);
+
+/**
+ * @brief Sets the entries of one slot of the index from its metadata.
+ */
+void imgfs_index_set(struct imgfs_index* index, uint32_t slot, const struct img_metadata* metadata);
+
+/**
+ * @brief Returns the first valid slot at or after slot, index->nb_slots if none.
+ */
+uint32_t imgfs_index_next_valid(const struct imgfs_index* index, uint32_t slot);
+
+/**
+ * @brief Returns the first empty slot at or after slot, index->nb_slots if none.
+ */
+uint32_t imgfs_index_next_empty(const struct imgfs_index* index, uint32_t slot);
+
+/**
+ * @brief Hash of an image ID stored in the index (32-bit FNV-1a).
+ */
+uint32_t imgfs_index_id_hash(const char* img_id);
+
+/**
+ * @brief The first 8 bytes of a SHA, as stored in the index.
+ */
+uint64_t imgfs_index_sha_prefix(const unsigned char* SHA);
+
+/**
+ * @brief Cheap fingerprint of an image: a hash (with the rounds of xxHash64)
+ *        of its size and of its first and last 4 KiB, folded on 16 bits.
+ *        Never 0, which marks the images inserted without fingerprint.
+ *
+ * @param image The content of the image
+ * @param size Its size
+ * @return The fingerprint, 0 if image is NULL.
+ */
+uint16_t imgfs_index_fingerprint(const void* image, size_t size);
+
+/**
+ * @brief Tells whether a valid slot other than slot may have the given ID
+ *        hash or the same content (fingerprint and size) according to the
+ *        counting filters. A slot without fingerprint may have any content.
+ *
+ * @param index The index
+ * @param slot The slot of the image (not counted if valid in the index)
+ * @param id_hash The hash of its ID (see imgfs_index_id_hash())
+ * @param fingerprint Its fingerprint, 0 if unknown (then its content may match any slot)
+ * @param size The size of its original
+ * @return 0 if no other slot can have the same ID or content, 1 otherwise.
+ */
+int imgfs_index_may_have_duplicate(const struct imgfs_index* index, uint32_t slot, uint32_t id_hash,
+                                   uint16_t fingerprint, uint32_t size);
+
+#ifdef __cplusplus
+}
+#endif
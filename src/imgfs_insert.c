@@ -2,6 +2,9 @@
 #include "util.h"
 #include "image_dedup.h"
 #include "image_content.h"
+#include "image_similar.h"
+#include "imgfs_index.h"
+#include "sha256.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -16,6 +19,19 @@ int garbage_collect_and_error(struct img_metadata* backup, struct img_metadata*
 int do_insert(const char* image_buffer, size_t image_size, const char* img_id, struct imgfs_file* imgfs_file)
 {
     M_REQUIRE_NON_NULL(image_buffer);
+
+    unsigned char sha[SHA256_DIGEST_LENGTH] = {0};
+    const int ret = sha256(image_buffer, image_size, sha);
+    if(ret != ERR_NONE) return ret;
+
+    return do_insert_hashed(image_buffer, image_size, sha, img_id, imgfs_file);
+}
+
+int do_insert_hashed(const char* image_buffer, size_t image_size, const unsigned char* sha,
+                     const char* img_id, struct imgfs_file* imgfs_file)
+{
+    M_REQUIRE_NON_NULL(image_buffer);
+    M_REQUIRE_NON_NULL(sha);
     M_REQUIRE_NON_NULL(img_id);
     M_REQUIRE_NON_NULL(imgfs_file);
     M_REQUIRE_NON_NULL(imgfs_file->file);
@@ -23,7 +39,8 @@ int do_insert(const char* image_buffer, size_t image_size, const char* img_id, s
 
     if(imgfs_file->header.nb_files >= imgfs_file->header.max_files) return ERR_IMGFS_FULL;
 
-    for(int i = 0; i < imgfs_file->header.max_files; ++i) {
+    const struct imgfs_index* hot = &imgfs_file->index;
+    for(uint32_t i = imgfs_index_next_empty(hot, 0); i < imgfs_file->header.max_files; i = imgfs_index_next_empty(hot, i + 1)) {
         if(imgfs_file->metadata[i].is_valid == EMPTY) {
             // store a backup to change the metadata in case of error
             struct img_metadata backup = imgfs_file->metadata[i];
@@ -31,14 +48,13 @@ int do_insert(const char* image_buffer, size_t image_size, const char* img_id, s
 
             zero_init_var(imgfs_file->metadata[i]);
 
-            unsigned char image_hash_value[SHA256_DIGEST_LENGTH] = {0};
-            SHA256((const unsigned char *)image_buffer, image_size, image_hash_value);
-            memcpy(imgfs_file->metadata[i].SHA, image_hash_value, SHA256_DIGEST_LENGTH);
+            memcpy(imgfs_file->metadata[i].SHA, sha, SHA256_DIGEST_LENGTH);
 
             // could check img_id in some way tbh, would define file with macro functions
             strcpy(imgfs_file->metadata[i].img_id, img_id);
 
             imgfs_file->metadata[i].size[ORIG_RES] = (uint32_t) image_size;
+            imgfs_file->metadata[i].fingerprint = imgfs_index_fingerprint(image_buffer, image_size);
 
             uint32_t height = 0;
             uint32_t width = 0;
@@ -52,7 +68,8 @@ int do_insert(const char* image_buffer, size_t image_size, const char* img_id, s
             imgfs_file->metadata[i].is_valid = NON_EMPTY;
 
             ret = ERR_NONE;
-            if((ret = do_name_and_content_dedup(imgfs_file, i)) != ERR_NONE)
+            if((ret = do_name_and_content_dedup(imgfs_file, i)) != ERR_NONE
+               || (ret = do_similar_dedup(imgfs_file, i, image_buffer, image_size)) != ERR_NONE)
                 return garbage_collect_and_error(&backup, &imgfs_file->metadata[i], ret);
 
             if(!imgfs_file->metadata[i].offset[ORIG_RES]) {
@@ -67,15 +84,14 @@ int do_insert(const char* image_buffer, size_t image_size, const char* img_id, s
             header.nb_files++;
             header.version++;
 
-            if(fseek(imgfs_file->file, sizeof(struct imgfs_header) + i * sizeof(struct img_metadata), SEEK_SET) == -1
-               || fwrite(&imgfs_file->metadata[i], sizeof(struct img_metadata), 1UL, imgfs_file->file) != 1UL
+            if(write_metadata(imgfs_file, i, &imgfs_file->metadata[i]) != ERR_NONE
                || fseek(imgfs_file->file, 0, SEEK_SET) == -1
                || fwrite(&header, sizeof(struct imgfs_header), 1UL, imgfs_file->file) != 1UL)
                 return garbage_collect_and_error(&backup, &imgfs_file->metadata[i], ERR_IO);
 
             imgfs_file->header = header;
 
-            return ERR_NONE;
+            return do_commit(imgfs_file);
         }
     }
 
@@ -1,13 +1,15 @@
 #include "imgfs.h"
 #include  "util.h"
+#include "imgfs_index.h"
+#include "json_writer.h"
 
 #include <stdio.h>
-#include <json-c/json.h>
 #include <string.h>
 
 typedef struct {
     const struct img_metadata* metadata;
-    struct json_object* json_array;
+    struct json_writer* writer;
+    const struct list_options* options;
 } arguments_for_helper;
 
 typedef void (*func)(arguments_for_helper* arguments);
@@ -15,7 +17,8 @@ typedef void (*func)(arguments_for_helper* arguments);
 typedef struct {
     func helper_function;
     struct imgfs_file* imgfs_file;
-    struct json_object* json_array;
+    struct json_writer* writer;
+    const struct list_options* options;
 } arguments;
 
 void do_list_helper_print(arguments_for_helper* arg)
@@ -30,11 +33,8 @@ void do_list_helper_print(arguments_for_helper* arg)
 void do_list_helper_json_add(arguments_for_helper* arg)
 {
     const struct img_metadata* metadata = arg->metadata;
-    if(metadata != NULL && metadata->is_valid) {
-        struct json_object* json_string_imgid = json_object_new_string(metadata->img_id);
-        struct json_object* json_array = arg->json_array;
-        json_object_array_add(json_array, json_string_imgid);
-    }
+    if(metadata != NULL && metadata->is_valid && list_options_match(arg->options, metadata))
+        do_list_entry_json(arg->writer, metadata, arg->options == NULL ? 0 : arg->options->fields);
 }
 /**
 */
@@ -42,22 +42,17 @@ void do_list_aux(arguments* general_parameters)
 {
     func function = general_parameters->helper_function;
     struct imgfs_file* imgfs_file = general_parameters->imgfs_file;
-    struct json_object* json_array = general_parameters->json_array;
+    struct json_writer* writer = general_parameters->writer;
 
-    arguments_for_helper parameters_bis = {NULL, json_array};
+    arguments_for_helper parameters_bis = {NULL, writer, general_parameters->options};
 
-    for(uint32_t i = 0; i < imgfs_file->header.max_files; ++i) {
+    const struct imgfs_index* hot = &imgfs_file->index;
+    for(uint32_t i = imgfs_index_next_valid(hot, 0); i < imgfs_file->header.max_files; i = imgfs_index_next_valid(hot, i + 1)) {
         parameters_bis.metadata= &imgfs_file->metadata[i];
         function(&parameters_bis);
     }
 }
 
-int put_json_and_return(struct json_object* json_object, int return_code)
-{
-    json_object_put(json_object);
-    return return_code;
-}
-
 /**
  * @brief This function prints the header of the database and the metadata of all the stored images. If one of the parameters is null,
  * then an error occurs. Also, if the database is empty is signals it by a message.
@@ -67,46 +62,176 @@ int put_json_and_return(struct json_object* json_object, int return_code)
 */
 int do_list(const struct imgfs_file* imgfs_file, enum do_list_mode output_mode, char** json)
 {
-    M_REQUIRE_NON_NULL(imgfs_file);
+    return do_list_multiple(imgfs_file, 1, output_mode, json);
+}
 
-    const struct img_metadata* metadata = imgfs_file->metadata;
+/**
+ * @brief Same as do_list but for several databases at once: in STDOUT mode every database is displayed in turn,
+ * in JSON mode the images of all the databases are gathered in a single list.
+ * @param imgfs_files (const struct imgfs_file*) : the array of databases containg the images
+ * @param nb_files (size_t) : the number of databases in imgfs_files
+ * @param output_mode (enum do_list_mode) : the mode of display of the format
+ * @return the corresponding error code: ERR_NONE if all went fine or if something failed a specific code defined in error.h
+*/
+int do_list_multiple(const struct imgfs_file* imgfs_files, size_t nb_files, enum do_list_mode output_mode, char** json)
+{
+    M_REQUIRE_NON_NULL(imgfs_files);
 
     switch(output_mode) {
     case STDOUT:
-        print_header(&(imgfs_file->header));
-
-        if(metadata == NULL || imgfs_file->header.nb_files == 0) {
-            printf("<< empty imgFS >>\n");
-        } else {
-            arguments params = {do_list_helper_print, imgfs_file, NULL};
-            do_list_aux(&params);
+        for(size_t f = 0; f < nb_files; ++f) {
+            const struct imgfs_file* imgfs_file = &imgfs_files[f];
+            const struct img_metadata* metadata = imgfs_file->metadata;
+
+            print_header(&(imgfs_file->header));
+
+            if(metadata == NULL || imgfs_file->header.nb_files == 0) {
+                printf("<< empty imgFS >>\n");
+            } else {
+                arguments params = {do_list_helper_print, imgfs_file, NULL, NULL};
+                do_list_aux(&params);
+            }
         }
         break;
-    case JSON:
+    case JSON: {
         M_REQUIRE_NON_NULL(json);
 
-        struct json_object* json_object = json_object_new_object();
-        struct json_object* json_array = json_object_new_array();
+        struct json_writer writer;
+        int ret = json_writer_init(&writer, NULL, NULL);
+        if(ret != ERR_NONE) return ret;
 
-        if(metadata != NULL && imgfs_file->header.nb_files != 0) {
-            arguments params = {do_list_helper_json_add, imgfs_file, json_array};
-            do_list_aux(&params);
+        if((ret = do_list_json(imgfs_files, nb_files, NULL, &writer)) != ERR_NONE) {
+            json_writer_free(&writer);
+            return ret;
         }
 
-        const char* images_string = "Images";
+        // the buffer of the writer is handed over as it is, without copy
+        *json = writer.buffer;
+        break;
+    }
+    case NB_DO_LIST_MODES:
+        break;
+    }
 
-        if(json_object_object_add(json_object, images_string, json_array) < 0)
-            put_json_and_return(json_object, ERR_RUNTIME);
+    return ERR_NONE;
+}
 
-        const char* string_in_json_format = strdup(json_object_to_json_string(json_object));
-        *json = string_in_json_format;
+void list_options_init(struct list_options* options)
+{
+    if(options == NULL) return;
+    zero_init_ptr(options);
+    options->max_size = UINT32_MAX;
+}
 
-        put_json_and_return(json_object, ERR_NONE);
+int list_options_match(const struct list_options* options, const struct img_metadata* metadata)
+{
+    if(options == NULL) return 1;
+    if(metadata == NULL) return 0;
 
-        break;
-    case NB_DO_LIST_MODES:
-        break;
+    return options->min_size <= metadata->size[ORIG_RES] && metadata->size[ORIG_RES] <= options->max_size
+           && !strncmp(metadata->img_id, options->prefix, strnlen(options->prefix, MAX_IMG_ID + 1));
+}
+
+/**
+ * @brief The names of the resolutions in the JSON listings, as accepted by resolution_atoi()
+ */
+static const char* const resolution_names[NB_RES] = {"thumb", "small", "orig"};
+
+int do_list_entry_json(struct json_writer* writer, const struct img_metadata* metadata, unsigned int fields)
+{
+    M_REQUIRE_NON_NULL(writer);
+    M_REQUIRE_NON_NULL(metadata);
+
+    if(fields == 0) return json_string(writer, metadata->img_id, MAX_IMG_ID + 1);
+
+    json_begin_object(writer);
+    json_key(writer, "img_id");
+    json_string(writer, metadata->img_id, MAX_IMG_ID + 1);
+
+    if(fields & LIST_FIELD_ORIG_RES) {
+        json_key(writer, "orig_res");
+        json_begin_array(writer);
+        json_uint(writer, metadata->orig_res[0]);
+        json_uint(writer, metadata->orig_res[1]);
+        json_end_array(writer);
+    }
+    if(fields & LIST_FIELD_SIZE) {
+        json_key(writer, "size");
+        json_begin_object(writer);
+        for(int res = 0; res < NB_RES; ++res) {
+            json_key(writer, resolution_names[res]);
+            json_uint(writer, metadata->offset[res] != 0 ? metadata->size[res] : 0);
+        }
+        json_end_object(writer);
+    }
+    if(fields & LIST_FIELD_RESOLUTIONS) {
+        json_key(writer, "resolutions");
+        json_begin_array(writer);
+        for(int res = 0; res < NB_RES; ++res) {
+            if(metadata->offset[res] != 0 && metadata->size[res] != 0)
+                json_string(writer, resolution_names[res], strlen(resolution_names[res]));
+        }
+        json_end_array(writer);
+    }
+
+    return json_end_object(writer);
+}
+
+/**
+ * @brief Writes the JSON list of the images of the databases, as do_list_multiple() does, with the given writer.
+ * @param imgfs_files (const struct imgfs_file*) : the array of databases containg the images
+ * @param nb_files (size_t) : the number of databases in imgfs_files
+ * @param options (const struct list_options*) : the fields and filters of the listing, NULL for the IDs of all the images
+ * @param writer (struct json_writer*) : the writer
+ * @return the corresponding error code: ERR_NONE if all went fine or if something failed a specific code defined in error.h
+*/
+int do_list_json(const struct imgfs_file* imgfs_files, size_t nb_files, const struct list_options* options,
+                 struct json_writer* writer)
+{
+    M_REQUIRE_NON_NULL(imgfs_files);
+    M_REQUIRE_NON_NULL(writer);
+
+    json_begin_object(writer);
+    json_key(writer, "Images");
+    json_begin_array(writer);
+
+    for(size_t f = 0; f < nb_files && writer->error == ERR_NONE; ++f) {
+        const struct imgfs_file* imgfs_file = &imgfs_files[f];
+
+        if(imgfs_file->metadata != NULL && imgfs_file->header.nb_files != 0) {
+            arguments params = {do_list_helper_json_add, imgfs_file, writer, options};
+            do_list_aux(&params);
+        }
+    }
+
+    json_end_array(writer);
+    return json_end_object(writer);
+}
+
+int do_list_page(const struct imgfs_file* imgfs_file, const struct list_options* options,
+                 uint32_t* cursor, size_t max_images, struct img_metadata* images, size_t* nb_images)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(cursor);
+    M_REQUIRE_NON_NULL(images);
+    M_REQUIRE_NON_NULL(nb_images);
+
+    *nb_images = 0;
+    if(imgfs_file->metadata == NULL || *cursor >= imgfs_file->header.max_files) {
+        *cursor = imgfs_file->header.max_files;
+        return ERR_NONE;
+    }
+
+    const struct imgfs_index* hot = &imgfs_file->index;
+    uint32_t i = imgfs_index_next_valid(hot, *cursor);
+    for(; i < imgfs_file->header.max_files && *nb_images < max_images; i = imgfs_index_next_valid(hot, i + 1)) {
+        // the size filter is checked on the index first: the records of the filtered out images are not read
+        if(options != NULL && (hot->orig_size[i] < options->min_size || hot->orig_size[i] > options->max_size)) continue;
+        if(!list_options_match(options, &imgfs_file->metadata[i])) continue;
+
+        images[(*nb_images)++] = imgfs_file->metadata[i];
     }
 
+    *cursor = MIN(i, imgfs_file->header.max_files);
     return ERR_NONE;
 }
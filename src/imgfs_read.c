@@ -1,47 +1,82 @@
-#include "imgfs.h"
-#include "image_content.h"
-
-#include <string.h>
-#include <stdlib.h>
-#include <stdio.h>
-
-int do_read(const char* img_id, int resolution, char** image_buffer, uint32_t* image_size, struct imgfs_file* imgfs_file)
-{
-    M_REQUIRE_NON_NULL(imgfs_file);
-    M_REQUIRE_NON_NULL(img_id);
-    M_REQUIRE_NON_NULL(image_size);
-    M_REQUIRE_NON_NULL(image_buffer);
-    M_REQUIRE_NON_NULL(imgfs_file->file);
-    M_REQUIRE_NON_NULL(imgfs_file->metadata);
-
-    if(!(0 <= resolution && resolution <= 2)) return ERR_INVALID_ARGUMENT;
-
-    for(size_t i = 0; i < imgfs_file->header.max_files; ++i) {
-        if(!strcmp(imgfs_file->metadata[i].img_id, img_id)) {
-            int ret = ERR_NONE;
-            if((ret = lazily_resize(resolution, imgfs_file, i)) != ERR_NONE) {
-                return ret;
-            }
-
-            uint32_t size = imgfs_file->metadata[i].size[resolution];
-            uint64_t offset = imgfs_file->metadata[i].offset[resolution];
-
-            char* buffer = NULL;
-
-            if((buffer = calloc(size, sizeof(char))) == NULL) return ERR_OUT_OF_MEMORY;
-
-            if(fseek(imgfs_file->file, offset, SEEK_SET) == -1
-               || fread(buffer, sizeof(char), size, imgfs_file->file) != size) {
-                free(buffer);
-                return ERR_IO;
-            }
-
-            *image_size = size;
-            *image_buffer = buffer;
-
-            return ERR_NONE;
-        }
-    }
-
-    return ERR_IMAGE_NOT_FOUND;
-}
\ No newline at end of file
+#include "imgfs.h"
+#include "image_content.h"
+#include "trace.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+int do_read(const char* img_id, int resolution, char** image_buffer, uint32_t* image_size, struct imgfs_file* imgfs_file)
+{
+    // the whole image is the range from its first byte, as long as it is
+    int ret = do_read_range(img_id, resolution, &(int64_t) {0}, &(uint32_t) {UINT32_MAX},
+                            image_buffer, image_size, imgfs_file);
+
+    // which an empty image has no byte of
+    if(ret == ERR_RANGE && *image_size == 0) {
+        if((*image_buffer = calloc(1UL, sizeof(char))) == NULL) return ERR_OUT_OF_MEMORY;
+        ret = ERR_NONE;
+    }
+    return ret;
+}
+
+int do_read_range(const char* img_id, int resolution, int64_t* first, uint32_t* len,
+                  char** image_buffer, uint32_t* image_size, struct imgfs_file* imgfs_file)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(img_id);
+    M_REQUIRE_NON_NULL(first);
+    M_REQUIRE_NON_NULL(len);
+    M_REQUIRE_NON_NULL(image_size);
+    M_REQUIRE_NON_NULL(image_buffer);
+    M_REQUIRE_NON_NULL(imgfs_file->file);
+    M_REQUIRE_NON_NULL(imgfs_file->metadata);
+
+    if(!(0 <= resolution && resolution < NB_RES)) return ERR_INVALID_ARGUMENT;
+
+    uint32_t index = 0;
+    int ret = ERR_NONE;
+    if((ret = find_image(img_id, imgfs_file, &index)) != ERR_NONE) return ret;
+    const uint64_t resize_start = trace_now();
+    if((ret = lazily_resize(resolution, imgfs_file, index)) != ERR_NONE) return ret;
+    trace_phase("resize", resize_start);
+
+    const uint32_t size = imgfs_file->metadata[index].size[resolution];
+    *image_size = size;
+
+    // a suffix longer than the image is the whole image
+    if(*first < 0) *first = *first + size < 0 ? 0 : *first + size;
+    if(*first >= size) return ERR_RANGE;
+
+    *len = MIN(*len, size - (uint32_t) *first);
+    if(*len == 0) return ERR_RANGE;
+
+    char* buffer = calloc(*len, sizeof(char));
+    if(buffer == NULL) return ERR_OUT_OF_MEMORY;
+
+    const uint64_t fread_start = trace_now();
+    if(fseek(imgfs_file->file, (long) (imgfs_file->metadata[index].offset[resolution] + (uint64_t) *first), SEEK_SET) == -1
+       || fread(buffer, sizeof(char), *len, imgfs_file->file) != *len) {
+        free(buffer);
+        return ERR_IO;
+    }
+    trace_phase("fread", fread_start);
+
+    *image_buffer = buffer;
+    return ERR_NONE;
+}
+
+int do_stat(const char* img_id, struct img_metadata* metadata, const struct imgfs_file* imgfs_file)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(img_id);
+    M_REQUIRE_NON_NULL(metadata);
+    M_REQUIRE_NON_NULL(imgfs_file->metadata);
+
+    uint32_t index = 0;
+    const int ret = find_image(img_id, imgfs_file, &index);
+    if(ret != ERR_NONE) return ret;
+
+    *metadata = imgfs_file->metadata[index];
+    return ERR_NONE;
+}
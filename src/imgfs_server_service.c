@@ -5,29 +5,187 @@
  * @author Konstantinos Prasopoulos
  */
 
+#include <ctype.h> // isdigit
+#include <errno.h>
+#include <inttypes.h> // PRIu64
+#include <limits.h> // ULLONG_MAX
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h> // uint16_t
+#include <signal.h> // SIGUSR1
+#include <time.h> // clock_gettime
 #include <vips/vips.h>
-#include <pthread.h>
 
 #include "util.h" // atouint16
 #include "imgfs.h"
+#include "imgfs_volumes.h"
 #include "http_net.h"
+#include "json_writer.h"
+#include "metrics.h"
+#include "trace.h"
 #include "imgfs_server_service.h"
 
-// Main in-memory structure for imgFS
-static struct imgfs_file fs_file;
+// Main in-memory structure for imgFS: the volumes and their locks
+static struct imgfs_volumes volumes;
 static uint16_t server_port;
+// the maximal distance of the perceptual deduplication of the inserts, 0 for the exact one only
+static uint32_t near_dedup_distance;
+
+// the periodic sync of the volumes (see -sync_interval): the thread wakes up every interval_ms
+// to sync the writes left pending since, until server_shutdown() sets stopping
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t stop;
+    uint32_t interval_ms;
+    int started;
+    int stopping;
+    pthread_t thread;
+} flusher = {.lock = PTHREAD_MUTEX_INITIALIZER, .stop = PTHREAD_COND_INITIALIZER};
 
 #define URI_ROOT "/imgfs"
 
-pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+// the number of images copied under the lock of a volume when listing
+#define LIST_PAGE_SIZE  1024
+// the maximal length of the numeric variables of a listing
+#define LIST_VAR_LENGTH 20
+#define LIST_HEADERS    "Content-Type: application/json" HTTP_LINE_DELIM
+
+#define READ_HEADERS    "Content-Type: image/jpeg" HTTP_LINE_DELIM "Accept-Ranges: bytes" HTTP_LINE_DELIM
+#define READ_HEADERS_MAX_LENGTH 384
+// the prefix of the ranges of bytes, and the maximal length of a Range header handled
+#define RANGE_UNIT      "bytes="
+#define RANGE_MAX_LENGTH 64
+// an ID may be deleted then inserted again with another content: the copies kept by the
+// caches are always revalidated, which the ETag makes cheap (304 answered from the metadata)
+#define READ_CACHE_CONTROL "Cache-Control: public, no-cache" HTTP_LINE_DELIM
+// "<hex SHA>-<resolution>", quoted
+#define ETAG_MAX_LENGTH (2 * SHA256_DIGEST_LENGTH + 10)
+
+// the near-duplicates of an image, see handle_similar_call()
+#define SIMILAR_HEADERS "Content-Type: application/json" HTTP_LINE_DELIM
+
+#define METRICS_URI     "/metrics"
+#define METRICS_HEADERS "Content-Type: text/plain; version=0.0.4" HTTP_LINE_DELIM
+// the phases of the last requests, also written to TRACE_FILE on SIGUSR1
+#define TRACE_URI       "/trace"
+#define TRACE_HEADERS   "Content-Type: application/json" HTTP_LINE_DELIM
+#define TRACE_FILE      "imgfs_trace.json"
+
+/**
+ * @brief Reads a port number: digits only, from 1 to 65535
+ * @return (int) : ERR_NONE, or ERR_INVALID_ARGUMENT if the value is not a valid port
+*/
+static int parse_port(const char* value, uint16_t* port)
+{
+    if(!isdigit((unsigned char) value[0])) return ERR_INVALID_ARGUMENT;
+    *port = atouint16(value);
+    return errno == ERANGE || *port == 0 ? ERR_INVALID_ARGUMENT : ERR_NONE;
+}
+
+/**
+ * @brief Reads an option of the server: "-port <port>" (see parse_port()), "-idle_timeout <ms>", "-max_requests <n>"
+ * or "-max_connections <n>", 0 meaning no limit, "-address <address>", "-backlog <n>"
+ * or "-listeners <n>" (see struct http_options), "-nodelay <0|1>", "-send_buffer <bytes>",
+ * "-receive_buffer <bytes>", "-defer_accept <s>" or "-cork <0|1>" (see struct tcp_options),
+ * "-trace <0|1>" (whether the phases of the requests are traced, see trace.h),
+ * "-near_dedup <bits>" (the inserts take the content of an image whose perceptual hash is at most
+ * this Hamming distance away, see DEDUP_PERCEPTUAL; 0, the default, for the exact deduplication only),
+ * "-sync_interval <ms>" (the writes are synced to the disk at most about twice this interval later,
+ * see DURABILITY_PERIODIC; 0, the default, for no explicit sync).
+ * @return (int) : ERR_NONE, ERR_INVALID_COMMAND for an unknown option or ERR_INVALID_ARGUMENT for an invalid value
+*/
+static int parse_server_option(const char* name, const char* value, struct http_options* options)
+{
+    if(!strcmp(name, "-port")) return parse_port(value, &server_port);
+    if(!strcmp(name, "-address")) {
+        options->address = value;
+        return ERR_NONE;
+    }
+    if(!strcmp(name, "-near_dedup")) {
+        near_dedup_distance = atouint32(value);
+        return errno == ERANGE || near_dedup_distance > 64 ? ERR_INVALID_ARGUMENT : ERR_NONE;
+    }
+    if(!strcmp(name, "-sync_interval")) {
+        flusher.interval_ms = atouint32(value);
+        return errno == ERANGE ? ERR_INVALID_ARGUMENT : ERR_NONE;
+    }
+    if(!strcmp(name, "-trace")) {
+        const uint32_t trace = atouint32(value);
+        if(errno == ERANGE) return ERR_INVALID_ARGUMENT;
+        trace_enable(trace != 0);
+        return ERR_NONE;
+    }
+
+    const struct {
+        const char* name;
+        unsigned int* value;
+    } server_options[] = {
+        {"-idle_timeout", &options->idle_timeout_ms},
+        {"-max_requests", &options->max_requests},
+        {"-max_connections", &options->max_connections},
+        {"-backlog", &options->backlog},
+        {"-listeners", &options->nb_listeners},
+        {"-nodelay", &options->tcp.nodelay},
+        {"-send_buffer", &options->tcp.send_buffer},
+        {"-receive_buffer", &options->tcp.receive_buffer},
+        {"-defer_accept", &options->tcp.defer_accept_s},
+        {"-cork", &options->tcp.cork}
+    };
+
+    for(size_t o = 0; o < sizeof(server_options) / sizeof(server_options[0]); ++o) {
+        if(strcmp(name, server_options[o].name)) continue;
+
+        const uint32_t read = atouint32(value);
+        if(errno == ERANGE) return ERR_INVALID_ARGUMENT;
+        *server_options[o].value = read;
+        return ERR_NONE;
+    }
+    return ERR_INVALID_COMMAND;
+}
+
+/**
+ * @brief The loop of the thread syncing the volumes every flusher.interval_ms, until server_shutdown()
+ * (do_commit() only syncs on a write: without it, the last writes before a pause would stay unsynced)
+ */
+static void* flush_loop(void* arg _unused)
+{
+    // SIGINT and SIGTERM are handled by the main thread
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT );
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    pthread_mutex_lock(&flusher.lock);
+    while(!flusher.stopping) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += flusher.interval_ms / 1000;
+        deadline.tv_nsec += (long) (flusher.interval_ms % 1000) * 1000000L;
+        if(deadline.tv_nsec >= 1000000000L) {
+            ++deadline.tv_sec;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        if(pthread_cond_timedwait(&flusher.stop, &flusher.lock, &deadline) != ETIMEDOUT) continue;
+
+        pthread_mutex_unlock(&flusher.lock);
+        const int ret = volumes_sync_due(&volumes);
+        if(ret != ERR_NONE) fprintf(stderr, "flush_loop(): could not sync the volumes: %s\n", ERR_MSG(ret));
+        pthread_mutex_lock(&flusher.lock);
+    }
+    pthread_mutex_unlock(&flusher.lock);
+
+    return NULL;
+}
 
 /********************************************************************//**
  * Startup function. Create imgFS file and load in-memory structure.
- * Pass the imgFS file name as argv[1] and optionnaly port number as argv[2]
+ * Pass the imgFS file name as argv[1], optionnaly followed by the file
+ * names of further volumes, by the port number and by options of the
+ * connections (see parse_server_option()). An argument starting with a
+ * digit is the port (see parse_port()), which "-port" also sets.
  ********************************************************************** */
 int server_startup (int argc, char **argv)
 {
@@ -36,31 +194,49 @@ int server_startup (int argc, char **argv)
     M_REQUIRE_NON_NULL(argv[0]);
     M_REQUIRE_NON_NULL(argv[1]);
 
+    // before any other thread is created (by VIPS or for the connections): they inherit the signal blocked
+    int ret = trace_dump_on_signal(SIGUSR1, TRACE_FILE);
+    if(ret != ERR_NONE) return ret;
+
     VIPS_INIT(argv[0]);
 
     ++argv; --argc;
 
-    if(pthread_mutex_init(&global_lock, NULL) != 0) return ERR_RUNTIME;
-
     server_port = DEFAULT_LISTENING_PORT;
 
-    int ret = ERR_NONE;
-    if((ret = do_open(*(argv++), "rb+", &fs_file)) != ERR_NONE) return ret;
+    const char* filenames[MAX_VOLUMES] = {*(argv++)};
+    size_t nb_volumes = 1;
     --argc;
 
-    print_header(&fs_file.header);
+    struct http_options options;
+    http_options_init(&options);
 
     while(argc--) {
         char* i = *(argv++);
         if(i == NULL) {
             return ERR_INVALID_COMMAND;
-        } else {
-            server_port = atouint16(i);
-            if(!server_port) return ERR_INVALID_ARGUMENT;
-        }
+        } else if(i[0] == '-') {
+            if(argc-- == 0) return ERR_NOT_ENOUGH_ARGUMENTS;
+            if((ret = parse_server_option(i, *(argv++), &options)) != ERR_NONE) return ret;
+        } else if(isdigit((unsigned char) i[0])) {
+            if((ret = parse_port(i, &server_port)) != ERR_NONE) return ret;
+        } else if(nb_volumes < MAX_VOLUMES) {
+            filenames[nb_volumes++] = i;
+        } else return ERR_INVALID_ARGUMENT;
     }
 
-    if((ret = http_init(server_port, handle_http_message)) <= 0) return ERR_RUNTIME;
+    if((ret = volumes_open(filenames, nb_volumes, "rb+", &volumes)) != ERR_NONE) return ret;
+    if(near_dedup_distance != 0
+       && (ret = volumes_set_dedup(&volumes, DEDUP_PERCEPTUAL, near_dedup_distance)) != ERR_NONE) return ret;
+    if(flusher.interval_ms != 0) {
+        if((ret = volumes_set_durability(&volumes, DURABILITY_PERIODIC, flusher.interval_ms)) != ERR_NONE) return ret;
+        if(pthread_create(&flusher.thread, NULL, flush_loop, NULL) != 0) return ERR_THREADING;
+        flusher.started = 1;
+    }
+
+    for(size_t v = 0; v < volumes.nb_volumes; ++v) print_header(&volumes.files[v].header);
+
+    if((ret = http_init(server_port, handle_http_message, &options)) <= 0) return ERR_RUNTIME;
     printf("ImgFS server started on http://localhost: %u", server_port);
 
     return ERR_NONE;
@@ -73,8 +249,16 @@ void server_shutdown (void)
 {
     fprintf(stderr, "Shutting down...\n");
     http_close();
-    do_close(&fs_file);
-    pthread_mutex_destroy(&global_lock);
+    if(flusher.started) {
+        pthread_mutex_lock(&flusher.lock);
+        flusher.stopping = 1;
+        pthread_cond_signal(&flusher.stop);
+        pthread_mutex_unlock(&flusher.lock);
+        pthread_join(flusher.thread, NULL);
+        flusher.started = 0;
+    }
+    // the writes still pending are synced on closing
+    volumes_close(&volumes);
     vips_shutdown();
 }
 
@@ -108,28 +292,96 @@ static int reply_302_msg(int connection)
 }
 
 /**********************************************************************
- * Simple handling of http message. TO BE UPDATED WEEK 13
+ * Sends the metrics of the server, in the Prometheus text format.
  ********************************************************************** */
-int handle_http_message(struct http_message* msg, int connection)
+static int handle_metrics_call(int connection)
 {
-    M_REQUIRE_NON_NULL(msg);
-    debug_printf("handle_http_message() on connection %d. URI: %.*s\n",
-                 connection,
-                 (int) msg->uri.len, msg->uri.val);
+    char* text = NULL;
+    size_t len = 0;
+    int ret = metrics_expose(&text, &len);
+    if(ret != ERR_NONE) {
+        const int sent = reply_error_msg(connection, ret);
+        return sent != ERR_NONE ? sent : ret;
+    }
 
+    ret = http_reply(connection, HTTP_OK, METRICS_HEADERS, text, len);
+    free(text);
+    return ret;
+}
 
+/**********************************************************************
+ * Sends the phases of the last requests, as a Chrome trace.
+ ********************************************************************** */
+static int handle_trace_call(int connection)
+{
+    char* json = NULL;
+    size_t len = 0;
+    int ret = trace_dump(&json, &len);
+    if(ret != ERR_NONE) {
+        const int sent = reply_error_msg(connection, ret);
+        return sent != ERR_NONE ? sent : ret;
+    }
+
+    ret = http_reply(connection, HTTP_OK, TRACE_HEADERS, json, len);
+    free(json);
+    return ret;
+}
+
+/**
+ * @brief Serves a request according to its URI
+ * @param route (enum metrics_route*) : where to store the route of the request, for its metrics
+ * @return (int) : the error code of the handler
+*/
+static int dispatch_http_message(struct http_message* msg, int connection, enum metrics_route* route)
+{
     if (http_match_verb(&msg->uri, "/") || http_match_uri(msg, "/index.html")) {
+        *route = ROUTE_INDEX;
         return http_serve_file(connection, BASE_FILE);
     } else if(http_match_uri(msg, URI_ROOT "/list")) {
-        return handle_list_call(connection);
+        *route = ROUTE_LIST;
+        return handle_list_call(&msg->uri, connection);
     } else if(http_match_uri(msg, URI_ROOT "/insert") && http_match_verb(&msg->method, "POST")) {
+        *route = ROUTE_INSERT;
         return handle_insert_call(msg, connection);
     } else if(http_match_uri(msg, URI_ROOT "/read")) {
-        return handle_read_call(&(msg->uri), connection);
+        *route = ROUTE_READ;
+        return handle_read_call(msg, connection);
     } else if(http_match_uri(msg, URI_ROOT "/delete")) {
+        *route = ROUTE_DELETE;
         return handle_delete_call(msg, connection);
-    } else
-        return reply_error_msg(connection, ERR_INVALID_COMMAND);
+    } else if(http_match_uri(msg, URI_ROOT "/similar")) {
+        *route = ROUTE_SIMILAR;
+        return handle_similar_call(&msg->uri, connection);
+    } else if(http_match_uri(msg, METRICS_URI)) {
+        *route = ROUTE_METRICS;
+        return handle_metrics_call(connection);
+    } else if(http_match_uri(msg, TRACE_URI)) {
+        *route = ROUTE_TRACE;
+        return handle_trace_call(connection);
+    }
+
+    *route = ROUTE_OTHER;
+    return reply_error_msg(connection, ERR_INVALID_COMMAND);
+}
+
+/**********************************************************************
+ * Simple handling of http message, timed for the metrics of its route.
+ ********************************************************************** */
+int handle_http_message(struct http_message* msg, int connection)
+{
+    M_REQUIRE_NON_NULL(msg);
+    debug_printf("handle_http_message() on connection %d. URI: %.*s\n",
+                 connection,
+                 (int) msg->uri.len, msg->uri.val);
+
+    const uint64_t start = metrics_now_ns();
+    const size_t sent_bytes = http_sent_bytes();
+    enum metrics_route route = ROUTE_OTHER;
+
+    const int ret = dispatch_http_message(msg, connection, &route);
+
+    metrics_request(route, ret, http_sent_bytes() - sent_bytes, metrics_now_ns() - start);
+    return ret;
 }
 
 /**
@@ -202,37 +454,323 @@ struct return_value_of_return_correct_header return_correct_header(char* key, si
     return return_value;
 };
 
-int handle_list_call(int connection)
+/**
+ * @brief json_sink of the list replies: every flush of the JSON writer is sent as one chunk
+ * @param context (void*) : a pointer to the connection
+*/
+static int send_json_chunk(void* context, const char* data, size_t len)
 {
-    if(connection <= 0) return ERR_INVALID_ARGUMENT;
+    return http_send_chunk(*(const int*) context, data, len);
+}
 
-    char* json = NULL;
+/**
+ * @brief Reads an optional variable from the URI.
+ * @param name (const char*) : the name of the variable
+ * @param out (char*) : where to store it, null terminated, left untouched if the variable is absent
+ * @param out_len (size_t) : the size of out
+ * @return (int) : ERR_NONE, or ERR_INVALID_ARGUMENT if the value is too long
+*/
+static int get_optional_var(const struct http_string* uri, const char* name, char* out, size_t out_len)
+{
+    // http_get_var() fails on a URI without variables
+    if(memchr(uri->val, '?', uri->len) == NULL) return ERR_NONE;
+
+    char buffer[MAX_IMG_ID + 1];
+    zero_init_var(buffer);
+
+    const int ret = http_get_var(uri, name, buffer, MIN(out_len, sizeof(buffer)));
+    if(ret < 0) return ERR_INVALID_ARGUMENT;
+    if(ret > 0) memcpy(out, buffer, (size_t) ret + 1);
+    return ERR_NONE;
+}
+
+/**
+ * @brief Reads an optional unsigned integer from the URI.
+ * @param name (const char*) : the name of the variable
+ * @param value (uint64_t*) : where to store it, left untouched if the variable is absent
+ * @param max (uint64_t) : the maximal value
+ * @return (int) : ERR_NONE, or ERR_INVALID_ARGUMENT if the value is not an unsigned integer up to max
+*/
+static int get_uint_var(const struct http_string* uri, const char* name, uint64_t* value, uint64_t max)
+{
+    char buffer[LIST_VAR_LENGTH + 1];
+    zero_init_var(buffer);
 
-    if(pthread_mutex_lock(&global_lock) != 0)
-        return return_and_garbage_collect_call(connection, NULL, NULL, ERR_RUNTIME, NULL);
-    int ret = do_list(&fs_file, JSON, &json);
-    if(pthread_mutex_unlock(&global_lock) != 0)
-        return return_and_garbage_collect_call(connection, NULL, NULL, ERR_RUNTIME, NULL);
+    const int ret = get_optional_var(uri, name, buffer, sizeof(buffer));
+    if(ret != ERR_NONE || buffer[0] == '\0') return ret;
 
-    if(ret < 0) return return_and_garbage_collect_call(connection, json, NULL, ret, NULL);
+    const uint64_t read = atouint64(buffer);
+    if(errno == ERANGE || read > max) return ERR_INVALID_ARGUMENT;
 
-    struct return_value_of_return_correct_header headers = return_correct_header("Content-Type: ", 14, "application/json", 16);
-    if(headers.error_code < 0)
-        return return_and_garbage_collect_call(connection, json, headers.string_of_return, ERR_RUNTIME, NULL);
+    *value = read;
+    return ERR_NONE;
+}
 
-    ret = http_reply(connection, HTTP_OK, headers.string_of_return, json, strlen(json));
-    if(ret != ERR_NONE)
-        return return_and_garbage_collect_call(connection, json, headers.string_of_return, ret, NULL);
+/**
+ * @brief Reads the fields ("fields", a comma separated list of orig_res, size and resolutions, or all)
+ * and the filters ("prefix" of the IDs, "min_size" and "max_size" of the original images) of a listing from the URI.
+ * @return (int) : ERR_NONE, or ERR_INVALID_ARGUMENT if a variable is invalid
+*/
+static int get_list_options(const struct http_string* uri, struct list_options* options)
+{
+    list_options_init(options);
 
-    free(json);
-    free(headers.string_of_return);
+    char fields[LIST_VAR_LENGTH * 2 + 1];
+    zero_init_var(fields);
+    uint64_t min_size = 0;
+    uint64_t max_size = UINT32_MAX;
+
+    int ret = ERR_NONE;
+    if((ret = get_optional_var(uri, "fields", fields, sizeof(fields))) != ERR_NONE
+       || (ret = get_optional_var(uri, "prefix", options->prefix, sizeof(options->prefix))) != ERR_NONE
+       || (ret = get_uint_var(uri, "min_size", &min_size, UINT32_MAX)) != ERR_NONE
+       || (ret = get_uint_var(uri, "max_size", &max_size, UINT32_MAX)) != ERR_NONE) return ret;
+
+    options->min_size = (uint32_t) min_size;
+    options->max_size = (uint32_t) max_size;
+
+    char* save = NULL;
+    for(char* field = strtok_r(fields, ",", &save); field != NULL; field = strtok_r(NULL, ",", &save)) {
+        if(!strcmp(field, "orig_res")) options->fields |= LIST_FIELD_ORIG_RES;
+        else if(!strcmp(field, "size")) options->fields |= LIST_FIELD_SIZE;
+        else if(!strcmp(field, "resolutions")) options->fields |= LIST_FIELD_RESOLUTIONS;
+        else if(!strcmp(field, "all")) options->fields |= LIST_FIELDS_ALL;
+        else return ERR_INVALID_ARGUMENT;
+    }
 
     return ERR_NONE;
 }
 
-int handle_read_call(struct http_string* uri, int connection)
+/**
+ * @brief Lists the images, by pages of at most LIST_PAGE_SIZE images, each of them copied under
+ * the lock of its volume only. The images are written by a JSON writer: a list which holds in one page
+ * is sent as before, with its length; a longer one is streamed in chunks as the pages are read,
+ * without the whole list ever being in memory.
+ * With the "limit" variable, at most limit images are listed, starting at the "cursor" variable (0 by default);
+ * the reply then gives in "next" the cursor of the following images, if any.
+ * See get_list_options() for the fields and filters.
+*/
+int handle_list_call(const struct http_string* uri, int connection)
+{
+    M_REQUIRE_NON_NULL(uri);
+    if(connection <= 0) return ERR_INVALID_ARGUMENT;
+
+    uint64_t limit = 0;
+    uint64_t cursor = 0;
+    struct list_options options;
+    int ret = ERR_NONE;
+    if((ret = get_uint_var(uri, "limit", &limit, UINT64_MAX)) != ERR_NONE
+       || (ret = get_uint_var(uri, "cursor", &cursor, UINT64_MAX)) != ERR_NONE
+       || (ret = get_list_options(uri, &options)) != ERR_NONE)
+        return reply_error_msg(connection, ret);
+
+    struct img_metadata* images = calloc(LIST_PAGE_SIZE, sizeof(*images));
+    if(images == NULL) return reply_error_msg(connection, ERR_OUT_OF_MEMORY);
+
+    uint64_t nb_listed = 0;
+    size_t nb_images = 0;
+    ret = volumes_list_page(&volumes, &options, &cursor, limit == 0 ? LIST_PAGE_SIZE : MIN(limit, LIST_PAGE_SIZE),
+                            images, &nb_images);
+    if(ret != ERR_NONE) {
+        free(images);
+        return reply_error_msg(connection, ret);
+    }
+
+    const int streamed = cursor != VOLUMES_CURSOR_END && (limit == 0 || nb_images < limit);
+    struct json_writer writer;
+    if((ret = json_writer_init(&writer, streamed ? send_json_chunk : NULL, &connection)) != ERR_NONE) {
+        free(images);
+        return reply_error_msg(connection, ret);
+    }
+
+    if(streamed && (ret = http_reply_chunked(connection, HTTP_OK, LIST_HEADERS)) != ERR_NONE) {
+        free(images);
+        json_writer_free(&writer);
+        return ret;
+    }
+
+    json_begin_object(&writer);
+    json_key(&writer, "Images");
+    json_begin_array(&writer);
+    while(ret == ERR_NONE) {
+        for(size_t i = 0; i < nb_images; ++i) do_list_entry_json(&writer, &images[i], options.fields);
+        nb_listed += nb_images;
+
+        if(writer.error != ERR_NONE || cursor == VOLUMES_CURSOR_END || (limit != 0 && nb_listed >= limit)) break;
+        ret = volumes_list_page(&volumes, &options, &cursor,
+                                limit == 0 ? LIST_PAGE_SIZE : MIN(limit - nb_listed, LIST_PAGE_SIZE), images, &nb_images);
+    }
+    json_end_array(&writer);
+
+    if(limit != 0 && cursor != VOLUMES_CURSOR_END) {
+        char next[LIST_VAR_LENGTH + 1];
+        snprintf(next, sizeof(next), "%" PRIu64, cursor);
+        json_key(&writer, "next");
+        json_string(&writer, next, sizeof(next));
+    }
+    json_end_object(&writer);
+    free(images);
+
+    if(ret == ERR_NONE) ret = writer.error;
+
+    if(!streamed) {
+        ret = ret != ERR_NONE ? reply_error_msg(connection, ret)
+              : http_reply(connection, HTTP_OK, LIST_HEADERS, writer.buffer, writer.len);
+    } else if(ret == ERR_NONE && (ret = json_writer_flush(&writer)) == ERR_NONE) {
+        ret = http_send_chunk(connection, NULL, 0);
+    }
+    // once a chunked reply is started, an error can only be signaled by closing the connection
+    // before the last chunk: the error code returned does so
+
+    json_writer_free(&writer);
+    return ret;
+}
+
+/**
+ * @brief Lists the near-duplicates of the image of ID "img_id": the images whose perceptual hash is at most
+ * "max_distance" bits (DEFAULT_SIMILAR_DISTANCE by default) away from its own, the closest first, at most
+ * "limit" of them (SIMILAR_MAX_MATCHES by default), as {"Images": [{"img_id": ..., "distance": ...}, ...]}.
+*/
+int handle_similar_call(const struct http_string* uri, int connection)
 {
     M_REQUIRE_NON_NULL(uri);
+    if(connection <= 0) return ERR_INVALID_ARGUMENT;
+
+    char img_id[MAX_IMG_ID + 1];
+    zero_init_var(img_id);
+    if(http_get_var(uri, "img_id", img_id, MAX_IMG_ID) <= 0) return reply_error_msg(connection, ERR_NOT_ENOUGH_ARGUMENTS);
+
+    uint64_t max_distance = DEFAULT_SIMILAR_DISTANCE;
+    uint64_t limit = SIMILAR_MAX_MATCHES;
+    int ret = ERR_NONE;
+    if((ret = get_uint_var(uri, "max_distance", &max_distance, 64)) != ERR_NONE
+       || (ret = get_uint_var(uri, "limit", &limit, SIMILAR_MAX_MATCHES)) != ERR_NONE)
+        return reply_error_msg(connection, ret);
+
+    struct similar_match matches[SIMILAR_MAX_MATCHES];
+    size_t nb_matches = 0;
+    if((ret = volumes_similar(img_id, (uint32_t) max_distance, matches, (size_t) limit, &nb_matches, &volumes)) != ERR_NONE)
+        return reply_error_msg(connection, ret);
+
+    struct json_writer writer;
+    if((ret = json_writer_init(&writer, NULL, NULL)) != ERR_NONE) return reply_error_msg(connection, ret);
+
+    json_begin_object(&writer);
+    json_key(&writer, "Images");
+    json_begin_array(&writer);
+    for(size_t i = 0; i < nb_matches; ++i) {
+        json_begin_object(&writer);
+        json_key(&writer, "img_id");
+        json_string(&writer, matches[i].img_id, MAX_IMG_ID + 1);
+        json_key(&writer, "distance");
+        json_uint(&writer, matches[i].distance);
+        json_end_object(&writer);
+    }
+    json_end_array(&writer);
+    json_end_object(&writer);
+
+    ret = writer.error != ERR_NONE ? reply_error_msg(connection, writer.error)
+          : http_reply(connection, HTTP_OK, SIMILAR_HEADERS, writer.buffer, writer.len);
+    json_writer_free(&writer);
+    return ret;
+}
+
+/**
+ * @brief Makes the ETag of an image at a resolution: its content is fully determined by the SHA of the original.
+ * @param etag (char*) : where to write it, ETAG_MAX_LENGTH + 1 bytes
+*/
+static void make_etag(const struct img_metadata* metadata, int resolution, char* etag)
+{
+    static const char* const resolution_names[NB_RES] = {"thumb", "small", "orig"};
+
+    char* out = etag;
+    *out++ = '"';
+    for(size_t i = 0; i < SHA256_DIGEST_LENGTH; ++i) out += sprintf(out, "%02x", metadata->SHA[i]);
+    snprintf(out, ETAG_MAX_LENGTH + 1 - (size_t) (out - etag), "-%s\"", resolution_names[resolution]);
+}
+
+/**
+ * @brief Whether the value of an If-None-Match header ("*" or a comma separated list of
+ * entity tags, weak or not) matches the ETag of an existing image (weak comparison).
+*/
+static int etag_matches(const struct http_string* value, const char* etag)
+{
+    const size_t etag_len = strlen(etag);
+    size_t i = 0;
+    while(i < value->len) {
+        while(i < value->len && memchr(" \t,", value->val[i], 3) != NULL) ++i;
+        if(i == value->len) break;
+        if(value->val[i] == '*') return 1;
+        if(value->len - i > 2 && !strncmp(value->val + i, "W/", 2)) i += 2;
+
+        const char* tag = value->val + i;
+        const char* end = NULL;
+        if(tag[0] == '"') end = memchr(tag + 1, '"', value->len - i - 1);
+        if(end == NULL) return 0;
+
+        if((size_t) (end - tag + 1) == etag_len && !memcmp(tag, etag, etag_len)) return 1;
+        i += (size_t) (end - tag + 1);
+    }
+    return 0;
+}
+
+/**
+ * @brief Whether the value of an If-Range header is the ETag of the image (strong comparison: a weak
+ * entity tag, or a date, which no Last-Modified was sent for, never matches)
+*/
+static int if_range_matches(const struct http_string* value, const char* etag)
+{
+    size_t first = 0;
+    size_t last = value->len;
+    while(first < last && memchr(" \t", value->val[first], 2) != NULL) ++first;
+    while(last > first && memchr(" \t", value->val[last - 1], 2) != NULL) --last;
+
+    return last - first == strlen(etag) && !memcmp(value->val + first, etag, last - first);
+}
+
+/**
+ * @brief Parses the value of a Range header, if it is a single range of bytes ("bytes=first-last",
+ * "bytes=first-" or "bytes=-suffix_length"); anything else is to be ignored, the whole image being then sent.
+ * @param value (const struct http_string*) : the value of the header
+ * @param first (int64_t*) : set to the first byte, negative for a suffix (see do_read_range())
+ * @param len (uint32_t*) : set to the number of bytes
+ * @return (int) : 1 if the range is to be used, 0 if it is to be ignored
+*/
+static int parse_range(const struct http_string* value, int64_t* first, uint32_t* len)
+{
+    char range[RANGE_MAX_LENGTH + 1];
+    if(value->len <= strlen(RANGE_UNIT) || value->len > RANGE_MAX_LENGTH
+       || strncmp(value->val, RANGE_UNIT, strlen(RANGE_UNIT))) return 0;
+
+    memcpy(range, value->val + strlen(RANGE_UNIT), value->len - strlen(RANGE_UNIT));
+    range[value->len - strlen(RANGE_UNIT)] = '\0';
+
+    char* dash = strchr(range, '-');
+    if(dash == NULL || strspn(range, "0123456789-") != strlen(range) || strchr(dash + 1, '-') != NULL) return 0;
+    *dash = '\0';
+
+    errno = 0;
+    if(range[0] == '\0') {
+        // suffix: the last bytes
+        if(dash[1] == '\0') return 0;
+        const unsigned long long suffix = strtoull(dash + 1, NULL, 10);
+        *first = -(int64_t) MIN(suffix, UINT32_MAX);
+        *len = (uint32_t) MIN(suffix, UINT32_MAX);
+    } else {
+        const unsigned long long from = strtoull(range, NULL, 10);
+        const unsigned long long to = dash[1] == '\0' ? ULLONG_MAX : strtoull(dash + 1, NULL, 10);
+        if(to < from) return 0;
+        *first = (int64_t) MIN(from, INT64_MAX);
+        *len = (uint32_t) MIN(to - from, UINT32_MAX - 1) + 1;
+    }
+    return errno == 0;
+}
+
+int handle_read_call(struct http_message* msg, int connection)
+{
+    M_REQUIRE_NON_NULL(msg);
+    const uint64_t start = metrics_now_ns();
+    struct http_string* uri = &msg->uri;
     if(connection <= 0) return return_and_garbage_collect_call(connection, NULL, NULL, ERR_INVALID_ARGUMENT, NULL);
 
     int ret = ERR_NONE;
@@ -257,30 +795,77 @@ int handle_read_call(struct http_string* uri, int connection)
     ret = http_get_var(uri, "img_id", buffer, out_len - 1);
     if(ret <= 0) return return_and_garbage_collect_call(connection, buffer, NULL, ERR_NOT_ENOUGH_ARGUMENTS, NULL);
 
+    // the ETag comes from the metadata only: a revalidation reads no image bytes
+    struct img_metadata metadata;
+    const uint64_t stat_start = trace_now();
+    ret = volumes_stat(buffer, &metadata, &volumes);
+    trace_phase("stat", stat_start);
+    if(ret != ERR_NONE) return return_and_garbage_collect_call(connection, buffer, NULL, ret, NULL);
+
+    char etag[ETAG_MAX_LENGTH + 1];
+    make_etag(&metadata, resolution, etag);
+
+    char headers[READ_HEADERS_MAX_LENGTH];
+    const struct http_string* if_none_match = http_get_header(msg, "If-None-Match");
+    if(if_none_match != NULL && etag_matches(if_none_match, etag)) {
+        free(buffer);
+        snprintf(headers, sizeof(headers), "ETag: %s" HTTP_LINE_DELIM READ_CACHE_CONTROL, etag);
+        return http_reply_no_body(connection, HTTP_NOT_MODIFIED, headers);
+    }
+
     char* image_buffer = NULL;
     uint32_t image_size = 0;
 
-    if(pthread_mutex_lock(&global_lock) != 0)
-        return return_and_garbage_collect_call(connection, buffer, NULL, ERR_RUNTIME, NULL);
-    ret = do_read(buffer, resolution, &image_buffer, &image_size, &fs_file);
-    if(pthread_mutex_unlock(&global_lock) != 0)
-        return return_and_garbage_collect_call(connection, buffer, NULL, ERR_RUNTIME, NULL);
-
-    if(ret != ERR_NONE) return return_and_garbage_collect_call(connection, buffer, NULL, ret, NULL);
+    // with a Range header, only the requested bytes are read from the file, unless an If-Range
+    // header tells that the client holds another version: the whole image is then sent
+    const struct http_string* range = http_get_header(msg, "Range");
+    const struct http_string* if_range = http_get_header(msg, "If-Range");
+    int64_t first = 0;
+    uint32_t len = 0;
+    int partial = range != NULL && (if_range == NULL || if_range_matches(if_range, etag))
+                  && parse_range(range, &first, &len);
+
+    // the image may have been replaced since its stat: the bytes are read with their metadata, under
+    // the lock of their volume, and sent with the ETag of this metadata; a range of another version
+    // than the one of If-Range is read again as the whole image
+    const uint64_t read_start = trace_now();
+    if(partial) {
+        ret = volumes_read_range(buffer, resolution, &first, &len, &image_buffer, &image_size, &metadata, &volumes);
+        if((ret == ERR_NONE || ret == ERR_RANGE) && if_range != NULL) {
+            make_etag(&metadata, resolution, etag);
+            if(!if_range_matches(if_range, etag)) {
+                free(image_buffer);
+                image_buffer = NULL;
+                partial = 0;
+            }
+        }
+    }
+    if(!partial) ret = volumes_read(buffer, resolution, &image_buffer, &image_size, &metadata, &volumes);
+    trace_phase("read", read_start);
 
     free(buffer);
     buffer = NULL;
 
-    struct return_value_of_return_correct_header headers = return_correct_header("Content-Type: ", 14, "image/jpeg", 10);
-    if(headers.error_code < 0)
-        return return_and_garbage_collect_call(connection, image_buffer, headers.string_of_return, ERR_RUNTIME, NULL);
-
-    ret = http_reply(connection, HTTP_OK, headers.string_of_return, image_buffer, image_size);
+    if(ret == ERR_RANGE) {
+        snprintf(headers, sizeof(headers), "Content-Range: bytes */%" PRIu32 HTTP_LINE_DELIM, image_size);
+        return http_reply(connection, HTTP_RANGE_NOT_SATISFIABLE, headers, "", 0);
+    }
+    if(ret != ERR_NONE) return return_and_garbage_collect_call(connection, NULL, NULL, ret, NULL);
+
+    make_etag(&metadata, resolution, etag);
+    const int headers_len = snprintf(headers, sizeof(headers), READ_HEADERS "ETag: %s" HTTP_LINE_DELIM READ_CACHE_CONTROL, etag);
+    if(partial) {
+        snprintf(headers + headers_len, sizeof(headers) - (size_t) headers_len,
+                 "Content-Range: bytes %" PRId64 "-%" PRId64 "/%" PRIu32 HTTP_LINE_DELIM, first, first + len - 1, image_size);
+        ret = http_reply(connection, HTTP_PARTIAL_CONTENT, headers, image_buffer, len);
+    } else {
+        ret = http_reply(connection, HTTP_OK, headers, image_buffer, image_size);
+    }
 
-    if(ret != ERR_NONE) return return_and_garbage_collect_call(connection, image_buffer, headers.string_of_return, ret, NULL);
+    if(ret != ERR_NONE) return return_and_garbage_collect_call(connection, image_buffer, NULL, ret, NULL);
 
-    free(headers.string_of_return);
     free(image_buffer);
+    metrics_read(resolution, metrics_now_ns() - start);
 
     return ERR_NONE;
 }
@@ -366,11 +951,7 @@ int handle_delete_call(struct http_message* msg, int connection)
     int ret = http_get_var(&uri, "img_id", buffer, out_len);
     if(ret <= 0) return return_and_garbage_collect_call(connection, buffer, NULL, ERR_NOT_ENOUGH_ARGUMENTS, NULL);
 
-    if(pthread_mutex_lock(&global_lock) != 0)
-        return return_and_garbage_collect_call(connection, buffer, NULL, ERR_RUNTIME, NULL);
-    ret = do_delete(buffer, &fs_file);
-    if(pthread_mutex_unlock(&global_lock) != 0)
-        return return_and_garbage_collect_call(connection, buffer, NULL, ERR_RUNTIME, NULL);
+    ret = volumes_delete(buffer, &volumes);
 
     free(buffer);
     buffer = NULL;
@@ -399,11 +980,7 @@ int handle_insert_call(struct http_message* msg, int connection)
         return return_and_garbage_collect_call(connection, img_id, NULL, ERR_OUT_OF_MEMORY, NULL);
     memcpy(image, msg->body.val, msg->body.len);
 
-    if(pthread_mutex_lock(&global_lock) != 0)
-        return return_and_garbage_collect_call(connection, img_id, NULL, ERR_RUNTIME, NULL);
-    ret = do_insert(image, msg->body.len, img_id, &fs_file);
-    if(pthread_mutex_unlock(&global_lock) != 0)
-        return return_and_garbage_collect_call(connection, img_id, NULL, ERR_RUNTIME, NULL);
+    ret = volumes_insert(image, msg->body.len, img_id, &volumes);
 
     if(ret != ERR_NONE) return return_and_garbage_collect_call(connection, img_id, image, ret, NULL);
 
@@ -24,10 +24,12 @@ static int reply_302_msg(int connection);
 
 int handle_http_message(struct http_message* msg, int connection);
 
-int handle_list_call(int connection);
+int handle_list_call(const struct http_string* uri, int connection);
 
-int handle_read_call(struct http_string* uri, int connection);
+int handle_read_call(struct http_message* msg, int connection);
 
 int handle_delete_call(struct http_message* msg, int connection);
 
-int handle_insert_call(struct http_message* msg, int connection);
\ No newline at end of file
+int handle_insert_call(struct http_message* msg, int connection);
+
+int handle_similar_call(const struct http_string* uri, int connection);
\ No newline at end of file
@@ -0,0 +1,83 @@
+/**
+ * @file imgfs_sync.c
+ * @brief Durability policies of the imgFS write operations
+ */
+
+#include "imgfs.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @brief Returns the current time of the monotonic clock in milliseconds
+ */
+static uint64_t monotonic_ms(void)
+{
+    struct timespec now;
+    if(clock_gettime(CLOCK_MONOTONIC, &now) == -1) return 0;
+    return (uint64_t) now.tv_sec * 1000UL + (uint64_t) now.tv_nsec / 1000000UL;
+}
+
+int do_set_durability(struct imgfs_file* imgfs_file, enum imgfs_durability durability, uint32_t sync_param)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    if(durability < DURABILITY_NONE || durability >= NB_DURABILITY_MODES) return ERR_INVALID_ARGUMENT;
+
+    if(sync_param == 0) {
+        if(durability == DURABILITY_PERIODIC) sync_param = DEFAULT_SYNC_INTERVAL_MS;
+        else if(durability == DURABILITY_GROUP_COMMIT) sync_param = DEFAULT_SYNC_GROUP_SIZE;
+    }
+
+    imgfs_file->durability = durability;
+    imgfs_file->sync_param = sync_param;
+    imgfs_file->last_sync_ms = monotonic_ms();
+
+    return ERR_NONE;
+}
+
+int do_sync(struct imgfs_file* imgfs_file)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->file);
+
+    if(fflush(imgfs_file->file) == EOF || fdatasync(fileno(imgfs_file->file)) == -1) return ERR_IO;
+
+    imgfs_file->pending_ops = 0;
+    imgfs_file->last_sync_ms = monotonic_ms();
+
+    return ERR_NONE;
+}
+
+int do_sync_due(struct imgfs_file* imgfs_file)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+
+    if(imgfs_file->durability != DURABILITY_PERIODIC || imgfs_file->pending_ops == 0
+       || monotonic_ms() - imgfs_file->last_sync_ms < imgfs_file->sync_param) return ERR_NONE;
+
+    return do_sync(imgfs_file);
+}
+
+int do_commit(struct imgfs_file* imgfs_file)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+
+    ++imgfs_file->pending_ops;
+
+    switch(imgfs_file->durability) {
+    case DURABILITY_PER_OP:
+        return do_sync(imgfs_file);
+    case DURABILITY_PERIODIC:
+        return do_sync_due(imgfs_file);
+    case DURABILITY_GROUP_COMMIT:
+        if(imgfs_file->pending_ops >= imgfs_file->sync_param) return do_sync(imgfs_file);
+        break;
+    case DURABILITY_NONE:
+    case NB_DURABILITY_MODES:
+        break;
+    }
+
+    return ERR_NONE;
+}
@@ -6,6 +6,10 @@
  */
 
 #include "imgfs.h"
+#include "imgfs_format.h"
+#include "imgfs_index.h"
+#include "image_similar.h"
+#include "imgfs_blobs.h"
 #include "util.h"
 
 #include <inttypes.h>      // for PRIxN macros
@@ -57,12 +61,13 @@ void print_metadata (const struct img_metadata* metadata)
     char sha_printable[2 * SHA256_DIGEST_LENGTH + 1];
     sha_to_string(metadata->SHA, sha_printable);
 
+    // the fingerprint keeps the label of the field it took the place of, as in the expected outputs
     printf("IMAGE ID: %s\nSHA: %s\nVALID: %" PRIu16 "\nUNUSED: %" PRIu16 "\n\
 OFFSET ORIG. : %" PRIu64 "\t\tSIZE ORIG. : %" PRIu32 "\n\
 OFFSET THUMB.: %" PRIu64 "\t\tSIZE THUMB.: %" PRIu32 "\n\
 OFFSET SMALL : %" PRIu64 "\t\tSIZE SMALL : %" PRIu32 "\n\
 ORIGINAL: %" PRIu32 " x %" PRIu32 "\n",
-           metadata->img_id, sha_printable, metadata->is_valid, metadata->unused_16, metadata->offset[ORIG_RES],
+           metadata->img_id, sha_printable, metadata->is_valid, metadata->fingerprint, metadata->offset[ORIG_RES],
            metadata->size[ORIG_RES], metadata->offset[THUMB_RES], metadata->size[THUMB_RES],
            metadata->offset[SMALL_RES], metadata->size[SMALL_RES], metadata->orig_res[0], metadata->orig_res[1]);
     printf("*****************************************\n");
@@ -81,6 +86,44 @@ int error_handler(FILE* file, int error_code)
     return error_code;
 }
 
+/**
+ * @brief Follows the chain of extensions of the metadata table from the header.
+ * An extension linked but not yet accounted for in max_files (growth interrupted before the header was written) is ignored.
+ * @param file (FILE*) : the opened imgFS file
+ * @param header (const struct imgfs_header*) : its header
+ * @param extensions (struct extension_region*) : the array of at least MAX_EXTENSIONS regions to fill
+ * @param nb_extensions (uint32_t*) : where to store the number of extensions
+ * @return (int) : ERR_IO if an extension cannot be read, ERR_MAX_FILES if the slots do not add up to max_files, ERR_NONE otherwise
+*/
+static int read_extensions(FILE* file, const struct imgfs_header* header, struct extension_region* extensions, uint32_t* nb_extensions)
+{
+    *nb_extensions = 0;
+    if(header->unused_64 == 0) return ERR_NONE;
+    if(header->unused_32 == 0 || header->unused_32 > header->max_files) return ERR_MAX_FILES;
+
+    uint32_t first_slot = header->unused_32;
+    uint64_t offset = header->unused_64;
+
+    while(offset != 0 && first_slot < header->max_files) {
+        struct imgfs_extension extension;
+        zero_init_var(extension);
+
+        if(*nb_extensions == MAX_EXTENSIONS) return ERR_MAX_FILES;
+        if(fseek(file, (long) offset, SEEK_SET) == -1
+           || fread(&extension, sizeof(struct imgfs_extension), 1UL, file) != 1UL
+           || extension.nb_slots == 0 || extension.nb_slots > header->max_files - first_slot)
+            return ERR_IO;
+
+        struct extension_region region = {first_slot, extension.nb_slots, offset + sizeof(struct imgfs_extension)};
+        extensions[(*nb_extensions)++] = region;
+
+        first_slot += extension.nb_slots;
+        offset = extension.next;
+    }
+
+    return first_slot == header->max_files ? ERR_NONE : ERR_MAX_FILES;
+}
+
 /**
  * @brief This function opens a file in a certain mode and copies all of its content in a given structure, that it its header, and the metadata of the stored images.
  * If one its parameter is initially NULL, the function returns an error.
@@ -104,24 +147,39 @@ int do_open(const char* imgfs_filename, const char* open_mode, struct imgfs_file
     struct imgfs_header header_res;
     zero_init_var(header_res);
     struct img_metadata* metadata_arr_res = NULL;
+    int ret = ERR_NONE;
 
     if(fread(&header_res, sizeof(struct imgfs_header), 1UL, open_file) == 1UL) {
         if(header_res.max_files != 0 && header_res.nb_files <= header_res.max_files) {
-            if((metadata_arr_res = calloc(header_res.max_files, sizeof(struct img_metadata))) == NULL)
+            if((ret = read_extensions(open_file, &header_res, imgfs_file->extensions, &imgfs_file->nb_extensions)) != ERR_NONE)
+                return error_handler(open_file, ret);
+
+            if((metadata_arr_res = imgfs_index_alloc(header_res.max_files, &imgfs_file->index)) == NULL)
                 return error_handler(open_file, ERR_OUT_OF_MEMORY);
 
-            if(fread(metadata_arr_res, sizeof(struct img_metadata), 1UL * header_res.max_files, open_file) != 1UL * header_res.max_files) {
+            if((ret = read_metadata_table(open_file, &header_res, imgfs_file->extensions, imgfs_file->nb_extensions, metadata_arr_res)) != ERR_NONE) {
                 free(metadata_arr_res);
-                return error_handler(open_file, ERR_IO);
+                return error_handler(open_file, ret);
             }
         } else return error_handler(open_file, ERR_MAX_FILES);
     } else return error_handler(open_file, ERR_IO);
 
+    struct blob_table* blobs = blobs_build(header_res.max_files, metadata_arr_res);
+    if(blobs == NULL) {
+        free(metadata_arr_res);
+        return error_handler(open_file, ERR_OUT_OF_MEMORY);
+    }
+
     imgfs_file->file = open_file;
     imgfs_file->header = header_res;
     imgfs_file->metadata = metadata_arr_res;
+    imgfs_file->pending_ops = 0;
+    imgfs_file->similar = NULL;
+    imgfs_file->blobs = blobs;
+    imgfs_index_build(&imgfs_file->index, metadata_arr_res);
+    do_set_dedup(imgfs_file, DEDUP_EXACT, 0);
 
-    return ERR_NONE;
+    return do_set_durability(imgfs_file, DURABILITY_NONE, 0);
 }
 
 /**
@@ -134,14 +192,78 @@ void do_close(struct imgfs_file* imgfs_ptr)
     if(imgfs_ptr != NULL) {
         FILE* file = imgfs_ptr->file;
 
-        if(file != NULL) fclose(file);
-        free(imgfs_ptr->metadata);
+        if(file != NULL && imgfs_ptr->durability != DURABILITY_NONE && imgfs_ptr->pending_ops > 0
+           && do_sync(imgfs_ptr) != ERR_NONE)
+            fprintf(stderr, "do_close(): could not sync the imgFS file, the last writes may be lost\n");
+        if(file != NULL) {
+            fclose(file);
+            // only an opened imgFS has them (the structure may be otherwise uninitialized)
+            similar_close(imgfs_ptr);
+            blobs_free(imgfs_ptr->blobs);
+            imgfs_ptr->blobs = NULL;
+        }
+        free(imgfs_ptr->metadata); // and the index with it
 
         imgfs_ptr->metadata = NULL;
+        zero_init_var(imgfs_ptr->index);
         imgfs_ptr->file = NULL;
     }
 }
 
+uint64_t metadata_offset(const struct imgfs_file* imgfs_file, uint32_t index)
+{
+    const size_t record_size = metadata_record_size(&imgfs_file->header);
+
+    for(uint32_t e = imgfs_file->nb_extensions; e > 0; --e) {
+        const struct extension_region* region = &imgfs_file->extensions[e - 1];
+        if(index >= region->first_slot) return region->offset + 1UL * (index - region->first_slot) * record_size;
+    }
+
+    return sizeof(struct imgfs_header) + 1UL * index * record_size;
+}
+
+int write_metadata(struct imgfs_file* imgfs_file, uint32_t index, const struct img_metadata* metadata)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->file);
+    M_REQUIRE_NON_NULL(metadata);
+
+    if(index >= imgfs_file->header.max_files) return ERR_INVALID_ARGUMENT;
+
+    if(imgfs_format(&imgfs_file->header) == IMGFS_FORMAT_V2) {
+        const int ret = write_record(imgfs_file->file, metadata_offset(imgfs_file, index), metadata);
+        if(ret != ERR_NONE) return ret;
+    } else if(fseek(imgfs_file->file, (long) metadata_offset(imgfs_file, index), SEEK_SET) == -1
+              || fwrite(metadata, sizeof(struct img_metadata), 1UL, imgfs_file->file) != 1UL)
+        return ERR_IO;
+
+    imgfs_index_set(&imgfs_file->index, index, metadata);
+    blobs_set(imgfs_file->blobs, index, metadata);
+
+    return ERR_NONE;
+}
+
+int find_image(const char* img_id, const struct imgfs_file* imgfs_file, uint32_t* index)
+{
+    M_REQUIRE_NON_NULL(img_id);
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->metadata);
+    M_REQUIRE_NON_NULL(index);
+
+    const struct imgfs_index* hot = &imgfs_file->index;
+    const uint32_t hash = imgfs_index_id_hash(img_id);
+
+    for(uint32_t i = imgfs_index_next_valid(hot, 0); i < imgfs_file->header.max_files; i = imgfs_index_next_valid(hot, i + 1)) {
+        const struct img_metadata* metadata = &imgfs_file->metadata[i];
+        if(hot->id_hash[i] == hash && metadata->is_valid && !strncmp(metadata->img_id, img_id, MAX_IMG_ID + 1)) {
+            *index = i;
+            return ERR_NONE;
+        }
+    }
+
+    return ERR_IMAGE_NOT_FOUND;
+}
+
 int resolution_atoi (const char* str)
 {
     if (str == NULL) return -1;
@@ -0,0 +1,423 @@
+/**
+ * @file imgfs_volumes.c
+ * @brief Volume manager: routing of image IDs over several imgFS files
+ */
+
+#include "imgfs_volumes.h"
+#include "metrics.h"
+#include "sha256.h"
+#include "trace.h"
+#include "util.h"
+
+#include <stdlib.h> // for qsort
+#include <string.h>
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325UL
+#define FNV_PRIME        0x100000001b3UL
+
+/**
+ * @brief FNV-1a hash of a byte array, continuing from seed
+ */
+static uint64_t fnv1a(const void* data, size_t len, uint64_t seed)
+{
+    const unsigned char* bytes = data;
+    uint64_t hash = seed;
+    for(size_t i = 0; i < len; ++i) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/**
+ * @brief Final avalanche of splitmix64, spreads the FNV hashes over the whole ring
+ */
+static uint64_t mix64(uint64_t hash)
+{
+    hash ^= hash >> 30;
+    hash *= 0xbf58476d1ce4e5b9UL;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebUL;
+    hash ^= hash >> 31;
+    return hash;
+}
+
+static const char* base_name(const char* path)
+{
+    const char* slash = strrchr(path, '/');
+    return slash == NULL ? path : slash + 1;
+}
+
+static int compare_points(const void* a, const void* b)
+{
+    const struct volume_ring_point* p1 = a;
+    const struct volume_ring_point* p2 = b;
+    if(p1->hash != p2->hash) return p1->hash < p2->hash ? -1 : 1;
+    return (p1->volume > p2->volume) - (p1->volume < p2->volume);
+}
+
+/**
+ * @brief Closes the first nb_opened volumes and returns the error code
+ */
+static int volumes_error(struct imgfs_volumes* volumes, size_t nb_opened, int error_code)
+{
+    for(size_t v = 0; v < nb_opened; ++v) {
+        do_close(&volumes->files[v]);
+        pthread_mutex_destroy(&volumes->locks[v]);
+    }
+    volumes->nb_volumes = 0;
+    volumes->nb_points = 0;
+    return error_code;
+}
+
+int volumes_open(const char* const* filenames, size_t nb_volumes, const char* open_mode, struct imgfs_volumes* volumes)
+{
+    M_REQUIRE_NON_NULL(filenames);
+    M_REQUIRE_NON_NULL(open_mode);
+    M_REQUIRE_NON_NULL(volumes);
+
+    if(nb_volumes == 0 || nb_volumes > MAX_VOLUMES) return ERR_INVALID_ARGUMENT;
+
+    volumes->nb_volumes = 0;
+    volumes->nb_points = 0;
+
+    for(size_t v = 0; v < nb_volumes; ++v) {
+        M_REQUIRE_NON_NULL(filenames[v]);
+
+        // the ring is derived from the base names, which must thus be distinct
+        for(size_t other = 0; other < v; ++other) {
+            if(!strcmp(base_name(filenames[v]), base_name(filenames[other])))
+                return volumes_error(volumes, v, ERR_INVALID_FILENAME);
+        }
+
+        int ret = do_open(filenames[v], open_mode, &volumes->files[v]);
+        if(ret != ERR_NONE) return volumes_error(volumes, v, ret);
+        if(pthread_mutex_init(&volumes->locks[v], NULL) != 0) {
+            do_close(&volumes->files[v]);
+            return volumes_error(volumes, v, ERR_THREADING);
+        }
+
+        const char* name = base_name(filenames[v]);
+        const uint64_t name_hash = fnv1a(name, strlen(name), FNV_OFFSET_BASIS);
+        for(uint32_t node = 0; node < VOLUME_VIRTUAL_NODES; ++node) {
+            struct volume_ring_point point = {mix64(fnv1a(&node, sizeof(node), name_hash)), (uint32_t) v};
+            volumes->ring[volumes->nb_points++] = point;
+        }
+    }
+
+    qsort(volumes->ring, volumes->nb_points, sizeof(struct volume_ring_point), compare_points);
+    volumes->nb_volumes = nb_volumes;
+
+    return ERR_NONE;
+}
+
+void volumes_close(struct imgfs_volumes* volumes)
+{
+    if(volumes != NULL) volumes_error(volumes, volumes->nb_volumes, ERR_NONE);
+}
+
+size_t volumes_route(const struct imgfs_volumes* volumes, const char* img_id)
+{
+    if(volumes == NULL || img_id == NULL || volumes->nb_points == 0) return 0;
+
+    const uint64_t hash = mix64(fnv1a(img_id, strnlen(img_id, MAX_IMG_ID + 1), FNV_OFFSET_BASIS));
+
+    // first point at or after the hash, wrapping around the ring
+    size_t low = 0;
+    size_t high = volumes->nb_points;
+    while(low < high) {
+        const size_t middle = low + (high - low) / 2;
+        if(volumes->ring[middle].hash < hash) low = middle + 1;
+        else high = middle;
+    }
+
+    return volumes->ring[low == volumes->nb_points ? 0 : low].volume;
+}
+
+/**
+ * @brief Takes the lock of a volume, recording how long it was waited for
+ * @return (int) : ERR_NONE, or ERR_THREADING if the lock failed
+*/
+static int lock_volume(struct imgfs_volumes* volumes, size_t volume)
+{
+    const uint64_t start = metrics_now_ns();
+    if(pthread_mutex_lock(&volumes->locks[volume]) != 0) return ERR_THREADING;
+    volumes->locked_at[volume] = metrics_now_ns();
+    metrics_lock_wait(volumes->locked_at[volume] - start);
+    trace_phase("lock_wait", start);
+    return ERR_NONE;
+}
+
+/**
+ * @brief Releases the lock of a volume, recording how long it was held
+ * @return (int) : ERR_NONE, or ERR_THREADING if the unlock failed
+*/
+static int unlock_volume(struct imgfs_volumes* volumes, size_t volume)
+{
+    // read before the lock is released, another thread may take it at once
+    const uint64_t locked_at = volumes->locked_at[volume];
+    const uint64_t held = metrics_now_ns() - locked_at;
+    if(pthread_mutex_unlock(&volumes->locks[volume]) != 0) return ERR_THREADING;
+    metrics_lock_hold(held);
+    trace_phase("lock_hold", locked_at);
+    return ERR_NONE;
+}
+
+/**
+ * @brief Finds the volume holding a valid image with the given ID, starting with the routed one.
+ * @param volume (size_t*) : where to store the volume, set to the routed volume if the image is not found
+ * @return (int) : ERR_NONE if found, ERR_IMAGE_NOT_FOUND if not, ERR_THREADING if a lock failed
+*/
+static int volumes_locate(struct imgfs_volumes* volumes, const char* img_id, size_t* volume)
+{
+    const size_t routed = volumes_route(volumes, img_id);
+
+    for(size_t n = 0; n < volumes->nb_volumes; ++n) {
+        const size_t v = (routed + n) % volumes->nb_volumes;
+        uint32_t index = 0;
+
+        if(lock_volume(volumes, v) != ERR_NONE) return ERR_THREADING;
+        const int ret = find_image(img_id, &volumes->files[v], &index);
+        if(unlock_volume(volumes, v) != ERR_NONE) return ERR_THREADING;
+
+        if(ret == ERR_NONE) {
+            *volume = v;
+            return ERR_NONE;
+        }
+    }
+
+    *volume = routed;
+    return ERR_IMAGE_NOT_FOUND;
+}
+
+int volumes_read(const char* img_id, int resolution, char** image_buffer, uint32_t* image_size,
+                 struct img_metadata* metadata, struct imgfs_volumes* volumes)
+{
+    M_REQUIRE_NON_NULL(img_id);
+    M_REQUIRE_NON_NULL(volumes);
+
+    size_t volume = 0;
+    int ret = volumes_locate(volumes, img_id, &volume);
+    if(ret != ERR_NONE) return ret;
+
+    if(lock_volume(volumes, volume) != ERR_NONE) return ERR_THREADING;
+    if(metadata != NULL) ret = do_stat(img_id, metadata, &volumes->files[volume]);
+    if(ret == ERR_NONE) ret = do_read(img_id, resolution, image_buffer, image_size, &volumes->files[volume]);
+    if(unlock_volume(volumes, volume) != ERR_NONE) return ERR_THREADING;
+
+    return ret;
+}
+
+int volumes_read_range(const char* img_id, int resolution, int64_t* first, uint32_t* len,
+                       char** image_buffer, uint32_t* image_size, struct img_metadata* metadata,
+                       struct imgfs_volumes* volumes)
+{
+    M_REQUIRE_NON_NULL(img_id);
+    M_REQUIRE_NON_NULL(volumes);
+
+    size_t volume = 0;
+    int ret = volumes_locate(volumes, img_id, &volume);
+    if(ret != ERR_NONE) return ret;
+
+    if(lock_volume(volumes, volume) != ERR_NONE) return ERR_THREADING;
+    if(metadata != NULL) ret = do_stat(img_id, metadata, &volumes->files[volume]);
+    if(ret == ERR_NONE) ret = do_read_range(img_id, resolution, first, len, image_buffer, image_size, &volumes->files[volume]);
+    if(unlock_volume(volumes, volume) != ERR_NONE) return ERR_THREADING;
+
+    return ret;
+}
+
+int volumes_stat(const char* img_id, struct img_metadata* metadata, struct imgfs_volumes* volumes)
+{
+    M_REQUIRE_NON_NULL(img_id);
+    M_REQUIRE_NON_NULL(volumes);
+
+    size_t volume = 0;
+    int ret = volumes_locate(volumes, img_id, &volume);
+    if(ret != ERR_NONE) return ret;
+
+    if(lock_volume(volumes, volume) != ERR_NONE) return ERR_THREADING;
+    ret = do_stat(img_id, metadata, &volumes->files[volume]);
+    if(unlock_volume(volumes, volume) != ERR_NONE) return ERR_THREADING;
+
+    return ret;
+}
+
+int volumes_insert(const char* image_buffer, size_t image_size, const char* img_id, struct imgfs_volumes* volumes)
+{
+    M_REQUIRE_NON_NULL(img_id);
+    M_REQUIRE_NON_NULL(volumes);
+
+    size_t volume = 0;
+    int ret = volumes_locate(volumes, img_id, &volume);
+    if(ret == ERR_NONE) return ERR_DUPLICATE_ID;
+    if(ret == ERR_THREADING) return ret;
+
+    // hashed before the lock is taken
+    unsigned char sha[SHA256_DIGEST_LENGTH] = {0};
+    if((ret = sha256(image_buffer, image_size, sha)) != ERR_NONE) return ret;
+
+    if(lock_volume(volumes, volume) != ERR_NONE) return ERR_THREADING;
+    ret = do_insert_hashed(image_buffer, image_size, sha, img_id, &volumes->files[volume]);
+    if(unlock_volume(volumes, volume) != ERR_NONE) return ERR_THREADING;
+
+    return ret;
+}
+
+int volumes_delete(const char* img_id, struct imgfs_volumes* volumes)
+{
+    M_REQUIRE_NON_NULL(img_id);
+    M_REQUIRE_NON_NULL(volumes);
+
+    size_t volume = 0;
+    int ret = volumes_locate(volumes, img_id, &volume);
+    if(ret != ERR_NONE) return ret;
+
+    if(lock_volume(volumes, volume) != ERR_NONE) return ERR_THREADING;
+    ret = do_delete(img_id, &volumes->files[volume]);
+    if(unlock_volume(volumes, volume) != ERR_NONE) return ERR_THREADING;
+
+    return ret;
+}
+
+int volumes_set_dedup(struct imgfs_volumes* volumes, enum imgfs_dedup dedup, uint32_t max_distance)
+{
+    M_REQUIRE_NON_NULL(volumes);
+
+    int ret = ERR_NONE;
+    for(size_t v = 0; v < volumes->nb_volumes && ret == ERR_NONE; ++v) {
+        if(lock_volume(volumes, v) != ERR_NONE) return ERR_THREADING;
+        ret = do_set_dedup(&volumes->files[v], dedup, max_distance);
+        if(unlock_volume(volumes, v) != ERR_NONE) return ERR_THREADING;
+    }
+
+    return ret;
+}
+
+int volumes_set_durability(struct imgfs_volumes* volumes, enum imgfs_durability durability, uint32_t sync_param)
+{
+    M_REQUIRE_NON_NULL(volumes);
+
+    int ret = ERR_NONE;
+    for(size_t v = 0; v < volumes->nb_volumes && ret == ERR_NONE; ++v) {
+        if(lock_volume(volumes, v) != ERR_NONE) return ERR_THREADING;
+        ret = do_set_durability(&volumes->files[v], durability, sync_param);
+        if(unlock_volume(volumes, v) != ERR_NONE) return ERR_THREADING;
+    }
+
+    return ret;
+}
+
+int volumes_sync_due(struct imgfs_volumes* volumes)
+{
+    M_REQUIRE_NON_NULL(volumes);
+
+    // all the volumes are tried, the first error being reported
+    int ret = ERR_NONE;
+    for(size_t v = 0; v < volumes->nb_volumes; ++v) {
+        if(lock_volume(volumes, v) != ERR_NONE) return ERR_THREADING;
+        const int synced = do_sync_due(&volumes->files[v]);
+        if(unlock_volume(volumes, v) != ERR_NONE) return ERR_THREADING;
+        if(ret == ERR_NONE) ret = synced;
+    }
+
+    return ret;
+}
+
+int volumes_similar(const char* img_id, uint32_t max_distance, struct similar_match* matches,
+                    size_t max_matches, size_t* nb_matches, struct imgfs_volumes* volumes)
+{
+    M_REQUIRE_NON_NULL(img_id);
+    M_REQUIRE_NON_NULL(matches);
+    M_REQUIRE_NON_NULL(nb_matches);
+    M_REQUIRE_NON_NULL(volumes);
+
+    *nb_matches = 0;
+    size_t volume = 0;
+    int ret = volumes_locate(volumes, img_id, &volume);
+    if(ret != ERR_NONE) return ret;
+
+    uint64_t hash = 0;
+    if(lock_volume(volumes, volume) != ERR_NONE) return ERR_THREADING;
+    ret = do_perceptual_hash(&volumes->files[volume], img_id, &hash);
+    if(unlock_volume(volumes, volume) != ERR_NONE) return ERR_THREADING;
+    if(ret != ERR_NONE) return ret;
+
+    // one more per volume, as the image itself is found and dropped
+    struct similar_match found[SIMILAR_MAX_MATCHES];
+    for(size_t v = 0; v < volumes->nb_volumes; ++v) {
+        size_t nb = 0;
+        if(lock_volume(volumes, v) != ERR_NONE) return ERR_THREADING;
+        ret = do_find_similar(&volumes->files[v], hash, max_distance, found, MIN(max_matches + 1, SIMILAR_MAX_MATCHES), &nb);
+        if(unlock_volume(volumes, v) != ERR_NONE) return ERR_THREADING;
+        if(ret != ERR_NONE) return ret;
+
+        // merged into the closest ones of the volumes before
+        for(size_t f = 0; f < nb; ++f) {
+            if(!strncmp(found[f].img_id, img_id, MAX_IMG_ID + 1)) continue;
+
+            size_t at = *nb_matches;
+            if(at == max_matches) {
+                if(at == 0 || found[f].distance >= matches[at - 1].distance) continue;
+                --at;
+            } else ++*nb_matches;
+
+            for(; at > 0 && matches[at - 1].distance > found[f].distance; --at) matches[at] = matches[at - 1];
+            matches[at] = found[f];
+        }
+    }
+
+    return ERR_NONE;
+}
+
+int volumes_list(struct imgfs_volumes* volumes, enum do_list_mode output_mode, char** json)
+{
+    M_REQUIRE_NON_NULL(volumes);
+
+    // always locked in increasing order, so that concurrent listings cannot deadlock
+    size_t nb_locked = 0;
+    while(nb_locked < volumes->nb_volumes && lock_volume(volumes, nb_locked) == ERR_NONE) ++nb_locked;
+
+    int ret = nb_locked == volumes->nb_volumes
+              ? do_list_multiple(volumes->files, volumes->nb_volumes, output_mode, json)
+              : ERR_THREADING;
+
+    while(nb_locked > 0) unlock_volume(volumes, --nb_locked);
+
+    return ret;
+}
+
+int volumes_list_page(struct imgfs_volumes* volumes, const struct list_options* options, uint64_t* cursor,
+                      size_t max_images, struct img_metadata* images, size_t* nb_images)
+{
+    M_REQUIRE_NON_NULL(volumes);
+    M_REQUIRE_NON_NULL(cursor);
+    M_REQUIRE_NON_NULL(images);
+    M_REQUIRE_NON_NULL(nb_images);
+
+    *nb_images = 0;
+
+    // the cursor is the volume in the high 32 bits, the slot in the low ones
+    size_t volume = (size_t) (*cursor >> 32);
+    uint32_t slot = (uint32_t) *cursor;
+
+    while(volume < volumes->nb_volumes && *nb_images < max_images) {
+        size_t nb = 0;
+
+        if(lock_volume(volumes, volume) != ERR_NONE) return ERR_THREADING;
+        const int ret = do_list_page(&volumes->files[volume], options, &slot, max_images - *nb_images,
+                                     images + *nb_images, &nb);
+        const int done = slot >= volumes->files[volume].header.max_files;
+        if(unlock_volume(volumes, volume) != ERR_NONE) return ERR_THREADING;
+
+        if(ret != ERR_NONE) return ret;
+        *nb_images += nb;
+        if(done) {
+            ++volume;
+            slot = 0;
+        }
+    }
+
+    *cursor = volume < volumes->nb_volumes ? ((uint64_t) volume << 32) | slot : VOLUMES_CURSOR_END;
+    return ERR_NONE;
+}
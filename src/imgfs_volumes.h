@@ -0,0 +1,176 @@
+/**
+ * @file imgfs_volumes.h
+ * @brief Volume manager: one logical imgFS sharded over several imgFS files.
+ *
+ * Image IDs are routed to the volumes by consistent hashing: every volume
+ * owns VOLUME_VIRTUAL_NODES points on a hash ring (derived from the base
+ * name of its file) and an image goes to the volume owning the first point
+ * following the hash of its ID. Adding a volume thus only remaps about
+ * 1/nb_volumes of the IDs; images which are not on their routed volume any
+ * more are still found by read and delete (the other volumes are searched
+ * on a miss), and insert refuses an ID existing on any volume.
+ *
+ * Every volume has its own lock so that requests on different volumes
+ * (possibly on different disks) proceed in parallel.
+ */
+
+#pragma once
+
+#include "imgfs.h"
+#include "image_similar.h" // for struct similar_match
+
+#include <pthread.h>
+#include <stddef.h> // for size_t
+#include <stdint.h> // for uint32_t, uint64_t
+
+#define MAX_VOLUMES          16
+#define VOLUME_VIRTUAL_NODES 64
+
+// the cursor of volumes_list_page() once all the volumes are listed
+#define VOLUMES_CURSOR_END   UINT64_MAX
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief A point of the consistent hashing ring
+ */
+struct volume_ring_point {
+    /*!The position of the point on the ring*/
+    uint64_t hash;
+    /*!The volume owning the point*/
+    uint32_t volume;
+};
+
+/**
+ * @brief The set of opened volumes
+ */
+struct imgfs_volumes {
+    /*!The number of opened volumes*/
+    size_t nb_volumes;
+    /*!The in-memory structure of each volume*/
+    struct imgfs_file files[MAX_VOLUMES];
+    /*!The lock protecting each volume*/
+    pthread_mutex_t locks[MAX_VOLUMES];
+    /*!When each lock was last taken (ns, see metrics_now_ns()), to measure how long it is held*/
+    uint64_t locked_at[MAX_VOLUMES];
+    /*!The hash ring, sorted by increasing hash*/
+    struct volume_ring_point ring[MAX_VOLUMES * VOLUME_VIRTUAL_NODES];
+    /*!The number of points on the ring*/
+    size_t nb_points;
+};
+
+/**
+ * @brief Opens the given imgFS files as volumes and builds the hash ring.
+ *
+ * @param filenames Paths to the imgFS files
+ * @param nb_volumes Number of paths, at most MAX_VOLUMES
+ * @param open_mode Mode for fopen(), see do_open()
+ * @param volumes The structure to fill
+ * @return Some error code. 0 if no error.
+ */
+int volumes_open(const char* const* filenames, size_t nb_volumes,
+                 const char* open_mode, struct imgfs_volumes* volumes);
+
+/**
+ * @brief Closes all the volumes.
+ */
+void volumes_close(struct imgfs_volumes* volumes);
+
+/**
+ * @brief Returns the volume an image ID is routed to.
+ */
+size_t volumes_route(const struct imgfs_volumes* volumes, const char* img_id);
+
+/**
+ * @brief do_read() on the volume holding the image, with do_stat() under
+ *        the same lock if metadata is not NULL: the metadata is the one of
+ *        the bytes read, even if the image is replaced concurrently.
+ */
+int volumes_read(const char* img_id, int resolution, char** image_buffer,
+                 uint32_t* image_size, struct img_metadata* metadata, struct imgfs_volumes* volumes);
+
+/**
+ * @brief do_read_range() on the volume holding the image, with do_stat()
+ *        under the same lock if metadata is not NULL (see volumes_read());
+ *        the metadata is set even if the range is not satisfiable.
+ */
+int volumes_read_range(const char* img_id, int resolution, int64_t* first, uint32_t* len,
+                       char** image_buffer, uint32_t* image_size, struct img_metadata* metadata,
+                       struct imgfs_volumes* volumes);
+
+/**
+ * @brief do_stat() on the volume holding the image.
+ */
+int volumes_stat(const char* img_id, struct img_metadata* metadata, struct imgfs_volumes* volumes);
+
+/**
+ * @brief do_insert() on the volume the ID is routed to.
+ */
+int volumes_insert(const char* image_buffer, size_t image_size,
+                   const char* img_id, struct imgfs_volumes* volumes);
+
+/**
+ * @brief do_delete() on the volume holding the image.
+ */
+int volumes_delete(const char* img_id, struct imgfs_volumes* volumes);
+
+/**
+ * @brief do_set_dedup() on all the volumes.
+ */
+int volumes_set_dedup(struct imgfs_volumes* volumes, enum imgfs_dedup dedup, uint32_t max_distance);
+
+/**
+ * @brief do_set_durability() on all the volumes.
+ */
+int volumes_set_durability(struct imgfs_volumes* volumes, enum imgfs_durability durability, uint32_t sync_param);
+
+/**
+ * @brief do_sync_due() on all the volumes.
+ */
+int volumes_sync_due(struct imgfs_volumes* volumes);
+
+/**
+ * @brief The images of all the volumes whose perceptual hash is within
+ *        max_distance of the one of the given image (itself excluded), the
+ *        closest first (see do_find_similar()).
+ *
+ * @param img_id The ID of the image
+ * @param max_distance The maximal Hamming distance
+ * @param matches Where to put the images found
+ * @param max_matches The number of elements of matches
+ * @param nb_matches Set to the number of images put in matches
+ * @param volumes The volumes
+ * @return Some error code. 0 if no error.
+ */
+int volumes_similar(const char* img_id, uint32_t max_distance, struct similar_match* matches,
+                    size_t max_matches, size_t* nb_matches, struct imgfs_volumes* volumes);
+
+/**
+ * @brief do_list_multiple() over all the volumes.
+ */
+int volumes_list(struct imgfs_volumes* volumes, enum do_list_mode output_mode, char** json);
+
+/**
+ * @brief do_list_page() over all the volumes, one after the other.
+ *
+ * Every volume is locked only while its metadata is copied: a listing by
+ * pages does not block the other requests, but is not a snapshot either
+ * (images inserted or deleted meanwhile may or may not be listed).
+ *
+ * @param volumes The volumes
+ * @param options The filters, NULL for none
+ * @param cursor Where to start, 0 for the first page; set to where the next
+ *      page starts, VOLUMES_CURSOR_END after the last one.
+ * @param max_images Number of elements of images
+ * @param images Where to copy the metadata
+ * @param nb_images Set to the number of images copied
+ * @return Some error code. 0 if no error.
+ */
+int volumes_list_page(struct imgfs_volumes* volumes, const struct list_options* options, uint64_t* cursor,
+                      size_t max_images, struct img_metadata* images, size_t* nb_images);
+
+#ifdef __cplusplus
+}
+#endif
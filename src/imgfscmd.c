@@ -23,7 +23,7 @@ struct command_mapping {
     const command command;
 };
 
-#define NB_COMMANDS 5
+#define NB_COMMANDS 8
 /*******************************************************************************
  * MAIN
  */
@@ -48,9 +48,12 @@ int main(int argc, char* argv[])
         struct command_mapping delete_cmd = {"delete", do_delete_cmd};
         struct command_mapping insert_cmd = {"insert", do_insert_cmd};
         struct command_mapping read_cmd = {"read", do_read_cmd};
+        struct command_mapping grow_cmd = {"grow", do_grow_cmd};
+        struct command_mapping convert_cmd = {"convert", do_convert_cmd};
+        struct command_mapping space_cmd = {"space", do_space_cmd};
         struct command_mapping null_cmd = {"null", NULL};
 
-        struct command_mapping commands[] = {list_cmd, create_cmd, help_cmd, delete_cmd, insert_cmd, read_cmd, null_cmd};
+        struct command_mapping commands[] = {list_cmd, create_cmd, help_cmd, delete_cmd, insert_cmd, read_cmd, grow_cmd, convert_cmd, space_cmd, null_cmd};
 
         argc--; argv++; // skips command call name
 
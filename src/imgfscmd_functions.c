@@ -7,6 +7,8 @@
 
 #include "imgfs.h"
 #include "imgfscmd_functions.h"
+#include "imgfs_blobs.h"
+#include "sha256.h"
 #include "util.h"   // for _unused
 
 #include <stdlib.h>
@@ -55,8 +57,13 @@ int help(int useless _unused, char** useless_too _unused)
     "  read   <imgFS_filename> <imgID> [original|orig|thumbnail|thumb|small]:\n"
     "      read an image from the imgFS and save it to a file.\n"
     "      default resolution is \"original\".\n"
-    "  insert <imgFS_filename> <imgID> <filename>: insert a new image in the imgFS.\n"
-    "  delete <imgFS_filename> <imgID>: delete image imgID from imgFS.\n";
+    "  insert <imgFS_filename> <imgID> <filename> [<imgID> <filename> ...]:\n"
+    "      insert new images in the imgFS.\n"
+    "  delete <imgFS_filename> <imgID>: delete image imgID from imgFS.\n"
+    "  grow <imgFS_filename> <MAX_FILES>: raise the maximum number of files of the imgFS.\n"
+    "  convert <imgFS_filename> <new_imgFS_filename>: write a copy of the imgFS in the compact format v2.\n"
+    "  space <imgFS_filename>: display the bytes of the imgFS file used by the table and the contents,\n"
+    "      and the bytes a conversion would reclaim.\n";
 
     printf("%s", output);
     return ERR_NONE;
@@ -269,29 +276,41 @@ int do_delete_cmd(int argc, char** argv)
 }
 
 
+/**********************************************************************
+ * Inserts one image, or several (their SHA-256 computed all at once).
+ ********************************************************************** */
 int do_insert_cmd(int argc, char **argv)
 {
     M_REQUIRE_NON_NULL(argv);
-    if (argc != 3) return ERR_NOT_ENOUGH_ARGUMENTS;
+    if (argc < 3 || argc % 2 == 0) return ERR_NOT_ENOUGH_ARGUMENTS;
+
+    const size_t nb_images = (size_t) (argc - 1) / 2;
+    char** image_buffers = calloc(nb_images, sizeof(char*));
+    size_t* image_sizes = calloc(nb_images, sizeof(size_t));
+    unsigned char (*shas)[SHA256_DIGEST_LENGTH] = calloc(nb_images, SHA256_DIGEST_LENGTH);
+    int error = image_buffers == NULL || image_sizes == NULL || shas == NULL ? ERR_OUT_OF_MEMORY : ERR_NONE;
+
+    // reads the images from the disk, then hashes them
+    for (size_t i = 0; error == ERR_NONE && i < nb_images; ++i) {
+        uint32_t image_size = 0;
+        error = read_disk_image(argv[2 + 2 * i], &image_buffers[i], &image_size);
+        image_sizes[i] = image_size;
+    }
+    if (error == ERR_NONE) error = sha256_many(nb_images, (const char* const*) image_buffers, image_sizes, shas);
 
     struct imgfs_file myfile;
     zero_init_var(myfile);
-    int error = do_open(argv[0], "rb+", &myfile);
-    if (error != ERR_NONE) return error;
-
-    char *image_buffer = NULL;
-    uint32_t image_size;
-
-    // Reads image from the disk.
-    error = read_disk_image (argv[2], &image_buffer, &image_size);
-    if (error != ERR_NONE) {
+    if (error == ERR_NONE && (error = do_open(argv[0], "rb+", &myfile)) == ERR_NONE) {
+        for (size_t i = 0; error == ERR_NONE && i < nb_images; ++i) {
+            error = do_insert_hashed(image_buffers[i], image_sizes[i], shas[i], argv[1 + 2 * i], &myfile);
+        }
         do_close(&myfile);
-        return error;
     }
 
-    error = do_insert(image_buffer, image_size, argv[1], &myfile);
-    free(image_buffer);
-    do_close(&myfile);
+    for (size_t i = 0; image_buffers != NULL && i < nb_images; ++i) free(image_buffers[i]);
+    free(image_buffers);
+    free(image_sizes);
+    free(shas);
     return error;
 }
 
@@ -329,6 +348,77 @@ int do_read_cmd(int argc, char **argv)
     return error;
 }
 
+/**********************************************************************
+ * Grows the metadata table of the imgFS.
+ */
+int do_grow_cmd(int argc, char** argv)
+{
+    M_REQUIRE_NON_NULL(argv);
+    if (argc > 2) return ERR_INVALID_COMMAND;
+    else if (argc < 2) return ERR_NOT_ENOUGH_ARGUMENTS;
+
+    M_REQUIRE_NON_NULL(argv[0]);
+    M_REQUIRE_NON_NULL(argv[1]);
+
+    const uint32_t max_files = atouint32(argv[1]);
+    if (!max_files) return ERR_MAX_FILES;
+
+    struct imgfs_file myfile;
+    zero_init_var(myfile);
+    int error = do_open(argv[0], "rb+", &myfile);
+    if (error != ERR_NONE) return error;
+
+    error = do_grow(&myfile, max_files);
+    do_close(&myfile);
+    return error;
+}
+
+/**********************************************************************
+ * Converts the imgFS to the compact format.
+ */
+int do_convert_cmd(int argc, char** argv)
+{
+    M_REQUIRE_NON_NULL(argv);
+    if (argc > 2) return ERR_INVALID_COMMAND;
+    else if (argc < 2) return ERR_NOT_ENOUGH_ARGUMENTS;
+
+    M_REQUIRE_NON_NULL(argv[0]);
+    M_REQUIRE_NON_NULL(argv[1]);
+
+    if (!check_if_string_is_valid(argv[1], FILENAME_MAX)) return ERR_INVALID_FILENAME;
+
+    return do_convert(argv[0], argv[1]);
+}
+
+/**********************************************************************
+ * Displays how the data of the imgFS file is used.
+ */
+int do_space_cmd(int argc, char** argv)
+{
+    M_REQUIRE_NON_NULL(argv);
+    if (argc > 1) return ERR_INVALID_COMMAND;
+    else if (argc < 1) return ERR_NOT_ENOUGH_ARGUMENTS;
+
+    M_REQUIRE_NON_NULL(argv[0]);
+
+    struct imgfs_file myfile;
+    zero_init_var(myfile);
+    int error = do_open(argv[0], "rb", &myfile);
+    if (error != ERR_NONE) return error;
+
+    struct imgfs_space space;
+    error = do_space(&myfile, &space);
+    do_close(&myfile);
+    if (error != ERR_NONE) return error;
+
+    printf("images: %" PRIu32 " (%" PRIu32 " distinct contents)\n", space.nb_images, space.nb_contents);
+    printf("file: %" PRIu64 " bytes\n", space.file_bytes);
+    printf("table: %" PRIu64 " bytes\n", space.table_bytes);
+    printf("contents: %" PRIu64 " bytes\n", space.live_bytes);
+    printf("reclaimable: %" PRIu64 " bytes\n", space.reclaimable_bytes);
+    return ERR_NONE;
+}
+
 char const* const convert_resolution_to_string(int resolution)
 {
     switch(resolution) {
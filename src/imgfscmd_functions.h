@@ -36,3 +36,18 @@ int do_insert_cmd(int argc, char* argv[]);
  * Reads an image from the imgFS.
  *******************************************************************/
 int do_read_cmd(int argc, char* argv[]);
+
+/********************************************************************
+ * Grows the metadata table of the imgFS.
+ *******************************************************************/
+int do_grow_cmd(int argc, char* argv[]);
+
+/********************************************************************
+ * Converts the imgFS to the compact format.
+ *******************************************************************/
+int do_convert_cmd(int argc, char* argv[]);
+
+/********************************************************************
+ * Displays how the data of the imgFS file is used.
+ *******************************************************************/
+int do_space_cmd(int argc, char* argv[]);
@@ -0,0 +1,265 @@
+/**
+ * @file json_writer.c
+ * @brief Streaming JSON writer
+ */
+
+#include "json_writer.h"
+#include "error.h"
+
+#include <inttypes.h> // for PRIu64
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ESCAPED_CHAR_MAX_LEN 6 // \u00XX
+
+static int fail(struct json_writer* writer, int error)
+{
+    if(writer->error == ERR_NONE) writer->error = error;
+    return writer->error;
+}
+
+int json_writer_init(struct json_writer* writer, json_sink sink, void* context)
+{
+    M_REQUIRE_NON_NULL(writer);
+
+    memset(writer, 0, sizeof(*writer));
+    writer->buffer = calloc(JSON_WRITER_CAPACITY, sizeof(char));
+    if(writer->buffer == NULL) return ERR_OUT_OF_MEMORY;
+
+    writer->capacity = JSON_WRITER_CAPACITY;
+    writer->sink = sink;
+    writer->context = context;
+    return ERR_NONE;
+}
+
+void json_writer_free(struct json_writer* writer)
+{
+    if(writer == NULL) return;
+    free(writer->buffer);
+    writer->buffer = NULL;
+    writer->len = writer->capacity = 0;
+}
+
+void json_writer_reset(struct json_writer* writer)
+{
+    if(writer == NULL) return;
+    writer->len = 0;
+    if(writer->buffer != NULL) writer->buffer[0] = '\0';
+    writer->is_object = writer->has_value = 0;
+    writer->depth = 0;
+    writer->after_key = 0;
+    writer->error = ERR_NONE;
+}
+
+int json_writer_flush(struct json_writer* writer)
+{
+    M_REQUIRE_NON_NULL(writer);
+    if(writer->error != ERR_NONE || writer->sink == NULL || writer->len == 0) return writer->error;
+
+    const int ret = writer->sink(writer->context, writer->buffer, writer->len);
+    if(ret != ERR_NONE) return fail(writer, ret);
+
+    writer->len = 0;
+    writer->buffer[0] = '\0';
+    return ERR_NONE;
+}
+
+/**
+ * @brief Makes room for len more bytes (and the null terminator) in the buffer,
+ * by flushing it if there is a sink, by growing it otherwise (or if it is still too small).
+ */
+static int reserve(struct json_writer* writer, size_t len)
+{
+    if(writer->error != ERR_NONE) return writer->error;
+    if(writer->len + len < writer->capacity) return ERR_NONE;
+
+    if(writer->sink != NULL && json_writer_flush(writer) != ERR_NONE) return writer->error;
+    if(writer->len + len < writer->capacity) return ERR_NONE;
+
+    size_t capacity = 2 * writer->capacity;
+    if(capacity <= writer->len + len) capacity = writer->len + len + 1;
+
+    char* buffer = realloc(writer->buffer, capacity);
+    if(buffer == NULL) return fail(writer, ERR_OUT_OF_MEMORY);
+
+    writer->buffer = buffer;
+    writer->capacity = capacity;
+    return ERR_NONE;
+}
+
+/**
+ * @brief Appends len bytes to the buffer, room must have been reserved.
+ */
+static void put(struct json_writer* writer, const char* data, size_t len)
+{
+    memcpy(writer->buffer + writer->len, data, len);
+    writer->len += len;
+    writer->buffer[writer->len] = '\0';
+}
+
+static uint64_t depth_bit(const struct json_writer* writer)
+{
+    return 1UL << (writer->depth - 1);
+}
+
+/**
+ * @brief Writes what comes before a key or a value: nothing after a key,
+ * a space before the first element of a container, a comma and a space before the others.
+ * @param is_key (int) : whether a key is to be written
+ */
+static int separate(struct json_writer* writer, int is_key)
+{
+    if(writer->error != ERR_NONE) return writer->error;
+
+    const int in_object = writer->depth > 0 && (writer->is_object & depth_bit(writer));
+    if(writer->after_key) {
+        if(is_key) return fail(writer, ERR_INVALID_ARGUMENT);
+        writer->after_key = 0;
+        return ERR_NONE;
+    }
+    // keys and only keys start the members of an object
+    if(is_key != in_object) return fail(writer, ERR_INVALID_ARGUMENT);
+    if(writer->depth == 0) return ERR_NONE;
+
+    if(reserve(writer, 2) != ERR_NONE) return writer->error;
+    if(writer->has_value & depth_bit(writer)) put(writer, ", ", 2);
+    else put(writer, " ", 1);
+    writer->has_value |= depth_bit(writer);
+
+    return ERR_NONE;
+}
+
+static int begin(struct json_writer* writer, char open, int is_object)
+{
+    M_REQUIRE_NON_NULL(writer);
+    if(writer->depth == JSON_MAX_DEPTH) return fail(writer, ERR_INVALID_ARGUMENT);
+    if(separate(writer, 0) != ERR_NONE || reserve(writer, 1) != ERR_NONE) return writer->error;
+
+    put(writer, &open, 1);
+    ++writer->depth;
+    writer->has_value &= ~depth_bit(writer);
+    if(is_object) writer->is_object |= depth_bit(writer);
+    else writer->is_object &= ~depth_bit(writer);
+
+    return ERR_NONE;
+}
+
+static int end(struct json_writer* writer, char close, int is_object)
+{
+    M_REQUIRE_NON_NULL(writer);
+    if(writer->error != ERR_NONE) return writer->error;
+    if(writer->depth == 0 || writer->after_key
+       || !(writer->is_object & depth_bit(writer)) != !is_object) return fail(writer, ERR_INVALID_ARGUMENT);
+    if(reserve(writer, 2) != ERR_NONE) return writer->error;
+
+    const char closing[] = {' ', close};
+    put(writer, closing, sizeof(closing));
+    --writer->depth;
+
+    return ERR_NONE;
+}
+
+int json_begin_object(struct json_writer* writer)
+{
+    return begin(writer, '{', 1);
+}
+
+int json_end_object(struct json_writer* writer)
+{
+    return end(writer, '}', 1);
+}
+
+int json_begin_array(struct json_writer* writer)
+{
+    return begin(writer, '[', 0);
+}
+
+int json_end_array(struct json_writer* writer)
+{
+    return end(writer, ']', 0);
+}
+
+/**
+ * @brief Writes a quoted string, escaped as json-c does (the slash included).
+ */
+static int put_escaped(struct json_writer* writer, const char* str, size_t max_len)
+{
+    const size_t len = strnlen(str, max_len);
+    if(reserve(writer, 2 + ESCAPED_CHAR_MAX_LEN * len) != ERR_NONE) return writer->error;
+
+    char* out = writer->buffer + writer->len;
+    *out++ = '"';
+    for(size_t i = 0; i < len; ++i) {
+        const unsigned char c = (unsigned char) str[i];
+        if(c >= 0x20 && c != '"' && c != '\\' && c != '/') {
+            *out++ = (char) c;
+            continue;
+        }
+
+        *out++ = '\\';
+        switch(c) {
+        case '"':
+        case '\\':
+        case '/':
+            *out++ = (char) c;
+            break;
+        case '\b':
+            *out++ = 'b';
+            break;
+        case '\f':
+            *out++ = 'f';
+            break;
+        case '\n':
+            *out++ = 'n';
+            break;
+        case '\r':
+            *out++ = 'r';
+            break;
+        case '\t':
+            *out++ = 't';
+            break;
+        default:
+            out += sprintf(out, "u%04x", c);
+            break;
+        }
+    }
+    *out++ = '"';
+    *out = '\0';
+
+    writer->len = (size_t) (out - writer->buffer);
+    return ERR_NONE;
+}
+
+int json_key(struct json_writer* writer, const char* key)
+{
+    M_REQUIRE_NON_NULL(writer);
+    M_REQUIRE_NON_NULL(key);
+    if(separate(writer, 1) != ERR_NONE || put_escaped(writer, key, strlen(key)) != ERR_NONE
+       || reserve(writer, 2) != ERR_NONE) return writer->error;
+
+    put(writer, ": ", 2);
+    writer->after_key = 1;
+    return ERR_NONE;
+}
+
+int json_string(struct json_writer* writer, const char* str, size_t max_len)
+{
+    M_REQUIRE_NON_NULL(writer);
+    M_REQUIRE_NON_NULL(str);
+    if(separate(writer, 0) != ERR_NONE) return writer->error;
+
+    return put_escaped(writer, str, max_len);
+}
+
+int json_uint(struct json_writer* writer, uint64_t value)
+{
+    M_REQUIRE_NON_NULL(writer);
+
+    char digits[21];
+    const int len = snprintf(digits, sizeof(digits), "%" PRIu64, value);
+    if(separate(writer, 0) != ERR_NONE || reserve(writer, (size_t) len) != ERR_NONE) return writer->error;
+
+    put(writer, digits, (size_t) len);
+    return ERR_NONE;
+}
@@ -0,0 +1,129 @@
+/**
+ * @file json_writer.h
+ * @brief Streaming JSON writer.
+ *
+ * The writer appends the JSON text to a buffer without building any object
+ * tree. With a sink, the buffer is handed to the sink whenever it is full
+ * (and by json_writer_flush()), so that arbitrarily long documents are
+ * written with a bounded amount of memory; without a sink the buffer grows.
+ *
+ * The output is laid out as json-c does by default (`{ "key": [ "a", "b" ] }`)
+ * so that both can be used interchangeably.
+ *
+ * The first error met is kept in the writer and returned by every later call:
+ * a sequence of calls can be checked once, at its end.
+ */
+
+#pragma once
+
+#include <stddef.h> // for size_t
+#include <stdint.h> // for uint64_t
+
+#define JSON_WRITER_CAPACITY 16384
+#define JSON_MAX_DEPTH       64
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Where a writer sends its buffer: returns some error code, 0 if no error.
+ */
+typedef int (*json_sink)(void* context, const char* data, size_t len);
+
+/**
+ * @brief A JSON writer
+ */
+struct json_writer {
+    /*!The text not yet handed to the sink, always null terminated*/
+    char* buffer;
+    /*!The number of bytes in the buffer*/
+    size_t len;
+    /*!The allocated size of the buffer*/
+    size_t capacity;
+    /*!Where the buffer is sent when it is full, NULL to grow the buffer instead*/
+    json_sink sink;
+    /*!The first argument of the sink*/
+    void* context;
+    /*!Bit d is set if the container opened at depth d is an object*/
+    uint64_t is_object;
+    /*!Bit d is set once the container opened at depth d holds a value*/
+    uint64_t has_value;
+    /*!The number of opened containers*/
+    unsigned int depth;
+    /*!Whether the last thing written is a key, thus the next value follows it without separator*/
+    int after_key;
+    /*!The first error met, 0 if none*/
+    int error;
+};
+
+/**
+ * @brief Initializes a writer.
+ *
+ * @param writer The writer to initialize
+ * @param sink Where to send the text, NULL to keep it all in the buffer
+ * @param context The first argument of the sink
+ * @return Some error code. 0 if no error.
+ */
+int json_writer_init(struct json_writer* writer, json_sink sink, void* context);
+
+/**
+ * @brief Frees the buffer of a writer, without flushing it.
+ */
+void json_writer_free(struct json_writer* writer);
+
+/**
+ * @brief Empties a writer to write a new document, keeping its buffer.
+ */
+void json_writer_reset(struct json_writer* writer);
+
+/**
+ * @brief Hands the content of the buffer to the sink (no-op without sink).
+ *
+ * @return The first error met by the writer. 0 if no error.
+ */
+int json_writer_flush(struct json_writer* writer);
+
+/**
+ * @brief Opens an object, a value of the current container.
+ */
+int json_begin_object(struct json_writer* writer);
+
+/**
+ * @brief Closes the innermost container, which must be an object.
+ */
+int json_end_object(struct json_writer* writer);
+
+/**
+ * @brief Opens an array, a value of the current container.
+ */
+int json_begin_array(struct json_writer* writer);
+
+/**
+ * @brief Closes the innermost container, which must be an array.
+ */
+int json_end_array(struct json_writer* writer);
+
+/**
+ * @brief Writes the key of the next member of the current object.
+ *
+ * @param key The key, null terminated
+ */
+int json_key(struct json_writer* writer, const char* key);
+
+/**
+ * @brief Writes a string value, escaped.
+ *
+ * @param str The string, up to its first null character or max_len bytes
+ * @param max_len The maximum length of the string
+ */
+int json_string(struct json_writer* writer, const char* str, size_t max_len);
+
+/**
+ * @brief Writes an unsigned integer value.
+ */
+int json_uint(struct json_writer* writer, uint64_t value);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,294 @@
+/**
+ * @file metrics.c
+ * @brief Metrics of the server
+ */
+
+#include "metrics.h"
+#include "error.h"
+
+#include <inttypes.h> // for PRIu64
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h> // for offsetof
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define CACHE_LINE_SIZE 64
+
+/**
+ * @brief A histogram of durations, see bucket_of()
+ */
+struct histogram {
+    /*!The number of durations recorded in each bucket*/
+    atomic_uint_fast64_t buckets[METRICS_NB_BUCKETS];
+    /*!The sum of the durations recorded (ns)*/
+    atomic_uint_fast64_t sum_ns;
+};
+
+/**
+ * @brief What a thread records, on cache lines of its own
+ */
+struct metrics_slot {
+    /*!Whether a thread records into the slot*/
+    _Alignas(CACHE_LINE_SIZE) atomic_int in_use;
+    /*!The requests served, by route*/
+    atomic_uint_fast64_t requests[NB_ROUTES];
+    /*!The requests whose handler failed, by route*/
+    atomic_uint_fast64_t errors[NB_ROUTES];
+    /*!The bytes sent in reply, by route*/
+    atomic_uint_fast64_t sent_bytes[NB_ROUTES];
+    /*!The durations of the requests, by route*/
+    struct histogram request_duration[NB_ROUTES];
+    /*!The durations of the image reads, by resolution*/
+    struct histogram read_duration[NB_RES];
+    /*!The durations of the resizes, by resolution*/
+    struct histogram resize_duration[NB_RES];
+    /*!The times the locks of the volumes were waited for*/
+    struct histogram lock_wait;
+    /*!The times the locks of the volumes were held*/
+    struct histogram lock_hold;
+};
+
+// the last slot is shared by the threads that find no free one
+static struct metrics_slot slots[METRICS_MAX_THREADS + 1];
+static _Thread_local struct metrics_slot* own_slot;
+
+// gives the slot of a thread back when it ends
+static pthread_key_t slot_key;
+static pthread_once_t slot_key_once = PTHREAD_ONCE_INIT;
+static int slot_key_created;
+
+static const char* const route_names[NB_ROUTES] = {"index", "list", "insert", "read", "delete", "metrics", "trace", "similar", "other"};
+static const char* const resolution_names[NB_RES] = {"thumb", "small", "orig"};
+
+uint64_t metrics_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000UL + (uint64_t) now.tv_nsec;
+}
+
+static void release_slot(void* slot)
+{
+    atomic_store(&((struct metrics_slot*) slot)->in_use, 0);
+}
+
+static void create_slot_key(void)
+{
+    slot_key_created = pthread_key_create(&slot_key, release_slot) == 0;
+}
+
+/**
+ * @brief The slot of the calling thread, taken at its first call: a free one,
+ * or the shared one if there is none (or if it could not be given back).
+ */
+static struct metrics_slot* get_slot(void)
+{
+    if(own_slot != NULL) return own_slot;
+
+    pthread_once(&slot_key_once, create_slot_key);
+    for(size_t s = 0; slot_key_created && s < METRICS_MAX_THREADS; ++s) {
+        int free_slot = 0;
+        if(!atomic_compare_exchange_strong(&slots[s].in_use, &free_slot, 1)) continue;
+        if(pthread_setspecific(slot_key, &slots[s]) != 0) {
+            release_slot(&slots[s]);
+            break;
+        }
+        return own_slot = &slots[s];
+    }
+    return own_slot = &slots[METRICS_MAX_THREADS];
+}
+
+/**
+ * @brief Adds to a counter of a slot (atomically: the last slot is shared)
+ */
+static void add(atomic_uint_fast64_t* counter, uint64_t value)
+{
+    atomic_fetch_add_explicit(counter, value, memory_order_relaxed);
+}
+
+/**
+ * @brief The bucket of a duration: the durations below METRICS_SUB_BUCKETS ns have
+ * a bucket each, the others one of the METRICS_SUB_BUCKETS equal parts of their power of two.
+ */
+static size_t bucket_of(uint64_t ns)
+{
+    if(ns < METRICS_SUB_BUCKETS) return (size_t) ns;
+
+    const unsigned int exponent = 63U - (unsigned int) __builtin_clzll(ns);
+    if(exponent >= METRICS_MAX_EXPONENT) return METRICS_NB_BUCKETS - 1;
+
+    return (exponent - METRICS_SUB_BUCKET_BITS + 1) * METRICS_SUB_BUCKETS
+           + (size_t) ((ns >> (exponent - METRICS_SUB_BUCKET_BITS)) & (METRICS_SUB_BUCKETS - 1));
+}
+
+/**
+ * @brief The (excluded) end of a bucket, in ns
+ */
+static uint64_t bucket_end(size_t bucket)
+{
+    if(bucket < METRICS_SUB_BUCKETS) return bucket + 1;
+
+    const size_t shift = bucket / METRICS_SUB_BUCKETS - 1;
+    return (uint64_t) (METRICS_SUB_BUCKETS + bucket % METRICS_SUB_BUCKETS + 1) << shift;
+}
+
+static void record(struct histogram* histogram, uint64_t duration_ns)
+{
+    add(&histogram->buckets[bucket_of(duration_ns)], 1);
+    add(&histogram->sum_ns, duration_ns);
+}
+
+void metrics_request(enum metrics_route route, int error, size_t sent_bytes, uint64_t duration_ns)
+{
+    if(route >= NB_ROUTES) route = ROUTE_OTHER;
+
+    struct metrics_slot* slot = get_slot();
+    add(&slot->requests[route], 1);
+    if(error != ERR_NONE) add(&slot->errors[route], 1);
+    add(&slot->sent_bytes[route], sent_bytes);
+    record(&slot->request_duration[route], duration_ns);
+}
+
+void metrics_read(int resolution, uint64_t duration_ns)
+{
+    if(resolution < 0 || resolution >= NB_RES) return;
+    record(&get_slot()->read_duration[resolution], duration_ns);
+}
+
+void metrics_resize(int resolution, uint64_t duration_ns)
+{
+    if(resolution < 0 || resolution >= NB_RES) return;
+    record(&get_slot()->resize_duration[resolution], duration_ns);
+}
+
+void metrics_lock_wait(uint64_t duration_ns)
+{
+    record(&get_slot()->lock_wait, duration_ns);
+}
+
+void metrics_lock_hold(uint64_t duration_ns)
+{
+    record(&get_slot()->lock_hold, duration_ns);
+}
+
+/**
+ * @brief Sums over the slots the counter at the given offset in a slot
+ */
+static uint64_t sum_counter(size_t offset)
+{
+    uint64_t sum = 0;
+    for(size_t s = 0; s <= METRICS_MAX_THREADS; ++s) {
+        sum += atomic_load_explicit((const atomic_uint_fast64_t*) ((const char*) &slots[s] + offset), memory_order_relaxed);
+    }
+    return sum;
+}
+
+/**
+ * @brief Writes the lines of one counter of a family (each route)
+ */
+static void write_route_counters(FILE* out, const char* name, const char* help, size_t offset)
+{
+    fprintf(out, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+    for(size_t r = 0; r < NB_ROUTES; ++r) {
+        fprintf(out, "%s{route=\"%s\"} %" PRIu64 "\n", name, route_names[r],
+                sum_counter(offset + r * sizeof(atomic_uint_fast64_t)));
+    }
+}
+
+/**
+ * @brief Writes a histogram summed over the slots (the one at the given offset in a slot):
+ * the cumulative counts at the end of its buckets from about 1 us, then its sum and count.
+ * @param labels (const char*) : its labels, "" for none
+*/
+static void write_histogram(FILE* out, const char* name, const char* labels, size_t offset)
+{
+    uint64_t buckets[METRICS_NB_BUCKETS] = {0};
+    uint64_t sum_ns = 0;
+    for(size_t s = 0; s <= METRICS_MAX_THREADS; ++s) {
+        const struct histogram* histogram = (const struct histogram*) ((const char*) &slots[s] + offset);
+        for(size_t b = 0; b < METRICS_NB_BUCKETS; ++b)
+            buckets[b] += atomic_load_explicit(&histogram->buckets[b], memory_order_relaxed);
+        sum_ns += atomic_load_explicit(&histogram->sum_ns, memory_order_relaxed);
+    }
+
+    const char* separator = labels[0] != '\0' ? "," : "";
+    const size_t first_exposed = (METRICS_MIN_EXPOSED_EXPONENT - METRICS_SUB_BUCKET_BITS + 1) * METRICS_SUB_BUCKETS - 1;
+    uint64_t count = 0;
+    for(size_t b = 0; b < METRICS_NB_BUCKETS - 1; ++b) {
+        count += buckets[b];
+        if(b < first_exposed) continue;
+        const uint64_t end_ns = bucket_end(b);
+        fprintf(out, "%s_bucket{%s%sle=\"%.9g\"} %" PRIu64 "\n", name, labels, separator, (double) end_ns / 1e9, count);
+    }
+    count += buckets[METRICS_NB_BUCKETS - 1];
+    fprintf(out, "%s_bucket{%s%sle=\"+Inf\"} %" PRIu64 "\n", name, labels, separator, count);
+
+    if(labels[0] != '\0') {
+        fprintf(out, "%s_sum{%s} %.9f\n%s_count{%s} %" PRIu64 "\n", name, labels, (double) sum_ns / 1e9, name, labels, count);
+    } else {
+        fprintf(out, "%s_sum %.9f\n%s_count %" PRIu64 "\n", name, (double) sum_ns / 1e9, name, count);
+    }
+}
+
+static void write_type(FILE* out, const char* name, const char* help)
+{
+    fprintf(out, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+}
+
+int metrics_expose(char** text, size_t* len)
+{
+    M_REQUIRE_NON_NULL(text);
+    M_REQUIRE_NON_NULL(len);
+
+    *text = NULL;
+    *len = 0;
+    FILE* out = open_memstream(text, len);
+    if(out == NULL) return ERR_OUT_OF_MEMORY;
+
+    write_route_counters(out, "imgfs_requests_total", "Requests served, by route.",
+                         offsetof(struct metrics_slot, requests));
+    write_route_counters(out, "imgfs_request_errors_total", "Requests whose handler failed, by route.",
+                         offsetof(struct metrics_slot, errors));
+    write_route_counters(out, "imgfs_sent_bytes_total", "Bytes sent in reply (headers included), by route.",
+                         offsetof(struct metrics_slot, sent_bytes));
+
+    char labels[32];
+    write_type(out, "imgfs_request_duration_seconds", "Time from a request parsed to its reply sent, by route.");
+    for(size_t r = 0; r < NB_ROUTES; ++r) {
+        snprintf(labels, sizeof(labels), "route=\"%s\"", route_names[r]);
+        write_histogram(out, "imgfs_request_duration_seconds", labels,
+                        offsetof(struct metrics_slot, request_duration) + r * sizeof(struct histogram));
+    }
+
+    write_type(out, "imgfs_read_duration_seconds", "Time to serve an image read, by resolution.");
+    for(size_t r = 0; r < NB_RES; ++r) {
+        snprintf(labels, sizeof(labels), "resolution=\"%s\"", resolution_names[r]);
+        write_histogram(out, "imgfs_read_duration_seconds", labels,
+                        offsetof(struct metrics_slot, read_duration) + r * sizeof(struct histogram));
+    }
+
+    // the originals are never resized
+    write_type(out, "imgfs_resize_duration_seconds", "Time to create a resolution of an image on its first read.");
+    for(size_t r = 0; r < NB_RES; ++r) {
+        if(r == ORIG_RES) continue;
+        snprintf(labels, sizeof(labels), "resolution=\"%s\"", resolution_names[r]);
+        write_histogram(out, "imgfs_resize_duration_seconds", labels,
+                        offsetof(struct metrics_slot, resize_duration) + r * sizeof(struct histogram));
+    }
+
+    write_type(out, "imgfs_volume_lock_wait_seconds", "Time waited for the lock of a volume.");
+    write_histogram(out, "imgfs_volume_lock_wait_seconds", "", offsetof(struct metrics_slot, lock_wait));
+    write_type(out, "imgfs_volume_lock_hold_seconds", "Time the lock of a volume was held.");
+    write_histogram(out, "imgfs_volume_lock_hold_seconds", "", offsetof(struct metrics_slot, lock_hold));
+
+    const int failed = ferror(out);
+    if(fclose(out) != 0 || failed) {
+        free(*text);
+        *text = NULL;
+        *len = 0;
+        return ERR_IO;
+    }
+    return ERR_NONE;
+}
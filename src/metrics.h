@@ -0,0 +1,102 @@
+/**
+ * @file metrics.h
+ * @brief Metrics of the server, exposed in the Prometheus text format.
+ *
+ * Each thread records into its own slot of the registry, taken at its first
+ * record and given back when it ends (to the next thread, which goes on
+ * adding to it): recording takes no lock and writes no cache line shared with
+ * another thread. The slots are only summed when the metrics are exposed.
+ *
+ * The durations are kept in log-linear histograms (as HDR histograms do):
+ * METRICS_SUB_BUCKETS buckets per power of two of nanoseconds, thus a
+ * relative error below 1 / METRICS_SUB_BUCKETS whatever the duration.
+ */
+
+#pragma once
+
+#include "imgfs.h" // for NB_RES
+
+#include <stddef.h> // for size_t
+#include <stdint.h> // for uint64_t
+
+// the slots of the registry, for as many threads recording at once; the threads
+// beyond share one last slot
+#define METRICS_MAX_THREADS 128
+
+// log2 of the number of buckets per power of two, and the longest duration told apart (2^36 ns, about 69 s)
+#define METRICS_SUB_BUCKET_BITS 2
+#define METRICS_SUB_BUCKETS     (1 << METRICS_SUB_BUCKET_BITS)
+#define METRICS_MAX_EXPONENT    36
+// the last bucket counts the longer durations
+#define METRICS_NB_BUCKETS      ((METRICS_MAX_EXPONENT - METRICS_SUB_BUCKET_BITS + 1) * METRICS_SUB_BUCKETS + 1)
+// the buckets below 2^METRICS_MIN_EXPOSED_EXPONENT ns (about 1 us) are exposed as one
+#define METRICS_MIN_EXPOSED_EXPONENT 10
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief The routes of the server, as labelled in the metrics
+ */
+enum metrics_route {
+    ROUTE_INDEX,
+    ROUTE_LIST,
+    ROUTE_INSERT,
+    ROUTE_READ,
+    ROUTE_DELETE,
+    ROUTE_METRICS,
+    ROUTE_TRACE,
+    ROUTE_SIMILAR,
+    ROUTE_OTHER,
+    NB_ROUTES
+};
+
+/**
+ * @brief The time of a monotonic clock, in nanoseconds.
+ */
+uint64_t metrics_now_ns(void);
+
+/**
+ * @brief Records a request served.
+ *
+ * @param route Its route
+ * @param error The error code returned by its handler, 0 if no error
+ * @param sent_bytes The number of bytes sent in reply
+ * @param duration_ns How long it took, from its parsing to its reply sent
+ */
+void metrics_request(enum metrics_route route, int error, size_t sent_bytes, uint64_t duration_ns);
+
+/**
+ * @brief Records an image read (in reply to a request) at a resolution.
+ */
+void metrics_read(int resolution, uint64_t duration_ns);
+
+/**
+ * @brief Records an image resized, on its first read at a resolution.
+ */
+void metrics_resize(int resolution, uint64_t duration_ns);
+
+/**
+ * @brief Records the time a lock of a volume was waited for.
+ */
+void metrics_lock_wait(uint64_t duration_ns);
+
+/**
+ * @brief Records the time a lock of a volume was held.
+ */
+void metrics_lock_hold(uint64_t duration_ns);
+
+/**
+ * @brief Writes all the metrics, summed over the threads, in the Prometheus
+ *        text exposition format (version 0.0.4).
+ *
+ * @param text Where to store the text, to be freed by the caller
+ * @param len Where to store its length
+ * @return Some error code. 0 if no error.
+ */
+int metrics_expose(char** text, size_t* len);
+
+#ifdef __cplusplus
+}
+#endif
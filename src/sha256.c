@@ -0,0 +1,126 @@
+/**
+ * @file sha256.c
+ * @brief SHA-256 of the images
+ */
+
+#include "sha256.h"
+#include "error.h"
+#include "util.h"
+
+#include <openssl/evp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+// the algorithm, fetched once (OpenSSL 3 would look it up in its providers at each call)
+static const EVP_MD* algorithm;
+static pthread_once_t algorithm_once = PTHREAD_ONCE_INIT;
+
+// the digest context of each thread, freed when it ends
+static _Thread_local EVP_MD_CTX* own_context;
+static pthread_key_t context_key;
+static int context_key_created;
+
+static void free_context(void* context)
+{
+    EVP_MD_CTX_free(context);
+}
+
+static void fetch_algorithm(void)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    algorithm = EVP_MD_fetch(NULL, "SHA256", NULL);
+#else
+    algorithm = EVP_sha256();
+#endif
+    context_key_created = pthread_key_create(&context_key, free_context) == 0;
+}
+
+/**
+ * @brief The digest context of the calling thread, created at its first call; NULL if out of memory.
+ */
+static EVP_MD_CTX* get_context(void)
+{
+    if(own_context != NULL) return own_context;
+    if(!context_key_created) return NULL;
+
+    EVP_MD_CTX* context = EVP_MD_CTX_new();
+    if(context == NULL) return NULL;
+    if(pthread_setspecific(context_key, context) != 0) {
+        EVP_MD_CTX_free(context);
+        return NULL;
+    }
+    return own_context = context;
+}
+
+int sha256(const void* data, size_t len, unsigned char digest[SHA256_DIGEST_LENGTH])
+{
+    M_REQUIRE_NON_NULL(digest);
+    if(data == NULL && len > 0) return ERR_INVALID_ARGUMENT;
+
+    pthread_once(&algorithm_once, fetch_algorithm);
+    if(algorithm == NULL) return ERR_RUNTIME;
+
+    EVP_MD_CTX* context = get_context();
+    if(context == NULL) return ERR_OUT_OF_MEMORY;
+
+    unsigned int digest_len = 0;
+    if(!EVP_DigestInit_ex(context, algorithm, NULL)
+       || !EVP_DigestUpdate(context, data, len)
+       || !EVP_DigestFinal_ex(context, digest, &digest_len)) return ERR_RUNTIME;
+
+    return digest_len == SHA256_DIGEST_LENGTH ? ERR_NONE : ERR_RUNTIME;
+}
+
+/**
+ * @brief Buffers hashed by several threads, each taking the next one not taken yet
+ */
+struct sha256_batch {
+    size_t nb;
+    const char* const* data;
+    const size_t* lens;
+    unsigned char (*digests)[SHA256_DIGEST_LENGTH];
+    atomic_size_t next;
+    atomic_int error;
+};
+
+static void* hash_batch(void* arg)
+{
+    struct sha256_batch* batch = arg;
+    for(size_t i = atomic_fetch_add(&batch->next, 1); i < batch->nb; i = atomic_fetch_add(&batch->next, 1)) {
+        const int ret = sha256(batch->data[i], batch->lens[i], batch->digests[i]);
+        int none = ERR_NONE;
+        if(ret != ERR_NONE) atomic_compare_exchange_strong(&batch->error, &none, ret);
+    }
+    return NULL;
+}
+
+int sha256_many(size_t nb, const char* const* data, const size_t* lens,
+                unsigned char (*digests)[SHA256_DIGEST_LENGTH])
+{
+    if(nb == 0) return ERR_NONE;
+    M_REQUIRE_NON_NULL(data);
+    M_REQUIRE_NON_NULL(lens);
+    M_REQUIRE_NON_NULL(digests);
+
+    struct sha256_batch batch = {.nb = nb, .data = data, .lens = lens, .digests = digests};
+    atomic_init(&batch.next, 0);
+    atomic_init(&batch.error, ERR_NONE);
+
+    size_t total = 0;
+    for(size_t i = 0; i < nb; ++i) total += lens[i];
+
+    // the calling thread hashes too
+    const long nb_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    const size_t nb_threads = total < SHA256_PARALLEL_MIN_SIZE || nb_cpus < 2 ? 0
+                        : MIN(MIN(nb, (size_t) nb_cpus), SHA256_MAX_THREADS) - 1;
+
+    pthread_t threads[SHA256_MAX_THREADS];
+    size_t nb_started = 0;
+    while(nb_started < nb_threads && pthread_create(&threads[nb_started], NULL, hash_batch, &batch) == 0) ++nb_started;
+
+    hash_batch(&batch);
+    for(size_t t = 0; t < nb_started; ++t) pthread_join(threads[t], NULL);
+
+    return atomic_load(&batch.error);
+}
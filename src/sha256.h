@@ -0,0 +1,51 @@
+/**
+ * @file sha256.h
+ * @brief SHA-256 of the images.
+ *
+ * The digests are computed by the EVP interface of OpenSSL, which picks the
+ * fastest implementation of the CPU (SHA extensions, else AVX2...). The
+ * algorithm is fetched once for the process and each thread reuses its own
+ * digest context: the one-shot SHA256() fetches it and allocates a context
+ * at each call. Several images are hashed at once on several threads
+ * (see sha256_many()), e.g. for a bulk insert.
+ */
+
+#pragma once
+
+#include <openssl/sha.h> // for SHA256_DIGEST_LENGTH
+#include <stddef.h>      // for size_t
+
+// the threads hashing several images at once, and the bytes below which they are hashed by the caller alone
+#define SHA256_MAX_THREADS       8
+#define SHA256_PARALLEL_MIN_SIZE (1 << 20)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Computes the SHA-256 of a buffer.
+ *
+ * @param data The buffer
+ * @param len Its length
+ * @param digest Where to store its digest
+ * @return Some error code. 0 if no error.
+ */
+int sha256(const void* data, size_t len, unsigned char digest[SHA256_DIGEST_LENGTH]);
+
+/**
+ * @brief Computes the SHA-256 of several buffers, on up to SHA256_MAX_THREADS
+ *        threads (one per online CPU) if they hold SHA256_PARALLEL_MIN_SIZE bytes or more.
+ *
+ * @param nb The number of buffers
+ * @param data The buffers
+ * @param lens Their lengths
+ * @param digests Where to store their digests, in the same order
+ * @return Some error code (the first met). 0 if no error.
+ */
+int sha256_many(size_t nb, const char* const* data, const size_t* lens,
+                unsigned char (*digests)[SHA256_DIGEST_LENGTH]);
+
+#ifdef __cplusplus
+}
+#endif
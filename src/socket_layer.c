@@ -1,9 +1,18 @@
+#define _GNU_SOURCE // accept4()
+
 #include "socket_layer.h"
 #include "util.h"
 
 #include <sys/socket.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h> // TCP_NODELAY, TCP_CORK, TCP_DEFER_ACCEPT
 #include <netdb.h>
+#include <limits.h> // INT_MAX
 #include <unistd.h>
+#include <stdio.h>
 #include <string.h>
 
 /**
@@ -29,22 +38,87 @@ int error_handler_for_tcp(const char* error_message, int socket_fd, int error_co
 */
 int tcp_server_init(uint16_t port)
 {
-    int socket_file_descriptor = 0;
-    if((socket_file_descriptor = socket(AF_INET, SOCK_STREAM, 0)) == -1)
-        return error_handler_for_tcp("Error: could not initialize the socket\n", socket_file_descriptor, ERR_IO);
-    int opt = 1;
-    if(setsockopt(socket_file_descriptor, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(int)) == -1)
-        return error_handler_for_tcp("Error: could not initialize the socket\n", socket_file_descriptor, ERR_IO);
-
-    struct sockaddr_in socket_address;
-    zero_init_var(socket_address);
-    socket_address.sin_family = AF_INET;
-    socket_address.sin_port = htons(port);
-    socket_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
-
-    if(bind(socket_file_descriptor, (const struct sockaddr*) &socket_address, sizeof(socket_address)) == -1)
+    return tcp_server_init_at("127.0.0.1", port, TCP_BACKLOG, 0, NULL);
+}
+
+void tcp_options_init(struct tcp_options* options)
+{
+    if(options == NULL) return;
+    zero_init_ptr(options);
+    options->nodelay = 1;
+    options->cork = 1;
+}
+
+/**
+ * @brief Sets the options on a listening socket, before it is bound (SO_RCVBUF must be set
+ * before the connection is established for the TCP window to be scaled accordingly).
+ * @param socket_fd (int) : the listening socket
+ * @param options (const struct tcp_options*) : the options
+ * @return (int) : 0, or -1 if an option could not be set
+*/
+static int set_tcp_options(int socket_fd, const struct tcp_options* options)
+{
+    const int on = 1;
+    const int send_buffer = (int) MIN(options->send_buffer, INT_MAX);
+    const int receive_buffer = (int) MIN(options->receive_buffer, INT_MAX);
+    if((options->nodelay && setsockopt(socket_fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) == -1)
+       || (send_buffer > 0 && setsockopt(socket_fd, SOL_SOCKET, SO_SNDBUF, &send_buffer, sizeof(send_buffer)) == -1)
+       || (receive_buffer > 0 && setsockopt(socket_fd, SOL_SOCKET, SO_RCVBUF, &receive_buffer, sizeof(receive_buffer)) == -1))
+        return -1;
+#ifdef TCP_DEFER_ACCEPT
+    const int defer_accept_s = (int) MIN(options->defer_accept_s, INT_MAX);
+    if(defer_accept_s > 0
+       && setsockopt(socket_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer_accept_s, sizeof(defer_accept_s)) == -1)
+        return -1;
+#endif
+    return 0;
+}
+
+/**
+ * @brief Creates a socket bound to one of the addresses resolved, the first that can be bound, and listens on it.
+ * @param address (const char*) : the address to bind to, NULL for all the interfaces
+ * @param port (uint16_t) : the port to bind to
+ * @param backlog (int) : the size of the queue of the pending connections
+ * @param reuse_port (int) : whether SO_REUSEPORT is set, for other sockets to listen on the same port
+ * @param options (const struct tcp_options*) : the options of the sockets, NULL for none
+ * @return (int) : the file descriptor of the listening socket, or ERR_IO
+*/
+int tcp_server_init_at(const char* address, uint16_t port, int backlog, int reuse_port,
+                       const struct tcp_options* options)
+{
+    char service[6];
+    snprintf(service, sizeof(service), "%u", port);
+
+    struct addrinfo hints;
+    zero_init_var(hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    struct addrinfo* addresses = NULL;
+    if(getaddrinfo(address, service, &hints, &addresses) != 0) {
+        fprintf(stderr, "Error: could not resolve the address %s\n", address != NULL ? address : "*");
+        return ERR_IO;
+    }
+
+    int socket_file_descriptor = -1;
+    for(const struct addrinfo* a = addresses; a != NULL && socket_file_descriptor == -1; a = a->ai_next) {
+        if((socket_file_descriptor = socket(a->ai_family, a->ai_socktype, a->ai_protocol)) == -1) continue;
+
+        const int opt = 1;
+        if(setsockopt(socket_file_descriptor, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1
+           || (reuse_port && setsockopt(socket_file_descriptor, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1)
+           || (options != NULL && set_tcp_options(socket_file_descriptor, options) == -1)
+           || bind(socket_file_descriptor, a->ai_addr, a->ai_addrlen) == -1) {
+            close(socket_file_descriptor);
+            socket_file_descriptor = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+
+    if(socket_file_descriptor == -1)
         return error_handler_for_tcp("Error: could not bind the socket\n", socket_file_descriptor, ERR_IO);
-    if(listen(socket_file_descriptor, 32) == -1)
+    if(listen(socket_file_descriptor, backlog) == -1)
         return error_handler_for_tcp("Error: in listening to new connections\n", socket_file_descriptor, ERR_IO);
 
     return socket_file_descriptor;
@@ -55,6 +129,36 @@ int tcp_accept(int passive_socket)
     return accept(passive_socket, NULL, NULL);
 }
 
+int tcp_set_nonblocking(int socket_fd)
+{
+    const int flags = fcntl(socket_fd, F_GETFL);
+    if(flags == -1 || fcntl(socket_fd, F_SETFL, flags | O_NONBLOCK) == -1) return ERR_IO;
+    return ERR_NONE;
+}
+
+int tcp_accept_batch(int passive_socket, int* sockets, size_t max)
+{
+    if(sockets == NULL || max == 0) return -1;
+
+    struct pollfd listener = {.fd = passive_socket, .events = POLLIN};
+    if(poll(&listener, 1, -1) == -1) return errno == EINTR ? 0 : -1;
+    if(listener.revents & POLLNVAL) return -1;
+
+    size_t nb = 0;
+    while(nb < max) {
+        const int active_socket = accept4(passive_socket, NULL, NULL, SOCK_CLOEXEC);
+        if(active_socket != -1) {
+            sockets[nb++] = active_socket;
+            continue;
+        }
+        // the listening socket is closed (shut down by another thread)
+        if(errno == EBADF || errno == EINVAL || errno == ENOTSOCK) return nb > 0 ? (int) nb : -1;
+        // no more pending connection (EAGAIN), or one aborted by its client, or out of descriptors
+        if(errno != ECONNABORTED && errno != EINTR) break;
+    }
+    return (int) nb;
+}
+
 ssize_t tcp_read(int active_socket, char* buf, size_t buflen)
 {
     M_REQUIRE_NON_NULL(buf);
@@ -73,3 +177,14 @@ ssize_t tcp_send(int active_socket, const char* response, size_t response_len)
 
     return send(active_socket, response, response_len, 0);
 }
+
+int tcp_cork(int active_socket, int on)
+{
+    if(active_socket < 0) return ERR_INVALID_ARGUMENT;
+#ifdef TCP_CORK
+    if(setsockopt(active_socket, IPPROTO_TCP, TCP_CORK, &on, sizeof(on)) == -1) return ERR_IO;
+#else
+    (void) on;
+#endif
+    return ERR_NONE;
+}
@@ -11,13 +11,85 @@
 #include <stdint.h> // uint16_t
 #include <sys/types.h> // ssize_t
 
+#define TCP_BACKLOG 32
+
+/**
+ * @brief Options of the TCP sockets of a server
+ */
+struct tcp_options {
+    /*!Whether TCP_NODELAY is set: a small reply leaves at once, without waiting for the previous one to be acknowledged*/
+    unsigned int nodelay;
+    /*!SO_SNDBUF of the connections (bytes), 0 for the default of the system*/
+    unsigned int send_buffer;
+    /*!SO_RCVBUF of the connections (bytes), 0 for the default of the system*/
+    unsigned int receive_buffer;
+    /*!TCP_DEFER_ACCEPT (s): a connection is accepted only once its first bytes arrived, 0 for no delay*/
+    unsigned int defer_accept_s;
+    /*!Whether the headers and the body of a reply, sent separately, are corked (TCP_CORK) to leave in full segments*/
+    unsigned int cork;
+};
+
+/**
+ * @brief Sets the options to their defaults: TCP_NODELAY and TCP_CORK, the buffers of the system.
+ */
+void tcp_options_init(struct tcp_options* options);
+
+/**
+ * @brief Listens on the given port of the loopback interface, without any option, see tcp_server_init_at()
+ */
 int tcp_server_init(uint16_t port);
 
+/**
+ * @brief Creates a socket listening on the given address and port.
+ *
+ * With reuse_port, the socket is bound with SO_REUSEPORT: several sockets can
+ * listen on the same address and port, the kernel spreading the connections
+ * among them. Without it, binding a port already listened on fails, even by
+ * another process.
+ * The options are set on the listening socket, the connections accepted
+ * inheriting them (TCP_NODELAY and the sizes of the buffers, on Linux).
+ *
+ * @param address The numeric IPv4 or IPv6 address or the host name to bind to,
+ *      NULL for all the interfaces
+ * @param port The port to bind to
+ * @param backlog The maximal number of pending connections
+ * @param reuse_port Whether other sockets are to listen on the same address and port
+ * @param options The options of the sockets, NULL for none
+ * @return The listening socket, or ERR_IO.
+ */
+int tcp_server_init_at(const char* address, uint16_t port, int backlog, int reuse_port,
+                       const struct tcp_options* options);
+
+/**
+ * @brief Corks (on = 1) or uncorks (on = 0) a connection: while corked, only full
+ *        segments are sent, the rest being sent when uncorked. No-op without TCP_CORK.
+ */
+int tcp_cork(int active_socket, int on);
+
 /**
  * @brief Blocking call that accepts a new TCP connection
  */
 int tcp_accept(int passive_socket);
 
+/**
+ * @brief Makes a (listening) socket non-blocking, as tcp_accept_batch() needs it.
+ */
+int tcp_set_nonblocking(int socket_fd);
+
+/**
+ * @brief Blocking call that waits for new TCP connections on a non-blocking
+ *        listening socket, then accepts all those pending, up to max.
+ *
+ * The connections are accepted with accept4() as blocking, close-on-exec sockets.
+ *
+ * @param passive_socket The listening socket, non-blocking
+ * @param sockets Where to store the accepted sockets
+ * @param max Number of elements of sockets
+ * @return The number of connections accepted (possibly 0), or -1 once the
+ *      listening socket is closed (or on a fatal error).
+ */
+int tcp_accept_batch(int passive_socket, int* sockets, size_t max);
+
 /**
  * @brief Blocking call that reads the active socket once and stores the output in buf
  */
@@ -0,0 +1,296 @@
+/**
+ * @file bench-core.c
+ * @brief Throughput and latency percentiles of the operations of the core library
+ *
+ * Creates a synthetic store of max_files slots and fills fill_percent % of
+ * them with images drawn at random among the JPEG images of the test data
+ * (their sizes are thus distributed as those of these images), each made
+ * unique (see bench_make_unique()). Then times, operation by operation:
+ *  - insert: the inserts of the fill;
+ *  - open: opening the filled store (its closing is not timed);
+ *  - read_<res>_first, read_<res>: the first read of each image at each
+ *    resolution (with its resize for thumb and small), then a second one;
+ *  - dedup: do_name_and_content_dedup() of each image (the record restored after);
+ *  - insert_duplicate: inserts of the content of existing images under new
+ *    IDs, in the slots left free;
+ *  - list: JSON listings of the store;
+ *  - delete: the deletion of all the images.
+ *
+ * Prints one CSV line per operation. The random draws are seeded, thus two
+ * runs with the same arguments insert the same images.
+ *
+ * Usage: bench-core [max_files [fill_percent [seed]]]
+ */
+
+#include "imgfs.h"
+#include "image_dedup.h"
+#include "util.h"
+#include "bench.h"
+
+#include <glob.h>
+#include <unistd.h>
+#include <vips/vips.h>
+
+#define DEFAULT_MAX_FILES    1000
+#define DEFAULT_FILL_PERCENT 50
+#define DEFAULT_SEED         0x9e3779b97f4a7c15UL
+#define NB_OPEN_ROUNDS       20
+#define NB_LIST_ROUNDS       20
+
+static uint64_t xorshift_state = DEFAULT_SEED;
+
+static uint64_t xorshift64(void)
+{
+    xorshift_state ^= xorshift_state << 13;
+    xorshift_state ^= xorshift_state >> 7;
+    xorshift_state ^= xorshift_state << 17;
+    return xorshift_state;
+}
+
+/**
+ * @brief The images the store is filled with
+ */
+struct image_set {
+    char** contents;
+    size_t* sizes;
+    size_t count;
+};
+
+/**
+ * @brief Reads all the JPEG images of the test data, with room for a counter (see bench_make_unique())
+ */
+static void load_images(struct image_set* images)
+{
+    glob_t found;
+    if (glob(DATA_DIR "*.jpg", 0, NULL, &found) != 0 || found.gl_pathc == 0) {
+        fprintf(stderr, "no image in %s\n", DATA_DIR);
+        exit(EXIT_FAILURE);
+    }
+
+    images->contents = calloc(found.gl_pathc, sizeof(char*));
+    images->sizes = calloc(found.gl_pathc, sizeof(size_t));
+    if (images->contents == NULL || images->sizes == NULL) BENCH_CHECK(ERR_OUT_OF_MEMORY);
+
+    images->count = 0;
+    for (size_t i = 0; i < found.gl_pathc; ++i) {
+        size_t size = 0;
+        char* content = bench_read_file(found.gl_pathv[i], sizeof(uint64_t), &size);
+        if (content == NULL) BENCH_CHECK(ERR_IO);
+        fprintf(stderr, "image %s: %zu bytes\n", found.gl_pathv[i], size);
+        images->contents[images->count] = content;
+        images->sizes[images->count++] = size;
+    }
+    globfree(&found);
+}
+
+static void free_images(struct image_set* images)
+{
+    for (size_t i = 0; i < images->count; ++i) free(images->contents[i]);
+    free(images->contents);
+    free(images->sizes);
+}
+
+/**
+ * @brief Creates the store, then opens it. do_create() reports on stdout,
+ *        which carries the results: its report goes to stderr.
+ */
+static void create_store(struct imgfs_file* imgfs_file, uint32_t max_files)
+{
+    zero_init_ptr(imgfs_file);
+    imgfs_file->header.max_files = max_files;
+    imgfs_file->header.resized_res[0] = imgfs_file->header.resized_res[1] = 64;
+    imgfs_file->header.resized_res[2] = imgfs_file->header.resized_res[3] = 256;
+
+    fflush(stdout);
+    const int saved_stdout = dup(STDOUT_FILENO);
+    if (saved_stdout == -1 || dup2(STDERR_FILENO, STDOUT_FILENO) == -1) BENCH_CHECK(ERR_IO);
+    const int ret = do_create(BENCH_STORE, imgfs_file);
+    fflush(stdout);
+    if (dup2(saved_stdout, STDOUT_FILENO) == -1) BENCH_CHECK(ERR_IO);
+    close(saved_stdout);
+    BENCH_CHECK(ret);
+
+    do_close(imgfs_file);
+    BENCH_CHECK(do_open(BENCH_STORE, "rb+", imgfs_file));
+}
+
+static void report(const char* operation, uint32_t max_files, uint32_t fill_percent, struct bench_samples* samples)
+{
+    printf("%s,%u,%u,", operation, max_files, fill_percent);
+    bench_samples_report(samples);
+}
+
+static void image_id(char* img_id, uint32_t i)
+{
+    snprintf(img_id, MAX_IMG_ID + 1, "image-%u", i);
+}
+
+static void bench_inserts(struct imgfs_file* imgfs_file, const struct image_set* images, uint32_t nb_images,
+                          uint32_t fill_percent)
+{
+    struct bench_samples samples;
+    bench_samples_init(&samples, nb_images);
+
+    char img_id[MAX_IMG_ID + 1];
+    for (uint32_t i = 0; i < nb_images; ++i) {
+        const size_t drawn = (size_t) (xorshift64() % images->count);
+        const size_t size = bench_make_unique(images->contents[drawn], images->sizes[drawn], i);
+        image_id(img_id, i);
+
+        const uint64_t start = bench_now_ns();
+        BENCH_CHECK(do_insert(images->contents[drawn], size, img_id, imgfs_file));
+        bench_samples_add(&samples, start);
+    }
+    report("insert", imgfs_file->header.max_files, fill_percent, &samples);
+}
+
+static void bench_open(struct imgfs_file* imgfs_file, uint32_t fill_percent)
+{
+    struct bench_samples samples;
+    bench_samples_init(&samples, NB_OPEN_ROUNDS);
+
+    for (uint32_t r = 0; r < NB_OPEN_ROUNDS; ++r) {
+        if (r > 0) do_close(imgfs_file);
+        const uint64_t start = bench_now_ns();
+        BENCH_CHECK(do_open(BENCH_STORE, "rb+", imgfs_file));
+        bench_samples_add(&samples, start);
+    }
+    report("open", imgfs_file->header.max_files, fill_percent, &samples);
+}
+
+static void bench_reads(struct imgfs_file* imgfs_file, uint32_t nb_images, uint32_t fill_percent)
+{
+    static const char* const names[NB_RES][2] = {
+        {"read_thumb_first", "read_thumb"}, {"read_small_first", "read_small"}, {"read_orig_first", "read_orig"}
+    };
+
+    char img_id[MAX_IMG_ID + 1];
+    for (int res = 0; res < NB_RES; ++res) {
+        for (int pass = 0; pass < 2; ++pass) {
+            struct bench_samples samples;
+            bench_samples_init(&samples, nb_images);
+
+            for (uint32_t i = 0; i < nb_images; ++i) {
+                image_id(img_id, i);
+                char* image = NULL;
+                uint32_t size = 0;
+
+                const uint64_t start = bench_now_ns();
+                BENCH_CHECK(do_read(img_id, res, &image, &size, imgfs_file));
+                bench_samples_add(&samples, start);
+                free(image);
+            }
+            report(names[res][pass], imgfs_file->header.max_files, fill_percent, &samples);
+        }
+    }
+}
+
+static void bench_dedup(struct imgfs_file* imgfs_file, uint32_t fill_percent)
+{
+    struct bench_samples samples;
+    bench_samples_init(&samples, imgfs_file->header.max_files);
+
+    for (uint32_t i = 0; i < imgfs_file->header.max_files; ++i) {
+        if (!imgfs_file->metadata[i].is_valid) continue;
+        // an image without duplicate loses its offset
+        const struct img_metadata saved = imgfs_file->metadata[i];
+
+        const uint64_t start = bench_now_ns();
+        BENCH_CHECK(do_name_and_content_dedup(imgfs_file, i));
+        bench_samples_add(&samples, start);
+        imgfs_file->metadata[i] = saved;
+    }
+    report("dedup", imgfs_file->header.max_files, fill_percent, &samples);
+}
+
+/**
+ * @brief Inserts again the content of the first images under new IDs (drawn
+ *        as by bench_inserts(), the random state being reset to its seed)
+ */
+static void bench_duplicate_inserts(struct imgfs_file* imgfs_file, const struct image_set* images,
+                                    uint32_t nb_images, uint32_t fill_percent)
+{
+    const uint32_t nb_duplicates = MIN(nb_images, imgfs_file->header.max_files - imgfs_file->header.nb_files);
+    struct bench_samples samples;
+    bench_samples_init(&samples, nb_duplicates);
+
+    char img_id[MAX_IMG_ID + 1];
+    for (uint32_t i = 0; i < nb_duplicates; ++i) {
+        const size_t drawn = (size_t) (xorshift64() % images->count);
+        const size_t size = bench_make_unique(images->contents[drawn], images->sizes[drawn], i);
+        image_id(img_id, nb_images + i);
+
+        const uint64_t start = bench_now_ns();
+        BENCH_CHECK(do_insert(images->contents[drawn], size, img_id, imgfs_file));
+        bench_samples_add(&samples, start);
+    }
+    report("insert_duplicate", imgfs_file->header.max_files, fill_percent, &samples);
+}
+
+static void bench_list(struct imgfs_file* imgfs_file, uint32_t fill_percent)
+{
+    struct bench_samples samples;
+    bench_samples_init(&samples, NB_LIST_ROUNDS);
+
+    for (uint32_t r = 0; r < NB_LIST_ROUNDS; ++r) {
+        char* json = NULL;
+        const uint64_t start = bench_now_ns();
+        BENCH_CHECK(do_list(imgfs_file, JSON, &json));
+        bench_samples_add(&samples, start);
+        free(json);
+    }
+    report("list", imgfs_file->header.max_files, fill_percent, &samples);
+}
+
+static void bench_deletes(struct imgfs_file* imgfs_file, uint32_t fill_percent)
+{
+    struct bench_samples samples;
+    bench_samples_init(&samples, imgfs_file->header.max_files);
+
+    for (uint32_t i = 0; i < imgfs_file->header.max_files; ++i) {
+        if (!imgfs_file->metadata[i].is_valid) continue;
+        char img_id[MAX_IMG_ID + 1];
+        memcpy(img_id, imgfs_file->metadata[i].img_id, sizeof(img_id));
+
+        const uint64_t start = bench_now_ns();
+        BENCH_CHECK(do_delete(img_id, imgfs_file));
+        bench_samples_add(&samples, start);
+    }
+    report("delete", imgfs_file->header.max_files, fill_percent, &samples);
+}
+
+int main(int argc, char* argv[])
+{
+    VIPS_INIT(argv[0]);
+
+    const uint32_t max_files = argc > 1 ? (uint32_t) strtoul(argv[1], NULL, 10) : DEFAULT_MAX_FILES;
+    const uint32_t fill_percent = argc > 2 ? (uint32_t) strtoul(argv[2], NULL, 10) : DEFAULT_FILL_PERCENT;
+    if (argc > 3) xorshift_state = DEFAULT_SEED ^ strtoull(argv[3], NULL, 10);
+    if (max_files == 0 || fill_percent == 0 || fill_percent > 100) return ERR_INVALID_ARGUMENT;
+    const uint64_t seed = xorshift_state;
+
+    struct image_set images;
+    load_images(&images);
+
+    struct imgfs_file imgfs_file;
+    create_store(&imgfs_file, max_files);
+
+    const uint32_t nb_images = (uint32_t) ((uint64_t) max_files * fill_percent / 100);
+
+    printf("operation,max_files,fill_percent," BENCH_SAMPLES_CSV_HEADER "\n");
+    bench_inserts(&imgfs_file, &images, nb_images, fill_percent);
+    do_close(&imgfs_file);
+    bench_open(&imgfs_file, fill_percent);
+    bench_reads(&imgfs_file, nb_images, fill_percent);
+    bench_dedup(&imgfs_file, fill_percent);
+    xorshift_state = seed;
+    bench_duplicate_inserts(&imgfs_file, &images, nb_images, fill_percent);
+    bench_list(&imgfs_file, fill_percent);
+    bench_deletes(&imgfs_file, fill_percent);
+
+    do_close(&imgfs_file);
+    remove(BENCH_STORE);
+    free_images(&images);
+    vips_shutdown();
+    return 0;
+}
@@ -0,0 +1,72 @@
+/**
+ * @file bench-durability.c
+ * @brief Insert throughput of the imgFS under each durability policy
+ *
+ * Usage: bench-durability [nb_inserts]
+ */
+
+#include "imgfs.h"
+#include "util.h"
+#include "bench.h"
+
+#include <vips/vips.h>
+
+#define DEFAULT_NB_INSERTS 200
+
+static const char* const mode_names[NB_DURABILITY_MODES] = {
+    "none", "periodic", "per-operation", "group-commit"
+};
+
+/**
+ * @brief Creates a fresh store and times nb_inserts distinct inserts
+ *        under the given durability policy.
+ */
+static double bench_inserts(enum imgfs_durability mode, uint32_t nb_inserts,
+                            char* image, size_t image_size)
+{
+    struct imgfs_file imgfs_file;
+    zero_init_var(imgfs_file);
+    imgfs_file.header.max_files = nb_inserts;
+    imgfs_file.header.resized_res[0] = imgfs_file.header.resized_res[1] = 64;
+    imgfs_file.header.resized_res[2] = imgfs_file.header.resized_res[3] = 256;
+
+    BENCH_CHECK(do_create(BENCH_STORE, &imgfs_file));
+    do_close(&imgfs_file);
+    BENCH_CHECK(do_open(BENCH_STORE, "rb+", &imgfs_file));
+    BENCH_CHECK(do_set_durability(&imgfs_file, mode, 0));
+
+    char img_id[MAX_IMG_ID + 1];
+    const uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < nb_inserts; ++i) {
+        snprintf(img_id, sizeof(img_id), "img%u", i);
+        const size_t size = bench_make_unique(image, image_size, i);
+        BENCH_CHECK(do_insert(image, size, img_id, &imgfs_file));
+    }
+    do_close(&imgfs_file); // includes the final sync of the pending operations
+    const uint64_t elapsed = bench_now_ns() - start;
+
+    remove(BENCH_STORE);
+    return nb_inserts * 1e9 / (double) elapsed;
+}
+
+int main(int argc, char* argv[])
+{
+    VIPS_INIT(argv[0]);
+
+    const uint32_t nb_inserts = argc > 1 ? (uint32_t) strtoul(argv[1], NULL, 10) : DEFAULT_NB_INSERTS;
+    if (nb_inserts == 0) return ERR_INVALID_ARGUMENT;
+
+    size_t image_size = 0;
+    char* image = bench_read_file(IMAGE("papillon"), sizeof(uint64_t), &image_size);
+    if (image == NULL) return ERR_IO;
+
+    printf("mode,inserts,inserts_per_s\n");
+    for (int mode = DURABILITY_NONE; mode < NB_DURABILITY_MODES; ++mode) {
+        const double throughput = bench_inserts((enum imgfs_durability) mode, nb_inserts, image, image_size);
+        printf("%s,%u,%.1f\n", mode_names[mode], nb_inserts, throughput);
+    }
+
+    free(image);
+    vips_shutdown();
+    return 0;
+}
@@ -0,0 +1,161 @@
+/**
+ * @file bench-index.c
+ * @brief Scans over the img_metadata records vs. over the SoA index
+ *
+ * Builds a synthetic in-memory store (no file) with a given number of slots,
+ * a given percentage of them valid, and times three scans both ways: listing
+ * the valid slots, looking up an absent ID and looking for a duplicate
+ * content (which, the images having fingerprints, the counting filters of the
+ * index answer without scan).
+ *
+ * Usage: bench-index [nb_slots [percent_valid [nb_rounds]]]
+ */
+
+#include "imgfs.h"
+#include "imgfs_index.h"
+#include "image_dedup.h"
+#include "util.h"
+#include "bench.h"
+
+#define DEFAULT_NB_SLOTS  1000000
+#define DEFAULT_PERCENT   50
+#define DEFAULT_NB_ROUNDS 10
+
+static uint64_t xorshift_state = 0x9e3779b97f4a7c15UL;
+
+static uint64_t xorshift64(void)
+{
+    xorshift_state ^= xorshift_state << 13;
+    xorshift_state ^= xorshift_state >> 7;
+    xorshift_state ^= xorshift_state << 17;
+    return xorshift_state;
+}
+
+/**
+ * @brief Fills the store: percent_valid % of the slots hold an image with a unique ID and SHA (and a random fingerprint)
+ */
+static void fill_store(struct imgfs_file* imgfs_file, uint32_t nb_slots, uint32_t percent_valid)
+{
+    imgfs_file->header.max_files = nb_slots;
+    imgfs_file->metadata = imgfs_index_alloc(nb_slots, &imgfs_file->index);
+    if (imgfs_file->metadata == NULL) BENCH_CHECK(ERR_OUT_OF_MEMORY);
+
+    for (uint32_t i = 0; i < nb_slots; ++i) {
+        struct img_metadata* metadata = &imgfs_file->metadata[i];
+        if (xorshift64() % 100 >= percent_valid) continue;
+
+        snprintf(metadata->img_id, sizeof(metadata->img_id), "image-%u", i);
+        for (size_t b = 0; b < SHA256_DIGEST_LENGTH; b += sizeof(uint64_t)) {
+            const uint64_t random = xorshift64();
+            memcpy(metadata->SHA + b, &random, sizeof(random));
+        }
+        metadata->size[ORIG_RES] = 10000 + (uint32_t) (xorshift64() % 1000);
+        metadata->fingerprint = (uint16_t) (xorshift64() | 1);
+        metadata->offset[ORIG_RES] = 1UL + i;
+        metadata->is_valid = NON_EMPTY;
+        ++imgfs_file->header.nb_files;
+    }
+
+    imgfs_index_build(&imgfs_file->index, imgfs_file->metadata);
+}
+
+// ======================================================================
+// the scans as done before the index, on the records
+static uint32_t records_list(const struct imgfs_file* imgfs_file)
+{
+    uint32_t nb = 0;
+    for (uint32_t i = 0; i < imgfs_file->header.max_files; ++i) {
+        if (imgfs_file->metadata[i].is_valid) nb += imgfs_file->metadata[i].img_id[0] != '\0';
+    }
+    return nb;
+}
+
+static int records_find(const struct imgfs_file* imgfs_file, const char* img_id)
+{
+    for (uint32_t i = 0; i < imgfs_file->header.max_files; ++i) {
+        const struct img_metadata* metadata = &imgfs_file->metadata[i];
+        if (metadata->is_valid && !strncmp(metadata->img_id, img_id, MAX_IMG_ID + 1)) return ERR_NONE;
+    }
+    return ERR_IMAGE_NOT_FOUND;
+}
+
+static uint32_t records_dedup(const struct imgfs_file* imgfs_file, uint32_t index)
+{
+    const struct img_metadata* image = &imgfs_file->metadata[index];
+    uint32_t nb = 0;
+    for (uint32_t i = 0; i < imgfs_file->header.max_files; ++i) {
+        const struct img_metadata* metadata = &imgfs_file->metadata[i];
+        if (i != index && metadata->is_valid) {
+            if (!strncmp(metadata->img_id, image->img_id, MAX_IMG_ID + 1)) return 0;
+            nb += !memcmp(metadata->SHA, image->SHA, SHA256_DIGEST_LENGTH);
+        }
+    }
+    return nb;
+}
+
+// ======================================================================
+// the same scans through the index
+static uint32_t index_list(const struct imgfs_file* imgfs_file)
+{
+    const struct imgfs_index* hot = &imgfs_file->index;
+    uint32_t nb = 0;
+    for (uint32_t i = imgfs_index_next_valid(hot, 0); i < hot->nb_slots; i = imgfs_index_next_valid(hot, i + 1)) {
+        nb += imgfs_file->metadata[i].img_id[0] != '\0';
+    }
+    return nb;
+}
+
+static volatile uint32_t sink;
+
+/**
+ * @brief Best time in ms over nb_rounds of a scan
+ */
+#define TIME_SCAN(nb_rounds, best, expression)              \
+    do {                                                    \
+        best = 1e30;                                        \
+        for (uint32_t r = 0; r < (nb_rounds); ++r) {        \
+            const uint64_t start = bench_now_ns();          \
+            sink = (uint32_t) (expression);                 \
+            const double ms = (double) (bench_now_ns() - start) / 1e6; \
+            if (ms < best) best = ms;                       \
+        }                                                   \
+    } while (0)
+
+static void report(const char* scan, uint32_t nb_slots, uint32_t percent_valid, double records_ms, double index_ms)
+{
+    printf("%s,%u,%u,%.3f,%.3f,%.1f\n", scan, nb_slots, percent_valid, records_ms, index_ms, records_ms / index_ms);
+}
+
+int main(int argc, char* argv[])
+{
+    const uint32_t nb_slots = argc > 1 ? (uint32_t) strtoul(argv[1], NULL, 10) : DEFAULT_NB_SLOTS;
+    const uint32_t percent_valid = argc > 2 ? (uint32_t) strtoul(argv[2], NULL, 10) : DEFAULT_PERCENT;
+    const uint32_t nb_rounds = argc > 3 ? (uint32_t) strtoul(argv[3], NULL, 10) : DEFAULT_NB_ROUNDS;
+    if (nb_slots == 0 || percent_valid == 0 || percent_valid > 100 || nb_rounds == 0) return ERR_INVALID_ARGUMENT;
+
+    struct imgfs_file imgfs_file;
+    zero_init_var(imgfs_file);
+    fill_store(&imgfs_file, nb_slots, percent_valid);
+
+    const uint32_t probe = imgfs_index_next_valid(&imgfs_file.index, 0);
+    uint32_t found = 0;
+    double records_ms = 0;
+    double index_ms = 0;
+
+    printf("scan,slots,percent_valid,records_ms,index_ms,speedup\n");
+
+    TIME_SCAN(nb_rounds, records_ms, records_list(&imgfs_file));
+    TIME_SCAN(nb_rounds, index_ms, index_list(&imgfs_file));
+    report("list", nb_slots, percent_valid, records_ms, index_ms);
+
+    TIME_SCAN(nb_rounds, records_ms, records_find(&imgfs_file, "absent"));
+    TIME_SCAN(nb_rounds, index_ms, find_image("absent", &imgfs_file, &found));
+    report("find_absent", nb_slots, percent_valid, records_ms, index_ms);
+
+    TIME_SCAN(nb_rounds, records_ms, records_dedup(&imgfs_file, probe));
+    TIME_SCAN(nb_rounds, index_ms, do_name_and_content_dedup(&imgfs_file, probe));
+    report("dedup", nb_slots, percent_valid, records_ms, index_ms);
+
+    free(imgfs_file.metadata);
+    return 0;
+}
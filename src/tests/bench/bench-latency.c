@@ -0,0 +1,171 @@
+/**
+ * @file bench-latency.c
+ * @brief Latency of thumbnail replies under each TCP configuration
+ *
+ * Serves a thumbnail with the HTTP layer of the server (no imgFS behind it)
+ * and times sequential requests on one keep-alive connection from a client
+ * thread, for every combination of TCP_NODELAY and TCP_CORK. Two replies are
+ * timed: a plain one (headers and body, see http_reply()) and a chunked one
+ * (headers, then the body as a chunk, then the last chunk, as the listings
+ * are sent), whose successive small writes are what Nagle's algorithm delays.
+ *
+ * Usage: bench-latency [nb_requests [port]]
+ */
+
+#include "http_net.h"
+#include "util.h"
+#include "bench.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define DEFAULT_NB_REQUESTS 200
+#define DEFAULT_PORT        8150
+#define RESPONSE_MAX_SIZE   (1 << 20)
+
+#define LAST_CHUNK      HTTP_LINE_DELIM "0" HTTP_HDR_END_DELIM
+
+#define PLAIN_REQUEST   "GET /plain HTTP/1.1\r\nHost: localhost\r\n\r\n"
+#define CHUNKED_REQUEST "GET /chunked HTTP/1.1\r\nHost: localhost\r\n\r\n"
+
+static const char* thumbnail = NULL;
+static size_t thumbnail_size = 0;
+
+static const struct {
+    const char* name;
+    unsigned int nodelay;
+    unsigned int cork;
+} configurations[] = {
+    {"nagle", 0, 0},
+    {"nagle+cork", 0, 1},
+    {"nodelay", 1, 0},
+    {"nodelay+cork", 1, 1}
+};
+
+/**
+ * @brief The callback of the server: the thumbnail, plain or chunked
+ */
+static int serve_thumbnail(struct http_message* msg, int connection)
+{
+    if (http_match_uri(msg, "/chunked")) {
+        int ret = http_reply_chunked(connection, HTTP_OK, "Content-Type: image/jpeg" HTTP_LINE_DELIM);
+        if (ret == ERR_NONE) ret = http_send_chunk(connection, thumbnail, thumbnail_size);
+        if (ret == ERR_NONE) ret = http_send_chunk(connection, NULL, 0);
+        return ret;
+    }
+    return http_reply(connection, HTTP_OK, "Content-Type: image/jpeg" HTTP_LINE_DELIM, thumbnail, thumbnail_size);
+}
+
+static void* accept_loop(void* arg _unused)
+{
+    while (http_receive() == ERR_NONE) {}
+    return NULL;
+}
+
+/**
+ * @brief Reads a whole reply: until the end of its headers then its Content-Length bytes,
+ *        or, chunked, until the last chunk
+ */
+static void read_reply(int client, char* response)
+{
+    size_t len = 0;
+    const char* body = NULL;
+    size_t expected = 0;
+
+    for (;;) {
+        const ssize_t ret = recv(client, response + len, RESPONSE_MAX_SIZE - 1 - len, 0);
+        if (ret <= 0) BENCH_CHECK(ERR_IO);
+        len += (size_t) ret;
+        response[len] = '\0';
+
+        if (body == NULL && (body = strstr(response, HTTP_HDR_END_DELIM)) != NULL) {
+            body += strlen(HTTP_HDR_END_DELIM);
+            const char* content_length = strstr(response, "Content-Length: ");
+            expected = content_length != NULL && content_length < body
+                       ? (size_t) (body - response) + strtoul(content_length + strlen("Content-Length: "), NULL, 10)
+                       : 0;
+        }
+        if (body == NULL) continue;
+        // (the body is binary: the last chunk is looked for at the end of what is received)
+        if (expected != 0 ? len >= expected
+            : len >= strlen(LAST_CHUNK) && !memcmp(response + len - strlen(LAST_CHUNK), LAST_CHUNK, strlen(LAST_CHUNK))) return;
+    }
+}
+
+static int compare_u64(const void* a, const void* b)
+{
+    const uint64_t x = *(const uint64_t*) a;
+    const uint64_t y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Times nb_requests requests on one connection and prints the percentiles of their latencies (in us)
+ */
+static void time_requests(const char* configuration, const char* reply, const char* request, uint16_t port,
+                          uint32_t nb_requests, uint64_t* latencies, char* response)
+{
+    const int client = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address;
+    zero_init_var(address);
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (client == -1 || connect(client, (const struct sockaddr*) &address, sizeof(address)) == -1) BENCH_CHECK(ERR_IO);
+
+    for (uint32_t i = 0; i < nb_requests; ++i) {
+        const uint64_t start = bench_now_ns();
+        if (send(client, request, strlen(request), 0) != (ssize_t) strlen(request)) BENCH_CHECK(ERR_IO);
+        read_reply(client, response);
+        latencies[i] = bench_now_ns() - start;
+    }
+    close(client);
+
+    qsort(latencies, nb_requests, sizeof(uint64_t), compare_u64);
+    printf("%s,%s,%zu,%.1f,%.1f,%.1f,%.1f\n", configuration, reply,
+           thumbnail_size, (double) latencies[nb_requests / 2] / 1e3, (double) latencies[nb_requests * 9 / 10] / 1e3,
+           (double) latencies[nb_requests * 99 / 100] / 1e3, (double) latencies[nb_requests - 1] / 1e3);
+}
+
+int main(int argc, char* argv[])
+{
+    const uint32_t nb_requests = argc > 1 ? (uint32_t) strtoul(argv[1], NULL, 10) : DEFAULT_NB_REQUESTS;
+    const uint16_t port = argc > 2 ? (uint16_t) strtoul(argv[2], NULL, 10) : DEFAULT_PORT;
+    if (nb_requests == 0 || port == 0) return ERR_INVALID_ARGUMENT;
+
+    char* image = bench_read_file(IMAGE("coquelicots_thumb"), 0, &thumbnail_size);
+    uint64_t* latencies = calloc(nb_requests, sizeof(uint64_t));
+    char* response = calloc(RESPONSE_MAX_SIZE, sizeof(char));
+    if (image == NULL || latencies == NULL || response == NULL) BENCH_CHECK(ERR_OUT_OF_MEMORY);
+    thumbnail = image;
+
+    printf("configuration,reply,body_bytes,p50_us,p90_us,p99_us,max_us\n");
+
+    for (size_t c = 0; c < sizeof(configurations) / sizeof(configurations[0]); ++c) {
+        struct http_options options;
+        http_options_init(&options);
+        options.max_requests = 0;
+        options.tcp.nodelay = configurations[c].nodelay;
+        options.tcp.cork = configurations[c].cork;
+
+        const int passive_socket = http_init(port, serve_thumbnail, &options);
+        if (passive_socket < 0) BENCH_CHECK(passive_socket);
+
+        pthread_t server;
+        if (pthread_create(&server, NULL, accept_loop, NULL) != 0) BENCH_CHECK(ERR_THREADING);
+
+        time_requests(configurations[c].name, "plain", PLAIN_REQUEST, port, nb_requests, latencies, response);
+        time_requests(configurations[c].name, "chunked", CHUNKED_REQUEST, port, nb_requests, latencies, response);
+
+        http_close();
+        pthread_join(server, NULL);
+    }
+
+    free(response);
+    free(latencies);
+    free(image);
+    return 0;
+}
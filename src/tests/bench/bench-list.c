@@ -0,0 +1,145 @@
+/**
+ * @file bench-list.c
+ * @brief JSON listing: json-c object tree vs. the streaming JSON writer
+ *
+ * Builds a synthetic in-memory store (no file) whose slots all hold an
+ * image and times its JSON listing three ways: as do_list() used to do it
+ * (one json-c object per ID, serialized then duplicated), with do_list()
+ * (a new writer per listing, the buffer handed to the caller) and with
+ * do_list_json() on a writer reused from a listing to the next (no
+ * allocation once its buffer is large enough). The outputs are checked to
+ * be identical.
+ *
+ * Usage: bench-list [nb_entries [nb_rounds]]
+ *        (without arguments: 100000 then 1000000 entries)
+ */
+
+#include "imgfs.h"
+#include "imgfs_index.h"
+#include "json_writer.h"
+#include "util.h"
+#include "bench.h"
+
+#include <json-c/json.h>
+
+#define DEFAULT_NB_ROUNDS 5
+
+/**
+ * @brief Fills every slot of the store with an image of unique ID
+ */
+static void fill_store(struct imgfs_file* imgfs_file, uint32_t nb_entries)
+{
+    imgfs_file->header.max_files = nb_entries;
+    imgfs_file->header.nb_files = nb_entries;
+    imgfs_file->metadata = imgfs_index_alloc(nb_entries, &imgfs_file->index);
+    if (imgfs_file->metadata == NULL) BENCH_CHECK(ERR_OUT_OF_MEMORY);
+
+    for (uint32_t i = 0; i < nb_entries; ++i) {
+        snprintf(imgfs_file->metadata[i].img_id, MAX_IMG_ID + 1, "image-%u", i);
+        imgfs_file->metadata[i].is_valid = NON_EMPTY;
+    }
+
+    imgfs_index_build(&imgfs_file->index, imgfs_file->metadata);
+}
+
+/**
+ * @brief The JSON listing as done before the writer
+ */
+static char* jsonc_list(const struct imgfs_file* imgfs_file)
+{
+    struct json_object* json_object = json_object_new_object();
+    struct json_object* json_array = json_object_new_array();
+
+    for (uint32_t i = 0; i < imgfs_file->header.max_files; ++i) {
+        if (imgfs_file->metadata[i].is_valid) {
+            json_object_array_add(json_array, json_object_new_string(imgfs_file->metadata[i].img_id));
+        }
+    }
+    json_object_object_add(json_object, "Images", json_array);
+
+    char* json = strdup(json_object_to_json_string(json_object));
+    json_object_put(json_object);
+    return json;
+}
+
+static char* writer_list(const struct imgfs_file* imgfs_file)
+{
+    char* json = NULL;
+    BENCH_CHECK(do_list(imgfs_file, JSON, &json));
+    return json;
+}
+
+static const char* reused_writer_list(const struct imgfs_file* imgfs_file, struct json_writer* writer)
+{
+    json_writer_reset(writer);
+    BENCH_CHECK(do_list_json(imgfs_file, 1, NULL, writer));
+    return writer->buffer;
+}
+
+/**
+ * @brief Best time in ms over nb_rounds of a listing; the output of the last round is left in last
+ */
+#define TIME_LIST(nb_rounds, best, last, expression, release)  \
+    do {                                                        \
+        best = 1e30;                                            \
+        for (uint32_t r = 0; r < (nb_rounds); ++r) {            \
+            if (r > 0) release;                                 \
+            const uint64_t start = bench_now_ns();              \
+            last = (expression);                                \
+            const double ms = (double) (bench_now_ns() - start) / 1e6; \
+            if (ms < best) best = ms;                           \
+        }                                                       \
+    } while (0)
+
+static void bench(uint32_t nb_entries, uint32_t nb_rounds)
+{
+    struct imgfs_file imgfs_file;
+    zero_init_var(imgfs_file);
+    fill_store(&imgfs_file, nb_entries);
+
+    struct json_writer writer;
+    BENCH_CHECK(json_writer_init(&writer, NULL, NULL));
+
+    double jsonc_ms = 0;
+    double writer_ms = 0;
+    double reused_ms = 0;
+    char* jsonc = NULL;
+    char* written = NULL;
+    const char* reused = NULL;
+
+    TIME_LIST(nb_rounds, jsonc_ms, jsonc, jsonc_list(&imgfs_file), free(jsonc));
+    TIME_LIST(nb_rounds, writer_ms, written, writer_list(&imgfs_file), free(written));
+    TIME_LIST(nb_rounds, reused_ms, reused, reused_writer_list(&imgfs_file, &writer), (void) reused);
+
+    if (strcmp(jsonc, written) != 0 || strcmp(jsonc, reused) != 0) {
+        fprintf(stderr, "the JSON listings differ\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%u,%zu,%.3f,%.3f,%.3f,%.1f\n", nb_entries, strlen(jsonc), jsonc_ms, writer_ms, reused_ms,
+           jsonc_ms / reused_ms);
+
+    free(jsonc);
+    free(written);
+    json_writer_free(&writer);
+    free(imgfs_file.metadata);
+}
+
+int main(int argc, char* argv[])
+{
+    const uint32_t nb_rounds = argc > 2 ? (uint32_t) strtoul(argv[2], NULL, 10) : DEFAULT_NB_ROUNDS;
+    if (nb_rounds == 0) return ERR_INVALID_ARGUMENT;
+
+    printf("entries,bytes,jsonc_ms,writer_ms,reused_writer_ms,speedup\n");
+
+    if (argc > 1) {
+        const uint32_t nb_entries = (uint32_t) strtoul(argv[1], NULL, 10);
+        if (nb_entries == 0) return ERR_INVALID_ARGUMENT;
+        bench(nb_entries, nb_rounds);
+    } else {
+        bench(100000, nb_rounds);
+        bench(1000000, nb_rounds);
+    }
+
+    return 0;
+}
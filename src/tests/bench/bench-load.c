@@ -0,0 +1,747 @@
+/**
+ * @file bench-load.c
+ * @brief Load generator for imgfs_server
+ *
+ * Each thread keeps a connection to the server (alive from a request to the
+ * next, unless -keepalive 0) and sends its requests open-loop, at a fixed
+ * rate: the i-th is due at start + i / (rate / nb_threads), whether the
+ * previous replies were late or not (a thread late on its schedule sends
+ * without waiting). With -rate 0, each thread sends its next request as soon
+ * as it has the reply of the previous one (closed loop, the maximal
+ * throughput).
+ *
+ * The requests are drawn according to a mix of reads, inserts and deletes:
+ *  - a read is of an image of the store (listed before the run, -res
+ *    resolution), drawn along a Zipf law of exponent -zipf (0 for uniform)
+ *    over the IDs: the first IDs listed are the most read;
+ *  - an insert is of a test image, made unique, under a new ID;
+ *  - a delete is of an image inserted before by the thread (a read if none).
+ *
+ * Prints, per operation and for all of them: the number of requests, of
+ * errors (status >= 400 or connection lost), the throughput and the
+ * percentiles of two measures, up to the whole reply received:
+ *  - latency: from the time the request was due. When the server stalls
+ *    (e.g. behind the lock of a volume during a resize), the requests due
+ *    meanwhile are sent late: timed from their sending, they would hide the
+ *    stall (the "coordinated omission" of closed-loop clients);
+ *  - service: from the request sent.
+ * With -hgrm PREFIX, the distribution of the latencies of all the requests is
+ * also written to PREFIX.hgrm, in the format of HdrHistogram.
+ *
+ * With -compare PORT, the same run (same schedule and same random draws) is
+ * then done against a second server, e.g. another build started on a copy of
+ * the same store, and each statistic of both runs is printed with their
+ * ratio (its distribution going to PREFIX-compare.hgrm).
+ *
+ * Usage: bench-load [-address A] [-port P] [-threads T] [-rate REQ_PER_S]
+ *                   [-duration S] [-mix READ:INSERT:DELETE] [-zipf S]
+ *                   [-res thumb|small|orig] [-keepalive 0|1]
+ *                   [-hgrm PREFIX] [-compare PORT]
+ */
+
+#include "http_prot.h"
+#include "util.h"
+#include "bench.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h> // for PRIu64
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <string.h> // for strerror()
+#include <strings.h> // for strncasecmp()
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define DEFAULT_PORT      8000
+#define DEFAULT_THREADS   4
+#define DEFAULT_RATE      1000
+#define DEFAULT_DURATION  10
+#define DEFAULT_ZIPF      0.99
+#define MAX_KEY_LENGTH    127
+#define HEADERS_MAX_SIZE  8192
+#define URI_MAX_SIZE      (2 * MAX_KEY_LENGTH + 64)
+
+#define INSERT_IMAGE IMAGE("papillon")
+
+enum operation {
+    OP_READ,
+    OP_INSERT,
+    OP_DELETE,
+    NB_OPERATIONS
+};
+
+// the statistics of all the operations are kept after those of each
+static const char* const operation_names[NB_OPERATIONS + 1] = {"read", "insert", "delete", "all"};
+
+enum measure {
+    LATENCY,
+    SERVICE,
+    NB_MEASURES
+};
+
+static const char* const measure_names[NB_MEASURES] = {"latency", "service"};
+
+/**
+ * @brief The parameters of the run
+ */
+struct load_options {
+    struct in_addr address;
+    uint16_t port;
+    uint32_t nb_threads;
+    double rate;
+    double duration_s;
+    uint32_t mix[NB_OPERATIONS];
+    double zipf;
+    const char* resolution;
+    int keepalive;
+    const char* hgrm_prefix;
+    uint16_t compare_port;
+};
+
+/**
+ * @brief The IDs of the images read, and the Zipf law they are drawn along
+ */
+struct key_set {
+    char** ids;
+    size_t count;
+    /*!cdf[k]: the probability to draw one of the k + 1 first IDs*/
+    double* cdf;
+};
+
+/**
+ * @brief What a thread sends and measures
+ */
+struct load_thread {
+    pthread_t thread;
+    uint32_t number;
+    const struct load_options* options;
+    const struct key_set* keys;
+    /*!Its own copy of the image inserted, with room for a counter (see bench_make_unique())*/
+    char* image;
+    size_t image_size;
+    uint64_t start_ns;
+    uint64_t end_ns;
+
+    int connection;
+    uint64_t random;
+    char* response;
+    size_t response_capacity;
+
+    /*!The images it inserted, not deleted yet (the oldest deleted first)*/
+    uint32_t* inserted;
+    size_t first_inserted;
+    size_t nb_inserted;
+    size_t inserted_capacity;
+    uint32_t next_insert;
+
+    struct bench_samples samples[NB_MEASURES][NB_OPERATIONS];
+    uint64_t errors[NB_OPERATIONS];
+};
+
+/**
+ * @brief What a run measured, per operation then for all
+ */
+struct load_result {
+    struct bench_samples samples[NB_MEASURES][NB_OPERATIONS + 1];
+    uint64_t errors[NB_OPERATIONS + 1];
+    double duration_s;
+};
+
+static uint64_t xorshift64(uint64_t* state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/**
+ * @brief A random number in [0, 1)
+ */
+static double uniform(uint64_t* state)
+{
+    return (double) (xorshift64(state) >> 11) / 9007199254740992.0;
+}
+
+// ======================================================================
+static int open_connection(const struct load_options* options)
+{
+    struct sockaddr_in address;
+    zero_init_var(address);
+    address.sin_family = AF_INET;
+    address.sin_port = htons(options->port);
+    address.sin_addr = options->address;
+
+    const int connection = socket(AF_INET, SOCK_STREAM, 0);
+    if (connection == -1) return -1;
+    const int on = 1;
+    setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    if (connect(connection, (const struct sockaddr*) &address, sizeof(address)) == -1) {
+        close(connection);
+        return -1;
+    }
+    return connection;
+}
+
+static int send_all(int connection, const char* buffer, size_t len)
+{
+    while (len > 0) {
+        const ssize_t sent = send(connection, buffer, len, MSG_NOSIGNAL);
+        if (sent <= 0) return ERR_IO;
+        buffer += sent;
+        len -= (size_t) sent;
+    }
+    return ERR_NONE;
+}
+
+/**
+ * @brief Reads a whole response into *buffer (grown as needed), its body being decoded if it is chunked
+ * @param status (int*) : where to store its status code
+ * @param body_offset (size_t*) : where to store the offset of its body in *buffer
+ * @param body_len (size_t*) : where to store the length of its (decoded) body
+ * @param close_after (int*) : where to store whether the server closes the connection after it
+ * @return (int) : some error code, ERR_IO if the connection is lost or the response malformed
+ */
+static int read_response(int connection, char** buffer, size_t* capacity, int* status,
+                         size_t* body_offset, size_t* body_len, int* close_after)
+{
+    size_t len = 0;
+    const char* end = NULL;
+    while (end == NULL) {
+        if (len + 1 >= HEADERS_MAX_SIZE) return ERR_IO;
+        const ssize_t received = recv(connection, *buffer + len, HEADERS_MAX_SIZE - 1 - len, 0);
+        if (received <= 0) return ERR_IO;
+        len += (size_t) received;
+        (*buffer)[len] = '\0';
+        end = strstr(*buffer, HTTP_HDR_END_DELIM);
+    }
+
+    const size_t headers_len = (size_t) (end - *buffer) + strlen(HTTP_HDR_END_DELIM);
+    if (sscanf(*buffer, "HTTP/1.%*d %d", status) != 1) return ERR_IO;
+
+    long content_length = -1;
+    int chunked = 0;
+    *close_after = 0;
+    for (const char* line = strstr(*buffer, HTTP_LINE_DELIM); line != NULL && line < end;
+         line = strstr(line + strlen(HTTP_LINE_DELIM), HTTP_LINE_DELIM)) {
+        const char* header = line + strlen(HTTP_LINE_DELIM);
+        if (!strncasecmp(header, "Content-Length:", strlen("Content-Length:"))) {
+            content_length = strtol(header + strlen("Content-Length:"), NULL, 10);
+        } else if (!strncasecmp(header, "Transfer-Encoding:", strlen("Transfer-Encoding:"))) {
+            chunked = 1;
+        } else if (!strncasecmp(header, "Connection: close", strlen("Connection: close"))) {
+            *close_after = 1;
+        }
+    }
+
+    *body_offset = headers_len;
+    if (!chunked) {
+        if (content_length < 0) return ERR_IO;
+        const size_t total = headers_len + (size_t) content_length;
+        if (total + 1 > *capacity) {
+            char* grown = realloc(*buffer, total + 1);
+            if (grown == NULL) return ERR_OUT_OF_MEMORY;
+            *buffer = grown;
+            *capacity = total + 1;
+        }
+        while (len < total) {
+            const ssize_t received = recv(connection, *buffer + len, total - len, 0);
+            if (received <= 0) return ERR_IO;
+            len += (size_t) received;
+        }
+        *body_len = (size_t) content_length;
+        return ERR_NONE;
+    }
+
+    // the chunks are decoded in place, as they are received
+    struct http_chunked decoder;
+    http_chunked_init(&decoder);
+    size_t decoded = 0;
+    size_t pending = len - headers_len;
+    for (;;) {
+        size_t out_len = 0;
+        const int ret = http_chunked_decode(&decoder, *buffer + headers_len + decoded, pending,
+                                            *buffer + headers_len + decoded, &out_len);
+        if (ret < 0) return ERR_IO;
+        decoded += out_len;
+        if (ret > 0) break;
+
+        if (headers_len + decoded + HEADERS_MAX_SIZE > *capacity) {
+            char* grown = realloc(*buffer, 2 * *capacity + HEADERS_MAX_SIZE);
+            if (grown == NULL) return ERR_OUT_OF_MEMORY;
+            *buffer = grown;
+            *capacity = 2 * *capacity + HEADERS_MAX_SIZE;
+        }
+        const ssize_t received = recv(connection, *buffer + headers_len + decoded,
+                                      *capacity - headers_len - decoded, 0);
+        if (received <= 0) return ERR_IO;
+        pending = (size_t) received;
+    }
+    *body_len = decoded;
+    return ERR_NONE;
+}
+
+// ======================================================================
+/**
+ * @brief Lists the IDs of the images of the store
+ */
+static void list_keys(const struct load_options* options, struct key_set* keys)
+{
+    const int connection = open_connection(options);
+    if (connection == -1) {
+        fprintf(stderr, "cannot connect to the server\n");
+        exit(EXIT_FAILURE);
+    }
+
+    const char request[] = "GET /imgfs/list HTTP/1.1" HTTP_LINE_DELIM "Host: localhost" HTTP_HDR_END_DELIM;
+    size_t capacity = HEADERS_MAX_SIZE;
+    char* response = malloc(capacity);
+    int status = 0;
+    size_t body = 0;
+    size_t body_len = 0;
+    int close_after = 0;
+    if (response == NULL) BENCH_CHECK(ERR_OUT_OF_MEMORY);
+    BENCH_CHECK(send_all(connection, request, strlen(request)));
+    BENCH_CHECK(read_response(connection, &response, &capacity, &status, &body, &body_len, &close_after));
+    close(connection);
+    if (status != 200) BENCH_CHECK(ERR_IO);
+
+    // {"Images": ["id", ...]}: the IDs are the strings of the array
+    const char* p = memchr(response + body, '[', body_len);
+    const char* const end = response + body + body_len;
+    keys->count = 0;
+    keys->ids = NULL;
+    size_t ids_capacity = 0;
+    while (p != NULL && p < end) {
+        const char* first = memchr(p, '"', (size_t) (end - p));
+        if (first == NULL) break;
+        const char* last = memchr(first + 1, '"', (size_t) (end - first - 1));
+        if (last == NULL) break;
+        if (keys->count == ids_capacity) {
+            ids_capacity = ids_capacity > 0 ? 2 * ids_capacity : 1024;
+            keys->ids = realloc(keys->ids, ids_capacity * sizeof(char*));
+            if (keys->ids == NULL) BENCH_CHECK(ERR_OUT_OF_MEMORY);
+        }
+        keys->ids[keys->count] = strndup(first + 1, MIN((size_t) (last - first - 1), MAX_KEY_LENGTH));
+        if (keys->ids[keys->count++] == NULL) BENCH_CHECK(ERR_OUT_OF_MEMORY);
+        p = last + 1;
+    }
+    free(response);
+}
+
+/**
+ * @brief Computes the cumulative distribution of the Zipf law of exponent s over the keys
+ */
+static void zipf_init(struct key_set* keys, double s)
+{
+    keys->cdf = calloc(keys->count > 0 ? keys->count : 1, sizeof(double));
+    if (keys->cdf == NULL) BENCH_CHECK(ERR_OUT_OF_MEMORY);
+
+    double sum = 0;
+    for (size_t k = 0; k < keys->count; ++k) {
+        sum += 1 / pow((double) (k + 1), s);
+        keys->cdf[k] = sum;
+    }
+    for (size_t k = 0; k < keys->count; ++k) keys->cdf[k] /= sum;
+}
+
+/**
+ * @brief Draws a key along the Zipf law (a binary search in its distribution)
+ */
+static const char* zipf_draw(const struct key_set* keys, uint64_t* random)
+{
+    const double u = uniform(random);
+    size_t low = 0;
+    size_t high = keys->count - 1;
+    while (low < high) {
+        const size_t middle = low + (high - low) / 2;
+        if (keys->cdf[middle] < u) low = middle + 1;
+        else high = middle;
+    }
+    return keys->ids[low];
+}
+
+// ======================================================================
+static enum operation draw_operation(struct load_thread* thread)
+{
+    const uint32_t* mix = thread->options->mix;
+    const uint32_t total = mix[OP_READ] + mix[OP_INSERT] + mix[OP_DELETE];
+    const uint32_t drawn = (uint32_t) (xorshift64(&thread->random) % total);
+    if (drawn < mix[OP_READ]) return OP_READ;
+    // nothing to delete: a read instead, or an insert on an empty store
+    if (drawn < mix[OP_READ] + mix[OP_INSERT]) return OP_INSERT;
+    if (thread->nb_inserted > 0) return OP_DELETE;
+    return thread->keys->count > 0 ? OP_READ : OP_INSERT;
+}
+
+static void remember_insert(struct load_thread* thread, uint32_t number)
+{
+    if (thread->nb_inserted == thread->inserted_capacity) {
+        const size_t capacity = thread->inserted_capacity > 0 ? 2 * thread->inserted_capacity : 256;
+        uint32_t* grown = calloc(capacity, sizeof(uint32_t));
+        if (grown == NULL) return;
+        for (size_t i = 0; i < thread->nb_inserted; ++i) {
+            grown[i] = thread->inserted[(thread->first_inserted + i) % thread->inserted_capacity];
+        }
+        free(thread->inserted);
+        thread->inserted = grown;
+        thread->inserted_capacity = capacity;
+        thread->first_inserted = 0;
+    }
+    thread->inserted[(thread->first_inserted + thread->nb_inserted++) % thread->inserted_capacity] = number;
+}
+
+/**
+ * @brief Writes the request of an operation
+ * @return (size_t) : the length of its headers (an insert is followed by the image)
+ */
+static size_t write_request(struct load_thread* thread, enum operation operation, char* request, size_t size)
+{
+    int len = 0;
+    switch (operation) {
+    case OP_READ:
+        len = snprintf(request, size, "GET /imgfs/read?res=%s&img_id=%s HTTP/1.1" HTTP_LINE_DELIM "Host: localhost%s",
+                       thread->options->resolution, zipf_draw(thread->keys, &thread->random), HTTP_HDR_END_DELIM);
+        break;
+    case OP_INSERT:
+        len = snprintf(request, size, "POST /imgfs/insert?name=load-%u-%u HTTP/1.1" HTTP_LINE_DELIM
+                       "Host: localhost" HTTP_LINE_DELIM "Content-Length: %zu%s", thread->number, thread->next_insert,
+                       thread->image_size + sizeof(uint64_t), HTTP_HDR_END_DELIM);
+        break;
+    default: {
+        const uint32_t number = thread->inserted[thread->first_inserted];
+        thread->first_inserted = (thread->first_inserted + 1) % thread->inserted_capacity;
+        --thread->nb_inserted;
+        len = snprintf(request, size, "GET /imgfs/delete?img_id=load-%u-%u HTTP/1.1" HTTP_LINE_DELIM
+                       "Host: localhost%s", thread->number, number, HTTP_HDR_END_DELIM);
+    }
+    }
+    return len < 0 ? 0 : MIN((size_t) len, size - 1);
+}
+
+/**
+ * @brief Sends a request on the connection of the thread and reads its reply
+ * @param status (int*) : where to store the status code of the reply
+ * @return (int) : some error code, ERR_IO if the connection is lost
+ */
+static int exchange(struct load_thread* thread, enum operation operation, const char* request, size_t len, int* status)
+{
+    int ret = send_all(thread->connection, request, len);
+    if (ret == ERR_NONE && operation == OP_INSERT) {
+        const size_t size = bench_make_unique(thread->image, thread->image_size,
+                                              (uint64_t) thread->number << 32 | thread->next_insert);
+        ret = send_all(thread->connection, thread->image, size);
+    }
+
+    size_t body = 0;
+    size_t body_len = 0;
+    int close_after = 1;
+    if (ret == ERR_NONE) {
+        ret = read_response(thread->connection, &thread->response, &thread->response_capacity,
+                            status, &body, &body_len, &close_after);
+    }
+    if (ret != ERR_NONE || close_after || !thread->options->keepalive) {
+        close(thread->connection);
+        thread->connection = -1;
+    }
+    return ret;
+}
+
+/**
+ * @brief Sends a request and reads its reply, on a new connection if the
+ *        server closed the one kept alive meanwhile
+ * @return (int) : some error code, ERR_IO on a lost connection or an error status
+ */
+static int send_request(struct load_thread* thread, enum operation operation)
+{
+    char request[URI_MAX_SIZE + HEADERS_MAX_SIZE / 8];
+    const size_t len = write_request(thread, operation, request, sizeof(request));
+
+    const int reused = thread->connection != -1;
+    if (!reused && (thread->connection = open_connection(thread->options)) == -1) return ERR_IO;
+
+    int status = 0;
+    int ret = exchange(thread, operation, request, len, &status);
+    if (ret == ERR_IO && reused) {
+        if ((thread->connection = open_connection(thread->options)) == -1) return ERR_IO;
+        ret = exchange(thread, operation, request, len, &status);
+    }
+    if (ret == ERR_NONE && status >= 400) ret = ERR_IO;
+
+    if (ret == ERR_NONE && operation == OP_INSERT) remember_insert(thread, thread->next_insert);
+    if (operation == OP_INSERT) ++thread->next_insert;
+    return ret;
+}
+
+static void* load_loop(void* arg)
+{
+    struct load_thread* thread = arg;
+    const struct load_options* options = thread->options;
+
+    // each thread sends one request out of nb_threads, its schedule shifted by its number
+    const uint64_t interval_ns = options->rate > 0 ? (uint64_t) (1e9 * options->nb_threads / options->rate) : 0;
+    uint64_t due_ns = thread->start_ns + interval_ns * thread->number / options->nb_threads;
+
+    while (due_ns < thread->end_ns) {
+        if (interval_ns > 0) {
+            struct timespec due = {(time_t) (due_ns / 1000000000UL), (long) (due_ns % 1000000000UL)};
+            // interrupted by a signal, the sleep goes on; any other error leaves the thread unpaced: it stops
+            int slept = 0;
+            while ((slept = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL)) == EINTR) {}
+            if (slept != 0) {
+                fprintf(stderr, "thread %" PRIu32 ": clock_nanosleep() failed: %s\n", thread->number, strerror(slept));
+                break;
+            }
+        }
+
+        const enum operation operation = draw_operation(thread);
+        const uint64_t start = bench_now_ns();
+        if (send_request(thread, operation) != ERR_NONE) ++thread->errors[operation];
+        const uint64_t end = bench_now_ns();
+        bench_samples_push(&thread->samples[LATENCY][operation], end - (interval_ns > 0 ? due_ns : start));
+        bench_samples_push(&thread->samples[SERVICE][operation], end - start);
+
+        due_ns = interval_ns > 0 ? due_ns + interval_ns : bench_now_ns();
+    }
+
+    if (thread->connection != -1) close(thread->connection);
+    return NULL;
+}
+
+// ======================================================================
+/**
+ * @brief Runs the load against the server of options->port
+ */
+static void run_load(const struct load_options* options, struct load_result* result)
+{
+    struct key_set keys;
+    list_keys(options, &keys);
+    if (keys.count == 0 && options->mix[OP_READ] > 0) {
+        fprintf(stderr, "no image in the store to read: insert some first\n");
+        exit(ERR_IMAGE_NOT_FOUND);
+    }
+    zipf_init(&keys, options->zipf);
+    fprintf(stderr, "port %u: %zu images in the store\n", options->port, keys.count);
+
+    size_t image_size = 0;
+    char* image = bench_read_file(INSERT_IMAGE, sizeof(uint64_t), &image_size);
+    struct load_thread* threads = calloc(options->nb_threads, sizeof(struct load_thread));
+    if (image == NULL || threads == NULL) BENCH_CHECK(ERR_OUT_OF_MEMORY);
+
+    const uint64_t start_ns = bench_now_ns() + 10000000UL;
+    const uint64_t end_ns = start_ns + (uint64_t) (options->duration_s * 1e9);
+    for (uint32_t t = 0; t < options->nb_threads; ++t) {
+        struct load_thread* thread = &threads[t];
+        thread->number = t;
+        thread->options = options;
+        thread->keys = &keys;
+        thread->image = malloc(image_size + sizeof(uint64_t));
+        thread->image_size = image_size;
+        thread->start_ns = start_ns;
+        thread->end_ns = end_ns;
+        thread->connection = -1;
+        thread->random = 0x9e3779b97f4a7c15UL ^ ((uint64_t) t + 1) * 0xbf58476d1ce4e5b9UL;
+        thread->response_capacity = HEADERS_MAX_SIZE;
+        thread->response = malloc(thread->response_capacity);
+        if (thread->image == NULL || thread->response == NULL) BENCH_CHECK(ERR_OUT_OF_MEMORY);
+        memcpy(thread->image, image, image_size);
+        for (int m = 0; m < NB_MEASURES; ++m) {
+            for (int op = 0; op < NB_OPERATIONS; ++op) bench_samples_init(&thread->samples[m][op], 0);
+        }
+
+        if (pthread_create(&thread->thread, NULL, load_loop, thread) != 0) BENCH_CHECK(ERR_THREADING);
+    }
+
+    zero_init_ptr(result);
+    for (int m = 0; m < NB_MEASURES; ++m) {
+        for (int op = 0; op <= NB_OPERATIONS; ++op) bench_samples_init(&result->samples[m][op], 0);
+    }
+
+    for (uint32_t t = 0; t < options->nb_threads; ++t) {
+        struct load_thread* thread = &threads[t];
+        pthread_join(thread->thread, NULL);
+        for (int op = 0; op < NB_OPERATIONS; ++op) {
+            for (int m = 0; m < NB_MEASURES; ++m) {
+                bench_samples_merge(&result->samples[m][op], &thread->samples[m][op]);
+                bench_samples_merge(&result->samples[m][NB_OPERATIONS], &thread->samples[m][op]);
+                bench_samples_free(&thread->samples[m][op]);
+            }
+            result->errors[op] += thread->errors[op];
+            result->errors[NB_OPERATIONS] += thread->errors[op];
+        }
+        free(thread->image);
+        free(thread->response);
+        free(thread->inserted);
+    }
+    result->duration_s = (double) (bench_now_ns() - start_ns) / 1e9;
+
+    for (int m = 0; m < NB_MEASURES; ++m) {
+        for (int op = 0; op <= NB_OPERATIONS; ++op) bench_samples_sort(&result->samples[m][op]);
+    }
+
+    for (size_t k = 0; k < keys.count; ++k) free(keys.ids[k]);
+    free(keys.ids);
+    free(keys.cdf);
+    free(threads);
+    free(image);
+}
+
+static void free_result(struct load_result* result)
+{
+    for (int m = 0; m < NB_MEASURES; ++m) {
+        for (int op = 0; op <= NB_OPERATIONS; ++op) bench_samples_free(&result->samples[m][op]);
+    }
+}
+
+static void write_hgrm(const char* prefix, const char* suffix, const struct load_result* result)
+{
+    char filename[FILENAME_MAX];
+    snprintf(filename, sizeof(filename), "%s%s.hgrm", prefix, suffix);
+    FILE* out = fopen(filename, "w");
+    if (out == NULL) BENCH_CHECK(ERR_IO);
+    bench_samples_write_hgrm(out, &result->samples[LATENCY][NB_OPERATIONS]);
+    fclose(out);
+}
+
+// the statistics compared: the throughput, the errors, then the percentiles of a measure
+#define NB_STATISTICS 7
+static const char* const statistic_names[NB_STATISTICS] = {
+    "throughput_rps", "errors", "p50_us", "p90_us", "p99_us", "p999_us", "max_us"
+};
+
+static double statistic(const struct load_result* result, int measure, int operation, int s)
+{
+    static const double percentiles[NB_STATISTICS] = {0, 0, 50, 90, 99, 99.9, 100};
+    const struct bench_samples* samples = &result->samples[measure][operation];
+    switch (s) {
+    case 0:
+        return (double) samples->count / result->duration_s;
+    case 1:
+        return (double) result->errors[operation];
+    default:
+        return bench_percentile_us(samples, percentiles[s]);
+    }
+}
+
+static void report(const struct load_result* result)
+{
+    printf("operation,measure,requests,errors,throughput_rps,p50_us,p90_us,p99_us,p999_us,max_us\n");
+    for (int op = 0; op <= NB_OPERATIONS; ++op) {
+        for (int m = 0; m < NB_MEASURES; ++m) {
+            const struct bench_samples* samples = &result->samples[m][op];
+            if (samples->count == 0) continue;
+            printf("%s,%s,%zu,%" PRIu64 ",%.1f,%.3f,%.3f,%.3f,%.3f,%.3f\n", operation_names[op], measure_names[m],
+                   samples->count, result->errors[op], statistic(result, m, op, 0), statistic(result, m, op, 2),
+                   statistic(result, m, op, 3), statistic(result, m, op, 4), statistic(result, m, op, 5),
+                   statistic(result, m, op, 6));
+        }
+    }
+}
+
+/**
+ * @brief Prints each statistic of the two runs, and its ratio (compared / base)
+ */
+static void report_comparison(const struct load_result* base, const struct load_result* compared)
+{
+    printf("operation,measure,statistic,base,compared,ratio\n");
+    for (int op = 0; op <= NB_OPERATIONS; ++op) {
+        for (int m = 0; m < NB_MEASURES; ++m) {
+            if (base->samples[m][op].count == 0 && compared->samples[m][op].count == 0) continue;
+            for (int s = 0; s < NB_STATISTICS; ++s) {
+                // the errors and throughput are the same for both measures
+                if (m != LATENCY && s < 2) continue;
+                const double before = statistic(base, m, op, s);
+                const double after = statistic(compared, m, op, s);
+                printf("%s,%s,%s,%.3f,%.3f,", operation_names[op], s >= 2 ? measure_names[m] : "",
+                       statistic_names[s], before, after);
+                if (before > 0) printf("%.3f\n", after / before);
+                else printf("\n");
+            }
+        }
+    }
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: bench-load [-address A] [-port P] [-threads T] [-rate REQ_PER_S] [-duration S]\n"
+            "                  [-mix READ:INSERT:DELETE] [-zipf S] [-res thumb|small|orig] [-keepalive 0|1]\n"
+            "                  [-hgrm PREFIX] [-compare PORT]\n");
+    exit(EXIT_FAILURE);
+}
+
+static void parse_options(int argc, char* argv[], struct load_options* options)
+{
+    zero_init_ptr(options);
+    options->address.s_addr = htonl(INADDR_LOOPBACK);
+    options->port = DEFAULT_PORT;
+    options->nb_threads = DEFAULT_THREADS;
+    options->rate = DEFAULT_RATE;
+    options->duration_s = DEFAULT_DURATION;
+    options->mix[OP_READ] = 100;
+    options->zipf = DEFAULT_ZIPF;
+    options->resolution = "thumb";
+    options->keepalive = 1;
+
+    for (int i = 1; i < argc; i += 2) {
+        if (i + 1 >= argc) usage();
+        const char* name = argv[i];
+        const char* value = argv[i + 1];
+        if (!strcmp(name, "-address")) {
+            if (inet_pton(AF_INET, value, &options->address) != 1) usage();
+        } else if (!strcmp(name, "-port")) {
+            options->port = atouint16(value);
+        } else if (!strcmp(name, "-threads")) {
+            options->nb_threads = atouint32(value);
+        } else if (!strcmp(name, "-rate")) {
+            options->rate = strtod(value, NULL);
+        } else if (!strcmp(name, "-duration")) {
+            options->duration_s = strtod(value, NULL);
+        } else if (!strcmp(name, "-mix")) {
+            if (sscanf(value, "%u:%u:%u", &options->mix[OP_READ], &options->mix[OP_INSERT], &options->mix[OP_DELETE]) != 3) usage();
+        } else if (!strcmp(name, "-zipf")) {
+            options->zipf = strtod(value, NULL);
+        } else if (!strcmp(name, "-res")) {
+            options->resolution = value;
+        } else if (!strcmp(name, "-keepalive")) {
+            options->keepalive = atoi(value) != 0;
+        } else if (!strcmp(name, "-hgrm")) {
+            options->hgrm_prefix = value;
+        } else if (!strcmp(name, "-compare")) {
+            if ((options->compare_port = atouint16(value)) == 0) usage();
+        } else {
+            usage();
+        }
+    }
+
+    if (options->port == 0 || options->nb_threads == 0 || options->rate < 0 || options->duration_s <= 0 ||
+        options->zipf < 0 || options->mix[OP_READ] + options->mix[OP_INSERT] + options->mix[OP_DELETE] == 0) usage();
+}
+
+int main(int argc, char* argv[])
+{
+    struct load_options options;
+    parse_options(argc, argv, &options);
+
+    struct load_result base;
+    run_load(&options, &base);
+    if (options.hgrm_prefix != NULL) write_hgrm(options.hgrm_prefix, "", &base);
+
+    if (options.compare_port == 0) {
+        report(&base);
+    } else {
+        struct load_options compare_options = options;
+        compare_options.port = options.compare_port;
+        struct load_result compared;
+        run_load(&compare_options, &compared);
+        if (options.hgrm_prefix != NULL) write_hgrm(options.hgrm_prefix, "-compare", &compared);
+
+        report_comparison(&base, &compared);
+        free_result(&compared);
+    }
+
+    free_result(&base);
+    return 0;
+}
@@ -0,0 +1,110 @@
+/**
+ * @file bench-sha.c
+ * @brief Hashing throughput: one-shot SHA256() vs. sha256() vs. sha256_many()
+ *
+ * Hashes the JPEG images of the test data, repeated to make a batch of
+ * nb_images images (as a bulk insert would), three ways: with the one-shot
+ * SHA256() of OpenSSL that do_insert() used (the algorithm fetched and a
+ * context allocated at each call), with sha256() (fetched once, the context
+ * of the thread reused) and with sha256_many() (the batch on several
+ * threads). The digests are checked to be identical.
+ *
+ * Usage: bench-sha [nb_images [nb_rounds]]
+ */
+
+#include "sha256.h"
+#include "bench.h"
+
+#include <glob.h>
+#include <openssl/sha.h>
+
+#define DEFAULT_NB_IMAGES 256
+#define DEFAULT_NB_ROUNDS 5
+
+static int oneshot(size_t nb, const char* const* data, const size_t* lens, unsigned char (*digests)[SHA256_DIGEST_LENGTH])
+{
+    for (size_t i = 0; i < nb; ++i) SHA256((const unsigned char*) data[i], lens[i], digests[i]);
+    return ERR_NONE;
+}
+
+static int one_by_one(size_t nb, const char* const* data, const size_t* lens, unsigned char (*digests)[SHA256_DIGEST_LENGTH])
+{
+    for (size_t i = 0; i < nb; ++i) {
+        const int ret = sha256(data[i], lens[i], digests[i]);
+        if (ret != ERR_NONE) return ret;
+    }
+    return ERR_NONE;
+}
+
+static const struct {
+    const char* name;
+    int (*hash)(size_t, const char* const*, const size_t*, unsigned char (*)[SHA256_DIGEST_LENGTH]);
+} methods[] = {
+    {"openssl_oneshot", oneshot},
+    {"sha256", one_by_one},
+    {"sha256_many", sha256_many}
+};
+
+#define NB_METHODS (sizeof(methods) / sizeof(methods[0]))
+
+int main(int argc, char* argv[])
+{
+    const size_t nb_images = argc > 1 ? (size_t) strtoul(argv[1], NULL, 10) : DEFAULT_NB_IMAGES;
+    const uint32_t nb_rounds = argc > 2 ? (uint32_t) strtoul(argv[2], NULL, 10) : DEFAULT_NB_ROUNDS;
+    if (nb_images == 0 || nb_rounds == 0) return ERR_INVALID_ARGUMENT;
+
+    glob_t found;
+    if (glob(DATA_DIR "*.jpg", 0, NULL, &found) != 0 || found.gl_pathc == 0) return ERR_IO;
+
+    char** files = calloc(found.gl_pathc, sizeof(char*));
+    size_t* file_sizes = calloc(found.gl_pathc, sizeof(size_t));
+    const char** data = calloc(nb_images, sizeof(char*));
+    size_t* lens = calloc(nb_images, sizeof(size_t));
+    unsigned char (*digests)[SHA256_DIGEST_LENGTH] = calloc(nb_images, SHA256_DIGEST_LENGTH);
+    unsigned char (*expected)[SHA256_DIGEST_LENGTH] = calloc(nb_images, SHA256_DIGEST_LENGTH);
+    if (files == NULL || file_sizes == NULL || data == NULL || lens == NULL || digests == NULL || expected == NULL) {
+        BENCH_CHECK(ERR_OUT_OF_MEMORY);
+    }
+    for (size_t f = 0; f < found.gl_pathc; ++f) {
+        if ((files[f] = bench_read_file(found.gl_pathv[f], 0, &file_sizes[f])) == NULL) BENCH_CHECK(ERR_IO);
+    }
+
+    size_t total = 0;
+    for (size_t i = 0; i < nb_images; ++i) {
+        data[i] = files[i % found.gl_pathc];
+        lens[i] = file_sizes[i % found.gl_pathc];
+        total += lens[i];
+    }
+
+    printf("method,images,bytes,best_ms,mb_per_s,speedup\n");
+    double oneshot_ms = 0;
+    for (size_t m = 0; m < NB_METHODS; ++m) {
+        double best_ms = 1e30;
+        for (uint32_t r = 0; r < nb_rounds; ++r) {
+            const uint64_t start = bench_now_ns();
+            BENCH_CHECK(methods[m].hash(nb_images, data, lens, digests));
+            const double ms = (double) (bench_now_ns() - start) / 1e6;
+            if (ms < best_ms) best_ms = ms;
+        }
+
+        if (m == 0) {
+            oneshot_ms = best_ms;
+            memcpy(expected, digests, nb_images * SHA256_DIGEST_LENGTH);
+        } else if (memcmp(expected, digests, nb_images * SHA256_DIGEST_LENGTH) != 0) {
+            fprintf(stderr, "the digests of %s differ\n", methods[m].name);
+            exit(EXIT_FAILURE);
+        }
+        printf("%s,%zu,%zu,%.3f,%.1f,%.2f\n", methods[m].name, nb_images, total, best_ms,
+               (double) total / 1e3 / best_ms, oneshot_ms / best_ms);
+    }
+
+    for (size_t f = 0; f < found.gl_pathc; ++f) free(files[f]);
+    globfree(&found);
+    free(files);
+    free(file_sizes);
+    free(data);
+    free(lens);
+    free(digests);
+    free(expected);
+    return 0;
+}
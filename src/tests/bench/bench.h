@@ -0,0 +1,221 @@
+#pragma once
+
+/**
+ * @file bench.h
+ * @brief Utilities shared by the benchmarks of the imgFS core library
+ */
+
+#include "error.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define IMAGE(name) DATA_DIR name ".jpg"
+
+#define BENCH_STORE "/tmp/imgfs-bench.imgfs"
+
+/**
+ * @brief Returns the current time of the monotonic clock in nanoseconds
+ */
+static inline uint64_t bench_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000UL + (uint64_t) now.tv_nsec;
+}
+
+/**
+ * @brief Reads a whole file, leaving room for `extra` more bytes at the end
+ *        of the buffer (see bench_make_unique()).
+ */
+static inline char* bench_read_file(const char* filename, size_t extra, size_t* size)
+{
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) return NULL;
+
+    fseek(file, 0, SEEK_END);
+    const long len = ftell(file);
+    rewind(file);
+
+    char* buffer = len < 0 ? NULL : calloc((size_t) len + extra, 1);
+    if (buffer != NULL && fread(buffer, 1, (size_t) len, file) != (size_t) len) {
+        free(buffer);
+        buffer = NULL;
+    }
+    fclose(file);
+
+    *size = (size_t) len;
+    return buffer;
+}
+
+/**
+ * @brief Appends a counter after the end of a JPEG image read with
+ *        bench_read_file(buffer, sizeof(uint64_t), ...), so that each
+ *        inserted image has a distinct content (and thus a distinct SHA)
+ *        while still being decodable.
+ *
+ * @return the size of the modified image
+ */
+static inline size_t bench_make_unique(char* buffer, size_t size, uint64_t counter)
+{
+    memcpy(buffer + size, &counter, sizeof(counter));
+    return size + sizeof(counter);
+}
+
+/**
+ * @brief Latencies of an operation, in nanoseconds
+ */
+struct bench_samples {
+    uint64_t* ns;
+    size_t count;
+    size_t capacity;
+};
+
+static inline void bench_samples_init(struct bench_samples* samples, size_t capacity)
+{
+    samples->ns = calloc(capacity > 0 ? capacity : 1, sizeof(uint64_t));
+    samples->count = 0;
+    samples->capacity = samples->ns == NULL ? 0 : capacity;
+}
+
+/**
+ * @brief Records a latency, growing the samples if needed (it is dropped if they cannot grow)
+ */
+static inline void bench_samples_push(struct bench_samples* samples, uint64_t ns)
+{
+    if (samples->count == samples->capacity) {
+        const size_t capacity = samples->capacity > 0 ? 2 * samples->capacity : 1024;
+        uint64_t* grown = realloc(samples->ns, capacity * sizeof(uint64_t));
+        if (grown == NULL) return;
+        samples->ns = grown;
+        samples->capacity = capacity;
+    }
+    samples->ns[samples->count++] = ns;
+}
+
+/**
+ * @brief Records the latency of one operation started at start_ns
+ */
+static inline void bench_samples_add(struct bench_samples* samples, uint64_t start_ns)
+{
+    bench_samples_push(samples, bench_now_ns() - start_ns);
+}
+
+/**
+ * @brief Adds the latencies of other samples
+ */
+static inline void bench_samples_merge(struct bench_samples* samples, const struct bench_samples* other)
+{
+    for (size_t i = 0; i < other->count; ++i) bench_samples_push(samples, other->ns[i]);
+}
+
+static inline int bench_compare_ns(const void* a, const void* b)
+{
+    const uint64_t x = *(const uint64_t*) a;
+    const uint64_t y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief The p-th percentile (nearest rank) of sorted samples, in microseconds
+ */
+static inline double bench_percentile_us(const struct bench_samples* samples, double p)
+{
+    if (samples->count == 0) return 0;
+    size_t rank = (size_t) (p / 100 * (double) samples->count + 0.999999);
+    if (rank < 1) rank = 1;
+    if (rank > samples->count) rank = samples->count;
+    return (double) samples->ns[rank - 1] / 1e3;
+}
+
+/**
+ * @brief Writes the percentile distribution of sorted samples in the format
+ *        of HdrHistogram (.hgrm, values in milliseconds), which its plotter
+ *        and the tools of wrk2 read: a line every 1/10 of the way to 100 %,
+ *        then 1/20 of the rest, and so on, up to the maximum.
+ */
+static inline void bench_samples_write_hgrm(FILE* out, const struct bench_samples* samples)
+{
+    fprintf(out, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+    if (samples->count == 0) return;
+
+    double percentile = 0;
+    for (;;) {
+        size_t rank = (size_t) (percentile / 100 * (double) samples->count + 0.999999);
+        if (rank < 1) rank = 1;
+        if (rank >= samples->count) break;
+        fprintf(out, "%12.3f %2.12f %10zu %14.2f\n", (double) samples->ns[rank - 1] / 1e6, percentile / 100, rank,
+                1 / (1 - percentile / 100));
+
+        // 5 ticks per halving of the distance to 100 %
+        const double halvings = floor(log2(100 / (100 - percentile))) + 1;
+        percentile += 100 / (5 * pow(2, halvings));
+    }
+    fprintf(out, "%12.3f %2.12f %10zu\n", (double) samples->ns[samples->count - 1] / 1e6, 1.0, samples->count);
+
+    double mean = 0;
+    double variance = 0;
+    for (size_t i = 0; i < samples->count; ++i) mean += (double) samples->ns[i] / 1e6;
+    mean /= (double) samples->count;
+    for (size_t i = 0; i < samples->count; ++i) {
+        const double deviation = (double) samples->ns[i] / 1e6 - mean;
+        variance += deviation * deviation;
+    }
+    fprintf(out, "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n", mean, sqrt(variance / (double) samples->count));
+    fprintf(out, "#[Max     = %12.3f, Total count    = %12zu]\n",
+            (double) samples->ns[samples->count - 1] / 1e6, samples->count);
+}
+
+#define BENCH_SAMPLES_CSV_HEADER "count,ops_per_s,mean_us,p50_us,p90_us,p99_us,p999_us,max_us"
+
+/**
+ * @brief Sorts the samples (for bench_percentile_us())
+ * @return the sum of their latencies, in nanoseconds
+ */
+static inline uint64_t bench_samples_sort(struct bench_samples* samples)
+{
+    uint64_t total_ns = 0;
+    for (size_t i = 0; i < samples->count; ++i) total_ns += samples->ns[i];
+    qsort(samples->ns, samples->count, sizeof(uint64_t), bench_compare_ns);
+    return total_ns;
+}
+
+static inline void bench_samples_free(struct bench_samples* samples)
+{
+    free(samples->ns);
+    samples->ns = NULL;
+    samples->count = samples->capacity = 0;
+}
+
+/**
+ * @brief Prints (as CSV, see BENCH_SAMPLES_CSV_HEADER) the throughput and
+ *        latency percentiles of the samples, then frees them. The throughput
+ *        is the number of operations per second spent in them.
+ */
+static inline void bench_samples_report(struct bench_samples* samples)
+{
+    const uint64_t total_ns = bench_samples_sort(samples);
+
+    const double count = (double) samples->count;
+    printf("%zu,%.1f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n", samples->count,
+           total_ns > 0 ? count * 1e9 / (double) total_ns : 0,
+           samples->count > 0 ? (double) total_ns / count / 1e3 : 0,
+           bench_percentile_us(samples, 50), bench_percentile_us(samples, 90),
+           bench_percentile_us(samples, 99), bench_percentile_us(samples, 99.9),
+           bench_percentile_us(samples, 100));
+
+    bench_samples_free(samples);
+}
+
+#define BENCH_CHECK(call) \
+    do { \
+        const int __err = (call); \
+        if (__err != ERR_NONE) { \
+            fprintf(stderr, "%s:%d: %s failed: %s\n", __FILE__, __LINE__, #call, ERR_MSG(__err)); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
@@ -0,0 +1,111 @@
+#include "http_prot.h"
+#include "error.h"
+#include "test.h"
+#include <check.h>
+
+#define CHUNKED_REQUEST "POST /imgfs/insert?name=pic HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked\r\n\r\n"
+#define CHUNKED_BODY    "5\r\nhello\r\n7;ext=1\r\n, world\r\n0\r\nX-Trailer: yes\r\n\r\n"
+
+// ======================================================================
+START_TEST(http_parse_chunked_request)
+{
+    start_test_print;
+
+    const char request[] = CHUNKED_REQUEST "5\r\nhel";
+    struct http_message message;
+    int content_len = 0;
+    ck_assert_int_eq(http_parse_message(request, strlen(request), &message, &content_len), 0);
+    ck_assert_int_eq(content_len, HTTP_CHUNKED_BODY);
+    ck_assert_uint_eq(message.body.len, strlen("5\r\nhel"));
+    ck_assert_mem_eq(message.body.val, "5\r\nhel", message.body.len);
+
+    const char both[] = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 5\r\n\r\n";
+    ck_assert_int_eq(http_parse_message(both, strlen(both), &message, &content_len), ERR_RUNTIME);
+
+    const char gzip[] = "POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n";
+    ck_assert_int_eq(http_parse_message(gzip, strlen(gzip), &message, &content_len), ERR_RUNTIME);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(http_chunked_decode_in_place)
+{
+    start_test_print;
+
+    char body[] = CHUNKED_BODY "next request";
+    struct http_chunked decoder;
+    http_chunked_init(&decoder);
+
+    size_t len = 0;
+    ck_assert_int_eq(http_chunked_decode(&decoder, body, strlen(body), body, &len), 1);
+    ck_assert_uint_eq(len, strlen("hello, world"));
+    ck_assert_mem_eq(body, "hello, world", len);
+
+    // once done, nothing more is decoded
+    ck_assert_int_eq(http_chunked_decode(&decoder, "1\r\na\r\n", 6, body, &len), 1);
+    ck_assert_uint_eq(len, 0);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(http_chunked_decode_byte_by_byte)
+{
+    start_test_print;
+
+    const char body[] = CHUNKED_BODY;
+    char data[sizeof(body)];
+    size_t data_len = 0;
+    struct http_chunked decoder;
+    http_chunked_init(&decoder);
+
+    for(size_t i = 0; i < strlen(body); ++i) {
+        size_t len = 0;
+        const int ret = http_chunked_decode(&decoder, body + i, 1, data + data_len, &len);
+        ck_assert_int_eq(ret, i + 1 == strlen(body));
+        data_len += len;
+    }
+    ck_assert_uint_eq(data_len, strlen("hello, world"));
+    ck_assert_mem_eq(data, "hello, world", data_len);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(http_chunked_decode_invalid)
+{
+    start_test_print;
+
+    const char* invalid[] = {"\r\n", "zz\r\n", "3\r\nabcX", "fffffffffffffffff\r\n",
+                             "\r3\r\nabc", "3\r\r\nabc", "3\rabc", "3;ext\rabc",
+                             "3\r\nabc\r\r\n", "3\r\nabc\rX"};
+    char out[32];
+    for(size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i) {
+        struct http_chunked decoder;
+        http_chunked_init(&decoder);
+        size_t len = 0;
+        ck_assert_int_eq(http_chunked_decode(&decoder, invalid[i], strlen(invalid[i]), out, &len), ERR_RUNTIME);
+    }
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+Suite *http_chunked_suite()
+{
+    Suite *s = suite_create("Tests for the decoding of chunked bodies");
+
+    Add_Test(s, http_parse_chunked_request);
+    Add_Test(s, http_chunked_decode_in_place);
+    Add_Test(s, http_chunked_decode_byte_by_byte);
+    Add_Test(s, http_chunked_decode_invalid);
+
+    return s;
+}
+
+TEST_SUITE(http_chunked_suite)
@@ -0,0 +1,233 @@
+#include "imgfs_blobs.h"
+#include "image_content.h"
+#include "imgfs.h"
+#include "util.h"
+#include "test.h"
+#include <check.h>
+
+static void set_content(struct img_metadata* metadata, unsigned char sha_byte, uint64_t offset, uint32_t size)
+{
+    zero_init_ptr(metadata);
+    memset(metadata->SHA, sha_byte, SHA256_DIGEST_LENGTH);
+    metadata->offset[ORIG_RES] = offset;
+    metadata->size[ORIG_RES] = size;
+    metadata->is_valid = NON_EMPTY;
+}
+
+static long file_size(FILE* file)
+{
+    ck_assert_int_eq(fseek(file, 0, SEEK_END), 0);
+    return ftell(file);
+}
+
+// ======================================================================
+START_TEST(blobs_count_references)
+{
+    start_test_print;
+
+    struct img_metadata metadata[4];
+    set_content(&metadata[0], 0xaa, 1000, 100);
+    set_content(&metadata[1], 0xbb, 2000, 50);
+    set_content(&metadata[2], 0xaa, 1000, 100);
+    zero_init_var(metadata[3]);
+
+    struct blob_table* table = blobs_build(4, metadata);
+    ck_assert_ptr_nonnull(table);
+    ck_assert_uint_eq(table->nb_blobs, 2);
+    ck_assert_uint_eq(table->live_bytes, 150);
+
+    const struct blob* shared = blobs_find(table, metadata[0].SHA);
+    ck_assert_ptr_nonnull(shared);
+    ck_assert_uint_eq(shared->refcount, 2);
+
+    // the slots of a blob are chained
+    uint32_t slots = 0;
+    for(uint32_t slot = blobs_first_slot(table, metadata[0].SHA); slot != NO_SLOT; slot = blobs_next_slot(table, slot)) {
+        slots |= 1U << slot;
+    }
+    ck_assert_uint_eq(slots, 0x5);
+
+    // the first copy of a resolution becomes the one of the blob, the others can adopt it
+    metadata[2].offset[THUMB_RES] = 3000;
+    metadata[2].size[THUMB_RES] = 10;
+    blobs_set(table, 2, &metadata[2]);
+    ck_assert_uint_eq(shared->refcount, 2);
+    ck_assert_uint_eq(shared->offset[THUMB_RES], 3000);
+    ck_assert_uint_eq(table->live_bytes, 160);
+    ck_assert_int_eq(blobs_adopt(table, &metadata[0]), 1);
+    ck_assert_uint_eq(metadata[0].offset[THUMB_RES], 3000);
+    ck_assert_uint_eq(metadata[0].size[THUMB_RES], 10);
+    ck_assert_int_eq(blobs_adopt(table, &metadata[0]), 0);
+
+    // a blob lives as long as a valid slot references it
+    metadata[0].is_valid = EMPTY;
+    blobs_set(table, 0, &metadata[0]);
+    ck_assert_uint_eq(shared->refcount, 1);
+    ck_assert_uint_eq(table->live_bytes, 160);
+    metadata[2].is_valid = EMPTY;
+    blobs_set(table, 2, &metadata[2]);
+    ck_assert_ptr_null(blobs_find(table, metadata[2].SHA));
+    ck_assert_uint_eq(blobs_first_slot(table, metadata[2].SHA), NO_SLOT);
+    ck_assert_uint_eq(table->nb_blobs, 1);
+    ck_assert_uint_eq(table->live_bytes, 50);
+
+    // and the freed entries are reused
+    set_content(&metadata[3], 0xcc, 4000, 20);
+    blobs_set(table, 3, &metadata[3]);
+    ck_assert_uint_eq(table->nb_blobs, 2);
+    ck_assert_uint_eq(table->live_bytes, 70);
+    ck_assert_ptr_nonnull(blobs_find(table, metadata[3].SHA));
+
+    blobs_free(table);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(lazily_resize_reuses_duplicate)
+{
+    start_test_print;
+    DECLARE_DUMP;
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+
+    struct imgfs_file file;
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+
+    char* image = NULL;
+    uint32_t size = 0;
+    ck_assert_err_none(do_read(file.metadata[0].img_id, ORIG_RES, &image, &size, &file));
+    ck_assert_err_none(do_insert(image, size, "copy", &file));
+    free(image);
+
+    uint32_t copy = 0;
+    ck_assert_err_none(find_image("copy", &file, &copy));
+    ck_assert_uint_eq(file.metadata[copy].offset[SMALL_RES], 0);
+
+    // resized once for the original...
+    ck_assert_err_none(lazily_resize(SMALL_RES, &file, 0));
+    const long resized = file_size(file.file);
+
+    // ...then shared by the duplicate, the file not growing
+    ck_assert_err_none(lazily_resize(SMALL_RES, &file, copy));
+    ck_assert_int_eq(file_size(file.file), resized);
+    ck_assert_uint_eq(file.metadata[copy].offset[SMALL_RES], file.metadata[0].offset[SMALL_RES]);
+    ck_assert_uint_eq(file.metadata[copy].size[SMALL_RES], file.metadata[0].size[SMALL_RES]);
+
+    do_close(&file);
+
+    // and so on disk
+    ck_assert_err_none(do_open(dump, "rb", &file));
+    ck_assert_uint_eq(file.metadata[copy].offset[SMALL_RES], file.metadata[0].offset[SMALL_RES]);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(lazily_resize_shares_with_duplicates)
+{
+    start_test_print;
+    DECLARE_DUMP;
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+
+    struct imgfs_file file;
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+
+    char* image = NULL;
+    uint32_t size = 0;
+    ck_assert_err_none(do_read(file.metadata[0].img_id, ORIG_RES, &image, &size, &file));
+    ck_assert_err_none(do_insert(image, size, "copy1", &file));
+    ck_assert_err_none(do_insert(image, size, "copy2", &file));
+    free(image);
+
+    uint32_t copy1 = 0;
+    uint32_t copy2 = 0;
+    ck_assert_err_none(find_image("copy1", &file, &copy1));
+    ck_assert_err_none(find_image("copy2", &file, &copy2));
+
+    // resized for one of them, given to all
+    ck_assert_err_none(lazily_resize(SMALL_RES, &file, copy1));
+    const uint64_t offset = file.metadata[copy1].offset[SMALL_RES];
+    ck_assert_uint_ne(offset, 0);
+    ck_assert_uint_eq(file.metadata[0].offset[SMALL_RES], offset);
+    ck_assert_uint_eq(file.metadata[copy2].offset[SMALL_RES], offset);
+    ck_assert_uint_eq(file.metadata[copy2].size[SMALL_RES], file.metadata[copy1].size[SMALL_RES]);
+    do_close(&file);
+
+    ck_assert_err_none(do_open(dump, "rb", &file));
+    ck_assert_uint_eq(file.metadata[0].offset[SMALL_RES], offset);
+    ck_assert_uint_eq(file.metadata[copy2].offset[SMALL_RES], offset);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_space_counts_reclaimable)
+{
+    start_test_print;
+    DECLARE_DUMP;
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+
+    ck_assert_invalid_arg(do_space(NULL, NULL));
+
+    struct imgfs_file file;
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+
+    struct imgfs_space space;
+    ck_assert_err_none(do_space(&file, &space));
+    ck_assert_uint_eq(space.nb_images, 1);
+    ck_assert_uint_eq(space.nb_contents, 1);
+    ck_assert_uint_eq(space.file_bytes, (uint64_t) file_size(file.file));
+    ck_assert_uint_eq(space.table_bytes, sizeof(struct imgfs_header) + 100 * sizeof(struct img_metadata));
+    ck_assert_uint_eq(space.live_bytes, file.metadata[0].size[ORIG_RES] + file.metadata[0].size[THUMB_RES]);
+    ck_assert_uint_eq(space.reclaimable_bytes, space.file_bytes - space.table_bytes - space.live_bytes);
+
+    // a duplicate costs nothing, and its deletion frees nothing
+    char* image = NULL;
+    uint32_t size = 0;
+    ck_assert_err_none(do_read(file.metadata[0].img_id, ORIG_RES, &image, &size, &file));
+    ck_assert_err_none(do_insert(image, size, "copy", &file));
+    free(image);
+
+    struct imgfs_space with_copy;
+    ck_assert_err_none(do_space(&file, &with_copy));
+    ck_assert_uint_eq(with_copy.nb_images, 2);
+    ck_assert_uint_eq(with_copy.nb_contents, 1);
+    ck_assert_uint_eq(with_copy.live_bytes, space.live_bytes);
+    ck_assert_uint_eq(with_copy.reclaimable_bytes, space.reclaimable_bytes);
+
+    ck_assert_err_none(do_delete(file.metadata[0].img_id, &file));
+    ck_assert_err_none(do_space(&file, &with_copy));
+    ck_assert_uint_eq(with_copy.live_bytes, space.live_bytes);
+
+    // the last reference gone, the whole content is reclaimable
+    ck_assert_err_none(do_delete("copy", &file));
+    ck_assert_err_none(do_space(&file, &with_copy));
+    ck_assert_uint_eq(with_copy.nb_contents, 0);
+    ck_assert_uint_eq(with_copy.live_bytes, 0);
+    ck_assert_uint_eq(with_copy.reclaimable_bytes, space.reclaimable_bytes + space.live_bytes);
+
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+Suite *imgfs_blobs_suite()
+{
+    Suite *s = suite_create("Tests for the table of the contents shared by the images");
+
+    Add_Test(s, blobs_count_references);
+    Add_Test(s, lazily_resize_reuses_duplicate);
+    Add_Test(s, lazily_resize_shares_with_duplicates);
+    Add_Test(s, do_space_counts_reclaimable);
+
+    return s;
+}
+
+TEST_SUITE(imgfs_blobs_suite)
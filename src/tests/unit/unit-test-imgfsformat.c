@@ -0,0 +1,167 @@
+#include "imgfs_format.h"
+#include "imgfs.h"
+#include "test.h"
+#include <check.h>
+
+#include <sys/stat.h>
+
+static long file_size(const char* filename)
+{
+    struct stat st;
+    ck_assert_int_eq(stat(filename, &st), 0);
+    return (long) st.st_size;
+}
+
+// ======================================================================
+START_TEST(do_convert_null_params)
+{
+    start_test_print;
+
+    ck_assert_invalid_arg(do_convert(NULL, "a"));
+    ck_assert_invalid_arg(do_convert(IMGFS("test03"), NULL));
+    ck_assert_err(do_convert(IMGFS("test03"), IMGFS("test03")), ERR_INVALID_FILENAME);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(img_record_size)
+{
+    start_test_print;
+
+    ck_assert_uint_eq(sizeof(struct img_record), 80);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_convert_same_content)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    ck_assert_err_none(do_convert(IMGFS("test03"), dump));
+    ck_assert_int_lt(file_size(dump), file_size(IMGFS("test03")));
+
+    struct imgfs_file v1;
+    struct imgfs_file v2;
+    ck_assert_err_none(do_open(IMGFS("test03"), "rb", &v1));
+    ck_assert_err_none(do_open(dump, "rb", &v2));
+
+    ck_assert_int_eq(imgfs_format(&v1.header), IMGFS_FORMAT_V1);
+    ck_assert_int_eq(imgfs_format(&v2.header), IMGFS_FORMAT_V2);
+    ck_assert_str_eq(v2.header.name, CAT_TXT_V2);
+    ck_assert_uint_eq(v2.header.max_files, v1.header.max_files);
+    ck_assert_uint_eq(v2.header.nb_files, v1.header.nb_files);
+    ck_assert_uint_eq(metadata_offset(&v2, 1), sizeof(struct imgfs_header) + sizeof(struct img_record));
+
+    for (uint32_t i = 0; i < v1.header.max_files; ++i) {
+        ck_assert_uint_eq(v2.metadata[i].is_valid, v1.metadata[i].is_valid);
+        if (!v1.metadata[i].is_valid) continue;
+
+        ck_assert_str_eq(v2.metadata[i].img_id, v1.metadata[i].img_id);
+        ck_assert_mem_eq(v2.metadata[i].SHA, v1.metadata[i].SHA, SHA256_DIGEST_LENGTH);
+        ck_assert_uint_eq(v2.metadata[i].orig_res[0], v1.metadata[i].orig_res[0]);
+        ck_assert_uint_eq(v2.metadata[i].size[ORIG_RES], v1.metadata[i].size[ORIG_RES]);
+
+        char* image1 = NULL;
+        char* image2 = NULL;
+        uint32_t size1 = 0;
+        uint32_t size2 = 0;
+        ck_assert_err_none(do_read(v1.metadata[i].img_id, ORIG_RES, &image1, &size1, &v1));
+        ck_assert_err_none(do_read(v2.metadata[i].img_id, ORIG_RES, &image2, &size2, &v2));
+        ck_assert_uint_eq(size1, size2);
+        ck_assert_mem_eq(image1, image2, size1);
+        free(image1);
+        free(image2);
+    }
+
+    do_close(&v1);
+    do_close(&v2);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_convert_writes_records)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    ck_assert_err_none(do_convert(IMGFS("test03"), dump));
+
+    struct imgfs_file file;
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+
+    // the ID of a deleted image is kept, without growing the pool
+    const long size = file_size(dump);
+    ck_assert_err_none(do_delete("pic1", &file));
+    do_close(&file);
+    ck_assert_int_eq(file_size(dump), size);
+
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+    ck_assert_uint_eq(file.metadata[0].is_valid, EMPTY);
+    ck_assert_str_eq(file.metadata[0].img_id, "pic1");
+
+    // a new ID goes to the pool
+    struct img_metadata copy = file.metadata[1];
+    strcpy(copy.img_id, "a_much_longer_image_identifier");
+    ck_assert_err_none(write_metadata(&file, 5, &copy));
+    do_close(&file);
+    ck_assert_int_eq(file_size(dump), size + (long) strlen(copy.img_id));
+
+    ck_assert_err_none(do_open(dump, "rb", &file));
+    ck_assert_str_eq(file.metadata[5].img_id, "a_much_longer_image_identifier");
+    ck_assert_str_eq(file.metadata[1].img_id, "pic2");
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_grow_format_v2)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    ck_assert_err_none(do_convert(IMGFS("full"), dump));
+
+    struct imgfs_file file;
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+    ck_assert_err_none(do_grow(&file, 6));
+
+    struct img_metadata copy = file.metadata[2];
+    strcpy(copy.img_id, "pic4");
+    ck_assert_err_none(write_metadata(&file, 4, &copy));
+    do_close(&file);
+
+    ck_assert_err_none(do_open(dump, "rb", &file));
+    ck_assert_uint_eq(file.header.max_files, 6);
+    ck_assert_str_eq(file.metadata[2].img_id, "pic3");
+    ck_assert_str_eq(file.metadata[4].img_id, "pic4");
+    ck_assert_uint_eq(file.metadata[3].is_valid, EMPTY);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+Suite *imgfs_format_suite()
+{
+    Suite *s = suite_create("Tests for the on-disk format v2");
+
+    Add_Test(s, do_convert_null_params);
+    Add_Test(s, img_record_size);
+    Add_Test(s, do_convert_same_content);
+    Add_Test(s, do_convert_writes_records);
+    Add_Test(s, do_grow_format_v2);
+
+    return s;
+}
+
+TEST_SUITE(imgfs_format_suite)
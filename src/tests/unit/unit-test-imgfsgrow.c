@@ -0,0 +1,136 @@
+#include "imgfs.h"
+#include "util.h"
+#include "test.h"
+#include <check.h>
+
+// ======================================================================
+START_TEST(do_grow_null_params)
+{
+    start_test_print;
+
+    ck_assert_invalid_arg(do_grow(NULL, 10));
+
+    struct imgfs_file file;
+    zero_init_var(file);
+    ck_assert_invalid_arg(do_grow(&file, 10));
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_grow_not_greater)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    struct imgfs_file file;
+    DUPLICATE_FILE(dump, IMGFS("full"));
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+
+    ck_assert_err(do_grow(&file, 3), ERR_MAX_FILES);
+    ck_assert_err(do_grow(&file, 2), ERR_MAX_FILES);
+    ck_assert_uint_eq(file.header.max_files, 3);
+    ck_assert_uint_eq(file.nb_extensions, 0);
+
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_grow_keeps_images)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    struct imgfs_file file;
+    DUPLICATE_FILE(dump, IMGFS("full"));
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+
+    const uint32_t version = file.header.version;
+    ck_assert_err_none(do_grow(&file, 5));
+    ck_assert_uint_eq(file.header.max_files, 5);
+    ck_assert_uint_eq(file.header.nb_files, 3);
+    ck_assert_uint_eq(file.header.version, version + 1);
+    ck_assert_uint_eq(file.nb_extensions, 1);
+    ck_assert_uint_eq(file.metadata[3].is_valid, EMPTY);
+    ck_assert_uint_eq(file.metadata[4].is_valid, EMPTY);
+    do_close(&file);
+
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+    ck_assert_uint_eq(file.header.max_files, 5);
+    ck_assert_uint_eq(file.nb_extensions, 1);
+
+    uint32_t index = 0;
+    ck_assert_err_none(find_image("pic1", &file, &index));
+    ck_assert_uint_eq(index, 0);
+    ck_assert_err_none(find_image("pic3", &file, &index));
+    ck_assert_uint_eq(index, 2);
+    ck_assert_uint_eq(file.metadata[4].is_valid, EMPTY);
+
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_grow_chained_extensions)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    struct imgfs_file file;
+    DUPLICATE_FILE(dump, IMGFS("full"));
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+
+    ck_assert_err_none(do_grow(&file, 4));
+    ck_assert_err_none(do_grow(&file, 10));
+    ck_assert_uint_eq(file.nb_extensions, 2);
+    ck_assert_uint_eq(metadata_offset(&file, 2), sizeof(struct imgfs_header) + 2 * sizeof(struct img_metadata));
+    ck_assert_uint_eq(metadata_offset(&file, 4), file.extensions[1].offset);
+
+    // the new slots are written where do_open() reads them back
+    struct img_metadata copy = file.metadata[0];
+    strcpy(copy.img_id, "copy");
+    ck_assert_err_none(write_metadata(&file, 3, &copy));
+    ck_assert_err_none(write_metadata(&file, 9, &copy));
+    ck_assert_invalid_arg(write_metadata(&file, 10, &copy));
+    do_close(&file);
+
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+    ck_assert_uint_eq(file.header.max_files, 10);
+    ck_assert_uint_eq(file.nb_extensions, 2);
+    ck_assert_str_eq(file.metadata[3].img_id, "copy");
+    ck_assert_str_eq(file.metadata[9].img_id, "copy");
+    ck_assert_uint_eq(file.metadata[9].is_valid, NON_EMPTY);
+    ck_assert_str_eq(file.metadata[2].img_id, "pic3");
+
+    // deletions in the extensions are persisted as well
+    ck_assert_err_none(do_delete("copy", &file));
+    do_close(&file);
+
+    ck_assert_err_none(do_open(dump, "rb", &file));
+    ck_assert_uint_eq(file.metadata[3].is_valid, EMPTY);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+Suite *imgfs_grow_suite()
+{
+    Suite *s = suite_create("Tests for the growth of the metadata table");
+
+    Add_Test(s, do_grow_null_params);
+    Add_Test(s, do_grow_not_greater);
+    Add_Test(s, do_grow_keeps_images);
+    Add_Test(s, do_grow_chained_extensions);
+
+    return s;
+}
+
+TEST_SUITE(imgfs_grow_suite)
@@ -0,0 +1,191 @@
+#include "imgfs_index.h"
+#include "image_similar.h"
+#include "imgfs.h"
+#include "util.h"
+#include "test.h"
+#include <check.h>
+
+// ======================================================================
+START_TEST(imgfs_index_scan_words)
+{
+    start_test_print;
+
+    struct imgfs_index index;
+    struct img_metadata* metadata = imgfs_index_alloc(130, &index);
+    ck_assert_ptr_nonnull(metadata);
+    ck_assert_uint_eq(index.nb_slots, 130);
+
+    ck_assert_uint_eq(imgfs_index_next_valid(&index, 0), 130);
+    ck_assert_uint_eq(imgfs_index_next_empty(&index, 0), 0);
+
+    const uint32_t slots[] = {0, 63, 64, 129};
+    for (size_t i = 0; i < sizeof(slots) / sizeof(slots[0]); ++i) {
+        metadata[slots[i]].is_valid = NON_EMPTY;
+        imgfs_index_set(&index, slots[i], &metadata[slots[i]]);
+    }
+
+    ck_assert_uint_eq(imgfs_index_next_valid(&index, 0), 0);
+    ck_assert_uint_eq(imgfs_index_next_valid(&index, 1), 63);
+    ck_assert_uint_eq(imgfs_index_next_valid(&index, 64), 64);
+    ck_assert_uint_eq(imgfs_index_next_valid(&index, 65), 129);
+    ck_assert_uint_eq(imgfs_index_next_valid(&index, 130), 130);
+    ck_assert_uint_eq(imgfs_index_next_empty(&index, 0), 1);
+    ck_assert_uint_eq(imgfs_index_next_empty(&index, 63), 65);
+    ck_assert_uint_eq(imgfs_index_next_empty(&index, 129), 130);
+
+    metadata[63].is_valid = EMPTY;
+    imgfs_index_set(&index, 63, &metadata[63]);
+    ck_assert_uint_eq(imgfs_index_next_valid(&index, 1), 64);
+
+    free(metadata);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(imgfs_index_follows_metadata)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    struct imgfs_file file;
+    DUPLICATE_FILE(dump, IMGFS("test03"));
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+
+    ck_assert_uint_eq(file.index.nb_slots, file.header.max_files);
+    ck_assert_uint_eq(imgfs_index_next_valid(&file.index, 0), 0);
+    ck_assert_uint_eq(imgfs_index_next_valid(&file.index, 2), file.header.max_files);
+    ck_assert_uint_eq(file.index.id_hash[1], imgfs_index_id_hash("pic2"));
+    ck_assert_uint_eq(file.index.sha_prefix[1], imgfs_index_sha_prefix(file.metadata[1].SHA));
+    ck_assert_uint_eq(file.index.orig_size[1], file.metadata[1].size[ORIG_RES]);
+
+    ck_assert_err_none(do_delete("pic1", &file));
+    ck_assert_uint_eq(imgfs_index_next_valid(&file.index, 0), 1);
+    ck_assert_uint_eq(imgfs_index_next_empty(&file.index, 0), 0);
+
+    uint32_t index = 0;
+    ck_assert_err(find_image("pic1", &file, &index), ERR_IMAGE_NOT_FOUND);
+    ck_assert_err_none(find_image("pic2", &file, &index));
+    ck_assert_uint_eq(index, 1);
+
+    ck_assert_err_none(do_grow(&file, 200));
+    ck_assert_uint_eq(file.index.nb_slots, 200);
+    ck_assert_err_none(find_image("pic2", &file, &index));
+
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(imgfs_index_filters_duplicates)
+{
+    start_test_print;
+
+    const char image[] = "not quite a JPEG image";
+    const uint16_t fingerprint = imgfs_index_fingerprint(image, sizeof(image));
+    ck_assert_uint_ne(fingerprint, 0);
+    ck_assert_uint_eq(imgfs_index_fingerprint(image, sizeof(image)), fingerprint);
+    ck_assert_uint_eq(imgfs_index_fingerprint(NULL, 0), 0);
+
+    struct imgfs_index index;
+    struct img_metadata* metadata = imgfs_index_alloc(10, &index);
+    ck_assert_ptr_nonnull(metadata);
+
+    const uint32_t hash = imgfs_index_id_hash("pic1");
+    ck_assert_int_eq(imgfs_index_may_have_duplicate(&index, 1, hash, fingerprint, sizeof(image)), 0);
+
+    strcpy(metadata[0].img_id, "pic1");
+    metadata[0].size[ORIG_RES] = sizeof(image);
+    metadata[0].fingerprint = fingerprint;
+    metadata[0].is_valid = NON_EMPTY;
+    imgfs_index_set(&index, 0, &metadata[0]);
+
+    // the same ID, the same content, but not the slot itself
+    ck_assert_int_eq(imgfs_index_may_have_duplicate(&index, 1, hash, 0, 0), 1);
+    ck_assert_int_eq(imgfs_index_may_have_duplicate(&index, 1, hash + 1, fingerprint, sizeof(image)), 1);
+    ck_assert_int_eq(imgfs_index_may_have_duplicate(&index, 0, hash, fingerprint, sizeof(image)), 0);
+
+    // a slot without fingerprint may hold any content
+    strcpy(metadata[5].img_id, "pic2");
+    metadata[5].is_valid = NON_EMPTY;
+    imgfs_index_set(&index, 5, &metadata[5]);
+    ck_assert_uint_eq(index.nb_unfingerprinted, 1);
+    ck_assert_int_eq(imgfs_index_may_have_duplicate(&index, 0, hash, fingerprint, sizeof(image)), 1);
+
+    // the slots leave the filters when they are emptied
+    metadata[0].is_valid = metadata[5].is_valid = EMPTY;
+    imgfs_index_set(&index, 0, &metadata[0]);
+    imgfs_index_set(&index, 5, &metadata[5]);
+    ck_assert_uint_eq(index.nb_unfingerprinted, 0);
+    ck_assert_int_eq(imgfs_index_may_have_duplicate(&index, 1, hash, fingerprint, sizeof(image)), 0);
+
+    free(metadata);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+static int record_slot(void* context, uint32_t slot, uint64_t hash, uint32_t distance)
+{
+    (void) hash;
+    uint32_t* found = context;
+    found[slot] = distance + 1;
+    return ERR_NONE;
+}
+
+START_TEST(similar_index_finds_near_hashes)
+{
+    start_test_print;
+
+    static const uint64_t hashes[] = {
+        0x0, 0x1, 0x3, 0xff, 0xffffffffffffffffUL, 0x8000000000000001UL, 0x7
+    };
+    const uint32_t nb_hashes = sizeof(hashes) / sizeof(hashes[0]);
+
+    struct similar_index* index = calloc(1, sizeof(struct similar_index));
+    ck_assert_ptr_nonnull(index);
+    for (uint32_t i = 0; i < nb_hashes; ++i) {
+        ck_assert_err_none(similar_index_add(index, i, hashes[i]));
+    }
+    ck_assert_uint_eq(index->nb_nodes, nb_hashes);
+
+    // every hash within 2 bits of 0x1, with its distance (plus one)
+    uint32_t found[sizeof(hashes) / sizeof(hashes[0])] = { 0 };
+    ck_assert_err_none(similar_index_find(index, 0x1, 2, record_slot, found));
+    ck_assert_uint_eq(found[0], 2);
+    ck_assert_uint_eq(found[1], 1);
+    ck_assert_uint_eq(found[2], 2);
+    ck_assert_uint_eq(found[3], 0);
+    ck_assert_uint_eq(found[4], 0);
+    ck_assert_uint_eq(found[5], 2);
+    ck_assert_uint_eq(found[6], 3);
+
+    struct img_metadata metadata;
+    zero_init_var(metadata);
+    ck_assert_uint_eq(similar_get_hash(&metadata), 0);
+    similar_set_hash(&metadata, 0x0123456789abcdefUL);
+    ck_assert_uint_eq(similar_get_hash(&metadata), 0x0123456789abcdefUL);
+
+    similar_index_free(index);
+
+    end_test_print;
+}
+END_TEST
+
+Suite *imgfs_index_suite()
+{
+    Suite *s = suite_create("Tests for the index of the hot metadata fields");
+
+    Add_Test(s, imgfs_index_scan_words);
+    Add_Test(s, imgfs_index_follows_metadata);
+    Add_Test(s, imgfs_index_filters_duplicates);
+    Add_Test(s, similar_index_finds_near_hashes);
+
+    return s;
+}
+
+TEST_SUITE(imgfs_index_suite)
@@ -1,5 +1,6 @@
 #include "imgfs.h"
 #include "imgfscmd_functions.h"
+#include "json_writer.h"
 #include "test.h"
 #include "util.h"
 #include <check.h>
@@ -52,6 +53,87 @@ START_TEST(do_list_cmd_inexistent_file)
 }
 END_TEST
 
+// ======================================================================
+START_TEST(do_list_json_output)
+{
+    start_test_print;
+
+    struct imgfs_file file;
+    ck_assert_err_none(do_open(IMGFS("test03"), "rb", &file));
+
+    char* json = NULL;
+    ck_assert_err_none(do_list(&file, JSON, &json));
+    ck_assert_str_eq(json, "{ \"Images\": [ \"pic1\", \"pic2\" ] }");
+    free(json);
+
+    // a writer can be reused from a listing to the next
+    struct json_writer writer;
+    ck_assert_err_none(json_writer_init(&writer, NULL, NULL));
+    for(int i = 0; i < 2; ++i) {
+        json_writer_reset(&writer);
+        ck_assert_err_none(do_list_json(&file, 1, NULL, &writer));
+        ck_assert_str_eq(writer.buffer, "{ \"Images\": [ \"pic1\", \"pic2\" ] }");
+    }
+    json_writer_free(&writer);
+
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_list_json_fields_and_filters)
+{
+    start_test_print;
+
+    struct imgfs_file file;
+    ck_assert_err_none(do_open(IMGFS("full"), "rb", &file));
+
+    struct json_writer writer;
+    ck_assert_err_none(json_writer_init(&writer, NULL, NULL));
+
+    struct list_options options;
+    list_options_init(&options);
+    options.fields = LIST_FIELDS_ALL;
+    strcpy(options.prefix, "pic");
+    options.min_size = 82234;
+    options.max_size = 98119;
+    ck_assert_err_none(do_list_json(&file, 1, &options, &writer));
+    ck_assert_str_eq(writer.buffer, "{ \"Images\": [ "
+                     "{ \"img_id\": \"pic1\", \"orig_res\": [ 1200, 800 ], "
+                     "\"size\": { \"thumb\": 0, \"small\": 0, \"orig\": 98119 }, \"resolutions\": [ \"orig\" ] }, "
+                     "{ \"img_id\": \"pic2\", \"orig_res\": [ 600, 400 ], "
+                     "\"size\": { \"thumb\": 0, \"small\": 0, \"orig\": 82234 }, \"resolutions\": [ \"orig\" ] } ] }");
+
+    json_writer_reset(&writer);
+    list_options_init(&options);
+    strcpy(options.prefix, "pic3");
+    ck_assert_err_none(do_list_json(&file, 1, &options, &writer));
+    ck_assert_str_eq(writer.buffer, "{ \"Images\": [ \"pic3\" ] }");
+
+    json_writer_free(&writer);
+
+    // by pages, with the filters
+    struct img_metadata images[3];
+    size_t nb_images = 0;
+    uint32_t cursor = 0;
+    options.prefix[0] = '\0';
+    options.min_size = 90000;
+    ck_assert_err_none(do_list_page(&file, &options, &cursor, 1, images, &nb_images));
+    ck_assert_uint_eq(nb_images, 1);
+    ck_assert_str_eq(images[0].img_id, "pic1");
+    ck_assert_err_none(do_list_page(&file, &options, &cursor, 3, images, &nb_images));
+    ck_assert_uint_eq(nb_images, 1);
+    ck_assert_str_eq(images[0].img_id, "pic3");
+    ck_assert_uint_eq(cursor, file.header.max_files);
+
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
 // ======================================================================
 Suite *imgfs_structures_test_suite()
 {
@@ -62,6 +144,8 @@ Suite *imgfs_structures_test_suite()
     Add_Test(s, do_list_cmd_null_params);
     Add_Test(s, do_list_cmd_too_many_params);
     Add_Test(s, do_list_cmd_inexistent_file);
+    Add_Test(s, do_list_json_output);
+    Add_Test(s, do_list_json_fields_and_filters);
 
     return s;
 }
@@ -0,0 +1,117 @@
+#include "imgfs.h"
+#include "test.h"
+#include <check.h>
+
+// ======================================================================
+START_TEST(do_read_range_null_params)
+{
+    start_test_print;
+
+    struct imgfs_file file;
+    int64_t first = 0;
+    uint32_t len = 1;
+    char* buffer = NULL;
+    uint32_t size = 0;
+
+    ck_assert_err_none(do_open(IMGFS("test03"), "rb", &file));
+    ck_assert_invalid_arg(do_read_range(NULL, ORIG_RES, &first, &len, &buffer, &size, &file));
+    ck_assert_invalid_arg(do_read_range("pic1", ORIG_RES, NULL, &len, &buffer, &size, &file));
+    ck_assert_invalid_arg(do_read_range("pic1", ORIG_RES, &first, NULL, &buffer, &size, &file));
+    ck_assert_invalid_arg(do_read_range("pic1", ORIG_RES, &first, &len, &buffer, &size, NULL));
+    ck_assert_invalid_arg(do_read_range("pic1", NB_RES, &first, &len, &buffer, &size, &file));
+    ck_assert_err(do_read_range("nope", ORIG_RES, &first, &len, &buffer, &size, &file), ERR_IMAGE_NOT_FOUND);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_read_range_spans)
+{
+    start_test_print;
+
+    struct imgfs_file file;
+    ck_assert_err_none(do_open(IMGFS("test03"), "rb", &file));
+
+    char* image = NULL;
+    uint32_t image_size = 0;
+    ck_assert_err_none(do_read("pic2", ORIG_RES, &image, &image_size, &file));
+
+    char* buffer = NULL;
+    uint32_t size = 0;
+    int64_t first = 100;
+    uint32_t len = 50;
+    ck_assert_err_none(do_read_range("pic2", ORIG_RES, &first, &len, &buffer, &size, &file));
+    ck_assert_uint_eq(size, image_size);
+    ck_assert_int_eq(first, 100);
+    ck_assert_uint_eq(len, 50);
+    ck_assert_mem_eq(buffer, image + 100, 50);
+    free(buffer);
+
+    // cut at the end of the image
+    first = image_size - 10;
+    len = UINT32_MAX;
+    ck_assert_err_none(do_read_range("pic2", ORIG_RES, &first, &len, &buffer, &size, &file));
+    ck_assert_uint_eq(len, 10);
+    ck_assert_mem_eq(buffer, image + image_size - 10, 10);
+    free(buffer);
+
+    // suffix
+    first = -20;
+    len = 20;
+    ck_assert_err_none(do_read_range("pic2", ORIG_RES, &first, &len, &buffer, &size, &file));
+    ck_assert_int_eq(first, image_size - 20);
+    ck_assert_mem_eq(buffer, image + image_size - 20, 20);
+    free(buffer);
+
+    // out of the image: the size is still given
+    first = image_size;
+    len = 1;
+    size = 0;
+    ck_assert_err(do_read_range("pic2", ORIG_RES, &first, &len, &buffer, &size, &file), ERR_RANGE);
+    ck_assert_uint_eq(size, image_size);
+
+    free(image);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_stat_copies_metadata)
+{
+    start_test_print;
+
+    struct imgfs_file file;
+    struct img_metadata metadata;
+    ck_assert_err_none(do_open(IMGFS("test03"), "rb", &file));
+
+    ck_assert_invalid_arg(do_stat(NULL, &metadata, &file));
+    ck_assert_invalid_arg(do_stat("pic2", NULL, &file));
+    ck_assert_invalid_arg(do_stat("pic2", &metadata, NULL));
+    ck_assert_err(do_stat("nope", &metadata, &file), ERR_IMAGE_NOT_FOUND);
+
+    ck_assert_err_none(do_stat("pic2", &metadata, &file));
+    ck_assert_mem_eq(&metadata, &file.metadata[1], sizeof(metadata));
+
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+Suite *imgfs_read_suite()
+{
+    Suite *s = suite_create("Tests for do_read, do_read_range and do_stat");
+
+    Add_Test(s, do_read_range_null_params);
+    Add_Test(s, do_read_range_spans);
+    Add_Test(s, do_stat_copies_metadata);
+
+    return s;
+}
+
+TEST_SUITE(imgfs_read_suite)
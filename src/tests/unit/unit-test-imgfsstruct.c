@@ -4,7 +4,7 @@
 // ======================================================================
 #define SIZE_imgfs_header 64
 #define SIZE_img_metadata 216
-#define SIZE_imgfs_file   80
+#define SIZE_imgfs_file   728
 
 #define OFFSET_imgfs_header_name        0
 #define OFFSET_imgfs_header_version     32
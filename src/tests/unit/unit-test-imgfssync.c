@@ -0,0 +1,176 @@
+#include "imgfs.h"
+#include "test.h"
+#include <check.h>
+
+// ======================================================================
+START_TEST(do_set_durability_null_params)
+{
+    start_test_print;
+
+    ck_assert_invalid_arg(do_set_durability(NULL, DURABILITY_NONE, 0));
+    ck_assert_invalid_arg(do_sync(NULL));
+    ck_assert_invalid_arg(do_commit(NULL));
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_set_durability_invalid_mode)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    struct imgfs_file file;
+    DUPLICATE_FILE(dump, IMGFS("test03"));
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+
+    ck_assert_int_eq(file.durability, DURABILITY_NONE);
+    ck_assert_invalid_arg(do_set_durability(&file, NB_DURABILITY_MODES, 0));
+
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_set_durability_defaults)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    struct imgfs_file file;
+    DUPLICATE_FILE(dump, IMGFS("test03"));
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+
+    ck_assert_err_none(do_set_durability(&file, DURABILITY_PERIODIC, 0));
+    ck_assert_uint_eq(file.sync_param, DEFAULT_SYNC_INTERVAL_MS);
+    ck_assert_err_none(do_set_durability(&file, DURABILITY_GROUP_COMMIT, 0));
+    ck_assert_uint_eq(file.sync_param, DEFAULT_SYNC_GROUP_SIZE);
+    ck_assert_err_none(do_set_durability(&file, DURABILITY_GROUP_COMMIT, 5));
+    ck_assert_uint_eq(file.sync_param, 5);
+
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_commit_per_op)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    struct imgfs_file file;
+    DUPLICATE_FILE(dump, IMGFS("test03"));
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+
+    ck_assert_err_none(do_set_durability(&file, DURABILITY_PER_OP, 0));
+    ck_assert_err_none(do_delete("pic1", &file));
+    ck_assert_uint_eq(file.pending_ops, 0);
+
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_commit_group)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    struct imgfs_file file;
+    DUPLICATE_FILE(dump, IMGFS("test03"));
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+
+    ck_assert_err_none(do_set_durability(&file, DURABILITY_GROUP_COMMIT, 3));
+    ck_assert_err_none(do_commit(&file));
+    ck_assert_err_none(do_commit(&file));
+    ck_assert_uint_eq(file.pending_ops, 2);
+    ck_assert_err_none(do_commit(&file));
+    ck_assert_uint_eq(file.pending_ops, 0);
+
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_sync_due_periodic)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    struct imgfs_file file;
+    DUPLICATE_FILE(dump, IMGFS("test03"));
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+    ck_assert_invalid_arg(do_sync_due(NULL));
+
+    ck_assert_err_none(do_set_durability(&file, DURABILITY_PERIODIC, 1000));
+    ck_assert_err_none(do_delete("pic1", &file));
+    ck_assert_uint_eq(file.pending_ops, 1);
+
+    // not before the interval elapsed...
+    ck_assert_err_none(do_sync_due(&file));
+    ck_assert_uint_eq(file.pending_ops, 1);
+
+    // ...but then, without another write
+    file.last_sync_ms -= 1000;
+    ck_assert_err_none(do_sync_due(&file));
+    ck_assert_uint_eq(file.pending_ops, 0);
+
+    // and only for this policy
+    ck_assert_err_none(do_set_durability(&file, DURABILITY_GROUP_COMMIT, 3));
+    ck_assert_err_none(do_delete("pic2", &file));
+    file.last_sync_ms -= 1000;
+    ck_assert_err_none(do_sync_due(&file));
+    ck_assert_uint_eq(file.pending_ops, 1);
+
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_commit_none)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    struct imgfs_file file;
+    DUPLICATE_FILE(dump, IMGFS("test03"));
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+
+    ck_assert_err_none(do_delete("pic1", &file));
+    ck_assert_err_none(do_delete("pic2", &file));
+    ck_assert_uint_eq(file.pending_ops, 2);
+
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+Suite *imgfs_sync_suite()
+{
+    Suite *s = suite_create("Tests for the durability policies");
+
+    Add_Test(s, do_set_durability_null_params);
+    Add_Test(s, do_set_durability_invalid_mode);
+    Add_Test(s, do_set_durability_defaults);
+    Add_Test(s, do_commit_per_op);
+    Add_Test(s, do_commit_group);
+    Add_Test(s, do_sync_due_periodic);
+    Add_Test(s, do_commit_none);
+
+    return s;
+}
+
+TEST_SUITE(imgfs_sync_suite)
@@ -0,0 +1,184 @@
+#include "imgfs_volumes.h"
+#include "imgfs.h"
+#include "util.h"
+#include "test.h"
+#include <check.h>
+
+// ======================================================================
+START_TEST(volumes_open_null_params)
+{
+    start_test_print;
+
+    struct imgfs_volumes volumes;
+    const char* filenames[] = {IMGFS("test03")};
+    ck_assert_invalid_arg(volumes_open(NULL, 1, "rb", &volumes));
+    ck_assert_invalid_arg(volumes_open(filenames, 1, NULL, &volumes));
+    ck_assert_invalid_arg(volumes_open(filenames, 1, "rb", NULL));
+    ck_assert_invalid_arg(volumes_open(filenames, 0, "rb", &volumes));
+    ck_assert_invalid_arg(volumes_open(filenames, MAX_VOLUMES + 1, "rb", &volumes));
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(volumes_open_same_name)
+{
+    start_test_print;
+
+    struct imgfs_volumes volumes;
+    const char* filenames[] = {IMGFS("test03"), DATA_DIR "/./test03.imgfs"};
+    ck_assert_err(volumes_open(filenames, 2, "rb", &volumes), ERR_INVALID_FILENAME);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(volumes_route_stable)
+{
+    start_test_print;
+    DECLARE_DUMP_PREFIXED(1);
+    DECLARE_DUMP_PREFIXED(2);
+
+    DUPLICATE_FILE(dump1, IMGFS("test03"));
+    DUPLICATE_FILE(dump2, IMGFS("empty"));
+    const char* filenames[] = {dump1, dump2};
+
+    struct imgfs_volumes volumes;
+    ck_assert_err_none(volumes_open(filenames, 2, "rb", &volumes));
+    ck_assert_uint_eq(volumes.nb_volumes, 2);
+    ck_assert_uint_eq(volumes.nb_points, 2 * VOLUME_VIRTUAL_NODES);
+
+    int used[2] = {0, 0};
+    char img_id[16];
+    for (int i = 0; i < 100; ++i) {
+        snprintf(img_id, sizeof(img_id), "img%d", i);
+        const size_t volume = volumes_route(&volumes, img_id);
+        ck_assert_uint_lt(volume, 2);
+        ck_assert_uint_eq(volumes_route(&volumes, img_id), volume);
+        used[volume] = 1;
+    }
+    ck_assert(used[0] && used[1]);
+
+    volumes_close(&volumes);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(volumes_list_and_delete)
+{
+    start_test_print;
+    DECLARE_DUMP_PREFIXED(1);
+    DECLARE_DUMP_PREFIXED(2);
+
+    DUPLICATE_FILE(dump1, IMGFS("empty"));
+    DUPLICATE_FILE(dump2, IMGFS("test03"));
+    const char* filenames[] = {dump1, dump2};
+
+    struct imgfs_volumes volumes;
+    ck_assert_err_none(volumes_open(filenames, 2, "rb+", &volumes));
+
+    char* json = NULL;
+    ck_assert_err_none(volumes_list(&volumes, JSON, &json));
+    ck_assert_ptr_nonnull(strstr(json, "\"pic1\""));
+    ck_assert_ptr_nonnull(strstr(json, "\"pic2\""));
+    free(json);
+
+    // found wherever it is stored, even if not on its routed volume
+    ck_assert_err_none(volumes_delete("pic1", &volumes));
+    ck_assert_err(volumes_delete("pic1", &volumes), ERR_IMAGE_NOT_FOUND);
+    ck_assert_uint_eq(volumes.files[1].header.nb_files, 1);
+
+    // and no longer served once deleted
+    char* image = NULL;
+    uint32_t size = 0;
+    struct img_metadata metadata;
+    ck_assert_err(volumes_read("pic1", ORIG_RES, &image, &size, &metadata, &volumes), ERR_IMAGE_NOT_FOUND);
+    ck_assert_err(volumes_stat("pic1", &metadata, &volumes), ERR_IMAGE_NOT_FOUND);
+    ck_assert_ptr_null(image);
+
+    // the bytes read come with their metadata, even out of range
+    struct img_metadata read;
+    ck_assert_err_none(volumes_stat("pic2", &metadata, &volumes));
+    int64_t first = 0;
+    uint32_t len = 10;
+    ck_assert_err_none(volumes_read_range("pic2", ORIG_RES, &first, &len, &image, &size, &read, &volumes));
+    ck_assert_mem_eq(read.SHA, metadata.SHA, SHA256_DIGEST_LENGTH);
+    free(image);
+    first = size;
+    zero_init_var(read);
+    ck_assert_err(volumes_read_range("pic2", ORIG_RES, &first, &len, &image, &size, &read, &volumes), ERR_RANGE);
+    ck_assert_mem_eq(read.SHA, metadata.SHA, SHA256_DIGEST_LENGTH);
+
+    volumes_close(&volumes);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(volumes_list_by_pages)
+{
+    start_test_print;
+
+    const char* filenames[] = {IMGFS("test03"), IMGFS("full")};
+    struct imgfs_volumes volumes;
+    ck_assert_err_none(volumes_open(filenames, 2, "rb", &volumes));
+
+    struct img_metadata images[2];
+    size_t nb_images = 0;
+    uint64_t cursor = 0;
+    ck_assert_invalid_arg(volumes_list_page(NULL, NULL, &cursor, 2, images, &nb_images));
+    ck_assert_invalid_arg(volumes_list_page(&volumes, NULL, NULL, 2, images, &nb_images));
+
+    const char* expected[] = {"pic1", "pic2", "pic1", "pic2", "pic3"};
+    size_t nb_listed = 0;
+    while(cursor != VOLUMES_CURSOR_END) {
+        ck_assert_err_none(volumes_list_page(&volumes, NULL, &cursor, 2, images, &nb_images));
+        ck_assert_uint_le(nb_images, 2);
+        for(size_t i = 0; i < nb_images; ++i) ck_assert_str_eq(images[i].img_id, expected[nb_listed++]);
+    }
+    ck_assert_uint_eq(nb_listed, 5);
+
+    // resuming at a cursor
+    cursor = 1;
+    ck_assert_err_none(volumes_list_page(&volumes, NULL, &cursor, 2, images, &nb_images));
+    ck_assert_uint_eq(nb_images, 2);
+    ck_assert_str_eq(images[0].img_id, "pic2");
+    ck_assert_str_eq(images[1].img_id, "pic1");
+
+    // filtered
+    struct list_options options;
+    list_options_init(&options);
+    strcpy(options.prefix, "pic2");
+    cursor = 0;
+    ck_assert_err_none(volumes_list_page(&volumes, &options, &cursor, 2, images, &nb_images));
+    ck_assert_uint_eq(nb_images, 2);
+    ck_assert_str_eq(images[0].img_id, "pic2");
+    ck_assert_str_eq(images[1].img_id, "pic2");
+    ck_assert_uint_eq(images[1].orig_res[0], 600);
+
+    volumes_close(&volumes);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+Suite *imgfs_volumes_suite()
+{
+    Suite *s = suite_create("Tests for the volume manager");
+
+    Add_Test(s, volumes_open_null_params);
+    Add_Test(s, volumes_open_same_name);
+    Add_Test(s, volumes_route_stable);
+    Add_Test(s, volumes_list_and_delete);
+    Add_Test(s, volumes_list_by_pages);
+
+    return s;
+}
+
+TEST_SUITE(imgfs_volumes_suite)
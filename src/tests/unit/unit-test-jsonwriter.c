@@ -0,0 +1,138 @@
+#include "json_writer.h"
+#include "error.h"
+#include "test.h"
+#include <check.h>
+
+// the chunks received by the sink, concatenated
+static char received[1 << 16];
+static size_t nb_received = 0;
+static size_t nb_chunks = 0;
+
+static int test_sink(void* context, const char* data, size_t len)
+{
+    ck_assert_ptr_eq(context, received);
+    ck_assert_uint_le(nb_received + len, sizeof(received));
+    memcpy(received + nb_received, data, len);
+    nb_received += len;
+    ++nb_chunks;
+    return ERR_NONE;
+}
+
+// ======================================================================
+START_TEST(json_writer_layout)
+{
+    start_test_print;
+
+    struct json_writer writer;
+    ck_assert_err_none(json_writer_init(&writer, NULL, NULL));
+
+    ck_assert_err_none(json_begin_object(&writer));
+    ck_assert_err_none(json_key(&writer, "Images"));
+    ck_assert_err_none(json_begin_array(&writer));
+    ck_assert_err_none(json_end_array(&writer));
+    ck_assert_err_none(json_key(&writer, "ids"));
+    ck_assert_err_none(json_begin_array(&writer));
+    ck_assert_err_none(json_string(&writer, "pic1", 10));
+    ck_assert_err_none(json_string(&writer, "pic2_truncated", 4));
+    ck_assert_err_none(json_uint(&writer, 18446744073709551615UL));
+    ck_assert_err_none(json_end_array(&writer));
+    ck_assert_err_none(json_end_object(&writer));
+
+    ck_assert_str_eq(writer.buffer, "{ \"Images\": [ ], \"ids\": [ \"pic1\", \"pic2\", 18446744073709551615 ] }");
+    ck_assert_uint_eq(writer.len, strlen(writer.buffer));
+
+    json_writer_free(&writer);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(json_writer_escapes)
+{
+    start_test_print;
+
+    struct json_writer writer;
+    ck_assert_err_none(json_writer_init(&writer, NULL, NULL));
+
+    ck_assert_err_none(json_string(&writer, "a\"b\\c/d\n\t\x01\xc3\xa9", 64));
+    ck_assert_str_eq(writer.buffer, "\"a\\\"b\\\\c\\/d\\n\\t\\u0001\xc3\xa9\"");
+
+    json_writer_free(&writer);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(json_writer_misuse)
+{
+    start_test_print;
+
+    struct json_writer writer;
+    ck_assert_invalid_arg(json_writer_init(NULL, NULL, NULL));
+
+    ck_assert_err_none(json_writer_init(&writer, NULL, NULL));
+    ck_assert_err_none(json_begin_object(&writer));
+    // a value without key in an object: the error sticks
+    ck_assert_invalid_arg(json_string(&writer, "pic1", 4));
+    ck_assert_invalid_arg(json_key(&writer, "Images"));
+    json_writer_free(&writer);
+
+    ck_assert_err_none(json_writer_init(&writer, NULL, NULL));
+    ck_assert_err_none(json_begin_array(&writer));
+    ck_assert_invalid_arg(json_end_object(&writer));
+    json_writer_free(&writer);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(json_writer_sink)
+{
+    start_test_print;
+
+    struct json_writer writer;
+    ck_assert_err_none(json_writer_init(&writer, test_sink, received));
+
+    char expected[sizeof(received)];
+    size_t len = (size_t) sprintf(expected, "[");
+    ck_assert_err_none(json_begin_array(&writer));
+    for(int i = 0; i < 4000; ++i) {
+        char img_id[16];
+        sprintf(img_id, "pic%d", i);
+        ck_assert_err_none(json_string(&writer, img_id, sizeof(img_id)));
+        len += (size_t) sprintf(expected + len, "%s\"%s\"", i == 0 ? " " : ", ", img_id);
+    }
+    ck_assert_err_none(json_end_array(&writer));
+    len += (size_t) sprintf(expected + len, " ]");
+
+    // the buffer never grows with a sink
+    ck_assert_uint_eq(writer.capacity, JSON_WRITER_CAPACITY);
+    ck_assert_err_none(json_writer_flush(&writer));
+    ck_assert_uint_eq(writer.len, 0);
+    ck_assert_uint_gt(nb_chunks, 1);
+    ck_assert_uint_eq(nb_received, len);
+    ck_assert_mem_eq(received, expected, len);
+
+    json_writer_free(&writer);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+Suite *json_writer_suite()
+{
+    Suite *s = suite_create("Tests for the streaming JSON writer");
+
+    Add_Test(s, json_writer_layout);
+    Add_Test(s, json_writer_escapes);
+    Add_Test(s, json_writer_misuse);
+    Add_Test(s, json_writer_sink);
+
+    return s;
+}
+
+TEST_SUITE(json_writer_suite)
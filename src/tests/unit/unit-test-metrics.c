@@ -0,0 +1,113 @@
+#include "metrics.h"
+#include "error.h"
+#include "test.h"
+#include <check.h>
+#include <pthread.h>
+
+#define NB_THREADS 4
+#define NB_RECORDS 1000
+
+static char* expose(void)
+{
+    char* text = NULL;
+    size_t len = 0;
+    ck_assert_err_none(metrics_expose(&text, &len));
+    ck_assert_ptr_nonnull(text);
+    ck_assert_uint_eq(len, strlen(text));
+    return text;
+}
+
+// ======================================================================
+START_TEST(metrics_requests)
+{
+    start_test_print;
+
+    metrics_request(ROUTE_READ, ERR_NONE, 100, 0);
+    metrics_request(ROUTE_READ, ERR_IMAGE_NOT_FOUND, 100, 1500);
+    metrics_request(ROUTE_READ, ERR_NONE, 100, 2000000000UL);
+
+    char* text = expose();
+    ck_assert_ptr_nonnull(strstr(text, "# TYPE imgfs_requests_total counter\n"));
+    ck_assert_ptr_nonnull(strstr(text, "imgfs_requests_total{route=\"read\"} 3\n"));
+    ck_assert_ptr_nonnull(strstr(text, "imgfs_requests_total{route=\"list\"} 0\n"));
+    ck_assert_ptr_nonnull(strstr(text, "imgfs_request_errors_total{route=\"read\"} 1\n"));
+    ck_assert_ptr_nonnull(strstr(text, "imgfs_sent_bytes_total{route=\"read\"} 300\n"));
+
+    // the durations below 1 us are counted in the first bucket exposed, 1500 ns in [1280, 1536)
+    ck_assert_ptr_nonnull(strstr(text, "# TYPE imgfs_request_duration_seconds histogram\n"));
+    ck_assert_ptr_nonnull(strstr(text, "imgfs_request_duration_seconds_bucket{route=\"read\",le=\"1.024e-06\"} 1\n"));
+    ck_assert_ptr_nonnull(strstr(text, "imgfs_request_duration_seconds_bucket{route=\"read\",le=\"1.28e-06\"} 1\n"));
+    ck_assert_ptr_nonnull(strstr(text, "imgfs_request_duration_seconds_bucket{route=\"read\",le=\"1.536e-06\"} 2\n"));
+    ck_assert_ptr_nonnull(strstr(text, "imgfs_request_duration_seconds_bucket{route=\"read\",le=\"+Inf\"} 3\n"));
+    ck_assert_ptr_nonnull(strstr(text, "imgfs_request_duration_seconds_sum{route=\"read\"} 2.000001500\n"));
+    ck_assert_ptr_nonnull(strstr(text, "imgfs_request_duration_seconds_count{route=\"read\"} 3\n"));
+
+    free(text);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(metrics_unlabelled_and_overflow)
+{
+    start_test_print;
+
+    // longer than the last bucket
+    metrics_lock_wait(100000000000UL);
+    metrics_resize(SMALL_RES, 5000);
+    metrics_resize(NB_RES, 5000);
+
+    char* text = expose();
+    ck_assert_ptr_nonnull(strstr(text, "imgfs_volume_lock_wait_seconds_bucket{le=\"+Inf\"} 1\n"));
+    ck_assert_ptr_nonnull(strstr(text, "imgfs_volume_lock_wait_seconds_count 1\n"));
+    ck_assert_ptr_null(strstr(text, "imgfs_volume_lock_wait_seconds_bucket{le=\"68.719476736\"} 1\n"));
+    ck_assert_ptr_nonnull(strstr(text, "imgfs_volume_lock_hold_seconds_count 0\n"));
+    ck_assert_ptr_nonnull(strstr(text, "imgfs_resize_duration_seconds_count{resolution=\"small\"} 1\n"));
+    ck_assert_ptr_null(strstr(text, "imgfs_resize_duration_seconds_count{resolution=\"orig\"}"));
+
+    free(text);
+
+    end_test_print;
+}
+END_TEST
+
+static void* record_reads(void* arg)
+{
+    (void) arg;
+    for(int i = 0; i < NB_RECORDS; ++i) metrics_read(THUMB_RES, (uint64_t) i * 1000);
+    return NULL;
+}
+
+// ======================================================================
+START_TEST(metrics_threads_summed)
+{
+    start_test_print;
+
+    pthread_t threads[NB_THREADS];
+    for(int t = 0; t < NB_THREADS; ++t) ck_assert_int_eq(pthread_create(&threads[t], NULL, record_reads, NULL), 0);
+    for(int t = 0; t < NB_THREADS; ++t) pthread_join(threads[t], NULL);
+
+    char* text = expose();
+    ck_assert_ptr_nonnull(strstr(text, "imgfs_read_duration_seconds_count{resolution=\"thumb\"} 4000\n"));
+    ck_assert_ptr_nonnull(strstr(text, "imgfs_read_duration_seconds_sum{resolution=\"thumb\"} 1.998000000\n"));
+
+    free(text);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+Suite *metrics_suite()
+{
+    Suite *s = suite_create("Tests for the metrics of the server");
+
+    Add_Test(s, metrics_requests);
+    Add_Test(s, metrics_unlabelled_and_overflow);
+    Add_Test(s, metrics_threads_summed);
+
+    return s;
+}
+
+TEST_SUITE(metrics_suite)
@@ -0,0 +1,90 @@
+#include "sha256.h"
+#include "error.h"
+#include "test.h"
+#include <check.h>
+
+#define NB_BUFFERS 16
+
+static const unsigned char abc_digest[SHA256_DIGEST_LENGTH] = {
+    0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+    0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad
+};
+
+static const unsigned char empty_digest[SHA256_DIGEST_LENGTH] = {
+    0xe3, 0xb0, 0xc4, 0x42, 0x98, 0xfc, 0x1c, 0x14, 0x9a, 0xfb, 0xf4, 0xc8, 0x99, 0x6f, 0xb9, 0x24,
+    0x27, 0xae, 0x41, 0xe4, 0x64, 0x9b, 0x93, 0x4c, 0xa4, 0x95, 0x99, 0x1b, 0x78, 0x52, 0xb8, 0x55
+};
+
+// ======================================================================
+START_TEST(sha256_known_digests)
+{
+    start_test_print;
+
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    ck_assert_err_none(sha256("abc", 3, digest));
+    ck_assert_mem_eq(digest, abc_digest, SHA256_DIGEST_LENGTH);
+
+    // the context of the thread is reused
+    ck_assert_err_none(sha256("", 0, digest));
+    ck_assert_mem_eq(digest, empty_digest, SHA256_DIGEST_LENGTH);
+    ck_assert_err_none(sha256(NULL, 0, digest));
+    ck_assert_mem_eq(digest, empty_digest, SHA256_DIGEST_LENGTH);
+
+    ck_assert_invalid_arg(sha256("abc", 3, NULL));
+    ck_assert_invalid_arg(sha256(NULL, 3, digest));
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(sha256_many_as_one_by_one)
+{
+    start_test_print;
+
+    // large enough to be hashed by several threads
+    char* data[NB_BUFFERS];
+    size_t lens[NB_BUFFERS];
+    unsigned char digests[NB_BUFFERS][SHA256_DIGEST_LENGTH];
+    for (size_t i = 0; i < NB_BUFFERS; ++i) {
+        lens[i] = SHA256_PARALLEL_MIN_SIZE / NB_BUFFERS * 2 + i;
+        data[i] = malloc(lens[i]);
+        ck_assert_ptr_nonnull(data[i]);
+        memset(data[i], (int) i, lens[i]);
+    }
+
+    ck_assert_err_none(sha256_many(NB_BUFFERS, (const char* const*) data, lens, digests));
+    for (size_t i = 0; i < NB_BUFFERS; ++i) {
+        unsigned char digest[SHA256_DIGEST_LENGTH];
+        ck_assert_err_none(sha256(data[i], lens[i], digest));
+        ck_assert_mem_eq(digests[i], digest, SHA256_DIGEST_LENGTH);
+    }
+
+    // and a few small ones, by the caller alone
+    const char* const small[2] = {"abc", ""};
+    const size_t small_lens[2] = {3, 0};
+    ck_assert_err_none(sha256_many(2, small, small_lens, digests));
+    ck_assert_mem_eq(digests[0], abc_digest, SHA256_DIGEST_LENGTH);
+    ck_assert_mem_eq(digests[1], empty_digest, SHA256_DIGEST_LENGTH);
+
+    ck_assert_err_none(sha256_many(0, NULL, NULL, NULL));
+    ck_assert_invalid_arg(sha256_many(1, NULL, lens, digests));
+
+    for (size_t i = 0; i < NB_BUFFERS; ++i) free(data[i]);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+Suite *sha256_suite()
+{
+    Suite *s = suite_create("Tests for the SHA-256 of the images");
+
+    Add_Test(s, sha256_known_digests);
+    Add_Test(s, sha256_many_as_one_by_one);
+
+    return s;
+}
+
+TEST_SUITE(sha256_suite)
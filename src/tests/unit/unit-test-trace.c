@@ -0,0 +1,125 @@
+#include "trace.h"
+#include "error.h"
+#include "test.h"
+#include <check.h>
+#include <pthread.h>
+
+#define NB_THREADS 4
+
+static char* dump(void)
+{
+    char* json = NULL;
+    size_t len = 0;
+    ck_assert_err_none(trace_dump(&json, &len));
+    ck_assert_ptr_nonnull(json);
+    ck_assert_uint_eq(len, strlen(json));
+    return json;
+}
+
+static size_t count(const char* text, const char* pattern)
+{
+    size_t n = 0;
+    for(const char* p = strstr(text, pattern); p != NULL; p = strstr(p + 1, pattern)) ++n;
+    return n;
+}
+
+// ======================================================================
+START_TEST(trace_phases_dumped)
+{
+    start_test_print;
+
+    const uint64_t start = trace_now();
+    ck_assert_uint_ne(start, 0);
+    trace_phase("first", start);
+    trace_phase("second", trace_now());
+    // not started
+    trace_phase("never", 0);
+
+    char* json = dump();
+    ck_assert_ptr_nonnull(strstr(json, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": ["));
+    ck_assert_ptr_nonnull(strstr(json, "{\"name\": \"first\", \"ph\": \"X\", \"pid\": 1, \"tid\": "));
+    ck_assert_ptr_nonnull(strstr(json, "{\"name\": \"second\", \"ph\": \"X\""));
+    ck_assert_ptr_null(strstr(json, "never"));
+    ck_assert(strstr(json, "first") < strstr(json, "second"));
+    free(json);
+
+    ck_assert_invalid_arg(trace_dump(NULL, NULL));
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(trace_ring_keeps_last)
+{
+    start_test_print;
+
+    for(size_t i = 0; i < 2 * TRACE_RING_SIZE; ++i) trace_phase(i < TRACE_RING_SIZE ? "old" : "new", trace_now());
+
+    char* json = dump();
+    ck_assert_ptr_null(strstr(json, "\"old\""));
+    ck_assert_uint_eq(count(json, "\"new\""), TRACE_RING_SIZE);
+    free(json);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(trace_disabled)
+{
+    start_test_print;
+
+    trace_enable(0);
+    ck_assert_uint_eq(trace_now(), 0);
+    trace_phase("hidden", 1);
+    trace_enable(1);
+
+    char* json = dump();
+    ck_assert_ptr_null(strstr(json, "hidden"));
+    free(json);
+
+    end_test_print;
+}
+END_TEST
+
+static void* record_phases(void* arg)
+{
+    (void) arg;
+    for(int i = 0; i < 10; ++i) trace_phase("threaded", trace_now());
+    return NULL;
+}
+
+// ======================================================================
+START_TEST(trace_threads)
+{
+    start_test_print;
+
+    pthread_t threads[NB_THREADS];
+    for(int t = 0; t < NB_THREADS; ++t) ck_assert_int_eq(pthread_create(&threads[t], NULL, record_phases, NULL), 0);
+    for(int t = 0; t < NB_THREADS; ++t) pthread_join(threads[t], NULL);
+
+    // the rings of the threads ended are kept (and reused)
+    char* json = dump();
+    ck_assert_uint_eq(count(json, "\"threaded\"") % 10, 0);
+    ck_assert_uint_ge(count(json, "\"threaded\""), 10);
+    free(json);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+Suite *trace_suite()
+{
+    Suite *s = suite_create("Tests for the tracing of the phases");
+
+    Add_Test(s, trace_phases_dumped);
+    Add_Test(s, trace_ring_keeps_last);
+    Add_Test(s, trace_disabled);
+    Add_Test(s, trace_threads);
+
+    return s;
+}
+
+TEST_SUITE(trace_suite)
@@ -0,0 +1,250 @@
+/**
+ * @file trace.c
+ * @brief Tracing of the phases of the requests
+ */
+
+#include "trace.h"
+#include "error.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * @brief A phase recorded
+ */
+struct trace_event {
+    /*!Its name (static)*/
+    const char* name;
+    /*!Its start (ns)*/
+    uint64_t start_ns;
+    /*!Its duration (ns)*/
+    uint64_t duration_ns;
+};
+
+/**
+ * @brief The phases recorded by a thread
+ */
+struct trace_ring {
+    /*!Whether a thread records into the ring*/
+    atomic_int in_use;
+    /*!The number of phases ever recorded, the last TRACE_RING_SIZE are kept*/
+    atomic_uint_fast64_t head;
+    /*!The phases, the one of number n at n % TRACE_RING_SIZE*/
+    struct trace_event events[TRACE_RING_SIZE];
+};
+
+// the rings, allocated when first needed and never freed (the index of a ring is its tid in the trace)
+static struct trace_ring* _Atomic rings[TRACE_MAX_THREADS];
+static _Thread_local struct trace_ring* own_ring;
+static _Thread_local int without_ring;
+
+static atomic_int enabled = 1;
+
+// gives the ring of a thread back when it ends
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static int ring_key_created;
+
+// the trace written on a signal (see trace_dump_on_signal())
+static sigset_t dump_signal;
+static const char* dump_filename;
+
+void trace_enable(int on)
+{
+    atomic_store(&enabled, on != 0);
+}
+
+uint64_t trace_now(void)
+{
+    if(!atomic_load_explicit(&enabled, memory_order_relaxed)) return 0;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000UL + (uint64_t) now.tv_nsec;
+}
+
+static void release_ring(void* ring)
+{
+    atomic_store(&((struct trace_ring*) ring)->in_use, 0);
+}
+
+static void create_ring_key(void)
+{
+    ring_key_created = pthread_key_create(&ring_key, release_ring) == 0;
+}
+
+/**
+ * @brief Takes the ring of index r if it is free, allocating it if it does not exist yet
+ * @return (struct trace_ring*) : the ring taken, NULL if it is used by another thread (or out of memory)
+ */
+static struct trace_ring* take_ring(size_t r)
+{
+    struct trace_ring* ring = atomic_load(&rings[r]);
+    if(ring == NULL) {
+        struct trace_ring* allocated = calloc(1, sizeof(struct trace_ring));
+        if(allocated == NULL) return NULL;
+        atomic_init(&allocated->in_use, 1);
+        if(atomic_compare_exchange_strong(&rings[r], &ring, allocated)) return allocated;
+        // allocated by another thread meanwhile
+        free(allocated);
+    }
+
+    int free_ring = 0;
+    return atomic_compare_exchange_strong(&ring->in_use, &free_ring, 1) ? ring : NULL;
+}
+
+/**
+ * @brief The ring of the calling thread, taken at its first phase; NULL if there is none left.
+ */
+static struct trace_ring* get_ring(void)
+{
+    if(own_ring != NULL || without_ring) return own_ring;
+
+    pthread_once(&ring_key_once, create_ring_key);
+    for(size_t r = 0; ring_key_created && r < TRACE_MAX_THREADS; ++r) {
+        struct trace_ring* ring = take_ring(r);
+        if(ring == NULL) continue;
+        if(pthread_setspecific(ring_key, ring) != 0) {
+            release_ring(ring);
+            break;
+        }
+        return own_ring = ring;
+    }
+    without_ring = 1;
+    return NULL;
+}
+
+void trace_phase(const char* name, uint64_t start_ns)
+{
+    if(start_ns == 0 || name == NULL || !atomic_load_explicit(&enabled, memory_order_relaxed)) return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const uint64_t end_ns = (uint64_t) now.tv_sec * 1000000000UL + (uint64_t) now.tv_nsec;
+
+    struct trace_ring* ring = get_ring();
+    if(ring == NULL) return;
+
+    // only this thread writes the ring: the event is written, then published
+    const uint_fast64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    struct trace_event* event = &ring->events[head % TRACE_RING_SIZE];
+    event->name = name;
+    event->start_ns = start_ns;
+    event->duration_ns = end_ns > start_ns ? end_ns - start_ns : 0;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/**
+ * @brief Copies the phases kept by a ring, the oldest first, leaving out those
+ * overwritten meanwhile by its thread.
+ * @param events (struct trace_event*) : where to copy them, TRACE_RING_SIZE events
+ * @return (size_t) : the number of phases copied
+ */
+static size_t copy_ring(struct trace_ring* ring, struct trace_event* events)
+{
+    const uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    const uint64_t first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+    for(uint64_t n = first; n < head; ++n) events[n - first] = ring->events[n % TRACE_RING_SIZE];
+
+    atomic_thread_fence(memory_order_acquire);
+    const uint64_t new_head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    const uint64_t overwritten = new_head > TRACE_RING_SIZE ? new_head - TRACE_RING_SIZE : 0;
+    if(overwritten <= first) return (size_t) (head - first);
+    if(overwritten >= head) return 0;
+
+    memmove(events, events + (overwritten - first), (size_t) (head - overwritten) * sizeof(struct trace_event));
+    return (size_t) (head - overwritten);
+}
+
+int trace_dump(char** json, size_t* len)
+{
+    M_REQUIRE_NON_NULL(json);
+    M_REQUIRE_NON_NULL(len);
+
+    struct trace_event* events = calloc(TRACE_RING_SIZE, sizeof(struct trace_event));
+    if(events == NULL) return ERR_OUT_OF_MEMORY;
+
+    *json = NULL;
+    *len = 0;
+    FILE* out = open_memstream(json, len);
+    if(out == NULL) {
+        free(events);
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    // complete events ("X"), timed in microseconds
+    fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+    const char* separator = "";
+    for(size_t r = 0; r < TRACE_MAX_THREADS; ++r) {
+        struct trace_ring* ring = atomic_load(&rings[r]);
+        if(ring == NULL) continue;
+
+        const size_t nb_events = copy_ring(ring, events);
+        for(size_t e = 0; e < nb_events; ++e) {
+            fprintf(out, "%s\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %zu, \"ts\": %.3f, \"dur\": %.3f}",
+                    separator, events[e].name, r, (double) events[e].start_ns / 1e3, (double) events[e].duration_ns / 1e3);
+            separator = ",";
+        }
+    }
+    fprintf(out, "\n]}\n");
+    free(events);
+
+    const int failed = ferror(out);
+    if(fclose(out) != 0 || failed) {
+        free(*json);
+        *json = NULL;
+        *len = 0;
+        return ERR_IO;
+    }
+    return ERR_NONE;
+}
+
+/**
+ * @brief Writes the trace to its file
+ */
+static int dump_to_file(const char* filename)
+{
+    char* json = NULL;
+    size_t len = 0;
+    int ret = trace_dump(&json, &len);
+    if(ret != ERR_NONE) return ret;
+
+    FILE* file = fopen(filename, "w");
+    if(file == NULL || fwrite(json, 1, len, file) != len) ret = ERR_IO;
+    if(file != NULL && fclose(file) != 0) ret = ERR_IO;
+    free(json);
+    return ret;
+}
+
+/**
+ * @brief The loop of the thread that waits for the signal and writes the trace
+ */
+static void* dump_loop(void* arg)
+{
+    (void) arg;
+    int signal_number = 0;
+    while(sigwait(&dump_signal, &signal_number) == 0) {
+        if(dump_to_file(dump_filename) == ERR_NONE) fprintf(stderr, "Trace written to %s\n", dump_filename);
+        else fprintf(stderr, "Error: could not write the trace to %s\n", dump_filename);
+    }
+    return NULL;
+}
+
+int trace_dump_on_signal(int signal_number, const char* filename)
+{
+    M_REQUIRE_NON_NULL(filename);
+
+    dump_filename = filename;
+    if(sigemptyset(&dump_signal) == -1 || sigaddset(&dump_signal, signal_number) == -1) return ERR_INVALID_ARGUMENT;
+    if(pthread_sigmask(SIG_BLOCK, &dump_signal, NULL) != 0) return ERR_THREADING;
+
+    pthread_t dumper;
+    if(pthread_create(&dumper, NULL, dump_loop, NULL) != 0) return ERR_THREADING;
+    pthread_detach(dumper);
+    return ERR_NONE;
+}
@@ -0,0 +1,71 @@
+/**
+ * @file trace.h
+ * @brief Tracing of the phases of the requests.
+ *
+ * A phase is timed from trace_now() to trace_phase(), on the monotonic clock,
+ * and recorded into the ring buffer of the calling thread, which keeps the
+ * last TRACE_RING_SIZE phases of the thread: recording takes no lock (a
+ * ring is given back when its thread ends, to the next thread). The rings
+ * are dumped on demand in the Chrome trace event format, which
+ * chrome://tracing and Perfetto display as one timeline per thread.
+ */
+
+#pragma once
+
+#include <stddef.h> // for size_t
+#include <stdint.h> // for uint64_t
+
+// the phases kept per thread (a power of 2), and the threads traced at once
+// (the threads beyond are not traced)
+#define TRACE_RING_SIZE   4096
+#define TRACE_MAX_THREADS 128
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Enables (the default) or disables the recording of the phases.
+ */
+void trace_enable(int on);
+
+/**
+ * @brief The start of a phase: the time of the monotonic clock in nanoseconds,
+ *        0 if tracing is disabled.
+ */
+uint64_t trace_now(void);
+
+/**
+ * @brief Records a phase, from its start to now (nothing if tracing is disabled
+ *        or if start_ns is 0).
+ *
+ * @param name The name of the phase, which must outlive the trace (a literal)
+ * @param start_ns Its start, see trace_now()
+ */
+void trace_phase(const char* name, uint64_t start_ns);
+
+/**
+ * @brief Writes the phases kept by all the rings as a Chrome trace (JSON).
+ *
+ * @param json Where to store the trace, to be freed by the caller
+ * @param len Where to store its length
+ * @return Some error code. 0 if no error.
+ */
+int trace_dump(char** json, size_t* len);
+
+/**
+ * @brief Starts a thread that writes the trace to a file each time the process
+ *        receives the given signal.
+ *
+ * The signal is blocked in the calling thread, and thus in the threads it
+ * creates afterwards: this is to be called before creating any other thread.
+ *
+ * @param signal_number The signal, e.g. SIGUSR1
+ * @param filename The file to (over)write
+ * @return Some error code. 0 if no error.
+ */
+int trace_dump_on_signal(int signal_number, const char* filename);
+
+#ifdef __cplusplus
+}
+#endif
@@ -8,7 +8,7 @@
 
 #include <errno.h>
 #include <inttypes.h>   // strtoumax()
-#include <stdint.h>     // for uint16_t, uint32_t
+#include <stdint.h>     // for uint16_t, uint32_t, uint64_t
 #include <string.h>
 
 /********************************************************************
@@ -31,6 +31,7 @@ atouint ## N(const char* str) \
 
 define_atouintN(16)
 define_atouintN(32)
+define_atouintN(64)
 
 /* function strnstr() is borrowed from FreeBSD:
  *
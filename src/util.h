@@ -12,7 +12,7 @@
 
 #include <assert.h>   // see TO_BE_IMPLEMENTED
 #include <stddef.h>   // for size_t
-#include <stdint.h>   // for uint16_t, uint32_t
+#include <stdint.h>   // for uint16_t, uint32_t, uint64_t
 
 /**
  * @brief tag a variable as POTENTIALLY unused, to avoid compiler warnings
@@ -78,6 +78,14 @@ uint16_t atouint16(const char* str);
  */
 uint32_t atouint32(const char* str);
 
+/**
+ * @brief String to uint64_t conversion function
+ *
+ * @param str a string containing some integer value to be extracted
+ * @return converted value in uint64_t format
+ */
+uint64_t atouint64(const char* str);
+
 /**
  * @brief Find the first occurrence of find in s, where the search is limited to the
  *        first slen characters of s.